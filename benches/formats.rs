@@ -0,0 +1,299 @@
+//! Throughput and allocation benchmarks for every format, over the `test/`
+//! corpus.
+//!
+//! Run with `cargo bench`. Criterion reports MB/s for each benchmark and
+//! keeps its timings under `target/criterion`, so a run can be compared to an
+//! earlier one with `cargo bench -- --save-baseline before` and later
+//! `cargo bench -- --baseline before`, e.g. around an upgrade of oead.
+//!
+//! A counting allocator measures the allocations made by one call of each
+//! benchmark. They are written to `target/criterion/allocations.csv`, and
+//! changes since the previous run are printed at the end.
+//!
+//! BYML and AAMP no longer cross the FFI boundary to be parsed, so the
+//! `convert` group measures the step that replaced the conversion from oead's
+//! types: building owned documents from views over binary data that have
+//! already been validated. Yaz0 is still backed by oead, so its group
+//! measures the FFI call including the copy of the result.
+use criterion::{black_box, measurement::WallTime, BenchmarkGroup, Criterion, Throughput};
+use once_cell::sync::Lazy;
+use roead::{
+    aamp::{ParameterIO, ParameterIOView},
+    byml::{Byml, BymlView},
+    sarc::{Sarc, SarcWriter},
+    yaz0, Endian,
+};
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    collections::HashMap,
+    fs,
+    path::Path,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Mutex,
+    },
+};
+
+struct CountingAlloc;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static ALLOCATED_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(new_size, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+/// Allocation counts and bytes of one call of every benchmark, by name.
+static RESULTS: Lazy<Mutex<Vec<(String, usize, usize)>>> = Lazy::new(Default::default);
+
+const RESULTS_FILE: &str = "target/criterion/allocations.csv";
+
+/// A benchmark group that also records allocations.
+struct Group<'c> {
+    name: &'static str,
+    group: BenchmarkGroup<'c, WallTime>,
+}
+
+impl<'c> Group<'c> {
+    fn new(c: &'c mut Criterion, name: &'static str) -> Self {
+        Group {
+            name,
+            group: c.benchmark_group(name),
+        }
+    }
+
+    /// Benchmark `f`, which processes `bytes` bytes per call.
+    fn bench<T>(&mut self, name: &str, bytes: usize, f: impl FnMut() -> T) {
+        self.bench_with(name, Throughput::Bytes(bytes as u64), f)
+    }
+
+    /// Benchmark `f`, which processes `throughput` per call.
+    fn bench_with<T>(&mut self, name: &str, throughput: Throughput, mut f: impl FnMut() -> T) {
+        let (count, size) = (
+            ALLOCATIONS.load(Ordering::Relaxed),
+            ALLOCATED_BYTES.load(Ordering::Relaxed),
+        );
+        drop(black_box(f()));
+        RESULTS.lock().unwrap().push((
+            format!("{}/{}", self.name, name),
+            ALLOCATIONS.load(Ordering::Relaxed) - count,
+            ALLOCATED_BYTES.load(Ordering::Relaxed) - size,
+        ));
+        self.group.throughput(throughput);
+        self.group
+            .bench_function(name, |b| b.iter(|| black_box(f())));
+    }
+}
+
+fn read(path: &str) -> Vec<u8> {
+    fs::read(Path::new("test").join(path)).unwrap()
+}
+
+struct Corpus {
+    pack: Vec<u8>,
+    pack_decompressed: Vec<u8>,
+    aamp_texts: Vec<String>,
+    aamp_binaries: Vec<Vec<u8>>,
+    byml: Vec<u8>,
+}
+
+impl Corpus {
+    fn load() -> Self {
+        let pack = read("Enemy_Lynel_Dark.sbactorpack");
+        let pack_decompressed = yaz0::decompress(&pack).unwrap();
+        let mut paths: Vec<_> = glob::glob("test/aamp/*.yml")
+            .unwrap()
+            .filter_map(|path| path.ok())
+            .collect();
+        paths.sort();
+        let aamp_texts: Vec<String> = paths
+            .iter()
+            .map(|path| fs::read_to_string(path).unwrap())
+            .collect();
+        let aamp_binaries = aamp_texts
+            .iter()
+            .map(|text| ParameterIO::from_text(text).unwrap().to_binary().unwrap())
+            .chain(std::iter::once(read("Chuchu_Middle.baiprog")))
+            .collect();
+        let byml = Sarc::read(pack_decompressed.as_slice())
+            .unwrap()
+            .get_file_data("Actor/AnimationInfo/Enemy_Lynel_Dark.baniminfo")
+            .unwrap()
+            .to_vec();
+        Corpus {
+            pack,
+            pack_decompressed,
+            aamp_texts,
+            aamp_binaries,
+            byml,
+        }
+    }
+}
+
+fn total_len<T: AsRef<[u8]>>(items: &[T]) -> usize {
+    items.iter().map(|item| item.as_ref().len()).sum()
+}
+
+fn aamp(c: &mut Criterion, corpus: &Corpus) {
+    let pios: Vec<_> = corpus
+        .aamp_binaries
+        .iter()
+        .map(|data| ParameterIO::from_binary(data).unwrap())
+        .collect();
+    let (binary_len, text_len) = (
+        total_len(&corpus.aamp_binaries),
+        total_len(&corpus.aamp_texts),
+    );
+    // The binaries include one that has no text in the corpus
+    let written_len: usize = pios.iter().map(|pio| pio.to_text().len()).sum();
+    let mut group = Group::new(c, "aamp");
+    group.bench("parse_binary", binary_len, || {
+        corpus
+            .aamp_binaries
+            .iter()
+            .map(|data| ParameterIO::from_binary(data).unwrap())
+            .count()
+    });
+    group.bench("write_binary", binary_len, || {
+        pios.iter()
+            .map(|pio| pio.to_binary().unwrap().len())
+            .sum::<usize>()
+    });
+    group.bench("parse_text", text_len, || {
+        corpus
+            .aamp_texts
+            .iter()
+            .map(|text| ParameterIO::from_text(text).unwrap())
+            .count()
+    });
+    group.bench("write_text", written_len, || {
+        pios.iter().map(|pio| pio.to_text().len()).sum::<usize>()
+    });
+    group.group.finish();
+}
+
+fn byml(c: &mut Criterion, corpus: &Corpus) {
+    let doc = Byml::from_binary(&corpus.byml).unwrap();
+    let text = doc.to_text();
+    let len = corpus.byml.len();
+    let mut group = Group::new(c, "byml");
+    group.bench("parse_binary", len, || {
+        Byml::from_binary(&corpus.byml).unwrap()
+    });
+    group.bench("write_binary", len, || doc.to_binary(Endian::Big));
+    group.bench("parse_text", text.len(), || Byml::from_text(&text).unwrap());
+    group.bench("write_text", text.len(), || doc.to_text());
+    group.group.finish();
+}
+
+fn convert(c: &mut Criterion, corpus: &Corpus) {
+    let byml = BymlView::new(&corpus.byml).unwrap();
+    let aamp: Vec<_> = corpus
+        .aamp_binaries
+        .iter()
+        .map(|data| ParameterIOView::new(data).unwrap())
+        .collect();
+    let mut group = Group::new(c, "convert");
+    group.bench("byml", corpus.byml.len(), || byml.to_byml().unwrap());
+    group.bench("aamp", total_len(&corpus.aamp_binaries), || {
+        aamp.iter().map(|view| view.to_pio().unwrap()).count()
+    });
+    group.group.finish();
+}
+
+fn yaz0(c: &mut Criterion, corpus: &Corpus) {
+    let data = &corpus.pack_decompressed;
+    let mut group = Group::new(c, "yaz0");
+    group.group.sample_size(10);
+    group.bench("decompress", data.len(), || {
+        yaz0::decompress(&corpus.pack).unwrap()
+    });
+    for level in 6..=9 {
+        group.bench(&format!("compress_{}", level), data.len(), || {
+            yaz0::compress_with_level(data, level).unwrap()
+        });
+    }
+    group.group.finish();
+}
+
+fn sarc(c: &mut Criterion, corpus: &Corpus) {
+    let data = &corpus.pack_decompressed;
+    let sarc = Sarc::read(data.as_slice()).unwrap();
+    let names: Vec<String> = sarc
+        .list_filenames()
+        .into_iter()
+        .map(|name| name.to_owned())
+        .collect();
+    let writer = SarcWriter::from(&sarc);
+    let mut group = Group::new(c, "sarc");
+    group.bench("read", data.len(), || Sarc::read(data.as_slice()).unwrap());
+    group.bench_with("lookup", Throughput::Elements(names.len() as u64), || {
+        names
+            .iter()
+            .filter(|name| sarc.get_file_data(name).is_some())
+            .count()
+    });
+    group.bench("write", data.len(), || writer.to_binary());
+    group.group.finish();
+}
+
+/// Save the allocation counts and print the ones that changed since the
+/// previous run.
+fn save_allocations() {
+    let previous: HashMap<String, String> = fs::read_to_string(RESULTS_FILE)
+        .unwrap_or_default()
+        .lines()
+        .skip(1)
+        .filter_map(|line| {
+            let (name, rest) = line.split_once(',')?;
+            Some((name.to_owned(), rest.to_owned()))
+        })
+        .collect();
+    let mut csv = String::from("benchmark,allocations,bytes\n");
+    println!("\nAllocations per call:");
+    for (name, count, bytes) in RESULTS.lock().unwrap().iter() {
+        let line = format!("{},{}", count, bytes);
+        let change = match previous.get(name) {
+            Some(old) if *old != line => format!(" (was {})", old.replace(',', " allocations, ")),
+            _ => String::new(),
+        };
+        println!(
+            "{:<24} {:>8} allocations, {:>10} bytes{}",
+            name, count, bytes, change
+        );
+        csv.push_str(&format!("{},{}\n", name, line));
+    }
+    if let Some(dir) = Path::new(RESULTS_FILE).parent() {
+        fs::create_dir_all(dir).unwrap();
+    }
+    fs::write(RESULTS_FILE, csv).unwrap();
+}
+
+fn main() {
+    let corpus = Corpus::load();
+    let mut c = Criterion::default().configure_from_args();
+    aamp(&mut c, &corpus);
+    byml(&mut c, &corpus);
+    convert(&mut c, &corpus);
+    yaz0(&mut c, &corpus);
+    sarc(&mut c, &corpus);
+    c.final_summary();
+    save_allocations();
+}
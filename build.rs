@@ -40,9 +40,6 @@ fn main() {
                 .flag("-w")
                 .files(
                     [
-                        "src/aamp/aamp.cc",
-                        "src/byml/byml.cc",
-                        "src/sarc/sarc.cc",
                         "src/types/types.cc",
                         "src/yaz0/yaz0.cc",
                     ]
@@ -88,9 +85,6 @@ fn main() {
                 .flag("-w")
                 .files(
                     [
-                        "src/aamp/aamp.cc",
-                        "src/byml/byml.cc",
-                        "src/sarc/sarc.cc",
                         "src/types/types.cc",
                         "src/yaz0/yaz0.cc",
                     ]
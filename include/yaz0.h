@@ -2,6 +2,7 @@
 #include "rust/cxx.h"
 #include <oead/yaz0.h>
 #include <memory>
+#include <vector>
 
-rust::Vec<uint8_t> decompress(const rust::Slice<const uint8_t> data);
-rust::Vec<uint8_t> compress(rust::Slice<const uint8_t> data, uint8_t level);
\ No newline at end of file
+void decompress_into(const rust::Slice<const uint8_t> data, rust::Slice<uint8_t> dst);
+std::unique_ptr<std::vector<uint8_t>> compress(rust::Slice<const uint8_t> data, uint8_t level);
\ No newline at end of file
@@ -0,0 +1,537 @@
+//! Arena-backed parameter archives.
+//!
+//! A `ParameterIOArena` holds a whole decoded archive in flat tables: one
+//! each for lists, objects and parameters, plus shared buffers for strings,
+//! buffer parameters and curves. The children of every list and the
+//! parameters of every object are stored as contiguous ranges of those
+//! tables, so decoding an archive costs a few amortized allocations instead
+//! of one map per list and object, and dropping it frees everything at once.
+//! ```
+//! # use roead::aamp::{ParameterIOArena, ParameterRef};
+//! # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+//! let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+//! let pio = ParameterIOArena::from_binary(&data)?;
+//! if let Some(demo_obj) = pio.root().object("DemoAIActionIdx") {
+//!     for (hash, value) in demo_obj.params() {
+//!         let value: ParameterRef = value;
+//!         // Do stuff with parameters
+//!     }
+//! }
+//! # Ok(())
+//! # }
+//! ```
+use super::names::hash_name;
+use super::{
+    Parameter, ParameterIO, ParameterIOView, ParameterList, ParameterListView, ParameterObject,
+    ParameterObjectView, ParameterRef, Result,
+};
+use crate::ffi::{Color, Curve, Quat, Vector2f, Vector3f, Vector4f};
+use indexmap::IndexMap;
+use std::{borrow::Cow, collections::HashMap, ops::Range};
+
+/// A range of one of the arena tables or buffers.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+struct Span {
+    start: u32,
+    len: u32,
+}
+
+impl Span {
+    #[inline]
+    fn range(self) -> Range<usize> {
+        self.start as usize..(self.start + self.len) as usize
+    }
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+struct ListNode {
+    hash: u32,
+    lists: Span,
+    objects: Span,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+struct ObjectNode {
+    hash: u32,
+    params: Span,
+}
+
+/// A parameter value. Anything larger than a quaternion lives in one of the
+/// arena buffers.
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Value {
+    Bool(bool),
+    F32(f32),
+    Int(i32),
+    Vec2(Vector2f),
+    Vec3(Vector3f),
+    Vec4(Vector4f),
+    Color(Color),
+    String32(Span),
+    String64(Span),
+    Curve(Span),
+    BufferInt(Span),
+    BufferF32(Span),
+    String256(Span),
+    Quat(Quat),
+    U32(u32),
+    BufferU32(Span),
+    BufferBinary(Span),
+    StringRef(Span),
+}
+
+impl Default for Value {
+    fn default() -> Self {
+        Self::Bool(false)
+    }
+}
+
+/// An owned parameter archive stored in flat tables. Use
+/// [`ParameterIOArena::root`] to access its lists and objects.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct ParameterIOArena {
+    version: u32,
+    doc_type: String,
+    /// The root list comes first. Each list's children follow somewhere
+    /// after it as one contiguous range.
+    lists: Vec<ListNode>,
+    objects: Vec<ObjectNode>,
+    params: Vec<(u32, Value)>,
+    text: String,
+    ints: Vec<i32>,
+    floats: Vec<f32>,
+    uints: Vec<u32>,
+    bytes: Vec<u8>,
+    curves: Vec<Curve>,
+}
+
+impl ParameterIOArena {
+    /// Parse a binary parameter archive into an arena.
+    pub fn from_binary(data: &[u8]) -> Result<Self> {
+        Self::from_view(ParameterIOView::new(data)?)
+    }
+
+    /// Decode a view of a binary parameter archive into an arena.
+    pub fn from_view(view: ParameterIOView<'_>) -> Result<Self> {
+        let mut builder = Builder::new(view.version(), view.doc_type());
+        builder.fill_list_view(0, view.root())?;
+        Ok(builder.arena)
+    }
+
+    /// Copy a `ParameterIO` into an arena.
+    pub fn from_pio(pio: &ParameterIO) -> Self {
+        let mut builder = Builder::new(pio.version, &pio.doc_type);
+        builder.arena.lists[0].hash = hash_name("param_root");
+        builder.fill_list(0, &pio.lists, &pio.objects);
+        builder.arena
+    }
+
+    /// Data version (not the AAMP format version). Typically 0.
+    pub fn version(&self) -> u32 {
+        self.version
+    }
+
+    /// Data type identifier. Typically “xml”.
+    pub fn doc_type(&self) -> &str {
+        &self.doc_type
+    }
+
+    /// The root parameter list.
+    pub fn root(&self) -> ArenaList<'_> {
+        ArenaList {
+            arena: self,
+            index: 0,
+        }
+    }
+
+    /// Convert the whole archive to an owned `ParameterIO`.
+    pub fn to_pio(&self) -> ParameterIO {
+        let ParameterList {
+            hash,
+            lists,
+            objects,
+        } = self.root().to_list();
+        ParameterIO {
+            version: self.version,
+            doc_type: self.doc_type.clone(),
+            hash,
+            lists,
+            objects,
+        }
+    }
+
+    fn value(&self, value: Value) -> ParameterRef<'_> {
+        match value {
+            Value::Bool(v) => ParameterRef::Bool(v),
+            Value::F32(v) => ParameterRef::F32(v),
+            Value::Int(v) => ParameterRef::Int(v),
+            Value::Vec2(v) => ParameterRef::Vec2(v),
+            Value::Vec3(v) => ParameterRef::Vec3(v),
+            Value::Vec4(v) => ParameterRef::Vec4(v),
+            Value::Color(v) => ParameterRef::Color(v),
+            Value::String32(span) => ParameterRef::String32(&self.text[span.range()]),
+            Value::String64(span) => ParameterRef::String64(&self.text[span.range()]),
+            Value::Curve(span) => {
+                let curves = &self.curves[span.range()];
+                match curves.len() {
+                    1 => ParameterRef::Curve1([curves[0]]),
+                    2 => ParameterRef::Curve2([curves[0], curves[1]]),
+                    3 => ParameterRef::Curve3([curves[0], curves[1], curves[2]]),
+                    _ => ParameterRef::Curve4([curves[0], curves[1], curves[2], curves[3]]),
+                }
+            }
+            Value::BufferInt(span) => {
+                ParameterRef::BufferInt(Cow::Borrowed(&self.ints[span.range()]))
+            }
+            Value::BufferF32(span) => {
+                ParameterRef::BufferF32(Cow::Borrowed(&self.floats[span.range()]))
+            }
+            Value::String256(span) => ParameterRef::String256(&self.text[span.range()]),
+            Value::Quat(v) => ParameterRef::Quat(v),
+            Value::U32(v) => ParameterRef::U32(v),
+            Value::BufferU32(span) => {
+                ParameterRef::BufferU32(Cow::Borrowed(&self.uints[span.range()]))
+            }
+            Value::BufferBinary(span) => ParameterRef::BufferBinary(&self.bytes[span.range()]),
+            Value::StringRef(span) => ParameterRef::StringRef(&self.text[span.range()]),
+        }
+    }
+}
+
+impl From<&ParameterIO> for ParameterIOArena {
+    fn from(pio: &ParameterIO) -> Self {
+        Self::from_pio(pio)
+    }
+}
+
+impl From<&ParameterIOArena> for ParameterIO {
+    fn from(arena: &ParameterIOArena) -> Self {
+        arena.to_pio()
+    }
+}
+
+#[inline]
+fn extend<T: Copy>(buf: &mut Vec<T>, items: &[T]) -> Span {
+    let start = buf.len() as u32;
+    buf.extend_from_slice(items);
+    Span {
+        start,
+        len: items.len() as u32,
+    }
+}
+
+#[inline]
+fn reserve<T: Default + Clone>(table: &mut Vec<T>, len: usize) -> Span {
+    let start = table.len();
+    table.resize(start + len, T::default());
+    Span {
+        start: start as u32,
+        len: len as u32,
+    }
+}
+
+fn param_ref(param: &Parameter) -> ParameterRef<'_> {
+    match param {
+        Parameter::Bool(v) => ParameterRef::Bool(*v),
+        Parameter::F32(v) => ParameterRef::F32(*v),
+        Parameter::Int(v) => ParameterRef::Int(*v),
+        Parameter::Vec2(v) => ParameterRef::Vec2(*v),
+        Parameter::Vec3(v) => ParameterRef::Vec3(*v),
+        Parameter::Vec4(v) => ParameterRef::Vec4(*v),
+        Parameter::Color(v) => ParameterRef::Color(*v),
+        Parameter::String32(v) => ParameterRef::String32(v),
+        Parameter::String64(v) => ParameterRef::String64(v),
+        Parameter::Curve1(v) => ParameterRef::Curve1(*v),
+        Parameter::Curve2(v) => ParameterRef::Curve2(*v),
+        Parameter::Curve3(v) => ParameterRef::Curve3(*v),
+        Parameter::Curve4(v) => ParameterRef::Curve4(*v),
+        Parameter::BufferInt(v) => ParameterRef::BufferInt(Cow::Borrowed(v)),
+        Parameter::BufferF32(v) => ParameterRef::BufferF32(Cow::Borrowed(v)),
+        Parameter::String256(v) => ParameterRef::String256(v),
+        Parameter::Quat(v) => ParameterRef::Quat(*v),
+        Parameter::U32(v) => ParameterRef::U32(*v),
+        Parameter::BufferU32(v) => ParameterRef::BufferU32(Cow::Borrowed(v)),
+        Parameter::BufferBinary(v) => ParameterRef::BufferBinary(v),
+        Parameter::StringRef(v) => ParameterRef::StringRef(v),
+    }
+}
+
+struct Builder<'a> {
+    arena: ParameterIOArena,
+    /// Strings that are already in the text buffer. Archives repeat the same
+    /// few strings a lot, so each one is stored once.
+    strings: HashMap<&'a str, Span>,
+}
+
+impl<'a> Builder<'a> {
+    fn new(version: u32, doc_type: &str) -> Self {
+        Builder {
+            arena: ParameterIOArena {
+                version,
+                doc_type: doc_type.to_owned(),
+                lists: vec![ListNode::default()],
+                ..Default::default()
+            },
+            strings: HashMap::new(),
+        }
+    }
+
+    fn text(&mut self, text: &'a str) -> Span {
+        let arena = &mut self.arena;
+        *self.strings.entry(text).or_insert_with(|| {
+            let start = arena.text.len() as u32;
+            arena.text.push_str(text);
+            Span {
+                start,
+                len: text.len() as u32,
+            }
+        })
+    }
+
+    fn value(&mut self, param: ParameterRef<'a>) -> Value {
+        match param {
+            ParameterRef::Bool(v) => Value::Bool(v),
+            ParameterRef::F32(v) => Value::F32(v),
+            ParameterRef::Int(v) => Value::Int(v),
+            ParameterRef::Vec2(v) => Value::Vec2(v),
+            ParameterRef::Vec3(v) => Value::Vec3(v),
+            ParameterRef::Vec4(v) => Value::Vec4(v),
+            ParameterRef::Color(v) => Value::Color(v),
+            ParameterRef::String32(v) => Value::String32(self.text(v)),
+            ParameterRef::String64(v) => Value::String64(self.text(v)),
+            ParameterRef::Curve1(v) => Value::Curve(extend(&mut self.arena.curves, &v)),
+            ParameterRef::Curve2(v) => Value::Curve(extend(&mut self.arena.curves, &v)),
+            ParameterRef::Curve3(v) => Value::Curve(extend(&mut self.arena.curves, &v)),
+            ParameterRef::Curve4(v) => Value::Curve(extend(&mut self.arena.curves, &v)),
+            ParameterRef::BufferInt(v) => Value::BufferInt(extend(&mut self.arena.ints, &v)),
+            ParameterRef::BufferF32(v) => Value::BufferF32(extend(&mut self.arena.floats, &v)),
+            ParameterRef::String256(v) => Value::String256(self.text(v)),
+            ParameterRef::Quat(v) => Value::Quat(v),
+            ParameterRef::U32(v) => Value::U32(v),
+            ParameterRef::BufferU32(v) => Value::BufferU32(extend(&mut self.arena.uints, &v)),
+            ParameterRef::BufferBinary(v) => Value::BufferBinary(extend(&mut self.arena.bytes, v)),
+            ParameterRef::StringRef(v) => Value::StringRef(self.text(v)),
+        }
+    }
+
+    fn fill_list_view(&mut self, index: usize, list: ParameterListView<'a>) -> Result<()> {
+        let lists = list.lists()?;
+        let objects = list.objects()?;
+        let node = ListNode {
+            hash: list.hash(),
+            lists: reserve(&mut self.arena.lists, lists.size_hint().0),
+            objects: reserve(&mut self.arena.objects, objects.size_hint().0),
+        };
+        self.arena.lists[index] = node;
+        for (slot, (_, obj)) in node.objects.range().zip(objects) {
+            self.fill_object_view(slot, obj)?;
+        }
+        for (slot, (_, list)) in node.lists.range().zip(lists) {
+            self.fill_list_view(slot, list)?;
+        }
+        Ok(())
+    }
+
+    fn fill_object_view(&mut self, index: usize, obj: ParameterObjectView<'a>) -> Result<()> {
+        let params = reserve(&mut self.arena.params, obj.len());
+        self.arena.objects[index] = ObjectNode {
+            hash: obj.hash(),
+            params,
+        };
+        for (slot, param) in params.range().zip(obj.params()?) {
+            let (hash, param) = param?;
+            let value = self.value(param);
+            self.arena.params[slot] = (hash, value);
+        }
+        Ok(())
+    }
+
+    fn fill_list(
+        &mut self,
+        index: usize,
+        lists: &'a IndexMap<u32, ParameterList>,
+        objects: &'a IndexMap<u32, ParameterObject>,
+    ) {
+        let node = ListNode {
+            hash: self.arena.lists[index].hash,
+            lists: reserve(&mut self.arena.lists, lists.len()),
+            objects: reserve(&mut self.arena.objects, objects.len()),
+        };
+        self.arena.lists[index] = node;
+        for (slot, (hash, obj)) in node.objects.range().zip(objects) {
+            let params = reserve(&mut self.arena.params, obj.0.len());
+            self.arena.objects[slot] = ObjectNode {
+                hash: *hash,
+                params,
+            };
+            for (slot, (hash, param)) in params.range().zip(&obj.0) {
+                let value = self.value(param_ref(param));
+                self.arena.params[slot] = (*hash, value);
+            }
+        }
+        for (slot, (hash, list)) in node.lists.range().zip(lists) {
+            self.arena.lists[slot].hash = *hash;
+            self.fill_list(slot, &list.lists, &list.objects);
+        }
+    }
+}
+
+/// A borrowed handle to a parameter list in a [`ParameterIOArena`].
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaList<'a> {
+    arena: &'a ParameterIOArena,
+    index: usize,
+}
+
+impl<'a> ArenaList<'a> {
+    #[inline]
+    fn node(&self) -> ListNode {
+        self.arena.lists[self.index]
+    }
+
+    /// The name hash of this list.
+    pub fn hash(&self) -> u32 {
+        self.node().hash
+    }
+
+    /// Iterate over the child parameter lists and their name hashes.
+    pub fn lists(&self) -> impl Iterator<Item = (u32, ArenaList<'a>)> {
+        let arena = self.arena;
+        self.node().lists.range().map(move |index| {
+            let list = ArenaList { arena, index };
+            (list.hash(), list)
+        })
+    }
+
+    /// Iterate over the child parameter objects and their name hashes.
+    pub fn objects(&self) -> impl Iterator<Item = (u32, ArenaObject<'a>)> {
+        let arena = self.arena;
+        self.node().objects.range().map(move |index| {
+            let obj = ArenaObject { arena, index };
+            (obj.hash(), obj)
+        })
+    }
+
+    /// Get a child parameter list by name hash
+    pub fn list_by_hash(&self, hash: u32) -> Option<ArenaList<'a>> {
+        self.lists().find(|(h, _)| *h == hash).map(|(_, list)| list)
+    }
+
+    /// Get a child parameter object by name hash
+    pub fn object_by_hash(&self, hash: u32) -> Option<ArenaObject<'a>> {
+        self.objects().find(|(h, _)| *h == hash).map(|(_, obj)| obj)
+    }
+
+    /// Get a child parameter list by name
+    pub fn list(&self, name: &str) -> Option<ArenaList<'a>> {
+        self.list_by_hash(hash_name(name))
+    }
+
+    /// Get a child parameter object by name
+    pub fn object(&self, name: &str) -> Option<ArenaObject<'a>> {
+        self.object_by_hash(hash_name(name))
+    }
+
+    /// Copy this list and all of its children into an owned `ParameterList`.
+    pub fn to_list(&self) -> ParameterList {
+        ParameterList {
+            hash: Default::default(),
+            lists: self
+                .lists()
+                .map(|(hash, list)| (hash, list.to_list()))
+                .collect(),
+            objects: self
+                .objects()
+                .map(|(hash, obj)| (hash, obj.to_object()))
+                .collect(),
+        }
+    }
+}
+
+/// A borrowed handle to a parameter object in a [`ParameterIOArena`].
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaObject<'a> {
+    arena: &'a ParameterIOArena,
+    index: usize,
+}
+
+impl<'a> ArenaObject<'a> {
+    #[inline]
+    fn node(&self) -> ObjectNode {
+        self.arena.objects[self.index]
+    }
+
+    /// The name hash of this object.
+    pub fn hash(&self) -> u32 {
+        self.node().hash
+    }
+
+    /// Count the number of parameters
+    pub fn len(&self) -> usize {
+        self.node().params.len as usize
+    }
+
+    /// Whether the object has no parameters
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Iterate over the parameters and their name hashes. Strings and buffers
+    /// are borrowed from the arena.
+    pub fn params(&self) -> impl Iterator<Item = (u32, ParameterRef<'a>)> {
+        let arena = self.arena;
+        arena.params[self.node().params.range()]
+            .iter()
+            .map(move |(hash, value)| (*hash, arena.value(*value)))
+    }
+
+    /// Get a parameter by name hash
+    pub fn param_by_hash(&self, hash: u32) -> Option<ParameterRef<'a>> {
+        self.params()
+            .find(|(h, _)| *h == hash)
+            .map(|(_, param)| param)
+    }
+
+    /// Get a parameter by name
+    pub fn param(&self, name: &str) -> Option<ParameterRef<'a>> {
+        self.param_by_hash(hash_name(name))
+    }
+
+    /// Copy this object into an owned `ParameterObject`.
+    pub fn to_object(&self) -> ParameterObject {
+        ParameterObject(
+            self.params()
+                .map(|(hash, param)| (hash, param.into()))
+                .collect(),
+            Default::default(),
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::ParameterIOArena;
+    use crate::aamp::{ParamList, ParameterIO, ParameterRef};
+
+    #[test]
+    fn arena_matches_pio() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let pio = ParameterIO::from_binary(&data).unwrap();
+        let arena = ParameterIOArena::from_binary(&data).unwrap();
+        assert_eq!(arena.to_pio(), pio);
+        assert_eq!(ParameterIOArena::from_pio(&pio), arena);
+        assert_eq!(arena.doc_type(), "xml");
+
+        let obj = arena.root().object("DemoAIActionIdx").unwrap();
+        let owned = pio.object("DemoAIActionIdx").unwrap();
+        assert_eq!(obj.len(), owned.len());
+        for ((hash, param), (owned_hash, owned)) in obj.params().zip(owned.params()) {
+            assert_eq!(hash, *owned_hash);
+            if let ParameterRef::StringRef(s) = &param {
+                assert_eq!(obj.param_by_hash(hash).unwrap(), ParameterRef::StringRef(s));
+            }
+            assert_eq!(&crate::aamp::Parameter::from(param), owned);
+        }
+        assert!(arena.root().object("Missing").is_none());
+    }
+}
@@ -0,0 +1,328 @@
+//! Structural hashing and diffing of parameter archives.
+//!
+//! Each object and list caches its structural hash once it has been computed.
+//! The cache is cleared whenever the node is borrowed mutably, and every path
+//! to a child's contents goes through its parents' mutable accessors, so after
+//! an edit only the edited node and its ancestors are hashed again.
+use super::{ParamList, Parameter, ParameterIO, ParameterList, ParameterObject};
+use crate::ffi::Curve;
+use indexmap::IndexMap;
+use std::{
+    hash::{Hash, Hasher},
+    sync::atomic::{AtomicU64, Ordering},
+};
+use xxhash_rust::xxh3::{xxh3_64, Xxh3};
+
+/// A lazily computed structural hash. Zero means unknown: never computed, or
+/// invalidated by a mutable borrow since.
+#[derive(Default)]
+pub(super) struct HashCache(AtomicU64);
+
+impl HashCache {
+    fn get_or(&self, compute: impl FnOnce() -> u64) -> u64 {
+        match self.0.load(Ordering::Relaxed) {
+            0 => {
+                let hash = compute().max(1);
+                self.0.store(hash, Ordering::Relaxed);
+                hash
+            }
+            hash => hash,
+        }
+    }
+
+    #[inline]
+    pub(super) fn invalidate(&mut self) {
+        *self.0.get_mut() = 0;
+    }
+}
+
+impl Clone for HashCache {
+    fn clone(&self) -> Self {
+        HashCache(AtomicU64::new(self.0.load(Ordering::Relaxed)))
+    }
+}
+
+/// Only used to short-circuit the comparison of the nodes holding the caches:
+/// two known hashes that differ prove that the nodes differ, anything else has
+/// to be compared in full.
+impl PartialEq for HashCache {
+    fn eq(&self, other: &Self) -> bool {
+        let (a, b) = (
+            self.0.load(Ordering::Relaxed),
+            other.0.load(Ordering::Relaxed),
+        );
+        a == 0 || b == 0 || a == b
+    }
+}
+
+/// `-0.0 + 0.0` is `0.0`, so both zeros hash alike, as they compare equal.
+#[inline]
+fn float_bits(v: f32) -> u32 {
+    (v + 0.0).to_bits()
+}
+
+fn write_floats(state: &mut Xxh3, values: &[f32]) {
+    for v in values {
+        state.write_u32(float_bits(*v));
+    }
+}
+
+fn write_curves(state: &mut Xxh3, curves: &[Curve]) {
+    for curve in curves {
+        state.write_u32(curve.a);
+        state.write_u32(curve.b);
+        write_floats(state, &curve.floats);
+    }
+}
+
+fn write_param(state: &mut Xxh3, param: &Parameter) {
+    std::mem::discriminant(param).hash(state);
+    match param {
+        Parameter::Bool(v) => state.write_u8(*v as u8),
+        Parameter::F32(v) => state.write_u32(float_bits(*v)),
+        Parameter::Int(v) => state.write_i32(*v),
+        Parameter::U32(v) => state.write_u32(*v),
+        Parameter::Vec2(v) => write_floats(state, &[v.x, v.y]),
+        Parameter::Vec3(v) => write_floats(state, &[v.x, v.y, v.z]),
+        Parameter::Vec4(v) => write_floats(state, &[v.x, v.y, v.z, v.t]),
+        Parameter::Color(v) => write_floats(state, &[v.r, v.g, v.b, v.a]),
+        Parameter::Quat(v) => write_floats(state, &[v.a, v.b, v.c, v.d]),
+        Parameter::String32(v)
+        | Parameter::String64(v)
+        | Parameter::String256(v)
+        | Parameter::StringRef(v) => v.hash(state),
+        Parameter::Curve1(v) => write_curves(state, v),
+        Parameter::Curve2(v) => write_curves(state, v),
+        Parameter::Curve3(v) => write_curves(state, v),
+        Parameter::Curve4(v) => write_curves(state, v),
+        Parameter::BufferInt(v) => v.hash(state),
+        Parameter::BufferF32(v) => {
+            state.write_usize(v.len());
+            write_floats(state, v);
+        }
+        Parameter::BufferU32(v) => v.hash(state),
+        Parameter::BufferBinary(v) => v.hash(state),
+    }
+}
+
+fn entry_hash(key: u32, hash: u64) -> u64 {
+    let mut bytes = [0; 12];
+    bytes[..4].copy_from_slice(&key.to_le_bytes());
+    bytes[4..].copy_from_slice(&hash.to_le_bytes());
+    xxh3_64(&bytes)
+}
+
+fn list_hash(
+    lists: &IndexMap<u32, ParameterList>,
+    objects: &IndexMap<u32, ParameterObject>,
+) -> u64 {
+    // Lists compare equal regardless of the order of their children, so the
+    // children are combined with a sum, which does not depend on order either.
+    let lists = lists
+        .iter()
+        .map(|(key, list)| entry_hash(*key, list.structural_hash()))
+        .fold(0, u64::wrapping_add);
+    let objects = objects
+        .iter()
+        .map(|(key, obj)| entry_hash(*key, obj.structural_hash()))
+        .fold(0, u64::wrapping_add);
+    let mut bytes = [0; 16];
+    bytes[..8].copy_from_slice(&lists.to_le_bytes());
+    bytes[8..].copy_from_slice(&objects.to_le_bytes());
+    xxh3_64(&bytes)
+}
+
+impl ParameterObject {
+    /// A hash of the parameters in this object, computed without serializing
+    /// anything and cached until the object is next borrowed mutably. Equal
+    /// objects always have equal hashes.
+    pub fn structural_hash(&self) -> u64 {
+        self.1.get_or(|| {
+            let mut state = Xxh3::new();
+            for (key, param) in &self.0 {
+                state.write_u32(*key);
+                write_param(&mut state, param);
+            }
+            state.finish()
+        })
+    }
+
+    /// List the name hashes of the parameters that were added, removed or
+    /// changed in `other`.
+    pub fn diff(&self, other: &ParameterObject) -> Vec<u32> {
+        let mut out = Vec::new();
+        diff_object(self, other, &mut Vec::new(), &mut out);
+        out.into_iter()
+            .filter_map(|path| path.first().copied())
+            .collect()
+    }
+}
+
+impl ParameterList {
+    /// A hash of this list and its children, computed without serializing
+    /// anything. Every list and object caches its hash until it is next
+    /// borrowed mutably, so after an edit only the changed nodes and their
+    /// parents are hashed again. Equal lists always have equal hashes.
+    pub fn structural_hash(&self) -> u64 {
+        self.hash.get_or(|| list_hash(&self.lists, &self.objects))
+    }
+
+    /// List the paths, as name hashes from this list down, of the lists,
+    /// objects and parameters that were added, removed or changed in `other`.
+    /// See [`ParameterIO::diff`].
+    pub fn diff(&self, other: &ParameterList) -> Vec<Vec<u32>> {
+        let mut out = Vec::new();
+        if self.structural_hash() != other.structural_hash() {
+            diff_list(self, other, &mut Vec::new(), &mut out);
+        }
+        out
+    }
+}
+
+impl ParameterIO {
+    /// A hash of the whole document, computed without serializing anything.
+    /// See [`ParameterList::structural_hash`].
+    pub fn structural_hash(&self) -> u64 {
+        let root = self.hash.get_or(|| list_hash(&self.lists, &self.objects));
+        let mut state = Xxh3::new();
+        state.write_u64(root);
+        state.write_u32(self.version);
+        self.doc_type.hash(&mut state);
+        state.finish()
+    }
+
+    /// List the paths, as name hashes from the root down, of the lists,
+    /// objects and parameters that were added, removed or changed in `other`.
+    /// An empty path means the version or data type differs.
+    ///
+    /// Children with equal structural hashes are taken to be equal and not
+    /// compared any further, so diffing many documents against the same base
+    /// document mostly touches the parts that changed.
+    /// ```
+    /// # use roead::aamp::{names::hash_name, ParamList, Parameter, ParameterIO};
+    /// # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+    /// let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+    /// let base = ParameterIO::from_binary(&data)?;
+    /// let mut pio = base.clone();
+    /// pio.objects_mut()
+    ///     .get_mut(&hash_name("DemoAIActionIdx"))
+    ///     .unwrap()
+    ///     .set_param("Demo_Idling", Parameter::Int(3));
+    /// assert_eq!(
+    ///     base.diff(&pio),
+    ///     vec![vec![hash_name("DemoAIActionIdx"), hash_name("Demo_Idling")]]
+    /// );
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn diff(&self, other: &ParameterIO) -> Vec<Vec<u32>> {
+        let mut out = Vec::new();
+        if self.version != other.version || self.doc_type != other.doc_type {
+            out.push(vec![]);
+        }
+        let root = |pio: &ParameterIO| pio.hash.get_or(|| list_hash(&pio.lists, &pio.objects));
+        if root(self) != root(other) {
+            diff_list(self, other, &mut Vec::new(), &mut out);
+        }
+        out
+    }
+}
+
+fn diff_maps<T>(
+    a: &IndexMap<u32, T>,
+    b: &IndexMap<u32, T>,
+    path: &mut Vec<u32>,
+    out: &mut Vec<Vec<u32>>,
+    mut diff_child: impl FnMut(&T, &T, &mut Vec<u32>, &mut Vec<Vec<u32>>),
+) {
+    for (key, child) in a {
+        path.push(*key);
+        match b.get(key) {
+            Some(other) => diff_child(child, other, path, out),
+            None => out.push(path.clone()),
+        }
+        path.pop();
+    }
+    for key in b.keys().filter(|key| !a.contains_key(*key)) {
+        path.push(*key);
+        out.push(path.clone());
+        path.pop();
+    }
+}
+
+fn diff_list<A: ParamList, B: ParamList>(
+    a: &A,
+    b: &B,
+    path: &mut Vec<u32>,
+    out: &mut Vec<Vec<u32>>,
+) {
+    diff_maps(a.lists(), b.lists(), path, out, |a, b, path, out| {
+        if a.structural_hash() != b.structural_hash() {
+            diff_list(a, b, path, out);
+        }
+    });
+    diff_maps(a.objects(), b.objects(), path, out, |a, b, path, out| {
+        if a.structural_hash() != b.structural_hash() {
+            diff_object(a, b, path, out);
+        }
+    });
+}
+
+fn diff_object(
+    a: &ParameterObject,
+    b: &ParameterObject,
+    path: &mut Vec<u32>,
+    out: &mut Vec<Vec<u32>>,
+) {
+    let len = out.len();
+    diff_maps(&a.0, &b.0, path, out, |a, b, path, out| {
+        if a != b {
+            out.push(path.clone());
+        }
+    });
+    // Objects with the same parameters in a different order are not equal
+    if out.len() == len && a != b {
+        out.push(path.clone());
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::aamp::{names::hash_name, ParamList, Parameter, ParameterIO, ParameterList};
+
+    #[test]
+    fn hash_and_diff() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let base = ParameterIO::from_binary(&data).unwrap();
+        let mut pio = base.clone();
+        assert_eq!(base.structural_hash(), pio.structural_hash());
+        assert!(base.diff(&pio).is_empty());
+
+        let old_hash = pio.structural_hash();
+        let obj = pio.objects().get_index(0).map(|(hash, _)| *hash).unwrap();
+        let param = {
+            let obj = pio.objects_mut().get_mut(&obj).unwrap();
+            let (param, value) = obj.params_mut().get_index_mut(0).unwrap();
+            *value = Parameter::StringRef("changed".into());
+            *param
+        };
+        let mut list = ParameterList::new();
+        list.set_object("Added", Default::default());
+        pio.set_list("AddedList", list);
+        assert_ne!(pio.structural_hash(), old_hash);
+        assert_ne!(base, pio);
+        assert_eq!(
+            base.diff(&pio),
+            vec![vec![hash_name("AddedList")], vec![obj, param]]
+        );
+
+        // Editing a nested object only invalidates its own hash and its parents'
+        let (list, added) = (hash_name("AddedList"), hash_name("Added"));
+        let mut zero = pio.clone();
+        zero.lists_mut()[&list].objects_mut()[&added].set_param("Zero", Parameter::F32(0.0));
+        assert_eq!(pio.diff(&zero), vec![vec![list, added, hash_name("Zero")]]);
+        pio.lists_mut()[&list].objects_mut()[&added].set_param("Zero", Parameter::F32(-0.0));
+        assert_eq!(zero.structural_hash(), pio.structural_hash());
+        assert_eq!(zero, pio);
+    }
+}
@@ -1,4 +1,4 @@
-//! Bindings for the `oead::aamp` module.
+//! Reading and writing binary and text parameter archives, compatible with `oead::aamp`.
 //!
 //! Only version 2, little endian and UTF-8 binary parameter archives are supported.  
 //! All parameter types including buffers are supported.  
@@ -24,13 +24,45 @@
 //! # Ok(())
 //! # }
 //! ```
-use crate::ffi;
-use crate::ffi::{Color, Curve, ParamType, Quat, Vector2f, Vector3f, Vector4f};
-use crc::crc32::checksum_ieee;
-use cxx::UniquePtr;
+//!
+//! For read-only access, `ParameterIOView` walks the binary data in place and
+//! hands out borrowed strings and buffers instead of building a `ParameterIO`.
+//! `ParameterIOArena` decodes a whole archive into a few flat tables, which
+//! is cheaper to build and drop than a `ParameterIO` when nothing needs to be
+//! modified.
+//!
+//! Names are hashed with [`names::hash_name`], which can run at compile time
+//! for names known in advance. The [`names`] module also holds the dictionary
+//! of names used when writing YAML.
+//!
+//! To check whether an archive differs from another without a deep compare,
+//! use `structural_hash`, which each list and object caches until it is next
+//! borrowed mutably, and `diff` to find the paths that changed.
+//!
+//! To change a few values in an archive without decoding it, use a
+//! `ParameterIOPatch`, which appends the new values and repoints the edited
+//! parameters to them.
+use crate::{
+    ffi::{Color, Curve, ParamType, Quat, Vector2f, Vector3f, Vector4f},
+    stats::{self, Format, Phase},
+};
 use indexmap::IndexMap;
+use std::sync::Arc;
 use thiserror::Error;
 
+mod arena;
+mod diff;
+pub mod names;
+mod patch;
+mod text;
+mod view;
+mod writer;
+pub use arena::{ArenaList, ArenaObject, ParameterIOArena};
+use diff::HashCache;
+use names::hash_name;
+pub use patch::ParameterIOPatch;
+pub use view::{ParamValue, ParameterIOView, ParameterListView, ParameterObjectView, ParameterRef};
+
 pub type Result<T> = std::result::Result<T, AampError>;
 
 /// An error when serializing/deserializing AAMP documents
@@ -38,9 +70,14 @@ pub type Result<T> = std::result::Result<T, AampError>;
 pub enum AampError {
     #[error("Invalid AAMP magic, expected \"AAMP\", found {0}")]
     MagicError(String),
-    /// Wraps any other error returned by `oead` in C++
-    #[error("Failed to parse AAMP: {0}")]
-    OeadError(#[from] cxx::Exception),
+    #[error("Invalid AAMP data: {0}")]
+    DataError(&'static str),
+    #[error("Invalid AAMP text: {0}")]
+    TextError(String),
+    #[error("Invalid AAMP patch: {0}")]
+    PatchError(String),
+    #[error("AAMP parameter is not of expected type")]
+    TypeError,
 }
 
 /// Represents a single AAMP parameter, with many possible types.
@@ -69,35 +106,6 @@ pub enum Parameter {
     StringRef(String),
 }
 
-impl From<UniquePtr<ffi::Parameter>> for Parameter {
-    fn from(fparam: UniquePtr<ffi::Parameter>) -> Self {
-        match fparam.GetType() {
-            ParamType::Bool => Self::Bool(ffi::GetParamBool(&fparam)),
-            ParamType::F32 => Self::F32(ffi::GetParamF32(&fparam)),
-            ParamType::U32 => Self::U32(ffi::GetParamU32(&fparam)),
-            ParamType::Int => Self::Int(ffi::GetParamInt(&fparam)),
-            ParamType::Vec2 => Self::Vec2(ffi::GetParamVec2(&fparam)),
-            ParamType::Vec3 => Self::Vec3(ffi::GetParamVec3(&fparam)),
-            ParamType::Vec4 => Self::Vec4(ffi::GetParamVec4(&fparam)),
-            ParamType::Color => Self::Color(ffi::GetParamColor(&fparam)),
-            ParamType::Quat => Self::Quat(ffi::GetParamQuat(&fparam)),
-            ParamType::Curve1 => Self::Curve1(ffi::GetParamCurve1(&fparam)),
-            ParamType::Curve2 => Self::Curve2(ffi::GetParamCurve2(&fparam)),
-            ParamType::Curve3 => Self::Curve3(ffi::GetParamCurve3(&fparam)),
-            ParamType::Curve4 => Self::Curve4(ffi::GetParamCurve4(&fparam)),
-            ParamType::String32 => Self::String32(ffi::GetParamString(&fparam)),
-            ParamType::String64 => Self::String64(ffi::GetParamString(&fparam)),
-            ParamType::String256 => Self::String256(ffi::GetParamString(&fparam)),
-            ParamType::StringRef => Self::StringRef(ffi::GetParamString(&fparam)),
-            ParamType::BufferInt => Self::BufferInt(ffi::GetParamBufInt(&fparam)),
-            ParamType::BufferF32 => Self::BufferF32(ffi::GetParamBufF32(&fparam)),
-            ParamType::BufferU32 => Self::BufferU32(ffi::GetParamBufU32(&fparam)),
-            ParamType::BufferBinary => Self::BufferBinary(ffi::GetParamBufBin(&fparam)),
-            _ => unreachable!(),
-        }
-    }
-}
-
 impl Parameter {
     /// Check if the parameter is any string type
     #[inline]
@@ -123,240 +131,129 @@ impl Parameter {
         )
     }
 
-    pub(crate) fn get_ffi_type(&self) -> ParamType {
+    /// Borrow the value of any string parameter
+    pub fn as_str(&self) -> Result<&str> {
         match self {
-            Self::Bool(_) => ParamType::Bool,
-            Self::F32(_) => ParamType::F32,
-            Self::Int(_) => ParamType::Int,
-            Self::Vec2(_) => ParamType::Vec2,
-            Self::Vec3(_) => ParamType::Vec3,
-            Self::Vec4(_) => ParamType::Vec4,
-            Self::Color(_) => ParamType::Color,
-            Self::String32(_) => ParamType::String32,
-            Self::String64(_) => ParamType::String64,
-            Self::Curve1(_) => ParamType::Curve1,
-            Self::Curve2(_) => ParamType::Curve2,
-            Self::Curve3(_) => ParamType::Curve3,
-            Self::Curve4(_) => ParamType::Curve4,
-            Self::BufferInt(_) => ParamType::BufferInt,
-            Self::BufferF32(_) => ParamType::BufferF32,
-            Self::String256(_) => ParamType::String256,
-            Self::Quat(_) => ParamType::Quat,
-            Self::U32(_) => ParamType::U32,
-            Self::BufferU32(_) => ParamType::BufferU32,
-            Self::BufferBinary(_) => ParamType::BufferBinary,
-            Self::StringRef(_) => ParamType::StringRef,
-        }
-    }
-
-    pub(crate) fn as_bool(&self) -> bool {
-        if let Self::Bool(v) = self {
-            *v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_f32(&self) -> f32 {
-        if let Self::F32(v) = self {
-            *v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_int(&self) -> i32 {
-        if let Self::Int(v) = self {
-            *v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_vec2(&self) -> &Vector2f {
-        if let Self::Vec2(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_vec3(&self) -> &Vector3f {
-        if let Self::Vec3(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_vec4(&self) -> &Vector4f {
-        if let Self::Vec4(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_color(&self) -> &Color {
-        if let Self::Color(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_string32(&self) -> &str {
-        if let Self::String32(v) = self {
-            v.as_str()
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_string64(&self) -> &str {
-        if let Self::String64(v) = self {
-            v.as_str()
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_curve1(&self) -> &[Curve; 1] {
-        if let Self::Curve1(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_curve2(&self) -> &[Curve; 2] {
-        if let Self::Curve2(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_curve3(&self) -> &[Curve; 3] {
-        if let Self::Curve3(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_curve4(&self) -> &[Curve; 4] {
-        if let Self::Curve4(v) = self {
-            v
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_buf_int(&self) -> &[i32] {
-        if let Self::BufferInt(v) = self {
-            v.as_slice()
-        } else {
-            unreachable!()
-        }
-    }
-
-    pub(crate) fn as_buf_f32(&self) -> &[f32] {
-        if let Self::BufferF32(v) = self {
-            v
-        } else {
-            unreachable!()
+            Parameter::String32(v)
+            | Parameter::String64(v)
+            | Parameter::String256(v)
+            | Parameter::StringRef(v) => Ok(v),
+            _ => Err(AampError::TypeError),
         }
     }
 
-    pub(crate) fn as_string_256(&self) -> &str {
-        if let Self::String256(v) = self {
-            v.as_str()
-        } else {
-            unreachable!()
+    /// Borrow the curves of any curve parameter
+    pub fn as_curves(&self) -> Result<&[Curve]> {
+        match self {
+            Parameter::Curve1(v) => Ok(v),
+            Parameter::Curve2(v) => Ok(v),
+            Parameter::Curve3(v) => Ok(v),
+            Parameter::Curve4(v) => Ok(v),
+            _ => Err(AampError::TypeError),
         }
     }
 
-    pub(crate) fn as_quat(&self) -> &Quat {
-        if let Self::Quat(v) = self {
-            v
+    /// Borrow the contents of an int buffer parameter
+    pub fn as_buf_int(&self) -> Result<&[i32]> {
+        if let Parameter::BufferInt(v) = self {
+            Ok(v)
         } else {
-            unreachable!()
+            Err(AampError::TypeError)
         }
     }
 
-    pub(crate) fn as_u32(&self) -> u32 {
-        if let Self::U32(v) = self {
-            *v
+    /// Borrow the contents of a float buffer parameter
+    pub fn as_buf_f32(&self) -> Result<&[f32]> {
+        if let Parameter::BufferF32(v) = self {
+            Ok(v)
         } else {
-            unreachable!()
+            Err(AampError::TypeError)
         }
     }
 
-    pub(crate) fn as_buf_u32(&self) -> &[u32] {
-        if let Self::BufferU32(v) = self {
-            v
+    /// Borrow the contents of a u32 buffer parameter
+    pub fn as_buf_u32(&self) -> Result<&[u32]> {
+        if let Parameter::BufferU32(v) = self {
+            Ok(v)
         } else {
-            unreachable!()
+            Err(AampError::TypeError)
         }
     }
 
-    pub(crate) fn as_buf_bin(&self) -> &[u8] {
-        if let Self::BufferBinary(v) = self {
-            v
+    /// Borrow the contents of a binary buffer parameter
+    pub fn as_buf_binary(&self) -> Result<&[u8]> {
+        if let Parameter::BufferBinary(v) = self {
+            Ok(v)
         } else {
-            unreachable!()
+            Err(AampError::TypeError)
         }
     }
 
-    pub(crate) fn as_str_ref(&self) -> &str {
-        if let Self::StringRef(v) = self {
-            v.as_str()
-        } else {
-            unreachable!()
+    pub(crate) fn get_ffi_type(&self) -> ParamType {
+        match self {
+            Self::Bool(_) => ParamType::Bool,
+            Self::F32(_) => ParamType::F32,
+            Self::Int(_) => ParamType::Int,
+            Self::Vec2(_) => ParamType::Vec2,
+            Self::Vec3(_) => ParamType::Vec3,
+            Self::Vec4(_) => ParamType::Vec4,
+            Self::Color(_) => ParamType::Color,
+            Self::String32(_) => ParamType::String32,
+            Self::String64(_) => ParamType::String64,
+            Self::Curve1(_) => ParamType::Curve1,
+            Self::Curve2(_) => ParamType::Curve2,
+            Self::Curve3(_) => ParamType::Curve3,
+            Self::Curve4(_) => ParamType::Curve4,
+            Self::BufferInt(_) => ParamType::BufferInt,
+            Self::BufferF32(_) => ParamType::BufferF32,
+            Self::String256(_) => ParamType::String256,
+            Self::Quat(_) => ParamType::Quat,
+            Self::U32(_) => ParamType::U32,
+            Self::BufferU32(_) => ParamType::BufferU32,
+            Self::BufferBinary(_) => ParamType::BufferBinary,
+            Self::StringRef(_) => ParamType::StringRef,
         }
     }
 }
 
 /// Wraps a map of parameters and their name hashes
-#[derive(Debug, Clone)]
-#[repr(transparent)]
-pub struct ParameterObject(IndexMap<u32, Parameter>);
+#[derive(Clone, Default)]
+pub struct ParameterObject(IndexMap<u32, Parameter>, HashCache);
 
-impl PartialEq for ParameterObject {
-    fn eq(&self, other: &Self) -> bool {
-        self.0.len() == other.0.len() && self.0.iter().zip(other.0.iter()).all(|(e, e2)| e == e2)
+impl std::fmt::Debug for ParameterObject {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_tuple("ParameterObject").field(&self.0).finish()
     }
 }
 
-impl From<UniquePtr<ffi::ParameterObject>> for ParameterObject {
-    fn from(pobj: UniquePtr<ffi::ParameterObject>) -> Self {
-        let map = ffi::GetParams(&pobj);
-        Self(
-            (0usize..map.size())
-                .map(|i| {
-                    let pair = ffi::GetParamAt(&map, i);
-                    (pair.hash, pair.param.into())
-                })
-                .collect::<IndexMap<u32, Parameter>>(),
-        )
+impl PartialEq for ParameterObject {
+    fn eq(&self, other: &Self) -> bool {
+        self.1 == other.1
+            && self.0.len() == other.0.len()
+            && self.0.iter().zip(other.0.iter()).all(|(e, e2)| e == e2)
     }
 }
 
 impl ParameterObject {
     /// Create an empty ParameterObject
     pub fn new() -> Self {
-        Self(IndexMap::new())
+        Self::default()
     }
 
     /// Attempt to get a `Parameter` by name, returns None if not found
     pub fn param(&self, name: &str) -> Option<&Parameter> {
-        self.0.get(&checksum_ieee(name.as_bytes()))
+        self.0.get(&hash_name(name))
+    }
+
+    /// Attempt to get a `Parameter` by name hash, e.g. one computed at compile time with
+    /// [`names::hash_name`], returns None if not found
+    pub fn param_by_hash(&self, hash: u32) -> Option<&Parameter> {
+        self.0.get(&hash)
     }
 
     /// Set a parameter value
     pub fn set_param(&mut self, name: &str, value: Parameter) {
-        self.0.insert(checksum_ieee(name.as_bytes()), value);
+        self.params_mut().insert(hash_name(name), value);
     }
     /// Expose reference to underlying IndexMap
     pub fn params(&self) -> &IndexMap<u32, Parameter> {
@@ -365,6 +262,7 @@ impl ParameterObject {
 
     /// Expose mutable reference to underlying IndexMap
     pub fn params_mut(&mut self) -> &mut IndexMap<u32, Parameter> {
+        self.1.invalidate();
         &mut self.0
     }
 
@@ -372,14 +270,6 @@ impl ParameterObject {
     pub fn len(&self) -> usize {
         self.0.len()
     }
-
-    pub(crate) fn hash_at(&self, i: usize) -> u32 {
-        *self.0.keys().nth(i).unwrap()
-    }
-
-    pub(crate) fn val_at(&self, i: usize) -> &Parameter {
-        self.0.values().nth(i).unwrap()
-    }
 }
 
 /// A trait representing any kind of parameter list, which can be used
@@ -395,55 +285,55 @@ pub trait ParamList {
     fn objects_mut(&mut self) -> &mut IndexMap<u32, ParameterObject>;
     /// Get a child parameter list by name
     fn list(&self, name: &str) -> Option<&ParameterList> {
-        self.lists().get(&checksum_ieee(name.as_bytes()))
+        self.lists().get(&hash_name(name))
     }
     /// Get a child parameter object by name
     fn object(&self, name: &str) -> Option<&ParameterObject> {
-        self.objects().get(&checksum_ieee(name.as_bytes()))
+        self.objects().get(&hash_name(name))
+    }
+    /// Get a child parameter list by name hash
+    fn list_by_hash(&self, hash: u32) -> Option<&ParameterList> {
+        self.lists().get(&hash)
+    }
+    /// Get a child parameter object by name hash
+    fn object_by_hash(&self, hash: u32) -> Option<&ParameterObject> {
+        self.objects().get(&hash)
     }
     /// Set a child parameter list by name
     fn set_list(&mut self, name: &str, plist: ParameterList) {
         self.lists_mut()
-            .insert(checksum_ieee(name.as_bytes()), plist);
+            .insert(hash_name(name), plist);
     }
     /// Set a child parameter object by name
     fn set_object(&mut self, name: &str, pobj: ParameterObject) {
         self.objects_mut()
-            .insert(checksum_ieee(name.as_bytes()), pobj);
+            .insert(hash_name(name), pobj);
     }
 }
 
 /// Represents a parameter list consisting of child parameter lists
 /// and parameter objects
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Clone, Default, PartialEq)]
 pub struct ParameterList {
+    // Compared first, so lists with different known hashes are unequal without a deep compare
+    hash: HashCache,
     lists: IndexMap<u32, ParameterList>,
     objects: IndexMap<u32, ParameterObject>,
 }
 
-impl From<UniquePtr<ffi::ParameterList>> for ParameterList {
-    fn from(plist: UniquePtr<ffi::ParameterList>) -> Self {
-        let list_map = ffi::GetParamLists(&plist);
-        let lists = (0usize..list_map.size())
-            .map(|i| {
-                let pair = ffi::GetParamListAt(&list_map, i);
-                (pair.hash, pair.param.into())
-            })
-            .collect::<IndexMap<u32, ParameterList>>();
-        let obj_map = ffi::GetParamObjs(&plist);
-        let objects = (0usize..obj_map.size())
-            .map(|i| {
-                let pair = ffi::GetParamObjAt(&obj_map, i);
-                (pair.hash, pair.param.into())
-            })
-            .collect::<IndexMap<u32, ParameterObject>>();
-        Self { lists, objects }
+impl std::fmt::Debug for ParameterList {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ParameterList")
+            .field("lists", &self.lists)
+            .field("objects", &self.objects)
+            .finish()
     }
 }
 
 impl From<ParameterIO> for ParameterList {
     fn from(pio: ParameterIO) -> Self {
         Self {
+            hash: pio.hash,
             lists: pio.lists,
             objects: pio.objects,
         }
@@ -460,10 +350,12 @@ impl ParamList for ParameterList {
     }
 
     fn lists_mut(&mut self) -> &mut IndexMap<u32, ParameterList> {
+        self.hash.invalidate();
         &mut self.lists
     }
 
     fn objects_mut(&mut self) -> &mut IndexMap<u32, ParameterObject> {
+        self.hash.invalidate();
         &mut self.objects
     }
 }
@@ -471,74 +363,33 @@ impl ParamList for ParameterList {
 impl ParameterList {
     /// Create an empty ParameterIO
     pub fn new() -> Self {
-        ParameterList {
-            lists: IndexMap::new(),
-            objects: IndexMap::new(),
-        }
-    }
-
-    pub(crate) fn list_count(&self) -> usize {
-        self.lists.len()
-    }
-
-    pub(crate) fn object_count(&self) -> usize {
-        self.objects.len()
-    }
-
-    pub(crate) fn list_hash_at(&self, i: usize) -> u32 {
-        *self.lists.keys().nth(i).unwrap()
-    }
-
-    pub(crate) fn obj_hash_at(&self, i: usize) -> u32 {
-        *self.objects.keys().nth(i).unwrap()
-    }
-
-    pub(crate) fn list_at(&self, i: usize) -> &ParameterList {
-        self.lists.values().nth(i).unwrap()
-    }
-
-    pub(crate) fn obj_at(&self, i: usize) -> &ParameterObject {
-        self.objects.values().nth(i).unwrap()
+        Self::default()
     }
 }
 
 /// Represents a parameter IO document. This is the root parameter list and
 /// the only structure that can be serialized to or deserialized from a binary
 /// parameter archive.
-#[derive(Debug, Clone, PartialEq)]
+#[derive(Clone, PartialEq)]
 pub struct ParameterIO {
     /// Data version (not the AAMP format version). Typically 0.
     pub version: u32,
     /// Data type identifier. Typically “xml”.
     pub doc_type: String,
+    // Covers the root list only, since the fields above are public
+    hash: HashCache,
     lists: IndexMap<u32, ParameterList>,
     objects: IndexMap<u32, ParameterObject>,
 }
 
-impl From<UniquePtr<ffi::ParameterIO>> for ParameterIO {
-    fn from(pio: UniquePtr<ffi::ParameterIO>) -> Self {
-        let version = ffi::GetPioVersion(&pio);
-        let r#type = ffi::GetPioType(&pio);
-        let list_map = ffi::GetParamListsFromPio(&pio);
-        let lists = (0usize..list_map.size())
-            .map(|i| {
-                let pair = ffi::GetParamListAt(&list_map, i);
-                (pair.hash, pair.param.into())
-            })
-            .collect::<IndexMap<u32, ParameterList>>();
-        let obj_map = ffi::GetParamObjsFromPio(&pio);
-        let objects = (0usize..obj_map.size())
-            .map(|i| {
-                let pair = ffi::GetParamObjAt(&obj_map, i);
-                (pair.hash, pair.param.into())
-            })
-            .collect::<IndexMap<u32, ParameterObject>>();
-        Self {
-            version,
-            doc_type: r#type,
-            lists,
-            objects,
-        }
+impl std::fmt::Debug for ParameterIO {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ParameterIO")
+            .field("version", &self.version)
+            .field("doc_type", &self.doc_type)
+            .field("lists", &self.lists)
+            .field("objects", &self.objects)
+            .finish()
     }
 }
 
@@ -547,6 +398,7 @@ impl From<ParameterList> for ParameterIO {
         Self {
             doc_type: "xml".to_owned(),
             version: 0,
+            hash: plist.hash,
             lists: plist.lists,
             objects: plist.objects,
         }
@@ -563,10 +415,12 @@ impl ParamList for ParameterIO {
     }
 
     fn lists_mut(&mut self) -> &mut IndexMap<u32, ParameterList> {
+        self.hash.invalidate();
         &mut self.lists
     }
 
     fn objects_mut(&mut self) -> &mut IndexMap<u32, ParameterObject> {
+        self.hash.invalidate();
         &mut self.objects
     }
 }
@@ -574,70 +428,62 @@ impl ParamList for ParameterIO {
 impl ParameterIO {
     /// Create an empty ParameterIO
     pub fn new() -> Self {
-        ParameterIO {
-            doc_type: "xml".to_owned(),
-            version: 0,
-            lists: IndexMap::new(),
-            objects: IndexMap::new(),
-        }
+        ParameterList::new().into()
     }
 
     /// Load a ParameterIO from a binary parameter archive.
     pub fn from_binary<B: AsRef<[u8]>>(data: B) -> Result<ParameterIO> {
         let data = data.as_ref();
-        if &data[0..4] != b"AAMP" {
-            return Err(AampError::MagicError(
-                String::from_utf8_lossy(&data[0..4]).to_string(),
-            ));
-        }
-        Ok(ffi::AampFromBinary(data.as_ref())?.into())
+        let _span = stats::span(Format::Aamp, Phase::Parse, data.len());
+        ParameterIOView::new(data)?.to_pio()
+    }
+
+    /// Load a ParameterIO from a binary parameter archive through the process-wide
+    /// [`ParseCache`], so byte-identical data is only parsed once while it stays cached.
+    /// See the [`cache`](crate::cache) module.
+    ///
+    /// [`ParseCache`]: crate::cache::ParseCache
+    pub fn from_binary_cached(data: &[u8]) -> Result<Arc<ParameterIO>> {
+        crate::cache::ParseCache::global().get_or_parse(data)
     }
 
     /// Load a ParameterIO from a YAML representation.
     pub fn from_text<S: AsRef<str>>(text: S) -> Result<ParameterIO> {
-        Ok(ffi::AampFromText(text.as_ref())?.into())
+        let text = text.as_ref();
+        let _span = stats::span(Format::Aamp, Phase::Parse, text.len());
+        text::from_text(text)
     }
 
     /// Serialize the ParameterIO to a YAML representation.
     pub fn to_text(&self) -> String {
-        ffi::AampToText(&self)
-    }
-
-    /// Serialize the ParameterIO to a binary parameter archive.
-    pub fn to_binary(&self) -> Vec<u8> {
-        ffi::AampToBinary(&self)
-    }
-
-    pub(crate) fn list_count(&self) -> usize {
-        self.lists.len()
-    }
-
-    pub(crate) fn object_count(&self) -> usize {
-        self.objects.len()
-    }
-
-    pub(crate) fn list_hash_at(&self, i: usize) -> u32 {
-        *self.lists.keys().nth(i).unwrap()
-    }
-
-    pub(crate) fn obj_hash_at(&self, i: usize) -> u32 {
-        *self.objects.keys().nth(i).unwrap()
-    }
-
-    pub(crate) fn list_at(&self, i: usize) -> &ParameterList {
-        self.lists.values().nth(i).unwrap()
-    }
-
-    pub(crate) fn obj_at(&self, i: usize) -> &ParameterObject {
-        self.objects.values().nth(i).unwrap()
-    }
-
-    pub(crate) fn pio_type(&self) -> &str {
-        self.doc_type.as_str()
-    }
-
-    pub(crate) fn version(&self) -> u32 {
-        self.version
+        let mut span = stats::span(Format::Aamp, Phase::Serialize, 0);
+        let text = text::to_text(self);
+        span.set_bytes(text.len());
+        text
+    }
+
+    /// Serialize the ParameterIO to a binary parameter archive. This fails
+    /// with a `DataError` if the document does not fit the format, e.g. an
+    /// object with more than 65535 parameters or an archive over 4 GiB.
+    pub fn to_binary(&self) -> Result<Vec<u8>> {
+        let mut span = stats::span(Format::Aamp, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self).map_err(AampError::DataError)?;
+        span.set_bytes(layout.size());
+        let mut buf = Vec::with_capacity(layout.size());
+        layout.write(&mut buf).unwrap();
+        Ok(buf)
+    }
+
+    /// Serialize the ParameterIO as a binary parameter archive into any
+    /// writer. The tables and data sections are laid out in memory first and
+    /// then written in order, so no single buffer for the whole archive is
+    /// allocated.
+    pub fn write_binary<W: std::io::Write>(&self, mut writer: W) -> std::io::Result<()> {
+        let mut span = stats::span(Format::Aamp, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self)
+            .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))?;
+        span.set_bytes(layout.size());
+        layout.write(&mut writer)
     }
 }
 
@@ -712,9 +558,31 @@ mod tests {
         {
             let data = std::fs::read(&file).unwrap();
             let pio = ParameterIO::from_binary(&data).unwrap();
-            let text = pio.to_binary();
+            let text = pio.to_binary().unwrap();
             let pio2 = ParameterIO::from_binary(&text).unwrap();
             assert_eq!(pio, pio2);
         }
     }
+
+    #[test]
+    fn aamp_binary_matches_oead() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let pio = ParameterIO::from_binary(&data).unwrap();
+        assert_eq!(pio.to_binary().unwrap(), data);
+        let mut buf = Vec::new();
+        pio.write_binary(&mut buf).unwrap();
+        assert_eq!(buf, data);
+    }
+
+    #[test]
+    fn too_many_params() {
+        let mut pio = ParameterIO::new();
+        let mut obj = super::ParameterObject::new();
+        for hash in 0..=u16::MAX as u32 + 1 {
+            obj.params_mut().insert(hash, Parameter::Bool(true));
+        }
+        pio.objects_mut().insert(0, obj);
+        assert!(pio.write_binary(std::io::sink()).is_err());
+        assert!(pio.to_binary().is_err());
+    }
 }
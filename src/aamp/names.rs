@@ -0,0 +1,275 @@
+//! Name hashing and the dictionary of names for the hashes used as keys in
+//! parameter archives.
+//!
+//! Keys are CRC32 hashes of names. [`hash_name`] is a `const fn`, so names
+//! that are known ahead of time can be hashed at compile time and looked up
+//! with the `_by_hash` accessors:
+//! ```
+//! # use roead::aamp::{names::hash_name, ParameterObject};
+//! const SHAPE_NUM: u32 = hash_name("ShapeNum");
+//! # let obj = ParameterObject::new();
+//! let shape_num = obj.param_by_hash(SHAPE_NUM);
+//! ```
+//!
+//! Binary archives only store the hashes, so the text format can only show a
+//! name that is in the dictionary. The dictionary starts with the name lists
+//! that oead ships: the known names of the game's archives, and numbered
+//! names like `Action_3`, which are also guessed from the name of their
+//! parent, the same way oead does. More names can be added with [`add_name`]
+//! and [`add_names`]. Names are never learned from the documents that are
+//! parsed, so the text form of a document does not depend on what else the
+//! process has read. Names that are not known and cannot be guessed are
+//! written as plain hashes.
+use once_cell::sync::Lazy;
+use std::{collections::HashMap, fmt::Write, sync::RwLock};
+
+/// oead's list of the names used in the game's parameter archives, one per
+/// line.
+static HASHED_NAMES: &str = include_str!("../../include/oead/data/botw_hashed_names.txt");
+/// oead's list of printf-style formats for numbered names, e.g. `Action_%d`.
+static NUMBERED_NAMES: &str = include_str!("../../include/oead/data/botw_numbered_names.txt");
+
+/// Lookup tables for slicing-by-8 CRC32 (IEEE, reflected). `TABLES[0]` is the
+/// classic byte-at-a-time table; `TABLES[n]` advances a byte by `n` more
+/// bytes of zeroes.
+const TABLES: [[u32; 256]; 8] = make_tables();
+
+const fn make_tables() -> [[u32; 256]; 8] {
+    let mut tables = [[0u32; 256]; 8];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut bit = 0;
+        while bit < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ 0xedb8_8320
+            } else {
+                crc >> 1
+            };
+            bit += 1;
+        }
+        tables[0][i] = crc;
+        i += 1;
+    }
+    let mut i = 0;
+    while i < 256 {
+        let mut n = 1;
+        while n < 8 {
+            let prev = tables[n - 1][i];
+            tables[n][i] = (prev >> 8) ^ tables[0][(prev & 0xff) as usize];
+            n += 1;
+        }
+        i += 1;
+    }
+    tables
+}
+
+/// Hash a name the way parameter archives do (CRC32). This can be evaluated
+/// at compile time; at run time it reads eight bytes per step.
+pub const fn hash_name(name: &str) -> u32 {
+    let bytes = name.as_bytes();
+    let mut crc = !0u32;
+    let mut i = 0;
+    while i + 8 <= bytes.len() {
+        let lo = crc ^ u32::from_le_bytes([bytes[i], bytes[i + 1], bytes[i + 2], bytes[i + 3]]);
+        let hi = u32::from_le_bytes([bytes[i + 4], bytes[i + 5], bytes[i + 6], bytes[i + 7]]);
+        crc = TABLES[7][(lo & 0xff) as usize]
+            ^ TABLES[6][(lo >> 8 & 0xff) as usize]
+            ^ TABLES[5][(lo >> 16 & 0xff) as usize]
+            ^ TABLES[4][(lo >> 24) as usize]
+            ^ TABLES[3][(hi & 0xff) as usize]
+            ^ TABLES[2][(hi >> 8 & 0xff) as usize]
+            ^ TABLES[1][(hi >> 16 & 0xff) as usize]
+            ^ TABLES[0][(hi >> 24) as usize];
+        i += 8;
+    }
+    while i < bytes.len() {
+        crc = (crc >> 8) ^ TABLES[0][((crc ^ bytes[i] as u32) & 0xff) as usize];
+        i += 1;
+    }
+    !crc
+}
+
+static DEFAULT_NAMES: Lazy<HashMap<u32, &'static str>> = Lazy::new(|| {
+    HASHED_NAMES
+        .lines()
+        .chain(std::iter::once("param_root"))
+        .filter(|name| !name.is_empty())
+        .map(|name| (hash_name(name), name))
+        .collect()
+});
+
+/// A numbered name format, split around its number.
+struct NumberedName {
+    prefix: &'static str,
+    /// The width the number is zero-padded to.
+    width: usize,
+    suffix: &'static str,
+}
+
+/// The numbered name formats that use a `%d` or `%0Nd` number.
+static NUMBERED: Lazy<Vec<NumberedName>> = Lazy::new(|| {
+    NUMBERED_NAMES
+        .lines()
+        .filter_map(|format| {
+            let (prefix, spec) = format.split_once('%')?;
+            let end = spec.find(|c: char| !c.is_ascii_digit())?;
+            if !spec[end..].starts_with('d') || (end > 0 && !spec.starts_with('0')) {
+                return None;
+            }
+            Some(NumberedName {
+                prefix,
+                width: spec[..end].parse().unwrap_or(0),
+                suffix: &spec[end + 1..],
+            })
+        })
+        .collect()
+});
+
+/// Names added at run time.
+static NAMES: Lazy<RwLock<HashMap<u32, String>>> = Lazy::new(Default::default);
+
+/// Add a name to the dictionary used for text output and return its hash.
+pub fn add_name(name: &str) -> u32 {
+    let hash = hash_name(name);
+    if !DEFAULT_NAMES.contains_key(&hash) && !NAMES.read().unwrap().contains_key(&hash) {
+        NAMES.write().unwrap().insert(hash, name.to_owned());
+    }
+    hash
+}
+
+/// Add many names to the dictionary used for text output at once, e.g. from
+/// a name list shipped with a tool.
+pub fn add_names<I, S>(names: I)
+where
+    I: IntoIterator<Item = S>,
+    S: AsRef<str>,
+{
+    let mut table = NAMES.write().unwrap();
+    for name in names {
+        let name = name.as_ref();
+        let hash = hash_name(name);
+        if !DEFAULT_NAMES.contains_key(&hash) {
+            table.entry(hash).or_insert_with(|| name.to_owned());
+        }
+    }
+}
+
+/// Look up the name of a hash in the dictionary.
+pub fn get_name(hash: u32) -> Option<String> {
+    match DEFAULT_NAMES.get(&hash) {
+        Some(name) => Some((*name).to_owned()),
+        None => NAMES.read().unwrap().get(&hash).cloned(),
+    }
+}
+
+/// Look up the name of a hash, or guess it from the name of its parent and
+/// its index in the parent, then from the numbered names. Guesses are not
+/// added to the dictionary, so the result only depends on the arguments and
+/// the names that were added explicitly.
+pub(crate) fn find_name(hash: u32, index: usize, parent: Option<&str>) -> Option<String> {
+    get_name(hash)
+        .or_else(|| parent.and_then(|parent| guess_name(hash, index, parent)))
+        .or_else(|| numbered_name(hash, index))
+}
+
+fn numbered_name(hash: u32, index: usize) -> Option<String> {
+    let mut name = String::new();
+    for i in 0..index + 2 {
+        for format in NUMBERED.iter() {
+            name.clear();
+            write!(
+                name,
+                "{}{:0width$}{}",
+                format.prefix,
+                i,
+                format.suffix,
+                width = format.width
+            )
+            .unwrap();
+            if hash_name(&name) == hash {
+                return Some(name);
+            }
+        }
+    }
+    None
+}
+
+fn guess_name(hash: u32, index: usize, parent: &str) -> Option<String> {
+    let test_prefix = |prefix: &str| {
+        (index..=index + 1).find_map(|i| {
+            [
+                format!("{}{}", prefix, i),
+                format!("{}_{}", prefix, i),
+                format!("{}{:02}", prefix, i),
+                format!("{}_{:02}", prefix, i),
+                format!("{}{:03}", prefix, i),
+                format!("{}_{:03}", prefix, i),
+            ]
+            .iter()
+            .find(|name| hash_name(name) == hash)
+            .cloned()
+        })
+    };
+    test_prefix(parent)
+        .or_else(|| {
+            if parent == "Children" {
+                test_prefix("Child")
+            } else {
+                None
+            }
+        })
+        // Lists are often plural and their children singular.
+        .or_else(|| {
+            ["s", "es", "List"]
+                .iter()
+                .filter_map(|suffix| parent.strip_suffix(suffix))
+                .find_map(|prefix| test_prefix(prefix))
+        })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crc::crc32::checksum_ieee;
+
+    #[test]
+    fn hash_names() {
+        const PARAM_ROOT: u32 = hash_name("param_root");
+        assert_eq!(PARAM_ROOT, 0xa4f6_cb6c);
+        for name in [
+            "",
+            "a",
+            "ShapeNum",
+            "AnimeDrivenSettings",
+            "オフ",
+            "Action_3",
+        ]
+        .iter()
+        {
+            assert_eq!(hash_name(name), checksum_ieee(name.as_bytes()), "{}", name);
+        }
+        add_names(["ShapeNum", "ParamSet"].iter());
+        assert_eq!(get_name(hash_name("ParamSet")).as_deref(), Some("ParamSet"));
+    }
+
+    #[test]
+    fn guess_names() {
+        let hash = hash_name("RoeadTest_3");
+        assert_eq!(
+            find_name(hash, 3, Some("RoeadTests")).as_deref(),
+            Some("RoeadTest_3")
+        );
+        // Guesses are not remembered
+        assert_eq!(find_name(hash, 0, None), None);
+        assert_eq!(
+            find_name(hash_name("Child02"), 1, Some("Children")).as_deref(),
+            Some("Child02")
+        );
+        assert_eq!(find_name(hash_name("RoeadUnknown"), 0, Some("Roead")), None);
+        assert_eq!(
+            get_name(hash_name("param_root")).as_deref(),
+            Some("param_root")
+        );
+    }
+}
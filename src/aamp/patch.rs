@@ -0,0 +1,285 @@
+//! Editing binary parameter archives without decoding them.
+//!
+//! A [`ParameterIOPatch`] records new values for parameters by path. When
+//! every edited parameter already exists, the archive is patched in place:
+//! the new values are appended to the data and string sections, the edited
+//! entries are repointed to them, and the offsets of the string parameters
+//! are shifted past the grown data section. Nothing else is decoded or
+//! written again. The old values are left unreferenced in the output, so it
+//! is slightly larger than a fully written archive.
+//!
+//! Edits that change the structure of the archive, by adding parameters,
+//! objects or lists, need new table entries in the middle of the tables, so
+//! for those the archive is decoded into a `ParameterIO`, edited and written
+//! in full instead.
+use super::{
+    writer::{self, Location, Section, HEADER_SIZE, LIST_SIZE, OBJECT_SIZE, PARAM_SIZE},
+    AampError, ParamList, Parameter, ParameterIO, ParameterIOView, Result,
+};
+use crate::ffi::ParamType;
+use indexmap::IndexMap;
+use std::convert::TryInto;
+
+/// A set of new parameter values for a binary parameter archive, applied
+/// without decoding the archive if the parameters exist. See the module
+/// documentation for how the output is laid out.
+///
+/// Parameters are addressed by the name hashes of the lists down from the
+/// root, then of the object and of the parameter, the same paths that
+/// [`ParameterIO::diff`] returns.
+/// ```
+/// # use roead::aamp::{names::hash_name, Parameter, ParameterIOPatch};
+/// # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+/// let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+/// let mut patch = ParameterIOPatch::new(&data)?;
+/// patch.set_param(
+///     &[hash_name("DemoAIActionIdx"), hash_name("Demo_Idling")],
+///     Parameter::Int(3),
+/// )?;
+/// let patched = patch.to_binary()?;
+/// # Ok(())
+/// # }
+/// ```
+#[derive(Debug)]
+pub struct ParameterIOPatch<'a> {
+    data: &'a [u8],
+    edits: IndexMap<Vec<u32>, Parameter>,
+}
+
+impl<'a> ParameterIOPatch<'a> {
+    /// Start an empty patch of a binary parameter archive. Only the header
+    /// is read.
+    pub fn new(data: &'a [u8]) -> Result<ParameterIOPatch<'a>> {
+        ParameterIOView::new(data)?;
+        Ok(ParameterIOPatch {
+            data,
+            edits: IndexMap::new(),
+        })
+    }
+
+    /// Check if the patch has no edits.
+    pub fn is_empty(&self) -> bool {
+        self.edits.is_empty()
+    }
+
+    /// Set the value of a parameter, adding it and any missing parents if
+    /// needed. The path must at least name an object and a parameter.
+    pub fn set_param(&mut self, path: &[u32], value: Parameter) -> Result<()> {
+        if path.len() < 2 {
+            return Err(AampError::PatchError(
+                "a parameter path needs an object and a parameter".to_owned(),
+            ));
+        }
+        self.edits.insert(path.to_vec(), value);
+        Ok(())
+    }
+
+    /// Write the patched archive.
+    pub fn to_binary(&self) -> Result<Vec<u8>> {
+        if self.edits.is_empty() {
+            return Ok(self.data.to_vec());
+        }
+        match self.patch_in_place()? {
+            Some(data) => Ok(data),
+            None => self.rewrite(),
+        }
+    }
+
+    fn u32(&self, offset: usize) -> u32 {
+        u32::from_le_bytes(self.data[offset..offset + 4].try_into().unwrap())
+    }
+
+    /// Patch the archive if every edited parameter exists and the layout is
+    /// the usual one, with the data and string sections after the tables.
+    fn patch_in_place(&self) -> Result<Option<Vec<u8>>> {
+        let view = ParameterIOView::new(self.data)?;
+        let tables_end = HEADER_SIZE
+            + self.u32(0x14) as usize
+            + LIST_SIZE * self.u32(0x18) as usize
+            + OBJECT_SIZE * self.u32(0x1C) as usize
+            + PARAM_SIZE * self.u32(0x20) as usize;
+        let (data_size, string_size) = (self.u32(0x24) as usize, self.u32(0x28) as usize);
+        let string_section = tables_end + data_size;
+        if string_section + string_size != self.data.len() {
+            return Ok(None);
+        }
+
+        let mut targets = Vec::with_capacity(self.edits.len());
+        for (path, value) in &self.edits {
+            let (param, path) = path.split_last().unwrap();
+            let (obj, lists) = path.split_last().unwrap();
+            let mut list = view.root();
+            for hash in lists {
+                list = match list.list_by_hash(*hash)? {
+                    Some(list) => list,
+                    None => return Ok(None),
+                };
+            }
+            let entry = match list.object_by_hash(*obj)? {
+                Some(obj) => obj.param_entry(*param)?,
+                None => None,
+            };
+            match entry {
+                Some(entry) => targets.push((entry, value)),
+                None => return Ok(None),
+            }
+        }
+
+        let (mut data, mut strings, mut scratch) =
+            (Section::default(), Section::default(), Vec::new());
+        let locations: Vec<_> = targets
+            .iter()
+            .map(|(entry, value)| {
+                let location = writer::write_value(value, &mut data, &mut strings, &mut scratch);
+                (*entry, value.get_ffi_type().repr, location)
+            })
+            .collect();
+        let growth = data.buf.len();
+        let mut out = Vec::with_capacity(self.data.len() + growth + strings.buf.len());
+        out.extend_from_slice(&self.data[..string_section]);
+        out.extend_from_slice(&data.buf);
+        out.extend_from_slice(&self.data[string_section..]);
+        out.extend_from_slice(&strings.buf);
+
+        let set_entry = |out: &mut Vec<u8>, entry: usize, value: usize, ty: u8| {
+            let rel = (value - entry) / 4;
+            if rel >= 1 << 24 {
+                return false;
+            }
+            out[entry + 4..entry + 8]
+                .copy_from_slice(&(rel as u32 | (ty as u32) << 24).to_le_bytes());
+            true
+        };
+        let mut entries = Vec::new();
+        view.root().param_entries(&mut entries)?;
+        entries.sort_unstable();
+        entries.dedup();
+        for entry in entries {
+            let [a, b, c, ty] = self.data[entry + 4..entry + 8].try_into().unwrap();
+            let is_string = matches!(
+                ParamType { repr: ty },
+                ParamType::String32
+                    | ParamType::String64
+                    | ParamType::String256
+                    | ParamType::StringRef
+            );
+            let value = entry + 4 * u32::from_le_bytes([a, b, c, 0]) as usize;
+            if is_string
+                && value >= string_section
+                && !set_entry(&mut out, entry, value + growth, ty)
+            {
+                return Ok(None);
+            }
+        }
+        for (entry, ty, location) in locations {
+            let value = match location {
+                Location::Data(offset) => string_section + offset as usize,
+                Location::String(offset) => self.data.len() + growth + offset as usize,
+            };
+            if !set_entry(&mut out, entry, value, ty) {
+                return Ok(None);
+            }
+        }
+
+        for (field, value) in [
+            (0x0C, out.len()),
+            (0x24, data_size + growth),
+            (0x28, string_size + strings.buf.len()),
+        ] {
+            out[field..field + 4].copy_from_slice(&(value as u32).to_le_bytes());
+        }
+        Ok(Some(out))
+    }
+
+    /// Decode, edit and write the whole archive.
+    fn rewrite(&self) -> Result<Vec<u8>> {
+        fn set<L: ParamList>(list: &mut L, path: &[u32], value: &Parameter) {
+            match path {
+                [obj, param] => {
+                    let obj = list.objects_mut().entry(*obj).or_default();
+                    obj.params_mut().insert(*param, value.clone());
+                }
+                [child, rest @ ..] => set(list.lists_mut().entry(*child).or_default(), rest, value),
+                _ => unreachable!(),
+            }
+        }
+        let mut pio = ParameterIO::from_binary(self.data)?;
+        for (path, value) in &self.edits {
+            set(&mut pio, path, value);
+        }
+        let layout = writer::Layout::new(&pio).map_err(AampError::DataError)?;
+        let mut buf = Vec::with_capacity(layout.size());
+        layout.write(&mut buf).unwrap();
+        Ok(buf)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::ParameterIOPatch;
+    use crate::aamp::{names::hash_name, ParamList, Parameter, ParameterIO, ParameterList};
+    use std::convert::TryInto;
+
+    #[test]
+    fn patch_in_place() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let mut expected = ParameterIO::from_binary(&data).unwrap();
+        let mut patch = ParameterIOPatch::new(&data).unwrap();
+        assert_eq!(patch.to_binary().unwrap(), data);
+
+        // Existing parameters, both in the data and the string section
+        fn edit<L: ParamList>(
+            list: &mut L,
+            path: &mut Vec<u32>,
+            out: &mut Vec<(Vec<u32>, Parameter)>,
+        ) {
+            for (hash, child) in list.lists_mut().iter_mut() {
+                path.push(*hash);
+                edit(child, path, out);
+                path.pop();
+            }
+            for (obj_hash, obj) in list.objects_mut().iter_mut() {
+                for (param_hash, value) in obj.params_mut().iter_mut() {
+                    let new = match value {
+                        Parameter::Int(v) => Parameter::Int(*v + 1),
+                        Parameter::StringRef(v) => Parameter::StringRef(format!("{}_Patched", v)),
+                        _ => continue,
+                    };
+                    *value = new.clone();
+                    let mut path = path.clone();
+                    path.extend([*obj_hash, *param_hash]);
+                    out.push((path, new));
+                }
+            }
+        }
+        let mut edited = Vec::new();
+        edit(&mut expected, &mut Vec::new(), &mut edited);
+        assert!(edited
+            .iter()
+            .any(|(_, value)| matches!(value, Parameter::StringRef(_))));
+        for (path, value) in edited {
+            patch.set_param(&path, value).unwrap();
+        }
+        let patched = patch.to_binary().unwrap();
+        assert_eq!(ParameterIO::from_binary(&patched).unwrap(), expected);
+        // The list and object tables were copied rather than written again
+        let size = |field: usize| u32::from_le_bytes(data[field..field + 4].try_into().unwrap());
+        let params = data.len() - (size(0x24) + size(0x28) + 8 * size(0x20)) as usize;
+        assert_eq!(&patched[0x10..0x24], &data[0x10..0x24]);
+        assert_eq!(&patched[0x30..params], &data[0x30..params]);
+
+        // New parameters and parents fall back to a full rewrite
+        let (list, obj, param) = (hash_name("NewList"), hash_name("NewObj"), hash_name("New"));
+        patch
+            .set_param(&[list, obj, param], Parameter::F32(1.5))
+            .unwrap();
+        let mut new_list = ParameterList::new();
+        new_list.set_object("NewObj", Default::default());
+        new_list.objects_mut()[&obj].set_param("New", Parameter::F32(1.5));
+        expected.lists_mut().insert(list, new_list);
+        let patched = patch.to_binary().unwrap();
+        assert_eq!(ParameterIO::from_binary(&patched).unwrap(), expected);
+
+        assert!(patch.set_param(&[obj], Parameter::Bool(true)).is_err());
+    }
+}
@@ -0,0 +1,879 @@
+//! Zero-copy access to binary parameter archives.
+//!
+//! A `ParameterIOView` borrows the original binary data and walks the list,
+//! object and parameter tables in place. String parameters and buffers are
+//! returned as slices of the input wherever the data layout allows it, so
+//! scanning large numbers of archives does not require building a full
+//! `ParameterIO` for each one. The `visit` methods go further and walk
+//! every parameter of one type, skipping the others without decoding them.
+//! ```
+//! # use roead::aamp::{ParameterIOView, ParameterRef};
+//! # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+//! let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+//! let pio = ParameterIOView::new(&data)?;
+//! if let Some(demo_obj) = pio.root().object("DemoAIActionIdx")? {
+//!     for param in demo_obj.params()? {
+//!         let (hash, value): (u32, ParameterRef) = param?;
+//!         // Do stuff with parameters
+//!     }
+//! }
+//! # Ok(())
+//! # }
+//! ```
+use super::names::hash_name;
+use super::{AampError, Parameter, ParameterIO, ParameterList, ParameterObject, Result};
+use crate::{
+    ffi::{Color, Curve, ParamType, Quat, Vector2f, Vector3f, Vector4f},
+    stats::{self, Format, Phase},
+};
+use indexmap::IndexMap;
+use std::borrow::Cow;
+use std::convert::TryInto;
+
+const HEADER_SIZE: usize = 0x30;
+const LIST_SIZE: usize = 12;
+const OBJECT_SIZE: usize = 8;
+const PARAM_SIZE: usize = 8;
+const CURVE_SIZE: usize = 0x80;
+/// How deeply parameter lists may nest. Child offsets can only point forward,
+/// but a malformed archive can still chain enough lists to overflow the stack
+/// of anything that walks them recursively.
+const MAX_DEPTH: usize = 256;
+
+const FLAG_LITTLE_ENDIAN: u32 = 1 << 0;
+const FLAG_UTF8: u32 = 1 << 1;
+
+/// A 4-byte plain-old-data type that buffer parameters are made of.
+trait Word: Copy {
+    fn from_le_bytes(bytes: [u8; 4]) -> Self;
+}
+
+impl Word for i32 {
+    fn from_le_bytes(bytes: [u8; 4]) -> Self {
+        i32::from_le_bytes(bytes)
+    }
+}
+
+impl Word for u32 {
+    fn from_le_bytes(bytes: [u8; 4]) -> Self {
+        u32::from_le_bytes(bytes)
+    }
+}
+
+impl Word for f32 {
+    fn from_le_bytes(bytes: [u8; 4]) -> Self {
+        f32::from_le_bytes(bytes)
+    }
+}
+
+/// The raw archive data. Only little endian archives exist, so unlike BYML
+/// there is no other state to carry around.
+#[derive(Debug, Clone, Copy)]
+struct Document<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> Document<'a> {
+    #[inline]
+    fn slice(&self, offset: usize, len: usize) -> Result<&'a [u8]> {
+        offset
+            .checked_add(len)
+            .and_then(|end| self.data.get(offset..end))
+            .ok_or(AampError::DataError("offset out of bounds"))
+    }
+
+    #[inline]
+    fn bytes<const N: usize>(&self, offset: usize) -> Result<[u8; N]> {
+        Ok(self.slice(offset, N)?.try_into().unwrap())
+    }
+
+    #[inline]
+    fn u16(&self, offset: usize) -> Result<u16> {
+        Ok(u16::from_le_bytes(self.bytes(offset)?))
+    }
+
+    #[inline]
+    fn u32(&self, offset: usize) -> Result<u32> {
+        Ok(u32::from_le_bytes(self.bytes(offset)?))
+    }
+
+    #[inline]
+    fn f32(&self, offset: usize) -> Result<f32> {
+        Ok(f32::from_le_bytes(self.bytes(offset)?))
+    }
+
+    fn f32s<const N: usize>(&self, offset: usize) -> Result<[f32; N]> {
+        let mut values = [0f32; N];
+        for (i, value) in values.iter_mut().enumerate() {
+            *value = self.f32(offset + 4 * i)?;
+        }
+        Ok(values)
+    }
+
+    fn str(&self, offset: usize) -> Result<&'a str> {
+        let bytes = self
+            .data
+            .get(offset..)
+            .ok_or(AampError::DataError("string offset out of bounds"))?;
+        let len = bytes
+            .iter()
+            .position(|b| *b == 0)
+            .ok_or(AampError::DataError("unterminated string"))?;
+        std::str::from_utf8(&bytes[..len])
+            .map_err(|_| AampError::DataError("string is not valid UTF-8"))
+    }
+
+    /// Reads a buffer whose element count is stored in the 4 bytes preceding
+    /// its data. The buffer is borrowed when the input is suitably aligned.
+    fn buffer<T: Word>(&self, offset: usize) -> Result<Cow<'a, [T]>> {
+        let count = self.u32(
+            offset
+                .checked_sub(4)
+                .ok_or(AampError::DataError("buffer offset out of bounds"))?,
+        )? as usize;
+        let bytes = self.slice(
+            offset,
+            count
+                .checked_mul(4)
+                .ok_or(AampError::DataError("buffer size out of bounds"))?,
+        )?;
+        #[cfg(target_endian = "little")]
+        {
+            if bytes.as_ptr() as usize % std::mem::align_of::<T>() == 0 {
+                // SAFETY: `Word` is only implemented for 4-byte types for which
+                // every bit pattern is valid, the pointer is aligned for `T`
+                // and `bytes` holds exactly `count` elements.
+                return Ok(Cow::Borrowed(unsafe {
+                    std::slice::from_raw_parts(bytes.as_ptr() as *const T, count)
+                }));
+            }
+        }
+        Ok(Cow::Owned(
+            bytes
+                .chunks_exact(4)
+                .map(|word| T::from_le_bytes(word.try_into().unwrap()))
+                .collect(),
+        ))
+    }
+
+    fn binary(&self, offset: usize) -> Result<&'a [u8]> {
+        let size = self.u32(
+            offset
+                .checked_sub(4)
+                .ok_or(AampError::DataError("buffer offset out of bounds"))?,
+        )? as usize;
+        self.slice(offset, size)
+    }
+
+    fn curve(&self, offset: usize) -> Result<Curve> {
+        Ok(Curve {
+            a: self.u32(offset)?,
+            b: self.u32(offset + 4)?,
+            floats: self.f32s(offset + 8)?,
+        })
+    }
+
+    fn curves<const N: usize>(&self, offset: usize) -> Result<[Curve; N]> {
+        let mut curves = [Curve::default(); N];
+        for (i, curve) in curves.iter_mut().enumerate() {
+            *curve = self.curve(offset + CURVE_SIZE * i)?;
+        }
+        Ok(curves)
+    }
+
+    /// Reads `count` curves. Like buffers, they are borrowed when the input is
+    /// suitably aligned.
+    fn curve_slice(&self, offset: usize, count: usize) -> Result<Cow<'a, [Curve]>> {
+        let bytes = self.slice(offset, CURVE_SIZE * count)?;
+        #[cfg(target_endian = "little")]
+        {
+            if std::mem::size_of::<Curve>() == CURVE_SIZE
+                && bytes.as_ptr() as usize % std::mem::align_of::<Curve>() == 0
+            {
+                // SAFETY: `Curve` is a `repr(C)` struct of 32 4-byte fields
+                // without padding for which every bit pattern is valid, the
+                // pointer is aligned and `bytes` holds exactly `count` curves.
+                return Ok(Cow::Borrowed(unsafe {
+                    std::slice::from_raw_parts(bytes.as_ptr() as *const Curve, count)
+                }));
+            }
+        }
+        (0..count)
+            .map(|i| self.curve(offset + CURVE_SIZE * i))
+            .collect()
+    }
+
+    /// Checks that a table of `count` entries of `size` bytes fits in the data.
+    fn table(&self, offset: usize, count: usize, size: usize) -> Result<()> {
+        self.slice(offset, count * size).map(|_| ())
+    }
+}
+
+/// A borrowed parameter value. Strings and buffers refer to the source data
+/// when possible; everything else is small enough to be copied out.
+#[derive(Debug, Clone, PartialEq, PartialOrd)]
+pub enum ParameterRef<'a> {
+    Bool(bool),
+    F32(f32),
+    Int(i32),
+    Vec2(Vector2f),
+    Vec3(Vector3f),
+    Vec4(Vector4f),
+    Color(Color),
+    String32(&'a str),
+    String64(&'a str),
+    Curve1([Curve; 1]),
+    Curve2([Curve; 2]),
+    Curve3([Curve; 3]),
+    Curve4([Curve; 4]),
+    BufferInt(Cow<'a, [i32]>),
+    BufferF32(Cow<'a, [f32]>),
+    String256(&'a str),
+    Quat(Quat),
+    U32(u32),
+    BufferU32(Cow<'a, [u32]>),
+    BufferBinary(&'a [u8]),
+    StringRef(&'a str),
+}
+
+impl From<ParameterRef<'_>> for Parameter {
+    fn from(param: ParameterRef<'_>) -> Self {
+        match param {
+            ParameterRef::Bool(v) => Self::Bool(v),
+            ParameterRef::F32(v) => Self::F32(v),
+            ParameterRef::Int(v) => Self::Int(v),
+            ParameterRef::Vec2(v) => Self::Vec2(v),
+            ParameterRef::Vec3(v) => Self::Vec3(v),
+            ParameterRef::Vec4(v) => Self::Vec4(v),
+            ParameterRef::Color(v) => Self::Color(v),
+            ParameterRef::String32(v) => Self::String32(v.to_owned()),
+            ParameterRef::String64(v) => Self::String64(v.to_owned()),
+            ParameterRef::Curve1(v) => Self::Curve1(v),
+            ParameterRef::Curve2(v) => Self::Curve2(v),
+            ParameterRef::Curve3(v) => Self::Curve3(v),
+            ParameterRef::Curve4(v) => Self::Curve4(v),
+            ParameterRef::BufferInt(v) => Self::BufferInt(v.into_owned()),
+            ParameterRef::BufferF32(v) => Self::BufferF32(v.into_owned()),
+            ParameterRef::String256(v) => Self::String256(v.to_owned()),
+            ParameterRef::Quat(v) => Self::Quat(v),
+            ParameterRef::U32(v) => Self::U32(v),
+            ParameterRef::BufferU32(v) => Self::BufferU32(v.into_owned()),
+            ParameterRef::BufferBinary(v) => Self::BufferBinary(v.to_vec()),
+            ParameterRef::StringRef(v) => Self::StringRef(v.to_owned()),
+        }
+    }
+}
+
+impl<'a> ParameterRef<'a> {
+    /// Borrow the value of any string parameter from the source data
+    pub fn as_str(&self) -> Result<&'a str> {
+        match self {
+            ParameterRef::String32(v)
+            | ParameterRef::String64(v)
+            | ParameterRef::String256(v)
+            | ParameterRef::StringRef(v) => Ok(v),
+            _ => Err(AampError::TypeError),
+        }
+    }
+
+    /// Borrow the curves of any curve parameter
+    pub fn as_curves(&self) -> Result<&[Curve]> {
+        match self {
+            ParameterRef::Curve1(v) => Ok(v),
+            ParameterRef::Curve2(v) => Ok(v),
+            ParameterRef::Curve3(v) => Ok(v),
+            ParameterRef::Curve4(v) => Ok(v),
+            _ => Err(AampError::TypeError),
+        }
+    }
+
+    /// Borrow the contents of an int buffer parameter
+    pub fn as_buf_int(&self) -> Result<&[i32]> {
+        if let ParameterRef::BufferInt(v) = self {
+            Ok(v)
+        } else {
+            Err(AampError::TypeError)
+        }
+    }
+
+    /// Borrow the contents of a float buffer parameter
+    pub fn as_buf_f32(&self) -> Result<&[f32]> {
+        if let ParameterRef::BufferF32(v) = self {
+            Ok(v)
+        } else {
+            Err(AampError::TypeError)
+        }
+    }
+
+    /// Borrow the contents of a u32 buffer parameter
+    pub fn as_buf_u32(&self) -> Result<&[u32]> {
+        if let ParameterRef::BufferU32(v) = self {
+            Ok(v)
+        } else {
+            Err(AampError::TypeError)
+        }
+    }
+
+    /// Borrow the contents of a binary buffer parameter from the source data
+    pub fn as_buf_binary(&self) -> Result<&'a [u8]> {
+        if let ParameterRef::BufferBinary(v) = self {
+            Ok(v)
+        } else {
+            Err(AampError::TypeError)
+        }
+    }
+}
+
+mod sealed {
+    pub trait Sealed<'a>: Sized {
+        /// Decode the value of a parameter of type `ty` stored at `offset`,
+        /// or return `None` without reading anything if parameters of that
+        /// type are not represented by `Self`.
+        fn read(data: &'a [u8], ty: u8, offset: usize) -> Option<super::Result<Self>>;
+    }
+}
+
+/// A type that parameter values can be read as by [`ParameterObjectView::visit`] and
+/// [`ParameterListView::visit`]:
+///
+/// * `bool`, `f32`, `i32`, `u32` and the vector, color and quaternion types for the parameters
+///   of the matching type;
+/// * `&str` for parameters of any string type, borrowed from the source data;
+/// * `Cow<[Curve]>` for parameters of any curve type;
+/// * `Cow<[i32]>`, `Cow<[f32]>`, `Cow<[u32]>` and `&[u8]` for buffers;
+/// * `ParameterRef` for every parameter.
+///
+/// Curves and buffers are borrowed from the source data when it is suitably aligned, which is
+/// usually the case for data read into a `Vec`, and copied otherwise.
+pub trait ParamValue<'a>: sealed::Sealed<'a> {}
+
+impl<'a, T: sealed::Sealed<'a>> ParamValue<'a> for T {}
+
+macro_rules! param_value {
+    ($ty:ty, |$doc:ident, $offset:ident| $($param_type:ident => $read:expr),+ $(,)?) => {
+        impl<'a> sealed::Sealed<'a> for $ty {
+            #[inline]
+            fn read(data: &'a [u8], ty: u8, $offset: usize) -> Option<Result<Self>> {
+                let $doc = Document { data };
+                match (ParamType { repr: ty }) {
+                    $(ParamType::$param_type => Some($read),)+
+                    _ => None,
+                }
+            }
+        }
+    };
+}
+
+param_value!(bool, |doc, offset| Bool => doc.u32(offset).map(|v| v != 0));
+param_value!(f32, |doc, offset| F32 => doc.f32(offset));
+param_value!(i32, |doc, offset| Int => doc.u32(offset).map(|v| v as i32));
+param_value!(u32, |doc, offset| U32 => doc.u32(offset));
+param_value!(Vector2f, |doc, offset| Vec2 => doc.f32s(offset).map(|[x, y]| Vector2f { x, y }));
+param_value!(Vector3f, |doc, offset| Vec3 => doc.f32s(offset).map(|[x, y, z]| Vector3f { x, y, z }));
+param_value!(Vector4f, |doc, offset| Vec4 => doc.f32s(offset).map(|[x, y, z, t]| Vector4f { x, y, z, t }));
+param_value!(Color, |doc, offset| Color => doc.f32s(offset).map(|[r, g, b, a]| Color { r, g, b, a }));
+param_value!(Quat, |doc, offset| Quat => doc.f32s(offset).map(|[a, b, c, d]| Quat { a, b, c, d }));
+param_value!(&'a str, |doc, offset|
+    String32 => doc.str(offset),
+    String64 => doc.str(offset),
+    String256 => doc.str(offset),
+    StringRef => doc.str(offset),
+);
+param_value!(Cow<'a, [Curve]>, |doc, offset|
+    Curve1 => doc.curve_slice(offset, 1),
+    Curve2 => doc.curve_slice(offset, 2),
+    Curve3 => doc.curve_slice(offset, 3),
+    Curve4 => doc.curve_slice(offset, 4),
+);
+param_value!(Cow<'a, [i32]>, |doc, offset| BufferInt => doc.buffer(offset));
+param_value!(Cow<'a, [f32]>, |doc, offset| BufferF32 => doc.buffer(offset));
+param_value!(Cow<'a, [u32]>, |doc, offset| BufferU32 => doc.buffer(offset));
+param_value!(&'a [u8], |doc, offset| BufferBinary => doc.binary(offset));
+
+impl<'a> sealed::Sealed<'a> for ParameterRef<'a> {
+    #[inline]
+    fn read(data: &'a [u8], ty: u8, offset: usize) -> Option<Result<Self>> {
+        Some(read_value(Document { data }, ty, offset))
+    }
+}
+
+/// A borrowed view of a binary parameter archive.
+#[derive(Debug, Clone, Copy)]
+pub struct ParameterIOView<'a> {
+    version: u32,
+    doc_type: &'a str,
+    root: ParameterListView<'a>,
+}
+
+impl<'a> ParameterIOView<'a> {
+    /// Open a binary parameter archive. Only the header is validated;
+    /// everything else is decoded on access.
+    pub fn new(data: &'a [u8]) -> Result<ParameterIOView<'a>> {
+        if data.len() < HEADER_SIZE {
+            return Err(AampError::DataError("not enough data for AAMP header"));
+        }
+        if &data[0..4] != b"AAMP" {
+            return Err(AampError::MagicError(
+                String::from_utf8_lossy(&data[0..4]).to_string(),
+            ));
+        }
+        let doc = Document { data };
+        if doc.u32(0x4)? != 2 {
+            return Err(AampError::DataError("only version 2 is supported"));
+        }
+        let flags = doc.u32(0x8)?;
+        if flags & FLAG_LITTLE_ENDIAN == 0 {
+            return Err(AampError::DataError("only little endian is supported"));
+        }
+        if flags & FLAG_UTF8 == 0 {
+            return Err(AampError::DataError("only UTF-8 is supported"));
+        }
+        let root = HEADER_SIZE + doc.u32(0x14)? as usize;
+        doc.table(root, 1, LIST_SIZE)?;
+        Ok(ParameterIOView {
+            version: doc.u32(0x10)?,
+            doc_type: doc.str(HEADER_SIZE)?,
+            root: ParameterListView {
+                doc,
+                offset: root,
+                depth: 0,
+            },
+        })
+    }
+
+    /// Data version (not the AAMP format version). Typically 0.
+    pub fn version(&self) -> u32 {
+        self.version
+    }
+
+    /// Data type identifier. Typically “xml”.
+    pub fn doc_type(&self) -> &'a str {
+        self.doc_type
+    }
+
+    /// The root parameter list.
+    pub fn root(&self) -> ParameterListView<'a> {
+        self.root
+    }
+
+    /// Call `f` with the object hash, parameter hash and value of every parameter in the archive
+    /// that can be read as `T` (see [`ParamValue`]). Other parameters are skipped without being
+    /// decoded.
+    /// ```
+    /// # use roead::aamp::ParameterIOView;
+    /// # use std::borrow::Cow;
+    /// # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+    /// let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+    /// let mut sum = 0.0;
+    /// ParameterIOView::new(&data)?.visit(|_, _, value: f32| sum += value)?;
+    /// ParameterIOView::new(&data)?.visit(|_, _, buffer: Cow<[f32]>| sum += buffer.iter().sum::<f32>())?;
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn visit<T: ParamValue<'a>>(&self, f: impl FnMut(u32, u32, T)) -> Result<()> {
+        self.root.visit(f)
+    }
+
+    /// Decode the whole archive into an owned `ParameterIO`.
+    pub fn to_pio(&self) -> Result<ParameterIO> {
+        let _span = stats::span(Format::Aamp, Phase::Convert, self.root.doc.data.len());
+        let ParameterList {
+            hash,
+            lists,
+            objects,
+        } = self.root.to_list()?;
+        Ok(ParameterIO {
+            version: self.version,
+            doc_type: self.doc_type.to_owned(),
+            hash,
+            lists,
+            objects,
+        })
+    }
+}
+
+/// A borrowed view of a parameter list.
+#[derive(Debug, Clone, Copy)]
+pub struct ParameterListView<'a> {
+    doc: Document<'a>,
+    offset: usize,
+    depth: usize,
+}
+
+impl<'a> ParameterListView<'a> {
+    /// The name hash of this list.
+    pub fn hash(&self) -> u32 {
+        self.doc.u32(self.offset).unwrap()
+    }
+
+    fn child_table(&self, header: usize, size: usize) -> Result<(usize, usize)> {
+        let rel = self.doc.u16(self.offset + header)? as usize;
+        let count = self.doc.u16(self.offset + header + 2)? as usize;
+        // A child table at the list itself would make the list its own child
+        if rel == 0 && count > 0 {
+            return Err(AampError::DataError("child table overlaps its parent list"));
+        }
+        let offset = self.offset + 4 * rel;
+        self.doc.table(offset, count, size)?;
+        Ok((offset, count))
+    }
+
+    /// Iterate over the child parameter lists and their name hashes.
+    pub fn lists(&self) -> Result<impl Iterator<Item = (u32, ParameterListView<'a>)>> {
+        let (offset, count) = self.child_table(4, LIST_SIZE)?;
+        if count > 0 && self.depth >= MAX_DEPTH {
+            return Err(AampError::DataError(
+                "parameter lists are nested too deeply",
+            ));
+        }
+        let (doc, depth) = (self.doc, self.depth + 1);
+        Ok((0..count).map(move |i| {
+            let list = ParameterListView {
+                doc,
+                offset: offset + LIST_SIZE * i,
+                depth,
+            };
+            (list.hash(), list)
+        }))
+    }
+
+    /// Iterate over the child parameter objects and their name hashes.
+    pub fn objects(&self) -> Result<impl Iterator<Item = (u32, ParameterObjectView<'a>)>> {
+        let (offset, count) = self.child_table(8, OBJECT_SIZE)?;
+        let doc = self.doc;
+        Ok((0..count).map(move |i| {
+            let obj = ParameterObjectView {
+                doc,
+                offset: offset + OBJECT_SIZE * i,
+            };
+            (obj.hash(), obj)
+        }))
+    }
+
+    /// Get a child parameter list by name hash
+    pub fn list_by_hash(&self, hash: u32) -> Result<Option<ParameterListView<'a>>> {
+        Ok(self
+            .lists()?
+            .find(|(h, _)| *h == hash)
+            .map(|(_, list)| list))
+    }
+
+    /// Get a child parameter object by name hash
+    pub fn object_by_hash(&self, hash: u32) -> Result<Option<ParameterObjectView<'a>>> {
+        Ok(self
+            .objects()?
+            .find(|(h, _)| *h == hash)
+            .map(|(_, obj)| obj))
+    }
+
+    /// Get a child parameter list by name
+    pub fn list(&self, name: &str) -> Result<Option<ParameterListView<'a>>> {
+        self.list_by_hash(hash_name(name))
+    }
+
+    /// Get a child parameter object by name
+    pub fn object(&self, name: &str) -> Result<Option<ParameterObjectView<'a>>> {
+        self.object_by_hash(hash_name(name))
+    }
+
+    /// Call `f` with the object hash, parameter hash and value of every parameter in this list
+    /// and its descendants that can be read as `T` (see [`ParamValue`]). Other parameters are
+    /// skipped without being decoded.
+    pub fn visit<T: ParamValue<'a>>(&self, mut f: impl FnMut(u32, u32, T)) -> Result<()> {
+        self.visit_with(&mut f)
+    }
+
+    fn visit_with<T: ParamValue<'a>, F: FnMut(u32, u32, T)>(&self, f: &mut F) -> Result<()> {
+        for (hash, obj) in self.objects()? {
+            obj.visit(|param, value| f(hash, param, value))?;
+        }
+        for (_, list) in self.lists()? {
+            list.visit_with(f)?;
+        }
+        Ok(())
+    }
+
+    /// Collect the entry offsets of the parameters in this list and its
+    /// descendants.
+    pub(super) fn param_entries(&self, out: &mut Vec<usize>) -> Result<()> {
+        for (_, obj) in self.objects()? {
+            let (offset, count) = obj.param_table()?;
+            out.extend((0..count).map(|i| offset + PARAM_SIZE * i));
+        }
+        for (_, list) in self.lists()? {
+            list.param_entries(out)?;
+        }
+        Ok(())
+    }
+
+    /// Decode this list and all of its children into an owned `ParameterList`.
+    pub fn to_list(&self) -> Result<ParameterList> {
+        let lists = self.lists()?;
+        let mut list_map = IndexMap::with_capacity(lists.size_hint().0);
+        for (hash, list) in lists {
+            list_map.insert(hash, list.to_list()?);
+        }
+        let objects = self.objects()?;
+        let mut obj_map = IndexMap::with_capacity(objects.size_hint().0);
+        for (hash, obj) in objects {
+            obj_map.insert(hash, obj.to_object()?);
+        }
+        Ok(ParameterList {
+            hash: Default::default(),
+            lists: list_map,
+            objects: obj_map,
+        })
+    }
+}
+
+/// A borrowed view of a parameter object.
+#[derive(Debug, Clone, Copy)]
+pub struct ParameterObjectView<'a> {
+    doc: Document<'a>,
+    offset: usize,
+}
+
+impl<'a> ParameterObjectView<'a> {
+    /// The name hash of this object.
+    pub fn hash(&self) -> u32 {
+        self.doc.u32(self.offset).unwrap()
+    }
+
+    /// Count the number of parameters
+    pub fn len(&self) -> usize {
+        self.doc.u16(self.offset + 6).unwrap() as usize
+    }
+
+    /// Whether the object has no parameters
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    fn param_table(&self) -> Result<(usize, usize)> {
+        let offset = self.offset + 4 * self.doc.u16(self.offset + 4)? as usize;
+        let count = self.len();
+        self.doc.table(offset, count, PARAM_SIZE)?;
+        Ok((offset, count))
+    }
+
+    /// Iterate over the parameters and their name hashes.
+    pub fn params(&self) -> Result<impl Iterator<Item = Result<(u32, ParameterRef<'a>)>>> {
+        let (offset, count) = self.param_table()?;
+        let doc = self.doc;
+        Ok((0..count).map(move |i| read_param(doc, offset + PARAM_SIZE * i)))
+    }
+
+    /// Get a parameter by name hash
+    pub fn param_by_hash(&self, hash: u32) -> Result<Option<ParameterRef<'a>>> {
+        match self.param_entry(hash)? {
+            Some(offset) => read_param(self.doc, offset).map(|(_, param)| Some(param)),
+            None => Ok(None),
+        }
+    }
+
+    /// Find the entry offset of a parameter by name hash.
+    pub(super) fn param_entry(&self, hash: u32) -> Result<Option<usize>> {
+        let (offset, count) = self.param_table()?;
+        for i in 0..count {
+            let offset = offset + PARAM_SIZE * i;
+            if self.doc.u32(offset)? == hash {
+                return Ok(Some(offset));
+            }
+        }
+        Ok(None)
+    }
+
+    /// Get a parameter by name
+    pub fn param(&self, name: &str) -> Result<Option<ParameterRef<'a>>> {
+        self.param_by_hash(hash_name(name))
+    }
+
+    /// Call `f` with the name hash and value of every parameter that can be read as `T` (see
+    /// [`ParamValue`]). Other parameters are skipped without being decoded.
+    pub fn visit<T: ParamValue<'a>>(&self, mut f: impl FnMut(u32, T)) -> Result<()> {
+        let (offset, count) = self.param_table()?;
+        for i in 0..count {
+            let offset = offset + PARAM_SIZE * i;
+            let (ty, data) = param_data(self.doc, offset)?;
+            if let Some(value) = T::read(self.doc.data, ty, data) {
+                f(self.doc.u32(offset)?, value?);
+            }
+        }
+        Ok(())
+    }
+
+    /// Decode this object into an owned `ParameterObject`.
+    pub fn to_object(&self) -> Result<ParameterObject> {
+        let params = self.params()?;
+        let mut map = IndexMap::with_capacity(params.size_hint().0);
+        for param in params {
+            let (hash, param) = param?;
+            map.insert(hash, param.into());
+        }
+        Ok(ParameterObject(map, Default::default()))
+    }
+}
+
+/// Read the type and data offset of the parameter at `offset`.
+#[inline]
+fn param_data(doc: Document<'_>, offset: usize) -> Result<(u8, usize)> {
+    let [a, b, c, ty] = doc.bytes::<4>(offset + 4)?;
+    Ok((ty, offset + 4 * u32::from_le_bytes([a, b, c, 0]) as usize))
+}
+
+fn read_param(doc: Document<'_>, offset: usize) -> Result<(u32, ParameterRef<'_>)> {
+    let (ty, data) = param_data(doc, offset)?;
+    Ok((doc.u32(offset)?, read_value(doc, ty, data)?))
+}
+
+fn read_value(doc: Document<'_>, ty: u8, data: usize) -> Result<ParameterRef<'_>> {
+    Ok(match (ParamType { repr: ty }) {
+        ParamType::Bool => ParameterRef::Bool(doc.u32(data)? != 0),
+        ParamType::F32 => ParameterRef::F32(doc.f32(data)?),
+        ParamType::Int => ParameterRef::Int(doc.u32(data)? as i32),
+        ParamType::U32 => ParameterRef::U32(doc.u32(data)?),
+        ParamType::Vec2 => {
+            let [x, y] = doc.f32s(data)?;
+            ParameterRef::Vec2(Vector2f { x, y })
+        }
+        ParamType::Vec3 => {
+            let [x, y, z] = doc.f32s(data)?;
+            ParameterRef::Vec3(Vector3f { x, y, z })
+        }
+        ParamType::Vec4 => {
+            let [x, y, z, t] = doc.f32s(data)?;
+            ParameterRef::Vec4(Vector4f { x, y, z, t })
+        }
+        ParamType::Color => {
+            let [r, g, b, a] = doc.f32s(data)?;
+            ParameterRef::Color(Color { r, g, b, a })
+        }
+        ParamType::Quat => {
+            let [a, b, c, d] = doc.f32s(data)?;
+            ParameterRef::Quat(Quat { a, b, c, d })
+        }
+        ParamType::Curve1 => ParameterRef::Curve1(doc.curves(data)?),
+        ParamType::Curve2 => ParameterRef::Curve2(doc.curves(data)?),
+        ParamType::Curve3 => ParameterRef::Curve3(doc.curves(data)?),
+        ParamType::Curve4 => ParameterRef::Curve4(doc.curves(data)?),
+        ParamType::String32 => ParameterRef::String32(doc.str(data)?),
+        ParamType::String64 => ParameterRef::String64(doc.str(data)?),
+        ParamType::String256 => ParameterRef::String256(doc.str(data)?),
+        ParamType::StringRef => ParameterRef::StringRef(doc.str(data)?),
+        ParamType::BufferInt => ParameterRef::BufferInt(doc.buffer(data)?),
+        ParamType::BufferF32 => ParameterRef::BufferF32(doc.buffer(data)?),
+        ParamType::BufferU32 => ParameterRef::BufferU32(doc.buffer(data)?),
+        ParamType::BufferBinary => ParameterRef::BufferBinary(doc.binary(data)?),
+        _ => return Err(AampError::DataError("invalid parameter type")),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{ParameterIOView, ParameterRef, HEADER_SIZE};
+    use crate::aamp::{ParamList, Parameter, ParameterIO, ParameterObject};
+    use crate::types::Curve;
+    use std::{borrow::Cow, convert::TryInto};
+
+    #[test]
+    fn view_matches_owned() {
+        for file in glob::glob("test/aamp/*.yml")
+            .unwrap()
+            .filter_map(|f| f.ok())
+        {
+            let text = std::fs::read_to_string(&file).unwrap();
+            let pio = ParameterIO::from_text(&text).unwrap();
+            let data = pio.to_binary().unwrap();
+            let view = ParameterIOView::new(&data).unwrap();
+            assert_eq!(view.to_pio().unwrap(), pio);
+        }
+    }
+
+    #[test]
+    fn self_referencing_list() {
+        let mut pio = ParameterIO::new();
+        pio.set_list("List", Default::default());
+        let mut data = pio.to_binary().unwrap();
+        let root = HEADER_SIZE + u32::from_le_bytes(data[0x14..0x18].try_into().unwrap()) as usize;
+        // Make the root list's only child list the root itself
+        data[root + 4..root + 6].copy_from_slice(&0u16.to_le_bytes());
+        let view = ParameterIOView::new(&data).unwrap();
+        assert!(view.to_pio().is_err());
+        assert!(crate::aamp::ParameterIOArena::from_view(view).is_err());
+
+        let mut list = crate::aamp::ParameterList::new();
+        for _ in 0..300 {
+            let mut parent = crate::aamp::ParameterList::new();
+            parent.set_list("Child", list);
+            list = parent;
+        }
+        let data = ParameterIO::from(list).to_binary().unwrap();
+        assert!(ParameterIOView::new(&data).unwrap().to_pio().is_err());
+    }
+
+    #[test]
+    fn view_lookup() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let view = ParameterIOView::new(&data).unwrap();
+        let pio = view.to_pio().unwrap();
+        assert_eq!(view.doc_type(), "xml");
+        let obj = view.root().object("DemoAIActionIdx").unwrap().unwrap();
+        let owned = pio.object("DemoAIActionIdx").unwrap();
+        assert_eq!(obj.len(), owned.len());
+        for (param, (hash, owned)) in obj.params().unwrap().zip(owned.params()) {
+            let (h, param) = param.unwrap();
+            assert_eq!(h, *hash);
+            if let ParameterRef::StringRef(s) = &param {
+                assert!(data.as_ptr_range().contains(&s.as_ptr()));
+            }
+            assert_eq!(&crate::aamp::Parameter::from(param), owned);
+        }
+    }
+
+    #[test]
+    fn visit_params() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let view = ParameterIOView::new(&data).unwrap();
+        let (mut strings, mut all) = (0, 0);
+        view.visit(|_, _, value: &str| {
+            assert!(data.as_ptr_range().contains(&value.as_ptr()));
+            strings += 1;
+        })
+        .unwrap();
+        view.visit(|_, _, _: ParameterRef| all += 1).unwrap();
+        assert!(strings > 0 && strings < all);
+
+        let mut obj = ParameterObject::new();
+        obj.set_param("Buffer", Parameter::BufferF32(vec![1.0, 2.5, -3.0]));
+        obj.set_param("Curve", Parameter::Curve2([Curve::default(); 2]));
+        obj.set_param("Float", Parameter::F32(4.0));
+        let mut pio = ParameterIO::new();
+        pio.set_object("Obj", obj.clone());
+        let data = pio.to_binary().unwrap();
+        let view = ParameterIOView::new(&data).unwrap();
+        let mut buffers = vec![];
+        view.visit(|_, hash, value: Cow<[f32]>| {
+            // Whether the values are borrowed depends on the alignment of `data`
+            if let Cow::Borrowed(values) = &value {
+                assert!(data
+                    .as_ptr_range()
+                    .contains(&(values.as_ptr() as *const u8)));
+            }
+            assert_eq!(obj.params()[&hash].as_buf_f32().unwrap(), &*value);
+            buffers.push(value);
+        })
+        .unwrap();
+        assert_eq!(buffers.len(), 1);
+        view.visit(|_, hash, value: Cow<[Curve]>| {
+            if let Cow::Borrowed(values) = &value {
+                assert!(data
+                    .as_ptr_range()
+                    .contains(&(values.as_ptr() as *const u8)));
+            }
+            assert_eq!(obj.params()[&hash].as_curves().unwrap(), &*value);
+        })
+        .unwrap();
+        let param = view.root().object("Obj").unwrap().unwrap();
+        assert_eq!(param.param("Float").unwrap().unwrap().as_str().ok(), None);
+    }
+}
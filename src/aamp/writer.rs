@@ -0,0 +1,334 @@
+//! Binary parameter archive serialization straight from the Rust structures.
+//!
+//! The tables are laid out the same way oead does, so archives that oead
+//! wrote come back byte for byte. Every list's children are contiguous and
+//! followed by the subtrees of those children. All lists come before all
+//! objects and all objects before all parameters, and a list's parameters
+//! come after those of its child lists. Values are deduplicated into a data
+//! section and a string section.
+use super::names::hash_name;
+use super::{ParamList, Parameter, ParameterIO, ParameterObject};
+use crate::ffi::Curve;
+use std::collections::HashMap;
+use std::io::Write;
+
+pub(super) const HEADER_SIZE: usize = 0x30;
+pub(super) const LIST_SIZE: usize = 12;
+pub(super) const OBJECT_SIZE: usize = 8;
+pub(super) const PARAM_SIZE: usize = 8;
+
+const FLAGS: u32 = 0x1 | 0x2; // Little endian, UTF-8
+
+type Result<T> = std::result::Result<T, &'static str>;
+
+#[inline]
+fn align4(value: usize) -> usize {
+    (value + 3) & !3
+}
+
+/// Where a parameter's value ended up.
+pub(super) enum Location {
+    Data(u32),
+    String(u32),
+}
+
+#[derive(Default)]
+pub(super) struct Section {
+    pub(super) buf: Vec<u8>,
+    offsets: HashMap<Vec<u8>, u32>,
+}
+
+impl Section {
+    /// Append `bytes` (4-byte aligned) unless an identical entry exists, and
+    /// return the offset of the entry within the section.
+    pub(super) fn insert(&mut self, bytes: &[u8]) -> u32 {
+        if let Some(offset) = self.offsets.get(bytes) {
+            return *offset;
+        }
+        let offset = self.buf.len() as u32;
+        self.buf.extend_from_slice(bytes);
+        self.buf.resize(align4(self.buf.len()), 0);
+        self.offsets.insert(bytes.to_vec(), offset);
+        offset
+    }
+}
+
+/// A fully laid out archive: the header and tables, and the two value
+/// sections that follow them.
+pub(super) struct Layout {
+    tables: Vec<u8>,
+    data: Vec<u8>,
+    strings: Vec<u8>,
+}
+
+impl Layout {
+    pub(super) fn new(pio: &ParameterIO) -> Result<Layout> {
+        let mut counts = (1, 0, 0);
+        count(pio, &mut counts);
+        let (num_lists, num_objects, num_params) = counts;
+        let type_size = align4(pio.doc_type.len() + 1);
+        let tables_size = HEADER_SIZE
+            + type_size
+            + LIST_SIZE * num_lists
+            + OBJECT_SIZE * num_objects
+            + PARAM_SIZE * num_params;
+
+        let mut ctx = Context {
+            tables: Vec::with_capacity(tables_size),
+            list_entries: Vec::with_capacity(num_lists),
+            object_entries: Vec::with_capacity(num_objects),
+            params: Vec::with_capacity(num_params),
+            data: Section::default(),
+            strings: Section::default(),
+            scratch: Vec::new(),
+        };
+        ctx.tables.resize(HEADER_SIZE, 0);
+        ctx.tables.extend_from_slice(pio.doc_type.as_bytes());
+        ctx.tables.resize(HEADER_SIZE + type_size, 0);
+
+        let root = ctx.tables.len();
+        ctx.entry(hash_name("param_root"), LIST_SIZE);
+        ctx.write_lists(pio, root)?;
+        let mut next_list = 0;
+        ctx.write_objects(pio, &mut next_list)?;
+        let mut next_object = 0;
+        ctx.write_params(pio, &mut next_object)?;
+        debug_assert_eq!(ctx.tables.len(), tables_size);
+
+        let Context {
+            mut tables,
+            params,
+            data,
+            strings,
+            ..
+        } = ctx;
+        let string_section = tables_size + data.buf.len();
+        for (entry, location) in params {
+            let value = match location {
+                Location::Data(offset) => tables_size + offset as usize,
+                Location::String(offset) => string_section + offset as usize,
+            };
+            let rel = (value - entry) / 4;
+            if rel >= 1 << 24 {
+                return Err("parameter data offset out of range");
+            }
+            tables[entry + 4..entry + 7].copy_from_slice(&(rel as u32).to_le_bytes()[..3]);
+        }
+
+        let file_size = string_section + strings.buf.len();
+        if file_size > u32::MAX as usize {
+            return Err("archive is larger than 4 GiB");
+        }
+        let header = [
+            u32::from_le_bytes(*b"AAMP"),
+            2,
+            FLAGS,
+            file_size as u32,
+            pio.version,
+            type_size as u32,
+            num_lists as u32,
+            num_objects as u32,
+            num_params as u32,
+            data.buf.len() as u32,
+            strings.buf.len() as u32,
+            0,
+        ];
+        for (i, value) in header.iter().enumerate() {
+            tables[4 * i..4 * i + 4].copy_from_slice(&value.to_le_bytes());
+        }
+        Ok(Layout {
+            tables,
+            data: data.buf,
+            strings: strings.buf,
+        })
+    }
+
+    /// Total size of the archive in bytes.
+    pub(super) fn size(&self) -> usize {
+        self.tables.len() + self.data.len() + self.strings.len()
+    }
+
+    pub(super) fn write<W: Write>(&self, writer: &mut W) -> std::io::Result<()> {
+        writer.write_all(&self.tables)?;
+        writer.write_all(&self.data)?;
+        writer.write_all(&self.strings)
+    }
+}
+
+fn count<L: ParamList>(list: &L, counts: &mut (usize, usize, usize)) {
+    counts.0 += list.lists().len();
+    counts.1 += list.objects().len();
+    counts.2 += list.objects().values().map(|obj| obj.len()).sum::<usize>();
+    for child in list.lists().values() {
+        count(child, counts);
+    }
+}
+
+struct Context {
+    tables: Vec<u8>,
+    /// List entry offsets, in the order the lists were written.
+    list_entries: Vec<usize>,
+    /// Object entry offsets, in the order the objects were written.
+    object_entries: Vec<usize>,
+    /// Parameter entry offsets and where their values were placed.
+    params: Vec<(usize, Location)>,
+    data: Section,
+    strings: Section,
+    scratch: Vec<u8>,
+}
+
+impl Context {
+    /// Append a table entry with the given name hash and zeroed fields.
+    fn entry(&mut self, hash: u32, size: usize) -> usize {
+        let offset = self.tables.len();
+        self.tables.extend_from_slice(&hash.to_le_bytes());
+        self.tables.resize(offset + size, 0);
+        offset
+    }
+
+    /// Fill in the relative offset (in 4-byte units) and count of a child
+    /// table at `field` within the entry starting at `entry`.
+    fn set_child_table(&mut self, entry: usize, field: usize, count: usize) -> Result<()> {
+        let rel = (self.tables.len() - entry) / 4;
+        if rel > u16::MAX as usize || count > u16::MAX as usize {
+            return Err("child table out of range");
+        }
+        self.tables[entry + field..entry + field + 2].copy_from_slice(&(rel as u16).to_le_bytes());
+        self.tables[entry + field + 2..entry + field + 4]
+            .copy_from_slice(&(count as u16).to_le_bytes());
+        Ok(())
+    }
+
+    fn write_lists<L: ParamList>(&mut self, list: &L, entry: usize) -> Result<()> {
+        self.list_entries.push(entry);
+        self.set_child_table(entry, 4, list.lists().len())?;
+        let first = self.tables.len();
+        for hash in list.lists().keys() {
+            self.entry(*hash, LIST_SIZE);
+        }
+        for (i, child) in list.lists().values().enumerate() {
+            self.write_lists(child, first + LIST_SIZE * i)?;
+        }
+        Ok(())
+    }
+
+    fn write_objects<L: ParamList>(&mut self, list: &L, next_list: &mut usize) -> Result<()> {
+        let entry = self.list_entries[*next_list];
+        *next_list += 1;
+        self.set_child_table(entry, 8, list.objects().len())?;
+        for (hash, obj) in list.objects() {
+            let offset = self.entry(*hash, OBJECT_SIZE);
+            self.object_entries.push(offset);
+            if obj.len() > u16::MAX as usize {
+                return Err("too many parameters in object");
+            }
+            self.tables[offset + 6..offset + 8].copy_from_slice(&(obj.len() as u16).to_le_bytes());
+        }
+        for child in list.lists().values() {
+            self.write_objects(child, next_list)?;
+        }
+        Ok(())
+    }
+
+    fn write_params<L: ParamList>(&mut self, list: &L, next_object: &mut usize) -> Result<()> {
+        let first = *next_object;
+        *next_object += list.objects().len();
+        for child in list.lists().values() {
+            self.write_params(child, next_object)?;
+        }
+        for (i, obj) in list.objects().values().enumerate() {
+            self.write_object_params(obj, self.object_entries[first + i])?;
+        }
+        Ok(())
+    }
+
+    fn write_object_params(&mut self, obj: &ParameterObject, entry: usize) -> Result<()> {
+        self.set_child_table(entry, 4, obj.len())?;
+        for (hash, param) in obj.params() {
+            let offset = self.entry(*hash, PARAM_SIZE);
+            self.tables[offset + 7] = param.get_ffi_type().repr;
+            let location = self.write_value(param);
+            self.params.push((offset, location));
+        }
+        Ok(())
+    }
+
+    fn write_value(&mut self, param: &Parameter) -> Location {
+        write_value(param, &mut self.data, &mut self.strings, &mut self.scratch)
+    }
+}
+
+/// Encode a parameter's value into the data or string section, using `buf`
+/// as scratch space.
+pub(super) fn write_value(
+    param: &Parameter,
+    data: &mut Section,
+    strings: &mut Section,
+    buf: &mut Vec<u8>,
+) -> Location {
+    buf.clear();
+    // Buffers are prefixed with their element count; the parameter
+    // points past the prefix.
+    let mut skip = 0;
+    match param {
+        Parameter::String32(s)
+        | Parameter::String64(s)
+        | Parameter::String256(s)
+        | Parameter::StringRef(s) => {
+            buf.extend_from_slice(s.as_bytes());
+            buf.push(0);
+            return Location::String(strings.insert(buf));
+        }
+        Parameter::Bool(v) => buf.extend_from_slice(&(*v as u32).to_le_bytes()),
+        Parameter::F32(v) => buf.extend_from_slice(&v.to_le_bytes()),
+        Parameter::Int(v) => buf.extend_from_slice(&v.to_le_bytes()),
+        Parameter::U32(v) => buf.extend_from_slice(&v.to_le_bytes()),
+        Parameter::Vec2(v) => put_f32s(buf, &[v.x, v.y]),
+        Parameter::Vec3(v) => put_f32s(buf, &[v.x, v.y, v.z]),
+        Parameter::Vec4(v) => put_f32s(buf, &[v.x, v.y, v.z, v.t]),
+        Parameter::Color(v) => put_f32s(buf, &[v.r, v.g, v.b, v.a]),
+        Parameter::Quat(v) => put_f32s(buf, &[v.a, v.b, v.c, v.d]),
+        Parameter::Curve1(v) => put_curves(buf, v),
+        Parameter::Curve2(v) => put_curves(buf, v),
+        Parameter::Curve3(v) => put_curves(buf, v),
+        Parameter::Curve4(v) => put_curves(buf, v),
+        Parameter::BufferInt(v) => {
+            skip = 4;
+            buf.extend_from_slice(&(v.len() as u32).to_le_bytes());
+            v.iter()
+                .for_each(|v| buf.extend_from_slice(&v.to_le_bytes()));
+        }
+        Parameter::BufferF32(v) => {
+            skip = 4;
+            buf.extend_from_slice(&(v.len() as u32).to_le_bytes());
+            put_f32s(buf, v);
+        }
+        Parameter::BufferU32(v) => {
+            skip = 4;
+            buf.extend_from_slice(&(v.len() as u32).to_le_bytes());
+            v.iter()
+                .for_each(|v| buf.extend_from_slice(&v.to_le_bytes()));
+        }
+        Parameter::BufferBinary(v) => {
+            skip = 4;
+            buf.extend_from_slice(&(v.len() as u32).to_le_bytes());
+            buf.extend_from_slice(v);
+        }
+    }
+    Location::Data(data.insert(buf) + skip)
+}
+
+#[inline]
+fn put_f32s(buf: &mut Vec<u8>, values: &[f32]) {
+    values
+        .iter()
+        .for_each(|v| buf.extend_from_slice(&v.to_le_bytes()));
+}
+
+fn put_curves(buf: &mut Vec<u8>, curves: &[Curve]) {
+    for curve in curves {
+        buf.extend_from_slice(&curve.a.to_le_bytes());
+        buf.extend_from_slice(&curve.b.to_le_bytes());
+        put_f32s(buf, &curve.floats);
+    }
+}
@@ -0,0 +1,1262 @@
+//! Arena-backed BYML documents.
+//!
+//! A `BymlArena` holds a whole decoded document in a handful of flat buffers:
+//! one table of nodes, one buffer for all string values and hash keys, and
+//! one for binary data. The children of every container are stored next to
+//! each other in the node table and refer to it by index, so parsing a
+//! document costs a few amortized allocations instead of one per node, and
+//! dropping it frees everything at once. This matters most when many rayon
+//! workers parse documents at the same time and would otherwise contend on
+//! the global allocator.
+//! ```
+//! # use roead::{byml::{Byml, BymlArena}, Endian};
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let text = "{Actors: [{name: Enemy_Lynel_Dark, instSize: 20480}]}";
+//! let buf: Vec<u8> = Byml::from_text(text)?.to_binary(Endian::Little);
+//! let actor_info = BymlArena::from_binary(&buf)?;
+//! let actors = actor_info.root().get("Actors")?.expect("No actor list");
+//! let name: &str = actors.at(0)?.get("name")?.unwrap().as_string()?;
+//! assert_eq!(name, "Enemy_Lynel_Dark");
+//! # Ok(())
+//! # }
+//! ```
+//!
+//! Documents like map units and `ActorInfo` hold arrays of thousands of hashes
+//! that mostly share the same keys. [`BymlArena::from_binary_columnar`] stores
+//! each such array as a table instead: one sorted list of keys for the whole
+//! array, and one typed column per key, so a float costs four bytes rather
+//! than a node and a key. The table's rows still have the accessors of a
+//! hash node, and a whole column can be scanned as a slice, e.g.
+//! ```
+//! # use roead::{byml::{Byml, BymlArena}, Endian};
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let text = "
+//! Objs:
+//!   - {UnitConfigName: Obj_Tree, Translate: {X: 1.0, Y: 0.0, Z: 2.0}}
+//!   - {UnitConfigName: Obj_Rock, Translate: {X: 3.0, Y: 0.0, Z: 4.0}}
+//!   - {UnitConfigName: Obj_Tree, Translate: {X: 5.0, Y: 0.0, Z: 6.0}}
+//!   - {UnitConfigName: Obj_Bush, Translate: {X: 7.0, Y: 0.0, Z: 8.0}}
+//! ";
+//! let buf: Vec<u8> = Byml::from_text(text)?.to_binary(Endian::Big);
+//! let map_unit = BymlArena::from_binary_columnar(&buf)?;
+//! let objs = map_unit.root().get("Objs")?.expect("No object list");
+//! let x: &[f32] = objs
+//!     .column("Translate")?
+//!     .expect("No translations")
+//!     .column("X")?
+//!     .expect("No X coordinates")
+//!     .as_floats()?;
+//! assert_eq!(x, [1.0, 3.0, 5.0, 7.0]);
+//! # Ok(())
+//! # }
+//! ```
+use super::{
+    view::{node_type::*, MAX_DEPTH},
+    Byml, BymlError, BymlView, Hash, KeyPool, Result,
+};
+use std::{
+    collections::{BTreeSet, HashMap},
+    ops::Range,
+};
+
+/// A range of one of the arena buffers.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+struct Span {
+    start: u32,
+    len: u32,
+}
+
+impl Span {
+    #[inline]
+    fn range(self) -> Range<usize> {
+        self.start as usize..(self.start + self.len) as usize
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Node {
+    Null,
+    Bool(bool),
+    Int(i32),
+    UInt(u32),
+    Float(f32),
+    Int64(i64),
+    UInt64(u64),
+    Double(f64),
+    String(Span),
+    Binary(Span),
+    Array(Span),
+    Hash(Span),
+    /// An array of hashes stored as a table.
+    Table(u32),
+    /// A hash that is one row of a table.
+    Row {
+        table: u32,
+        row: u32,
+    },
+}
+
+/// Arrays with fewer hashes than this are not worth storing as a table.
+const MIN_TABLE_ROWS: usize = 4;
+
+/// An array of hashes stored as one column per key.
+#[derive(Debug, Clone, Default, PartialEq)]
+struct Table {
+    rows: u32,
+    /// Every key that appears in a row, in order. Column `i` holds the values
+    /// of key `i`.
+    keys: Vec<Span>,
+    columns: Vec<Column>,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+struct Column {
+    /// Whether each row has the key, or empty if all of them do. The values
+    /// of missing rows are left at their default.
+    present: Vec<bool>,
+    values: Values,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+enum Values {
+    Bool(Vec<bool>),
+    Int(Vec<i32>),
+    UInt(Vec<u32>),
+    Float(Vec<f32>),
+    Int64(Vec<i64>),
+    UInt64(Vec<u64>),
+    Double(Vec<f64>),
+    String(Vec<Span>),
+    /// Hashes, stored as the rows of another table.
+    Table(u32),
+    /// Values of mixed or other types, by index in the node table.
+    Nodes(Vec<u32>),
+}
+
+impl Column {
+    #[inline]
+    fn is_present(&self, row: usize) -> bool {
+        self.present.is_empty() || self.present[row]
+    }
+
+    #[inline]
+    fn node(&self, arena: &BymlArena, row: usize) -> Node {
+        match &self.values {
+            Values::Bool(v) => Node::Bool(v[row]),
+            Values::Int(v) => Node::Int(v[row]),
+            Values::UInt(v) => Node::UInt(v[row]),
+            Values::Float(v) => Node::Float(v[row]),
+            Values::Int64(v) => Node::Int64(v[row]),
+            Values::UInt64(v) => Node::UInt64(v[row]),
+            Values::Double(v) => Node::Double(v[row]),
+            Values::String(v) => Node::String(v[row]),
+            Values::Table(table) => Node::Row {
+                table: *table,
+                row: row as u32,
+            },
+            Values::Nodes(v) => arena.nodes[v[row] as usize],
+        }
+    }
+}
+
+/// An owned BYML document stored in flat buffers. Use [`BymlArena::root`]
+/// to access its nodes.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct BymlArena {
+    /// The root node comes first, and each container's children follow
+    /// somewhere after it as one contiguous range.
+    nodes: Vec<Node>,
+    /// The key of every node that is a hash entry, by node index.
+    keys: Vec<Span>,
+    text: String,
+    bytes: Vec<u8>,
+    tables: Vec<Table>,
+}
+
+impl BymlArena {
+    /// Parse a binary BYML document into an arena.
+    pub fn from_binary(data: &[u8]) -> Result<Self> {
+        // Nodes take at least 8 bytes in the binary format, so this fits most
+        // documents without growing.
+        Self::decode(BymlView::new(data)?, data.len() / 8, false)
+    }
+
+    /// Parse a binary BYML document into an arena, storing arrays of hashes
+    /// that mostly share their keys as tables. See the module documentation.
+    pub fn from_binary_columnar(data: &[u8]) -> Result<Self> {
+        // Most values of the documents that benefit end up in tables.
+        Self::decode(BymlView::new(data)?, data.len() / 64, true)
+    }
+
+    /// Decode a view and everything below it into an arena.
+    pub fn from_view(view: BymlView<'_>) -> Result<Self> {
+        Self::decode(view, 1, false)
+    }
+
+    /// Decode a view and everything below it into an arena, storing arrays of
+    /// hashes that mostly share their keys as tables.
+    pub fn from_view_columnar(view: BymlView<'_>) -> Result<Self> {
+        Self::decode(view, 1, true)
+    }
+
+    fn decode(view: BymlView<'_>, capacity: usize, columnar: bool) -> Result<Self> {
+        let mut builder = Builder::with_capacity(capacity);
+        builder.columnar = columnar;
+        builder.push_view(view)?;
+        Ok(builder.finish())
+    }
+
+    /// Copy a `Byml` tree into an arena. No tables are built.
+    pub fn from_byml(byml: &Byml) -> Self {
+        let mut builder = Builder::with_capacity(1);
+        builder.push_byml(byml);
+        builder.finish()
+    }
+
+    /// Get the root node of the document.
+    pub fn root(&self) -> ArenaNode<'_> {
+        ArenaNode {
+            arena: self,
+            node: self.nodes[0],
+        }
+    }
+
+    /// Get the number of nodes in the node table. Values stored in the
+    /// columns of a table are not counted.
+    pub fn node_count(&self) -> usize {
+        self.nodes.len()
+    }
+
+    /// Get the number of arrays stored as tables.
+    pub fn table_count(&self) -> usize {
+        self.tables.len()
+    }
+
+    #[inline]
+    fn str(&self, span: Span) -> &str {
+        &self.text[span.range()]
+    }
+
+    /// Convert the whole document to an owned `Byml` tree.
+    pub fn to_byml(&self) -> Byml {
+        self.root().to_byml()
+    }
+
+    /// Convert the whole document to an owned `Byml` tree, taking hash keys
+    /// from a pool shared with other documents.
+    pub fn to_byml_with_pool(&self, pool: &mut KeyPool) -> Byml {
+        self.root().to_byml_with_pool(pool)
+    }
+}
+
+impl From<&Byml> for BymlArena {
+    fn from(byml: &Byml) -> Self {
+        Self::from_byml(byml)
+    }
+}
+
+impl From<&BymlArena> for Byml {
+    fn from(arena: &BymlArena) -> Self {
+        arena.to_byml()
+    }
+}
+
+struct Builder<'a> {
+    arena: BymlArena,
+    /// Strings that are already in the text buffer. Keys and values share
+    /// it, so a value that matches a key is stored once.
+    strings: HashMap<&'a str, Span>,
+    /// Whether to store arrays of hashes as tables.
+    columnar: bool,
+    /// Number of containers above the node being filled in.
+    depth: usize,
+}
+
+impl<'a> Builder<'a> {
+    fn with_capacity(nodes: usize) -> Self {
+        let mut arena = BymlArena {
+            nodes: Vec::with_capacity(nodes),
+            keys: Vec::with_capacity(nodes),
+            ..Default::default()
+        };
+        arena.nodes.push(Node::Null);
+        arena.keys.push(Span::default());
+        Builder {
+            arena,
+            strings: HashMap::new(),
+            columnar: false,
+            depth: 0,
+        }
+    }
+
+    fn finish(self) -> BymlArena {
+        self.arena
+    }
+
+    fn text(&mut self, text: &'a str) -> Span {
+        let arena = &mut self.arena;
+        *self.strings.entry(text).or_insert_with(|| {
+            let start = arena.text.len() as u32;
+            arena.text.push_str(text);
+            Span {
+                start,
+                len: text.len() as u32,
+            }
+        })
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) -> Span {
+        let start = self.arena.bytes.len() as u32;
+        self.arena.bytes.extend_from_slice(bytes);
+        Span {
+            start,
+            len: bytes.len() as u32,
+        }
+    }
+
+    /// Reserve a contiguous range of node slots for the children of a
+    /// container. The slots are filled in afterwards.
+    fn reserve(&mut self, len: usize) -> Span {
+        let start = self.arena.nodes.len();
+        self.arena.nodes.resize(start + len, Node::Null);
+        self.arena.keys.resize(start + len, Span::default());
+        Span {
+            start: start as u32,
+            len: len as u32,
+        }
+    }
+
+    fn push_view(&mut self, root: BymlView<'a>) -> Result<()> {
+        self.fill_view(0, root)
+    }
+
+    /// Count one more level of containers, failing if the document nests
+    /// them too deeply (or refers back to a container it is inside of).
+    fn enter(&mut self) -> Result<()> {
+        if self.depth >= MAX_DEPTH {
+            return Err(BymlError::DataError("containers are nested too deeply"));
+        }
+        self.depth += 1;
+        Ok(())
+    }
+
+    fn fill_view(&mut self, index: usize, view: BymlView<'a>) -> Result<()> {
+        let container = matches!(view.node_type(), ARRAY | HASH);
+        if container {
+            self.enter()?;
+        }
+        let node = match view.node_type() {
+            NULL => Node::Null,
+            BOOL => Node::Bool(view.as_bool()?),
+            INT => Node::Int(view.as_int()?),
+            UINT => Node::UInt(view.as_uint()?),
+            FLOAT => Node::Float(view.as_float()?),
+            INT64 => Node::Int64(view.as_int64()?),
+            UINT64 => Node::UInt64(view.as_uint64()?),
+            DOUBLE => Node::Double(view.as_double()?),
+            STRING => Node::String(self.text(view.as_string()?)),
+            BINARY => Node::Binary(self.bytes(view.as_binary()?)),
+            ARRAY => match self.try_table(view)? {
+                Some(table) => Node::Table(table),
+                None => {
+                    let span = self.reserve(view.len()?);
+                    for (slot, item) in span.range().zip(view.array_iter()?) {
+                        self.fill_view(slot, item?)?;
+                    }
+                    Node::Array(span)
+                }
+            },
+            HASH => {
+                let span = self.reserve(view.len()?);
+                for (slot, entry) in span.range().zip(view.hash_iter()?) {
+                    let (key, value) = entry?;
+                    self.arena.keys[slot] = self.text(key);
+                    self.fill_view(slot, value)?;
+                }
+                Node::Hash(span)
+            }
+            _ => return Err(BymlError::DataError("invalid node type")),
+        };
+        if container {
+            self.depth -= 1;
+        }
+        self.arena.nodes[index] = node;
+        Ok(())
+    }
+
+    /// Store an array as a table if columnar mode is on and the array is made
+    /// of enough hashes that mostly share their keys.
+    fn try_table(&mut self, view: BymlView<'a>) -> Result<Option<u32>> {
+        if !self.columnar || view.len()? < MIN_TABLE_ROWS {
+            return Ok(None);
+        }
+        let mut rows = Vec::with_capacity(view.len()?);
+        for item in view.array_iter()? {
+            let item = item?;
+            if !item.is_hash() {
+                return Ok(None);
+            }
+            rows.push(Some(item));
+        }
+        let (keys, entries) = schema(&rows)?;
+        if !dense(rows.len(), keys.len(), entries) {
+            return Ok(None);
+        }
+        self.table(&rows, &keys).map(Some)
+    }
+
+    /// Build a table from hashes, where a missing hash is a row without keys.
+    fn table(&mut self, rows: &[Option<BymlView<'a>>], keys: &[&'a str]) -> Result<u32> {
+        // The rows are one level of hashes.
+        self.enter()?;
+        // Cells are sorted by column, then by row.
+        let mut cells = vec![None; keys.len() * rows.len()];
+        for (i, row) in rows.iter().enumerate() {
+            if let Some(row) = row {
+                for entry in row.hash_iter()? {
+                    let (key, value) = entry?;
+                    let column = keys.binary_search(&key).unwrap();
+                    cells[column * rows.len() + i] = Some(value);
+                }
+            }
+        }
+        // Reserve the slot first so nested tables come after this one.
+        let index = self.arena.tables.len();
+        self.arena.tables.push(Table::default());
+        let mut table = Table {
+            rows: rows.len() as u32,
+            keys: keys.iter().map(|key| self.text(*key)).collect(),
+            columns: Vec::with_capacity(keys.len()),
+        };
+        for column in cells.chunks(rows.len().max(1)) {
+            table.columns.push(self.column(column)?);
+        }
+        self.arena.tables[index] = table;
+        self.depth -= 1;
+        Ok(index as u32)
+    }
+
+    /// Build a column, typed if all of its values have the same type.
+    fn column(&mut self, cells: &[Option<BymlView<'a>>]) -> Result<Column> {
+        fn scalars<'a, T: Default>(
+            cells: &[Option<BymlView<'a>>],
+            get: impl Fn(&BymlView<'a>) -> Result<T>,
+        ) -> Result<Vec<T>> {
+            cells
+                .iter()
+                .map(|cell| cell.as_ref().map_or(Ok(T::default()), &get))
+                .collect()
+        }
+        let present = if cells.iter().all(Option::is_some) {
+            Vec::new()
+        } else {
+            cells.iter().map(Option::is_some).collect()
+        };
+        let mut types = cells.iter().flatten().map(|cell| cell.node_type());
+        let first = types.next();
+        let node_type = if types.all(|ty| Some(ty) == first) {
+            first
+        } else {
+            None
+        };
+        let values = match node_type {
+            Some(BOOL) => Values::Bool(scalars(cells, BymlView::as_bool)?),
+            Some(INT) => Values::Int(scalars(cells, BymlView::as_int)?),
+            Some(UINT) => Values::UInt(scalars(cells, BymlView::as_uint)?),
+            Some(FLOAT) => Values::Float(scalars(cells, BymlView::as_float)?),
+            Some(INT64) => Values::Int64(scalars(cells, BymlView::as_int64)?),
+            Some(UINT64) => Values::UInt64(scalars(cells, BymlView::as_uint64)?),
+            Some(DOUBLE) => Values::Double(scalars(cells, BymlView::as_double)?),
+            Some(STRING) => {
+                let mut spans = Vec::with_capacity(cells.len());
+                for cell in cells {
+                    spans.push(match cell {
+                        Some(view) => self.text(view.as_string()?),
+                        None => Span::default(),
+                    });
+                }
+                Values::String(spans)
+            }
+            Some(HASH) => {
+                let (keys, entries) = schema(cells)?;
+                if dense(cells.len(), keys.len(), entries) {
+                    Values::Table(self.table(cells, &keys)?)
+                } else {
+                    self.nodes(cells)?
+                }
+            }
+            _ => self.nodes(cells)?,
+        };
+        Ok(Column { present, values })
+    }
+
+    /// Build a column of separate nodes, for values of mixed types or hashes
+    /// that share too few keys to be a table.
+    fn nodes(&mut self, cells: &[Option<BymlView<'a>>]) -> Result<Values> {
+        let mut nodes = Vec::with_capacity(cells.len());
+        for cell in cells {
+            nodes.push(match cell {
+                Some(view) => {
+                    let slot = self.reserve(1).start;
+                    self.fill_view(slot as usize, *view)?;
+                    slot
+                }
+                None => 0,
+            });
+        }
+        Ok(Values::Nodes(nodes))
+    }
+
+    fn push_byml(&mut self, root: &'a Byml) {
+        self.fill_byml(0, root)
+    }
+
+    fn fill_byml(&mut self, index: usize, byml: &'a Byml) {
+        let node = match byml {
+            Byml::Null => Node::Null,
+            Byml::Bool(v) => Node::Bool(*v),
+            Byml::Int(v) => Node::Int(*v),
+            Byml::UInt(v) => Node::UInt(*v),
+            Byml::Float(v) => Node::Float(*v),
+            Byml::Int64(v) => Node::Int64(*v),
+            Byml::UInt64(v) => Node::UInt64(*v),
+            Byml::Double(v) => Node::Double(*v),
+            Byml::String(v) => Node::String(self.text(v)),
+            Byml::Binary(v) => Node::Binary(self.bytes(v)),
+            Byml::Array(items) => {
+                let span = self.reserve(items.len());
+                for (slot, item) in span.range().zip(items) {
+                    self.fill_byml(slot, item);
+                }
+                Node::Array(span)
+            }
+            Byml::Hash(hash) => {
+                let span = self.reserve(hash.len());
+                for (slot, (key, value)) in span.range().zip(hash) {
+                    self.arena.keys[slot] = self.text(key.as_str());
+                    self.fill_byml(slot, value);
+                }
+                Node::Hash(span)
+            }
+        };
+        self.arena.nodes[index] = node;
+    }
+}
+
+/// Check if hashes with `entries` entries in total are worth storing as a
+/// table of `rows` rows and `keys` columns. A missing key still takes a slot
+/// in its column, so hashes where most keys are missing from most rows are
+/// better left as they are.
+fn dense(rows: usize, keys: usize, entries: usize) -> bool {
+    entries * 2 >= rows * keys
+}
+
+/// Get the sorted keys of some hashes and their total number of entries.
+fn schema<'a>(rows: &[Option<BymlView<'a>>]) -> Result<(Vec<&'a str>, usize)> {
+    let (mut keys, mut entries) = (BTreeSet::new(), 0);
+    for row in rows.iter().flatten() {
+        for entry in row.hash_iter()? {
+            keys.insert(entry?.0);
+            entries += 1;
+        }
+    }
+    Ok((keys.into_iter().collect(), entries))
+}
+
+/// A borrowed handle to a single node in a [`BymlArena`].
+///
+/// Handles are cheap to copy and have the same accessors as a [`BymlView`].
+/// The rows of a table are hash nodes, and the table itself is an array
+/// node. The document was validated when the arena was built, so the only
+/// error they return is a `BymlError::TypeError` if the node has a different
+/// type, or a `BymlError::DataError` for an array index that is out of
+/// bounds.
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaNode<'a> {
+    arena: &'a BymlArena,
+    node: Node,
+}
+
+impl<'a> ArenaNode<'a> {
+    #[inline]
+    fn node(&self) -> Node {
+        self.node
+    }
+
+    #[inline]
+    fn with(&self, node: Node) -> ArenaNode<'a> {
+        ArenaNode {
+            arena: self.arena,
+            node,
+        }
+    }
+
+    #[inline]
+    fn child(&self, index: usize) -> ArenaNode<'a> {
+        self.with(self.arena.nodes[index])
+    }
+
+    #[inline]
+    fn entry(&self, index: usize) -> (&'a str, ArenaNode<'a>) {
+        (self.arena.str(self.arena.keys[index]), self.child(index))
+    }
+
+    /// Get the entry for a column of a table row, if the row has it.
+    #[inline]
+    fn cell(&self, table: u32, column: usize, row: u32) -> Option<(&'a str, ArenaNode<'a>)> {
+        let table = &self.arena.tables[table as usize];
+        let data = &table.columns[column];
+        if data.is_present(row as usize) {
+            Some((
+                self.arena.str(table.keys[column]),
+                self.with(data.node(self.arena, row as usize)),
+            ))
+        } else {
+            None
+        }
+    }
+
+    /// Check if the node is null.
+    pub fn is_null(&self) -> bool {
+        matches!(self.node(), Node::Null)
+    }
+
+    /// Check if the node is a hash.
+    pub fn is_hash(&self) -> bool {
+        matches!(self.node(), Node::Hash(_) | Node::Row { .. })
+    }
+
+    /// Check if the node is an array.
+    pub fn is_array(&self) -> bool {
+        matches!(self.node(), Node::Array(_) | Node::Table(_))
+    }
+
+    /// Check if the node is an array stored as a table.
+    pub fn is_table(&self) -> bool {
+        matches!(self.node(), Node::Table(_))
+    }
+
+    /// Get the number of entries in an array or hash node.
+    pub fn len(&self) -> Result<usize> {
+        match self.node() {
+            Node::Array(span) | Node::Hash(span) => Ok(span.len as usize),
+            Node::Table(table) => Ok(self.arena.tables[table as usize].rows as usize),
+            Node::Row { table, row } => Ok(self.arena.tables[table as usize]
+                .columns
+                .iter()
+                .filter(|column| column.is_present(row as usize))
+                .count()),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Check if an array or hash node has no entries.
+    pub fn is_empty(&self) -> Result<bool> {
+        self.len().map(|len| len == 0)
+    }
+
+    /// Look up a key in a hash node. Returns `Ok(None)` if the key is not present.
+    pub fn get(&self, key: &str) -> Result<Option<ArenaNode<'a>>> {
+        match self.node() {
+            Node::Hash(span) => {
+                let range = span.range();
+                Ok(self.arena.keys[range.clone()]
+                    .binary_search_by(|k| self.arena.str(*k).cmp(key))
+                    .ok()
+                    .map(|i| self.child(range.start + i)))
+            }
+            Node::Row { table, row } => Ok(self.arena.tables[table as usize]
+                .keys
+                .binary_search_by(|k| self.arena.str(*k).cmp(key))
+                .ok()
+                .and_then(|column| self.cell(table, column, row))
+                .map(|(_, node)| node)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Get the node at an index in an array node.
+    pub fn at(&self, index: usize) -> Result<ArenaNode<'a>> {
+        match self.node() {
+            Node::Array(span) if index < span.len as usize => {
+                Ok(self.child(span.start as usize + index))
+            }
+            Node::Table(table) if index < self.arena.tables[table as usize].rows as usize => {
+                Ok(self.with(Node::Row {
+                    table,
+                    row: index as u32,
+                }))
+            }
+            Node::Array(_) | Node::Table(_) => {
+                Err(BymlError::DataError("array index out of bounds"))
+            }
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Iterate over the entries of a hash node in key order.
+    pub fn hash_iter(&self) -> Result<impl Iterator<Item = (&'a str, ArenaNode<'a>)>> {
+        let (range, row) = match self.node() {
+            Node::Hash(span) => (span.range(), None),
+            Node::Row { table, row } => (
+                0..self.arena.tables[table as usize].columns.len(),
+                Some((table, row)),
+            ),
+            _ => return Err(BymlError::TypeError),
+        };
+        let this = *self;
+        Ok(range.filter_map(move |i| match row {
+            None => Some(this.entry(i)),
+            Some((table, row)) => this.cell(table, i, row),
+        }))
+    }
+
+    /// Iterate over the items of an array node.
+    pub fn array_iter(&self) -> Result<impl Iterator<Item = ArenaNode<'a>>> {
+        let (range, table) = match self.node() {
+            Node::Array(span) => (span.range(), None),
+            Node::Table(table) => (
+                0..self.arena.tables[table as usize].rows as usize,
+                Some(table),
+            ),
+            _ => return Err(BymlError::TypeError),
+        };
+        let this = *self;
+        Ok(range.map(move |i| match table {
+            None => this.child(i),
+            Some(table) => this.with(Node::Row {
+                table,
+                row: i as u32,
+            }),
+        }))
+    }
+
+    /// Get the column of a table for a key. Returns `Ok(None)` if no row has
+    /// the key, or a type error if the node is not a table.
+    pub fn column(&self, key: &str) -> Result<Option<ArenaColumn<'a>>> {
+        match self.node() {
+            Node::Table(table) => Ok(ArenaColumn::find(self.arena, table, key)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Iterate over the columns of a table in key order.
+    pub fn columns(&self) -> Result<impl Iterator<Item = ArenaColumn<'a>>> {
+        match self.node() {
+            Node::Table(table) => Ok(ArenaColumn::all(self.arena, table)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the boolean value or a type error
+    pub fn as_bool(&self) -> Result<bool> {
+        match self.node() {
+            Node::Bool(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the s32 value or a type error
+    pub fn as_int(&self) -> Result<i32> {
+        match self.node() {
+            Node::Int(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u32 value or a type error
+    pub fn as_uint(&self) -> Result<u32> {
+        match self.node() {
+            Node::UInt(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f32 value or a type error
+    pub fn as_float(&self) -> Result<f32> {
+        match self.node() {
+            Node::Float(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the i64 value or a type error
+    pub fn as_int64(&self) -> Result<i64> {
+        match self.node() {
+            Node::Int64(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u64 value or a type error
+    pub fn as_uint64(&self) -> Result<u64> {
+        match self.node() {
+            Node::UInt64(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f64 value or a type error
+    pub fn as_double(&self) -> Result<f64> {
+        match self.node() {
+            Node::Double(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with a string slice borrowed from the arena or a type error
+    pub fn as_string(&self) -> Result<&'a str> {
+        match self.node() {
+            Node::String(span) => Ok(self.arena.str(span)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with a byte slice borrowed from the arena or a type error
+    pub fn as_binary(&self) -> Result<&'a [u8]> {
+        match self.node() {
+            Node::Binary(span) => Ok(&self.arena.bytes[span.range()]),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Copy this node and everything below it into an owned `Byml`. Each
+    /// distinct hash key is allocated once.
+    pub fn to_byml(&self) -> Byml {
+        self.to_byml_with_pool(&mut KeyPool::new())
+    }
+
+    /// Copy this node and everything below it into an owned `Byml`, taking
+    /// hash keys from a pool shared with other documents.
+    pub fn to_byml_with_pool(&self, pool: &mut KeyPool) -> Byml {
+        match self.node() {
+            Node::Null => Byml::Null,
+            Node::Bool(v) => Byml::Bool(v),
+            Node::Int(v) => Byml::Int(v),
+            Node::UInt(v) => Byml::UInt(v),
+            Node::Float(v) => Byml::Float(v),
+            Node::Int64(v) => Byml::Int64(v),
+            Node::UInt64(v) => Byml::UInt64(v),
+            Node::Double(v) => Byml::Double(v),
+            Node::String(span) => Byml::String(self.arena.str(span).to_owned()),
+            Node::Binary(span) => Byml::Binary(self.arena.bytes[span.range()].to_vec()),
+            Node::Array(_) | Node::Table(_) => Byml::Array(
+                self.array_iter()
+                    .unwrap()
+                    .map(|item| item.to_byml_with_pool(pool))
+                    .collect(),
+            ),
+            Node::Hash(_) | Node::Row { .. } => Byml::Hash(
+                self.hash_iter()
+                    .unwrap()
+                    .map(|(key, value)| (pool.intern(key), value.to_byml_with_pool(pool)))
+                    .collect::<Hash>(),
+            ),
+        }
+    }
+}
+
+/// A borrowed handle to one column of a table in a [`BymlArena`]: the values
+/// of one key in every row.
+///
+/// Columns whose values all have the same scalar type can be read as a slice.
+/// Rows that do not have the key hold the default value in the slice, so
+/// check [`ArenaColumn::is_present`] unless the column [is
+/// dense](ArenaColumn::is_dense). Columns of hashes that mostly share their
+/// keys are tables themselves and have columns of their own.
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaColumn<'a> {
+    arena: &'a BymlArena,
+    table: u32,
+    index: usize,
+}
+
+impl<'a> ArenaColumn<'a> {
+    fn find(arena: &'a BymlArena, table: u32, key: &str) -> Option<ArenaColumn<'a>> {
+        arena.tables[table as usize]
+            .keys
+            .binary_search_by(|k| arena.str(*k).cmp(key))
+            .ok()
+            .map(|index| ArenaColumn {
+                arena,
+                table,
+                index,
+            })
+    }
+
+    fn all(arena: &'a BymlArena, table: u32) -> impl Iterator<Item = ArenaColumn<'a>> {
+        (0..arena.tables[table as usize].columns.len()).map(move |index| ArenaColumn {
+            arena,
+            table,
+            index,
+        })
+    }
+
+    #[inline]
+    fn data(&self) -> &'a Column {
+        &self.arena.tables[self.table as usize].columns[self.index]
+    }
+
+    /// Get the key of the column.
+    pub fn key(&self) -> &'a str {
+        self.arena
+            .str(self.arena.tables[self.table as usize].keys[self.index])
+    }
+
+    /// Get the number of rows in the table.
+    pub fn len(&self) -> usize {
+        self.arena.tables[self.table as usize].rows as usize
+    }
+
+    /// Check if the table has no rows.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Check if every row has the key.
+    pub fn is_dense(&self) -> bool {
+        self.data().present.is_empty()
+    }
+
+    /// Check if a row has the key.
+    pub fn is_present(&self, row: usize) -> bool {
+        row < self.len() && self.data().is_present(row)
+    }
+
+    /// Get the value of a row, if the row has the key.
+    pub fn get(&self, row: usize) -> Option<ArenaNode<'a>> {
+        if self.is_present(row) {
+            Some(ArenaNode {
+                arena: self.arena,
+                node: self.data().node(self.arena, row),
+            })
+        } else {
+            None
+        }
+    }
+
+    /// Iterate over the values of every row, with `None` for rows that do
+    /// not have the key.
+    pub fn iter(&self) -> impl Iterator<Item = Option<ArenaNode<'a>>> {
+        let this = *self;
+        (0..self.len()).map(move |row| this.get(row))
+    }
+
+    /// Get a column of the table that this column's hashes are stored in.
+    /// Returns `Ok(None)` if none of them has the key, or a type error if the
+    /// column does not only hold hashes.
+    pub fn column(&self, key: &str) -> Result<Option<ArenaColumn<'a>>> {
+        match self.data().values {
+            Values::Table(table) => Ok(ArenaColumn::find(self.arena, table, key)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the boolean values or a type error
+    pub fn as_bools(&self) -> Result<&'a [bool]> {
+        match &self.data().values {
+            Values::Bool(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the s32 values or a type error
+    pub fn as_ints(&self) -> Result<&'a [i32]> {
+        match &self.data().values {
+            Values::Int(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u32 values or a type error
+    pub fn as_uints(&self) -> Result<&'a [u32]> {
+        match &self.data().values {
+            Values::UInt(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f32 values or a type error
+    pub fn as_floats(&self) -> Result<&'a [f32]> {
+        match &self.data().values {
+            Values::Float(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the i64 values or a type error
+    pub fn as_int64s(&self) -> Result<&'a [i64]> {
+        match &self.data().values {
+            Values::Int64(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u64 values or a type error
+    pub fn as_uint64s(&self) -> Result<&'a [u64]> {
+        match &self.data().values {
+            Values::UInt64(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f64 values or a type error
+    pub fn as_doubles(&self) -> Result<&'a [f64]> {
+        match &self.data().values {
+            Values::Double(v) => Ok(v),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with an iterator over the string values or a type
+    /// error. Rows that do not have the key yield an empty string.
+    pub fn as_strings(&self) -> Result<impl Iterator<Item = &'a str>> {
+        match &self.data().values {
+            Values::String(v) => {
+                let arena = self.arena;
+                Ok(v.iter().map(move |span| arena.str(*span)))
+            }
+            _ => Err(BymlError::TypeError),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::BymlArena;
+    use crate::{
+        byml::{Byml, BymlError, Key},
+        Endian,
+    };
+
+    #[test]
+    fn arena_roundtrip() {
+        let byml = Byml::Hash(
+            vec![
+                (
+                    "Actors".into(),
+                    Byml::Array(vec![
+                        Byml::Hash(
+                            vec![
+                                ("name".into(), Byml::String("Enemy_Bokoblin".to_owned())),
+                                ("life".into(), Byml::Int(13)),
+                                ("data".into(), Byml::Binary(vec![1, 2, 3])),
+                            ]
+                            .into_iter()
+                            .collect(),
+                        ),
+                        Byml::Hash(
+                            vec![
+                                ("name".into(), Byml::String("name".to_owned())),
+                                ("speed".into(), Byml::Double(1.5)),
+                            ]
+                            .into_iter()
+                            .collect(),
+                        ),
+                    ]),
+                ),
+                (
+                    "Hashes".into(),
+                    Byml::Array(vec![Byml::UInt(31119), Byml::Int64(-1)]),
+                ),
+                ("Null".into(), Byml::Null),
+            ]
+            .into_iter()
+            .collect(),
+        );
+        let arena = BymlArena::from_byml(&byml);
+        assert_eq!(arena.node_count(), 13);
+        assert_eq!(arena.to_byml(), byml);
+        // Equal keys share one allocation
+        let owned = arena.to_byml();
+        let names: Vec<&Key> = owned["Actors"]
+            .as_array()
+            .unwrap()
+            .iter()
+            .map(|actor| {
+                actor
+                    .as_hash()
+                    .unwrap()
+                    .keys()
+                    .find(|k| *k == "name")
+                    .unwrap()
+            })
+            .collect();
+        assert!(names[0].ptr_eq(names[1]));
+        for endian in [Endian::Big, Endian::Little] {
+            let binary = byml.to_binary(endian);
+            assert_eq!(BymlArena::from_binary(&binary).unwrap(), arena);
+        }
+
+        let root = arena.root();
+        let actors = root.get("Actors").unwrap().unwrap();
+        assert_eq!(actors.len().unwrap(), 2);
+        let bokoblin = actors.at(0).unwrap();
+        assert_eq!(
+            bokoblin.get("name").unwrap().unwrap().as_string().unwrap(),
+            "Enemy_Bokoblin"
+        );
+        assert_eq!(bokoblin.get("life").unwrap().unwrap().as_int().unwrap(), 13);
+        assert_eq!(
+            bokoblin.get("data").unwrap().unwrap().as_binary().unwrap(),
+            &[1, 2, 3]
+        );
+        assert!(bokoblin.get("speed").unwrap().is_none());
+        let keys: Vec<&str> = actors
+            .at(1)
+            .unwrap()
+            .hash_iter()
+            .unwrap()
+            .map(|(k, _)| k)
+            .collect();
+        assert_eq!(keys, ["name", "speed"]);
+        assert!(root.get("Null").unwrap().unwrap().is_null());
+        assert!(matches!(actors.at(2), Err(BymlError::DataError(_))));
+        assert!(matches!(actors.get("name"), Err(BymlError::TypeError)));
+        assert!(matches!(root.as_int(), Err(BymlError::TypeError)));
+    }
+
+    #[test]
+    fn sparse_nested_hashes() {
+        let text = r#"
+Objs:
+  - {Id: 1, Params: {A: 1}}
+  - {Id: 2, Params: {B: 2}}
+  - {Id: 3, Params: {C: 3}}
+  - {Id: 4, Params: {D: 4}}
+"#;
+        let byml = Byml::from_text(text).unwrap();
+        let binary = byml.to_binary(Endian::Little);
+        let arena = BymlArena::from_binary_columnar(&binary).unwrap();
+        // The parameters share no keys, so they stay separate hashes
+        assert_eq!(arena.table_count(), 1);
+        assert_eq!(arena.to_byml(), byml);
+        let objs = arena.root().get("Objs").unwrap().unwrap();
+        let params = objs.at(2).unwrap().get("Params").unwrap().unwrap();
+        assert!(params.is_hash() && !params.is_table());
+        assert_eq!(params.get("C").unwrap().unwrap().as_int().unwrap(), 3);
+    }
+
+    #[test]
+    fn columnar_tables() {
+        let text = r#"
+Objs:
+  - {HashId: !u 0x1, Translate: {X: 1.0, Y: 2.0, Z: 3.0}, UnitConfigName: Obj_Tree,
+     Links: [{DefinitionName: Link, DestUnitHashId: !u 0x2}]}
+  - {HashId: !u 0x2, Translate: {X: 4.0, Y: 5.0, Z: 6.0}, UnitConfigName: Obj_Rock}
+  - {HashId: !u 0x3, Translate: {X: 7.0, Z: 9.0}, UnitConfigName: Obj_Tree, Rotate: 0.5}
+  - {HashId: !u 0x4, Translate: {X: 10.0, Y: 11.0, Z: 12.0}, UnitConfigName: Obj_Bush,
+     Rotate: [0.0, 1.5, 0.0]}
+Pairs: [{A: 1}, {A: 2}]
+Mixed: [{A: 1}, {B: 2}, {C: 3}, {D: 4}]
+"#;
+        let byml = Byml::from_text(text).unwrap();
+        let binary = byml.to_binary(Endian::Little);
+        let arena = BymlArena::from_binary_columnar(&binary).unwrap();
+        // Only the object list and its translations are stored as tables
+        assert_eq!(arena.table_count(), 2);
+        assert!(arena.node_count() < BymlArena::from_binary(&binary).unwrap().node_count());
+        assert_eq!(arena.to_byml(), byml);
+        let view = crate::byml::BymlView::new(&binary).unwrap();
+        assert_eq!(BymlArena::from_view_columnar(view).unwrap(), arena);
+
+        let root = arena.root();
+        let objs = root.get("Objs").unwrap().unwrap();
+        assert!(objs.is_table() && objs.is_array());
+        assert!(!root.get("Pairs").unwrap().unwrap().is_table());
+        assert!(!root.get("Mixed").unwrap().unwrap().is_table());
+
+        // Rows look like hash nodes
+        assert_eq!(objs.len().unwrap(), 4);
+        let rock = objs.at(1).unwrap();
+        assert!(rock.is_hash());
+        assert_eq!(rock.len().unwrap(), 3);
+        assert_eq!(
+            rock.get("UnitConfigName")
+                .unwrap()
+                .unwrap()
+                .as_string()
+                .unwrap(),
+            "Obj_Rock"
+        );
+        assert!(rock.get("Links").unwrap().is_none());
+        assert!(rock.get("Missing").unwrap().is_none());
+        let keys: Vec<&str> = objs
+            .at(2)
+            .unwrap()
+            .hash_iter()
+            .unwrap()
+            .map(|(k, _)| k)
+            .collect();
+        assert_eq!(keys, ["HashId", "Rotate", "Translate", "UnitConfigName"]);
+        let translate = objs.at(2).unwrap().get("Translate").unwrap().unwrap();
+        assert!(translate.get("Y").unwrap().is_none());
+        assert_eq!(
+            translate.get("Z").unwrap().unwrap().as_float().unwrap(),
+            9.0
+        );
+        let link = objs
+            .at(0)
+            .unwrap()
+            .get("Links")
+            .unwrap()
+            .unwrap()
+            .at(0)
+            .unwrap();
+        assert_eq!(
+            link.get("DestUnitHashId")
+                .unwrap()
+                .unwrap()
+                .as_uint()
+                .unwrap(),
+            2
+        );
+        assert!(matches!(objs.at(4), Err(BymlError::DataError(_))));
+
+        // Columns can be scanned directly
+        let ids = objs.column("HashId").unwrap().unwrap();
+        assert!(ids.is_dense());
+        assert_eq!(ids.as_uints().unwrap(), &[1, 2, 3, 4]);
+        let translate = objs.column("Translate").unwrap().unwrap();
+        let x = translate.column("X").unwrap().unwrap();
+        assert_eq!(x.as_floats().unwrap(), &[1.0, 4.0, 7.0, 10.0]);
+        let y = translate.column("Y").unwrap().unwrap();
+        assert!(!y.is_dense() && !y.is_present(2) && y.get(2).is_none());
+        assert_eq!(y.as_floats().unwrap(), &[2.0, 5.0, 0.0, 11.0]);
+        let names: Vec<&str> = objs
+            .column("UnitConfigName")
+            .unwrap()
+            .unwrap()
+            .as_strings()
+            .unwrap()
+            .collect();
+        assert_eq!(names, ["Obj_Tree", "Obj_Rock", "Obj_Tree", "Obj_Bush"]);
+        let rotate = objs.column("Rotate").unwrap().unwrap();
+        assert!(matches!(rotate.as_floats(), Err(BymlError::TypeError)));
+        let rotate: Vec<Option<Byml>> = rotate.iter().map(|v| v.map(|v| v.to_byml())).collect();
+        assert_eq!(rotate[2], Some(Byml::Float(0.5)));
+        assert_eq!(rotate[3], Some(byml["Objs"][3]["Rotate"].clone()));
+        let columns: Vec<&str> = objs.columns().unwrap().map(|c| c.key()).collect();
+        assert_eq!(
+            columns,
+            ["HashId", "Links", "Rotate", "Translate", "UnitConfigName"]
+        );
+        assert!(objs.column("Missing").unwrap().is_none());
+        assert!(matches!(ids.column("X"), Err(BymlError::TypeError)));
+        assert!(matches!(root.column("Objs"), Err(BymlError::TypeError)));
+    }
+
+    #[test]
+    fn cyclic_containers() {
+        let byml = Byml::from_text("{A: [1]}").unwrap();
+        let mut bytes = byml.to_binary(Endian::Little);
+        // Make the root's only entry a hash that is the root itself
+        let root = u32::from_le_bytes([bytes[12], bytes[13], bytes[14], bytes[15]]) as usize;
+        bytes[root + 7] = 0xC1;
+        bytes[root + 8..root + 12].copy_from_slice(&(root as u32).to_le_bytes());
+        assert!(matches!(
+            BymlArena::from_binary(&bytes),
+            Err(BymlError::DataError(_))
+        ));
+    }
+}
@@ -0,0 +1,142 @@
+//! Structural hashing and diffing of BYML documents.
+use super::{Byml, BymlIndex};
+use std::hash::{Hash, Hasher};
+use xxhash_rust::xxh3::Xxh3;
+
+fn write_node(state: &mut Xxh3, node: &Byml) {
+    std::mem::discriminant(node).hash(state);
+    match node {
+        Byml::Null => (),
+        Byml::String(v) => v.hash(state),
+        Byml::Binary(v) => v.hash(state),
+        Byml::Array(items) => {
+            state.write_usize(items.len());
+            for item in items {
+                write_node(state, item);
+            }
+        }
+        Byml::Hash(hash) => {
+            state.write_usize(hash.len());
+            for (key, value) in hash {
+                key.as_str().hash(state);
+                write_node(state, value);
+            }
+        }
+        Byml::Bool(v) => state.write_u8(*v as u8),
+        Byml::Int(v) => state.write_i32(*v),
+        // Adding zero turns -0.0 into 0.0, so both zeros hash alike, as they compare equal
+        Byml::Float(v) => state.write_u32((v + 0.0).to_bits()),
+        Byml::UInt(v) => state.write_u32(*v),
+        Byml::Int64(v) => state.write_i64(*v),
+        Byml::UInt64(v) => state.write_u64(*v),
+        Byml::Double(v) => state.write_u64((v + 0.0).to_bits()),
+    }
+}
+
+fn diff<'a>(
+    a: &'a Byml,
+    b: &'a Byml,
+    path: &mut Vec<BymlIndex<'a>>,
+    out: &mut Vec<Vec<BymlIndex<'a>>>,
+) {
+    // Diff a pair of children, or report a child that only one side has
+    let mut child = |index, a: Option<&'a Byml>, b: Option<&'a Byml>| {
+        path.push(index);
+        match (a, b) {
+            (Some(a), Some(b)) => diff(a, b, path, out),
+            _ => out.push(path.clone()),
+        }
+        path.pop();
+    };
+    match (a, b) {
+        (Byml::Array(a), Byml::Array(b)) => {
+            for i in 0..a.len().max(b.len()) {
+                child(BymlIndex::ArrayIdx(i), a.get(i), b.get(i));
+            }
+        }
+        (Byml::Hash(a), Byml::Hash(b)) => {
+            for (key, value) in a {
+                child(BymlIndex::HashIdx(key), Some(value), b.get(key));
+            }
+            for (key, value) in b.iter().filter(|(key, _)| !a.contains_key(*key)) {
+                child(BymlIndex::HashIdx(key), None, Some(value));
+            }
+        }
+        _ => {
+            if a != b {
+                out.push(path.clone());
+            }
+        }
+    }
+}
+
+impl Byml {
+    /// A hash of the node and all of its children, computed in a single pass
+    /// without serializing anything. Equal nodes always have equal hashes.
+    ///
+    /// Unlike the parameter archive hashes, this is not cached: the contents of
+    /// a `Byml` can be changed through any of its variants without going
+    /// through a method that could invalidate a cache.
+    pub fn structural_hash(&self) -> u64 {
+        let mut state = Xxh3::new();
+        write_node(&mut state, self);
+        state.finish()
+    }
+
+    /// List the paths of the nodes that were added, removed or changed in
+    /// `other`, from this node down. Changed nodes are reported at the deepest
+    /// level where they still have the same type; an empty path means the
+    /// nodes themselves differ.
+    /// ```
+    /// # use roead::byml::{Byml, BymlIndex};
+    /// let a = Byml::Array(vec![Byml::Int(1), Byml::Int(2)]);
+    /// let b = Byml::Array(vec![Byml::Int(1), Byml::Int(3), Byml::Null]);
+    /// assert_eq!(
+    ///     a.diff(&b),
+    ///     vec![vec![BymlIndex::ArrayIdx(1)], vec![BymlIndex::ArrayIdx(2)]]
+    /// );
+    /// ```
+    pub fn diff<'a>(&'a self, other: &'a Byml) -> Vec<Vec<BymlIndex<'a>>> {
+        let mut out = Vec::new();
+        diff(self, other, &mut Vec::new(), &mut out);
+        out
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::byml::{Byml, BymlIndex};
+
+    #[test]
+    fn hash_and_diff() {
+        let base = Byml::from_text(
+            "Actors:\n\
+             - {name: Enemy_Bokoblin, life: 13, scale: 0.35}\n\
+             - {name: Enemy_Lizalfos, life: 24, scale: 1.0}\n\
+             Hashes: [31119, 1031290, 1035142]\n",
+        )
+        .unwrap();
+        let mut byml = base.clone();
+        assert_eq!(base.structural_hash(), byml.structural_hash());
+        assert!(base.diff(&byml).is_empty());
+
+        byml["Actors"][1]["name"] = Byml::String("Changed".to_owned());
+        byml.as_mut_hash().unwrap().remove("Hashes");
+        assert_ne!(base.structural_hash(), byml.structural_hash());
+        assert_eq!(
+            base.diff(&byml),
+            vec![
+                vec![
+                    BymlIndex::HashIdx("Actors"),
+                    BymlIndex::ArrayIdx(1),
+                    BymlIndex::HashIdx("name")
+                ],
+                vec![BymlIndex::HashIdx("Hashes")],
+            ]
+        );
+        assert_eq!(
+            Byml::Float(0.0).structural_hash(),
+            Byml::Float(-0.0).structural_hash()
+        );
+    }
+}
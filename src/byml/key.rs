@@ -0,0 +1,155 @@
+//! Interned hash keys.
+//!
+//! BYML documents reuse a small set of keys across thousands of hash nodes.
+//! Every [`Key`] with the same text that comes from the same parse shares
+//! one allocation. A [`KeyPool`] can be passed to several parses so whole
+//! sets of documents share their keys too.
+use std::{
+    borrow::Borrow,
+    collections::HashSet,
+    fmt,
+    hash::{Hash, Hasher},
+    ops::Deref,
+    sync::Arc,
+};
+
+/// A reference-counted, immutable hash key. Cloning a key does not
+/// allocate. Keys dereference to `str` and order like strings, so hashes
+/// can be indexed and searched with plain `&str`s.
+#[derive(Clone, PartialOrd, Ord)]
+pub struct Key(Arc<str>);
+
+impl Key {
+    /// Get the key as a string slice.
+    #[inline]
+    pub fn as_str(&self) -> &str {
+        &self.0
+    }
+
+    /// Check if two keys share the same allocation.
+    #[inline]
+    pub fn ptr_eq(&self, other: &Key) -> bool {
+        Arc::ptr_eq(&self.0, &other.0)
+    }
+}
+
+impl PartialEq for Key {
+    #[inline]
+    fn eq(&self, other: &Key) -> bool {
+        self.ptr_eq(other) || self.0 == other.0
+    }
+}
+
+impl Eq for Key {}
+
+impl Hash for Key {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.0.hash(state)
+    }
+}
+
+impl PartialEq<str> for Key {
+    fn eq(&self, other: &str) -> bool {
+        &*self.0 == other
+    }
+}
+
+impl PartialEq<&str> for Key {
+    fn eq(&self, other: &&str) -> bool {
+        &*self.0 == *other
+    }
+}
+
+impl Deref for Key {
+    type Target = str;
+
+    #[inline]
+    fn deref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl AsRef<str> for Key {
+    fn as_ref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl Borrow<str> for Key {
+    fn borrow(&self) -> &str {
+        &self.0
+    }
+}
+
+impl fmt::Debug for Key {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(&*self.0, f)
+    }
+}
+
+impl fmt::Display for Key {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Display::fmt(&*self.0, f)
+    }
+}
+
+impl From<&str> for Key {
+    fn from(key: &str) -> Self {
+        Key(key.into())
+    }
+}
+
+impl From<String> for Key {
+    fn from(key: String) -> Self {
+        Key(key.into())
+    }
+}
+
+impl From<&String> for Key {
+    fn from(key: &String) -> Self {
+        Key(key.as_str().into())
+    }
+}
+
+impl From<Key> for String {
+    fn from(key: Key) -> Self {
+        key.0.to_string()
+    }
+}
+
+/// A set of interned keys. Interning the same text twice returns keys that
+/// share one allocation.
+#[derive(Debug, Default, Clone)]
+pub struct KeyPool {
+    keys: HashSet<Key>,
+}
+
+impl KeyPool {
+    /// Create an empty pool.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Get the pooled key for a string, adding it if it is not in the pool
+    /// yet.
+    pub fn intern(&mut self, key: &str) -> Key {
+        match self.keys.get(key) {
+            Some(key) => key.clone(),
+            None => {
+                let key = Key::from(key);
+                self.keys.insert(key.clone());
+                key
+            }
+        }
+    }
+
+    /// Get the number of distinct keys in the pool.
+    pub fn len(&self) -> usize {
+        self.keys.len()
+    }
+
+    /// Check if the pool is empty.
+    pub fn is_empty(&self) -> bool {
+        self.keys.is_empty()
+    }
+}
@@ -1,4 +1,4 @@
-//! Bindings for the `oead::byml` module.
+//! Reading and writing binary and text BYML documents, compatible with `oead::byml`.
 //! 
 //! A `Byml` type will usually be constructed from binary data or a YAML string,
 //! e.g.
@@ -28,18 +28,20 @@
 //!
 //! A number of convenience getters are available which return a result for a variant value:
 //! ```
-//! # use roead::byml::Byml;
+//! # use roead::byml::{Byml, Key};
 //! # use std::collections::BTreeMap;
 //! # fn docttest() -> Result<(), Box<dyn std::error::Error>> {
 //! # let some_data = b"BYML";
 //! let doc = Byml::from_binary(some_data)?;
-//! let hash: &BTreeMap<String, Byml> = doc.as_hash()?;
+//! let hash: &BTreeMap<Key, Byml> = doc.as_hash()?;
 //! # Ok(())
 //! # }
 //! ```
 //!
 //! Most of the node types are fairly self-explanatory. Arrays are implemented as `Vec<Byml>`, and
-//! hash nodes as `BTreeMap<String, Byml>`.
+//! hash nodes as `BTreeMap<Key, Byml>`. A [`Key`] is an interned, reference-counted string, so
+//! every hash in a document shares one allocation per distinct key. Keys can be looked up with
+//! plain `&str`s, and created from strings with `into()`.
 //!
 //! For convenience, a `Byml` *known* to be an array or hash node can be indexed. **Panics if the
 //! node has the wrong type, the index has the wrong type, or the index is not found**.
@@ -53,12 +55,49 @@
 //! # Ok(())
 //! # }
 //! ```
-use crate::{ffi, Endian};
+//!
+//! When only a few values are needed from a large document, a [`BymlView`] can read them
+//! straight out of the binary data without building a `Byml` tree at all:
+//! ```
+//! # use roead::{byml::{Byml, BymlView}, Endian};
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let text = "{Actors: [{name: Enemy_Lynel_Dark}], Hashes: [31119, 32257]}";
+//! let buf: Vec<u8> = Byml::from_text(text)?.to_binary(Endian::Big);
+//! let actor_info = BymlView::new(&buf)?;
+//! assert_eq!(actor_info.get("Hashes")?.unwrap().at(0)?.as_int()?, 31119);
+//! # Ok(())
+//! # }
+//! ```
+//!
+//! A [`BymlArena`] decodes the whole document into a few flat buffers with the same accessors as
+//! a view. It is cheaper to build and drop than a `Byml` tree, which helps when many documents
+//! are parsed at once and nothing needs to be modified. In columnar mode, arrays of hashes that
+//! share their keys are stored as tables with one typed column per key, which takes far less
+//! memory for map units and `ActorInfo`, and lets one value of every hash be read as a slice.
+//!
+//! To change a few values in a large binary document, a [`BymlPatch`] writes only the containers
+//! on the paths to the edits again and copies everything else as it is.
+use crate::{
+    stats::{self, Format, Phase},
+    Endian,
+};
 use std::{
     collections::BTreeMap,
     ops::{Index, IndexMut},
+    sync::Arc,
 };
 use thiserror::Error;
+mod arena;
+mod diff;
+mod key;
+mod patch;
+mod text;
+mod view;
+mod writer;
+pub use arena::{ArenaColumn, ArenaNode, BymlArena};
+pub use key::{Key, KeyPool};
+pub use patch::BymlPatch;
+pub use view::BymlView;
 
 /// An error when serializing/deserializing BYML documents
 #[derive(Error, Debug)]
@@ -69,15 +108,19 @@ pub enum BymlError {
     Yaz0Error(#[from] crate::yaz0::Yaz0Error),
     #[error("BYML value is not of expected type")]
     TypeError,
-    /// Wraps any other error returned by `oead` in C++
-    #[error("Failed to parse BYML: {0}")]
-    OeadError(#[from] cxx::Exception),
+    #[error("Invalid BYML data: {0}")]
+    DataError(&'static str),
+    #[error("Invalid BYML text: {0}")]
+    TextError(String),
+    #[error("Invalid BYML patch: {0}")]
+    PatchError(String),
 }
 
 pub type Result<T> = std::result::Result<T, BymlError>;
-pub type Hash = BTreeMap<String, Byml>;
+pub type Hash = BTreeMap<Key, Byml>;
 
 /// Convenience type used for indexing into `Byml`s
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum BymlIndex<'a> {
     HashIdx(&'a str),
     ArrayIdx(usize),
@@ -304,30 +347,40 @@ impl Byml {
     
     /// Load a document from binary data.
     pub fn from_binary(data: &[u8]) -> Result<Self> {
-        let byml = ffi::BymlFromBinary(data)?;
-        Ok(match byml.GetType() {
-            ffi::BymlType::Hash | ffi::BymlType::Array | ffi::BymlType::Null => {
-                Self::from_ffi(byml.as_ref().unwrap())
-            }
-            _ => unreachable!(),
-        })
+        let _span = stats::span(Format::Byml, Phase::Parse, data.len());
+        BymlView::new(data)?.to_byml()
+    }
+
+    /// Load a document from binary data, taking hash keys from a pool. Documents loaded with the
+    /// same pool share one allocation per distinct key.
+    pub fn from_binary_with_pool(data: &[u8], pool: &mut KeyPool) -> Result<Self> {
+        let _span = stats::span(Format::Byml, Phase::Parse, data.len());
+        BymlView::new(data)?.to_byml_with_pool(pool)
+    }
+
+    /// Load a document from binary data through the process-wide [`ParseCache`], so
+    /// byte-identical data is only parsed once while it stays cached. See the
+    /// [`cache`](crate::cache) module.
+    ///
+    /// [`ParseCache`]: crate::cache::ParseCache
+    pub fn from_binary_cached(data: &[u8]) -> Result<Arc<Self>> {
+        crate::cache::ParseCache::global().get_or_parse(data)
     }
 
     /// Load a document from YAML text.
     pub fn from_text<S: AsRef<str>>(text: S) -> Result<Self> {
-        let byml = ffi::BymlFromText(text.as_ref())?;
-        Ok(match byml.GetType() {
-            ffi::BymlType::Hash | ffi::BymlType::Array | ffi::BymlType::Null => {
-                Self::from_ffi(byml.as_ref().unwrap())
-            }
-            _ => unreachable!(),
-        })
+        let text = text.as_ref();
+        let _span = stats::span(Format::Byml, Phase::Parse, text.len());
+        text::from_text(text)
     }
 
     /// Serialize the document to YAML. This can only be done for Null, Array or Hash nodes.
     pub fn to_text(&self) -> String {
         if matches!(self, Byml::Array(_) | Byml::Hash(_) | Byml::Null) {
-            ffi::BymlToText(self)
+            let mut span = stats::span(Format::Byml, Phase::Serialize, 0);
+            let text = text::to_text(self);
+            span.set_bytes(text.len());
+            text
         } else {
             panic!("Root node must be an array, hash, or null value")
         }
@@ -336,11 +389,7 @@ impl Byml {
     /// Serialize the document to BYML with the specified endianness and default version (2). 
     /// This can only be done for Null, Array or Hash nodes.
     pub fn to_binary(&self, endian: Endian) -> Vec<u8> {
-        if matches!(self, Byml::Array(_) | Byml::Hash(_) | Byml::Null) {
-            ffi::BymlToBinary(self, matches!(endian, Endian::Big), 2)
-        } else {
-            panic!("Root node must be an array, hash, or null value")
-        }
+        self.to_binary_with_version(endian, 2)
     }
 
     /// Serialize the document to BYML with the specified endianness and version number. 
@@ -350,75 +399,125 @@ impl Byml {
             panic!("Version must be <= 4")
         }
         if matches!(self, Byml::Array(_) | Byml::Hash(_) | Byml::Null) {
-            ffi::BymlToBinary(self, matches!(endian, Endian::Big), version as usize)
+            let mut span = stats::span(Format::Byml, Phase::Serialize, 0);
+            let data = writer::Layout::new(self, endian, version as u16, false).to_vec();
+            span.set_bytes(data.len());
+            data
         } else {
             panic!("Root node must be an array, hash, or null value")
         }
     }
 
-    fn from_ffi(byml: &ffi::Byml) -> Self {
-        match byml.GetType() {
-            ffi::BymlType::Hash => Self::Hash({
-                let chash = byml.GetHash();
-                let keys = ffi::GetHashKeys(chash);
-                keys.iter()
-                    .map(|k| (k.to_str().unwrap().to_owned(), Self::from_ffi(chash.at(k))))
-                    .collect()
-            }),
-            ffi::BymlType::Bool => Byml::Bool(byml.GetBool()),
-            ffi::BymlType::Binary => Byml::Binary(byml.GetBinary().iter().copied().collect()),
-            ffi::BymlType::Int => Byml::Int(byml.GetInt()),
-            ffi::BymlType::UInt => Byml::UInt(byml.GetUInt()),
-            ffi::BymlType::Int64 => Byml::Int64(byml.GetInt64()),
-            ffi::BymlType::UInt64 => Byml::UInt64(byml.GetUInt64()),
-            ffi::BymlType::Float => Byml::Float(byml.GetFloat()),
-            ffi::BymlType::Double => Byml::Double(byml.GetDouble()),
-            ffi::BymlType::String => Byml::String(byml.GetString().to_str().unwrap().to_owned()),
-            ffi::BymlType::Array => {
-                Self::Array(byml.GetArray().iter().map(Self::from_ffi).collect())
-            }
-            _ => Self::Null,
+    /// Serialize the document to BYML with the specified endianness and default version (2),
+    /// using the rayon thread pool. The output is identical to [`Byml::to_binary`]; this is
+    /// only faster for large documents. This can only be done for Null, Array or Hash nodes.
+    pub fn to_binary_parallel(&self, endian: Endian) -> Vec<u8> {
+        if matches!(self, Byml::Array(_) | Byml::Hash(_) | Byml::Null) {
+            let mut span = stats::span(Format::Byml, Phase::Serialize, 0);
+            let data = writer::Layout::new(self, endian, 2, true).to_vec();
+            span.set_bytes(data.len());
+            data
+        } else {
+            panic!("Root node must be an array, hash, or null value")
         }
     }
+}
 
-    pub(crate) fn len(&self) -> usize {
-        match self {
-            Byml::Array(v) => v.len(),
-            Byml::Hash(v) => v.len(),
-            _ => unreachable!(),
-        }
+enum Container {
+    Array(Vec<Byml>),
+    Hash(Vec<(Key, Byml)>),
+}
+
+/// Collects a pre-order walk of a document, pushed node by node by the text parser, into a
+/// `Byml` tree.
+#[derive(Default)]
+pub(crate) struct BymlBuilder {
+    stack: Vec<(Container, Option<Key>)>,
+    key: Option<Key>,
+    keys: KeyPool,
+    root: Option<Byml>,
+}
+
+impl BymlBuilder {
+    fn finish(self) -> Byml {
+        self.root.unwrap_or_default()
     }
 
-    pub(crate) fn get_key_by_index(&self, index: usize) -> &String {
-        if let Byml::Hash(h) = self {
-            h.iter().nth(index).unwrap().0
-        } else {
-            unreachable!()
+    fn push(&mut self, node: Byml) {
+        match self.stack.last_mut() {
+            Some((Container::Array(items), _)) => items.push(node),
+            Some((Container::Hash(entries), _)) => {
+                let key = self.key.take().unwrap_or_else(|| Key::from(""));
+                entries.push((key, node))
+            }
+            None => self.root = Some(node),
         }
     }
 
-    pub(crate) fn get(&self, index: usize) -> &Byml {
-        match self {
-            Byml::Hash(h) => h.iter().nth(index).unwrap().1,
-            Byml::Array(a) => a.get(index).unwrap(),
-            _ => unreachable!(),
-        }
+    pub(crate) fn push_null(&mut self) {
+        self.push(Byml::Null)
     }
 
-    pub(crate) fn get_ffi_type(&self) -> ffi::BymlType {
-        match self {
-            Self::Array(_) => ffi::BymlType::Array,
-            Self::Hash(_) => ffi::BymlType::Hash,
-            Self::Null => ffi::BymlType::Null,
-            Self::Bool(_) => ffi::BymlType::Bool,
-            Self::Binary(_) => ffi::BymlType::Binary,
-            Self::Int(_) => ffi::BymlType::Int,
-            Self::UInt(_) => ffi::BymlType::UInt,
-            Self::Int64(_) => ffi::BymlType::Int64,
-            Self::UInt64(_) => ffi::BymlType::UInt64,
-            Self::Float(_) => ffi::BymlType::Float,
-            Self::Double(_) => ffi::BymlType::Double,
-            Self::String(_) => ffi::BymlType::String,
+    pub(crate) fn push_bool(&mut self, value: bool) {
+        self.push(Byml::Bool(value))
+    }
+
+    pub(crate) fn push_int(&mut self, value: i32) {
+        self.push(Byml::Int(value))
+    }
+
+    pub(crate) fn push_uint(&mut self, value: u32) {
+        self.push(Byml::UInt(value))
+    }
+
+    pub(crate) fn push_int64(&mut self, value: i64) {
+        self.push(Byml::Int64(value))
+    }
+
+    pub(crate) fn push_uint64(&mut self, value: u64) {
+        self.push(Byml::UInt64(value))
+    }
+
+    pub(crate) fn push_float(&mut self, value: f32) {
+        self.push(Byml::Float(value))
+    }
+
+    pub(crate) fn push_double(&mut self, value: f64) {
+        self.push(Byml::Double(value))
+    }
+
+    pub(crate) fn push_string(&mut self, value: &str) {
+        self.push(Byml::String(value.to_owned()))
+    }
+
+    pub(crate) fn push_binary(&mut self, value: &[u8]) {
+        self.push(Byml::Binary(value.to_vec()))
+    }
+
+    /// Set the key for the next node pushed into the current hash.
+    pub(crate) fn push_key(&mut self, key: &str) {
+        self.key = Some(self.keys.intern(key));
+    }
+
+    pub(crate) fn begin_array(&mut self, len: usize) {
+        let key = self.key.take();
+        self.stack.push((Container::Array(Vec::with_capacity(len)), key));
+    }
+
+    pub(crate) fn begin_hash(&mut self, len: usize) {
+        let key = self.key.take();
+        self.stack.push((Container::Hash(Vec::with_capacity(len)), key));
+    }
+
+    pub(crate) fn end_container(&mut self) {
+        if let Some((container, key)) = self.stack.pop() {
+            self.key = key;
+            self.push(match container {
+                Container::Array(items) => Byml::Array(items),
+                // Collecting sorts the entries and then builds the tree in bulk. Text written by
+                // `to_text` lists keys in order, so the sort is usually a single linear pass.
+                Container::Hash(entries) => Byml::Hash(entries.into_iter().collect()),
+            })
         }
     }
 }
@@ -474,4 +573,89 @@ mod tests {
         let byml2 = Byml::from_binary(&bytes).unwrap();
         assert_eq!(byml, byml2);
     }
+
+    #[test]
+    fn parallel_binary() {
+        let actors: Vec<Byml> = (0..5000)
+            .map(|i| {
+                let mut actor = super::Hash::new();
+                actor.insert(
+                    "name".into(),
+                    Byml::String(format!("Actor_{}", i % 1500)),
+                );
+                actor.insert("hp".into(), Byml::Int(i));
+                actor.insert("scale".into(), Byml::Float(i as f32 / 8.0));
+                actor.insert("id".into(), Byml::UInt64(i as u64 % 700));
+                actor.insert(
+                    "tags".into(),
+                    Byml::Array(vec![Byml::String("Enemy".to_owned()), Byml::Int(i % 3)]),
+                );
+                actor.insert("flag".into(), Byml::Bool(i % 2 == 0));
+                Byml::Hash(actor)
+            })
+            .collect();
+        let mut root = super::Hash::new();
+        root.insert("Actors".into(), Byml::Array(actors));
+        root.insert("Data".into(), Byml::Binary(vec![1, 2, 3]));
+        root.insert(
+            "Hashes".into(),
+            Byml::Array((0..5000).map(Byml::UInt).collect()),
+        );
+        let byml = Byml::Hash(root);
+
+        for endian in [Endian::Big, Endian::Little].iter().copied() {
+            let bytes = byml.to_binary(endian);
+            assert_eq!(byml.to_binary_parallel(endian), bytes);
+            assert_eq!(Byml::from_binary(&bytes).unwrap(), byml);
+        }
+        // Identical subtrees are only written once
+        let mut doubled = byml.clone();
+        let actors = byml["Actors"].clone();
+        doubled.as_mut_hash().unwrap().insert("Copy".into(), actors);
+        let single = byml.to_binary(Endian::Little).len();
+        assert!(doubled.to_binary(Endian::Little).len() < single + 0x100);
+        assert_eq!(
+            Byml::from_binary(&doubled.to_binary(Endian::Little)).unwrap(),
+            doubled
+        );
+    }
+
+    #[test]
+    fn signed_zeros() {
+        let byml = Byml::Array(vec![
+            Byml::Double(0.0),
+            Byml::Double(-0.0),
+            Byml::Array(vec![Byml::Float(0.0)]),
+            Byml::Array(vec![Byml::Float(-0.0)]),
+        ]);
+        let doc = Byml::from_binary(&byml.to_binary(Endian::Little)).unwrap();
+        assert!(doc[1].as_double().unwrap().is_sign_negative());
+        assert!(doc[3][0].as_float().unwrap().is_sign_negative());
+        assert!(!doc[2][0].as_float().unwrap().is_sign_negative());
+    }
+
+    #[test]
+    fn interned_keys() {
+        let entry = |i: i32| {
+            let mut hash = super::Hash::new();
+            hash.insert("UnitConfigName".into(), Byml::String(format!("Obj_{}", i)));
+            hash.insert("HashId".into(), Byml::Int(i));
+            Byml::Hash(hash)
+        };
+        let bytes = Byml::Array((0..4).map(entry).collect()).to_binary(Endian::Little);
+        let key = |doc: &Byml, i: usize| doc[i].as_hash().unwrap().keys().next().unwrap().clone();
+
+        let doc = Byml::from_binary(&bytes).unwrap();
+        assert_eq!(key(&doc, 0), "HashId");
+        assert!(key(&doc, 0).ptr_eq(&key(&doc, 3)));
+        assert_eq!(doc[2]["UnitConfigName"].as_string().unwrap(), "Obj_2");
+
+        let mut pool = super::KeyPool::new();
+        let first = Byml::from_binary_with_pool(&bytes, &mut pool).unwrap();
+        let second = Byml::from_binary_with_pool(&bytes, &mut pool).unwrap();
+        assert_eq!(pool.len(), 2);
+        assert!(key(&first, 0).ptr_eq(&key(&second, 1)));
+        assert!(!key(&doc, 0).ptr_eq(&key(&first, 0)));
+        assert_eq!(first.to_binary(Endian::Little), bytes);
+    }
 }
@@ -0,0 +1,761 @@
+//! Editing binary BYML documents without decoding them.
+//!
+//! A [`BymlPatch`] records edits by path and applies them to a copy of the
+//! original data. Only the containers on the paths to edited nodes are
+//! written again, appended after the original nodes with their parents
+//! pointing to the new copies. Every other node is kept byte for byte, so the
+//! cost of a patch depends on what was edited rather than on the size of the
+//! document. The old copies of rewritten containers are left unreferenced in
+//! the output, so it is slightly larger than a fully re-encoded document.
+//!
+//! The string tables are kept as they are unless an edit needs a hash key or
+//! string that is not in them yet. In that case sorted tables with the new
+//! entries are appended, and the indices in every container are remapped in
+//! one pass over the containers, which is still far cheaper than parsing and
+//! writing the whole document.
+use super::{
+    view::node_type::*,
+    writer::{align4, is_non_inline, node_type, table_size, Out},
+    Byml, BymlError, BymlIndex, BymlView, Result,
+};
+use crate::Endian;
+use std::collections::{BTreeMap, BTreeSet, HashSet};
+
+/// One step of a path into the original document.
+#[derive(Debug, Clone, PartialEq, Eq, PartialOrd, Ord)]
+enum Segment {
+    Index(usize),
+    Key(String),
+}
+
+impl From<&BymlIndex<'_>> for Segment {
+    fn from(index: &BymlIndex<'_>) -> Self {
+        match index {
+            BymlIndex::ArrayIdx(i) => Segment::Index(*i),
+            BymlIndex::HashIdx(key) => Segment::Key((*key).to_owned()),
+        }
+    }
+}
+
+impl std::fmt::Display for Segment {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Segment::Index(i) => write!(f, "[{}]", i),
+            Segment::Key(key) => write!(f, "/{}", key),
+        }
+    }
+}
+
+#[derive(Debug)]
+enum Edit {
+    Set(Byml),
+    Remove,
+    Children(BTreeMap<Segment, Edit>),
+}
+
+fn patch_error(path: &[&Segment], msg: &str) -> BymlError {
+    let path: String = path.iter().map(|seg| seg.to_string()).collect();
+    BymlError::PatchError(format!("{}: {}", path, msg))
+}
+
+/// Apply an edit below a node that was already replaced by a new value.
+fn apply(node: &mut Byml, path: &[Segment], value: Option<Byml>) -> Result<()> {
+    let (last, parents) = path.split_last().unwrap();
+    let mut node = node;
+    for seg in parents {
+        node = match (node, seg) {
+            (Byml::Hash(hash), Segment::Key(key)) => hash.get_mut(key.as_str()),
+            (Byml::Array(items), Segment::Index(i)) => items.get_mut(*i),
+            _ => None,
+        }
+        .ok_or_else(|| BymlError::PatchError(format!("{}: node not found", seg)))?;
+    }
+    match (node, last, value) {
+        (Byml::Hash(hash), Segment::Key(key), Some(value)) => {
+            hash.insert(key.as_str().into(), value);
+        }
+        (Byml::Hash(hash), Segment::Key(key), None) => {
+            hash.remove(key.as_str());
+        }
+        (Byml::Array(items), Segment::Index(i), Some(value)) if *i < items.len() => {
+            items[*i] = value;
+        }
+        (Byml::Array(items), Segment::Index(i), Some(value)) if *i == items.len() => {
+            items.push(value);
+        }
+        _ => {
+            return Err(BymlError::PatchError(format!(
+                "{}: node not found or not removable",
+                last
+            )))
+        }
+    }
+    Ok(())
+}
+
+/// A set of edits to a binary BYML document, applied without decoding the
+/// parts of the document that are not edited. See the module documentation
+/// for how the output is laid out.
+///
+/// Paths are given as [`BymlIndex`] steps from the root. A path may end one
+/// past the last element of an array to append to it, or at a key that a
+/// hash does not have yet to insert it. Paths into the original document are
+/// checked when the patch is written.
+/// ```
+/// # use roead::{byml::{Byml, BymlIndex, BymlPatch}, Endian};
+/// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+/// let text = "{Objs: [{HashId: !u 0x1, UnitConfigName: Enemy_Lynel_Junior}]}";
+/// let data = Byml::from_text(text)?.to_binary(Endian::Big);
+/// let mut patch = BymlPatch::new(&data)?;
+/// let path = [
+///     BymlIndex::HashIdx("Objs"),
+///     BymlIndex::ArrayIdx(0),
+///     BymlIndex::HashIdx("UnitConfigName"),
+/// ];
+/// patch.set(&path, Byml::String("Enemy_Lynel_Dark".to_owned()))?;
+/// let patched = patch.to_binary()?;
+/// let doc = Byml::from_binary(&patched)?;
+/// assert_eq!(doc["Objs"][0]["UnitConfigName"].as_string()?, "Enemy_Lynel_Dark");
+/// # Ok(())
+/// # }
+/// ```
+#[derive(Debug)]
+pub struct BymlPatch<'a> {
+    data: &'a [u8],
+    endian: Endian,
+    root: Edit,
+}
+
+impl<'a> BymlPatch<'a> {
+    /// Start an empty patch of a binary document. Only the header is read.
+    pub fn new(data: &'a [u8]) -> Result<BymlPatch<'a>> {
+        let view = BymlView::new(data)?;
+        Ok(BymlPatch {
+            data,
+            endian: view.endian(),
+            root: Edit::Children(BTreeMap::new()),
+        })
+    }
+
+    /// Check if the patch has no edits.
+    pub fn is_empty(&self) -> bool {
+        matches!(&self.root, Edit::Children(children) if children.is_empty())
+    }
+
+    /// Replace the node at a path, or insert it. An empty path replaces the
+    /// whole document.
+    pub fn set(&mut self, path: &[BymlIndex], value: Byml) -> Result<()> {
+        self.edit(path, Some(value))
+    }
+
+    /// Remove a key from a hash.
+    pub fn remove(&mut self, path: &[BymlIndex]) -> Result<()> {
+        if !matches!(path.last(), Some(BymlIndex::HashIdx(_))) {
+            return Err(BymlError::PatchError(
+                "only hash keys can be removed".to_owned(),
+            ));
+        }
+        self.edit(path, None)
+    }
+
+    fn edit(&mut self, path: &[BymlIndex], value: Option<Byml>) -> Result<()> {
+        let path: Vec<Segment> = path.iter().map(Segment::from).collect();
+        let mut edit = &mut self.root;
+        for (i, seg) in path.iter().enumerate() {
+            edit = match edit {
+                // Edits below a replaced node go straight into the new value
+                Edit::Set(node) => return apply(node, &path[i..], value),
+                Edit::Remove => {
+                    return Err(BymlError::PatchError(format!(
+                        "{}: parent was removed",
+                        seg
+                    )))
+                }
+                Edit::Children(children) => children
+                    .entry(seg.clone())
+                    .or_insert_with(|| Edit::Children(BTreeMap::new())),
+            };
+        }
+        *edit = match value {
+            Some(value) => Edit::Set(value),
+            None => Edit::Remove,
+        };
+        Ok(())
+    }
+
+    /// Write the patched document.
+    pub fn to_binary(&self) -> Result<Vec<u8>> {
+        let children = match &self.root {
+            Edit::Set(root) => {
+                let version = u16::from_be_bytes([self.data[2], self.data[3]]);
+                let version = if self.endian == Endian::Big {
+                    version
+                } else {
+                    version.swap_bytes()
+                };
+                return Ok(root.to_binary_with_version(self.endian, version as u8));
+            }
+            Edit::Remove => unreachable!(),
+            Edit::Children(children) if children.is_empty() => return Ok(self.data.to_vec()),
+            Edit::Children(children) => children,
+        };
+        let mut patcher = Patcher::new(self.data, self.endian)?;
+        patcher.prepare_tables(children)?;
+        let root = patcher.u32(0xC)? as usize;
+        if root == 0 {
+            return Err(BymlError::PatchError(
+                "the document is empty, set the root instead".to_owned(),
+            ));
+        }
+        let root = patcher.rewrite(root, children, &mut Vec::new())?;
+        patcher.out().u32(0xC, root);
+        Ok(patcher.buf)
+    }
+}
+
+/// A sorted string table.
+#[derive(Default)]
+struct Table<'a> {
+    strings: Vec<&'a str>,
+    /// New index of every string of the original table, if entries were
+    /// added.
+    remap: Option<Vec<u32>>,
+}
+
+impl<'a> Table<'a> {
+    fn index(&self, string: &str) -> Option<u32> {
+        self.strings.binary_search(&string).ok().map(|i| i as u32)
+    }
+
+    /// Merge new entries into the table.
+    fn extend(&mut self, new: BTreeSet<&'a str>) {
+        let new: Vec<&str> = new
+            .into_iter()
+            .filter(|s| self.strings.binary_search(s).is_err())
+            .collect();
+        if new.is_empty() {
+            return;
+        }
+        let mut merged = Vec::with_capacity(self.strings.len() + new.len());
+        let mut remap = Vec::with_capacity(self.strings.len());
+        let mut new = new.into_iter().peekable();
+        for old in &self.strings {
+            while let Some(s) = new.next_if(|s| s < old) {
+                merged.push(s);
+            }
+            remap.push(merged.len() as u32);
+            merged.push(*old);
+        }
+        merged.extend(new);
+        self.strings = merged;
+        self.remap = Some(remap);
+    }
+}
+
+struct Patcher<'a> {
+    data: &'a [u8],
+    endian: Endian,
+    buf: Vec<u8>,
+    keys: Table<'a>,
+    strings: Table<'a>,
+}
+
+impl<'a> Patcher<'a> {
+    fn new(data: &'a [u8], endian: Endian) -> Result<Self> {
+        let mut patcher = Patcher {
+            data,
+            endian,
+            buf: data.to_vec(),
+            keys: Table::default(),
+            strings: Table::default(),
+        };
+        patcher.buf.resize(align4(data.len()), 0);
+        patcher.keys = patcher.read_table(patcher.u32(4)? as usize)?;
+        patcher.strings = patcher.read_table(patcher.u32(8)? as usize)?;
+        Ok(patcher)
+    }
+
+    fn out(&mut self) -> Out<'_> {
+        Out::new(&mut self.buf, 0, self.endian)
+    }
+
+    fn bytes<const N: usize>(&self, offset: usize) -> Result<[u8; N]> {
+        let mut bytes = [0u8; N];
+        bytes.copy_from_slice(
+            self.buf
+                .get(offset..offset + N)
+                .ok_or(BymlError::DataError("offset out of bounds"))?,
+        );
+        Ok(bytes)
+    }
+
+    fn u24(&self, offset: usize) -> Result<u32> {
+        let [a, b, c] = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u32::from_be_bytes([0, a, b, c]),
+            Endian::Little => u32::from_le_bytes([a, b, c, 0]),
+        })
+    }
+
+    fn u32(&self, offset: usize) -> Result<u32> {
+        let bytes = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u32::from_be_bytes(bytes),
+            Endian::Little => u32::from_le_bytes(bytes),
+        })
+    }
+
+    fn read_table(&self, offset: usize) -> Result<Table<'a>> {
+        let mut table = Table::default();
+        if offset == 0 {
+            return Ok(table);
+        }
+        let count = self.u24(offset + 1)? as usize;
+        table.strings.reserve(count);
+        for i in 0..count {
+            let start = offset + self.u32(offset + 4 + 4 * i)? as usize;
+            let bytes = self
+                .data
+                .get(start..)
+                .ok_or(BymlError::DataError("string offset out of bounds"))?;
+            let len = bytes
+                .iter()
+                .position(|b| *b == 0)
+                .ok_or(BymlError::DataError("unterminated string"))?;
+            let string = std::str::from_utf8(&bytes[..len])
+                .map_err(|_| BymlError::DataError("string is not valid UTF-8"))?;
+            // Lookups and merging new entries rely on the order
+            if matches!(table.strings.last(), Some(last) if *last >= string) {
+                return Err(BymlError::DataError("string table is not sorted"));
+            }
+            table.strings.push(string);
+        }
+        Ok(table)
+    }
+
+    /// Add the keys and strings used by the edits to the tables, appending
+    /// new tables and remapping the document if any are missing.
+    fn prepare_tables(&mut self, edits: &'a BTreeMap<Segment, Edit>) -> Result<()> {
+        fn collect<'a>(
+            edits: &'a BTreeMap<Segment, Edit>,
+            keys: &mut BTreeSet<&'a str>,
+            strings: &mut BTreeSet<&'a str>,
+        ) {
+            for (seg, edit) in edits {
+                match edit {
+                    Edit::Set(node) => {
+                        if let Segment::Key(key) = seg {
+                            keys.insert(key);
+                        }
+                        collect_node(node, keys, strings);
+                    }
+                    Edit::Remove => (),
+                    Edit::Children(children) => collect(children, keys, strings),
+                }
+            }
+        }
+        fn collect_node<'a>(
+            node: &'a Byml,
+            keys: &mut BTreeSet<&'a str>,
+            strings: &mut BTreeSet<&'a str>,
+        ) {
+            match node {
+                Byml::String(s) => {
+                    strings.insert(s);
+                }
+                Byml::Array(items) => items
+                    .iter()
+                    .for_each(|item| collect_node(item, keys, strings)),
+                Byml::Hash(hash) => {
+                    for (key, value) in hash {
+                        keys.insert(key.as_str());
+                        collect_node(value, keys, strings);
+                    }
+                }
+                _ => (),
+            }
+        }
+        // Collected through a reference with the patch's lifetime, so the
+        // tables can borrow from both the original data and the edits.
+        let (mut keys, mut strings) = (BTreeSet::new(), BTreeSet::new());
+        collect(edits, &mut keys, &mut strings);
+        self.keys.extend(keys);
+        self.strings.extend(strings);
+        if self.keys.remap.is_none() && self.strings.remap.is_none() {
+            return Ok(());
+        }
+
+        let root = self.u32(0xC)? as usize;
+        if root != 0 {
+            self.remap(root, &mut HashSet::new())?;
+        }
+        for header in [4, 8] {
+            let table = if header == 4 {
+                &self.keys
+            } else {
+                &self.strings
+            };
+            if table.remap.is_none() || table.strings.is_empty() {
+                continue;
+            }
+            let strings = table.strings.clone();
+            let at = self.buf.len();
+            self.buf.resize(at + table_size(&strings), 0);
+            let mut out = Out::new(&mut self.buf, 0, self.endian);
+            out.table(at, &strings);
+            out.u32(header, at as u32);
+        }
+        Ok(())
+    }
+
+    /// Rewrite the key and string indices of every container reachable from
+    /// `offset` for the new tables.
+    fn remap(&mut self, offset: usize, visited: &mut HashSet<usize>) -> Result<()> {
+        if !visited.insert(offset) {
+            return Ok(());
+        }
+        let (ty, entries) = self.entries(offset)?;
+        for (i, (key, node_type, value)) in entries.iter().enumerate() {
+            let (key_at, value_at) = self.entry_fields(offset, ty, entries.len(), i);
+            if let (Some(key), Some(remap)) = (key, &self.keys.remap) {
+                let key = *remap
+                    .get(*key as usize)
+                    .ok_or(BymlError::DataError("key index out of bounds"))?;
+                self.out().u24(key_at, key);
+            }
+            match *node_type {
+                STRING => {
+                    if let Some(remap) = &self.strings.remap {
+                        let value = *remap
+                            .get(*value as usize)
+                            .ok_or(BymlError::DataError("string index out of bounds"))?;
+                        self.out().u32(value_at, value);
+                    }
+                }
+                ARRAY | HASH => self.remap(*value as usize, visited)?,
+                _ => (),
+            }
+        }
+        Ok(())
+    }
+
+    /// Offsets of the key (for hashes) and value fields of entry `i`.
+    fn entry_fields(&self, offset: usize, ty: u8, len: usize, i: usize) -> (usize, usize) {
+        if ty == HASH {
+            (offset + 4 + 8 * i, offset + 8 + 8 * i)
+        } else {
+            (0, align4(offset + 4 + len) + 4 * i)
+        }
+    }
+
+    /// Read the entries of a container: key index (for hashes), node type
+    /// and raw value.
+    #[allow(clippy::type_complexity)]
+    fn entries(&self, offset: usize) -> Result<(u8, Vec<(Option<u32>, u8, u32)>)> {
+        let [ty] = self.bytes(offset)?;
+        let len = self.u24(offset + 1)? as usize;
+        let mut entries = Vec::with_capacity(len);
+        for i in 0..len {
+            let (key_at, value_at) = self.entry_fields(offset, ty, len, i);
+            entries.push(match ty {
+                HASH => {
+                    let [node_type] = self.bytes(key_at + 3)?;
+                    (Some(self.u24(key_at)?), node_type, self.u32(value_at)?)
+                }
+                ARRAY => {
+                    let [node_type] = self.bytes(offset + 4 + i)?;
+                    (None, node_type, self.u32(value_at)?)
+                }
+                _ => return Err(BymlError::DataError("container node has wrong type")),
+            });
+        }
+        Ok((ty, entries))
+    }
+
+    /// Write a copy of the container at `offset` with the edits applied and
+    /// return the offset of the copy.
+    fn rewrite<'e>(
+        &mut self,
+        offset: usize,
+        edits: &'e BTreeMap<Segment, Edit>,
+        path: &mut Vec<&'e Segment>,
+    ) -> Result<u32> {
+        let (ty, mut entries) = self.entries(offset)?;
+        for (seg, edit) in edits {
+            path.push(seg);
+            let found = match (ty, seg) {
+                (ARRAY, Segment::Index(i)) => Some(*i).filter(|i| *i < entries.len()),
+                (HASH, Segment::Key(key)) => {
+                    let key = self.keys.index(key);
+                    entries
+                        .iter()
+                        .position(|(k, _, _)| key.is_some() && *k == key)
+                }
+                _ => return Err(patch_error(path, "wrong index type for container")),
+            };
+            match (found, edit) {
+                (Some(i), Edit::Set(node)) => {
+                    let (key, _, _) = entries[i];
+                    entries[i] = (key, node_type(node), self.encode(node)?);
+                }
+                (Some(i), Edit::Remove) => {
+                    entries.remove(i);
+                }
+                (Some(i), Edit::Children(children)) => {
+                    let (key, node_type, value) = entries[i];
+                    if !matches!(node_type, ARRAY | HASH) {
+                        return Err(patch_error(path, "node is not a container"));
+                    }
+                    entries[i] = (
+                        key,
+                        node_type,
+                        self.rewrite(value as usize, children, path)?,
+                    );
+                }
+                (None, Edit::Set(node)) => match seg {
+                    Segment::Index(i) if *i == entries.len() => {
+                        entries.push((None, node_type(node), self.encode(node)?));
+                    }
+                    Segment::Key(key) => {
+                        let key = self
+                            .keys
+                            .index(key)
+                            .ok_or(BymlError::DataError("key is not in the hash key table"))?;
+                        entries.push((Some(key), node_type(node), self.encode(node)?));
+                    }
+                    _ => return Err(patch_error(path, "index out of bounds")),
+                },
+                (None, _) => return Err(patch_error(path, "node not found")),
+            }
+            path.pop();
+        }
+        Ok(self.write_container(ty, entries))
+    }
+
+    #[allow(clippy::type_complexity)]
+    fn write_container(&mut self, ty: u8, mut entries: Vec<(Option<u32>, u8, u32)>) -> u32 {
+        if ty == HASH {
+            entries.sort_by_key(|(key, _, _)| *key);
+        }
+        let at = self.buf.len();
+        let size = match ty {
+            HASH => 4 + 8 * entries.len(),
+            _ => align4(4 + entries.len()) + 4 * entries.len(),
+        };
+        self.buf.resize(at + size, 0);
+        let len = entries.len();
+        let fields: Vec<_> = (0..len)
+            .map(|i| self.entry_fields(at, ty, len, i))
+            .collect();
+        let mut out = self.out();
+        out.u8(at, ty);
+        out.u24(at + 1, len as u32);
+        for (i, ((key, node_type, value), (key_at, value_at))) in
+            entries.iter().zip(fields).enumerate()
+        {
+            if ty == HASH {
+                out.u24(key_at, key.unwrap());
+                out.u8(key_at + 3, *node_type);
+            } else {
+                out.u8(at + 4 + i, *node_type);
+            }
+            out.u32(value_at, *value);
+        }
+        at as u32
+    }
+
+    /// Append a new node (for non-inline nodes) and return the value its
+    /// parent stores for it. Fails if a key or string of the node is missing
+    /// from the tables.
+    fn encode(&mut self, node: &Byml) -> Result<u32> {
+        if !is_non_inline(node) {
+            return Ok(match node {
+                Byml::String(s) => self
+                    .strings
+                    .index(s)
+                    .ok_or(BymlError::DataError("string is not in the string table"))?,
+                Byml::Bool(v) => *v as u32,
+                Byml::Int(v) => *v as u32,
+                Byml::UInt(v) => *v,
+                Byml::Float(v) => v.to_bits(),
+                _ => 0,
+            });
+        }
+        let entries = match node {
+            Byml::Array(items) => items
+                .iter()
+                .map(|item| Ok((None, node_type(item), self.encode(item)?)))
+                .collect::<Result<_>>()?,
+            Byml::Hash(hash) => hash
+                .iter()
+                .map(|(key, value)| {
+                    let key = self
+                        .keys
+                        .index(key)
+                        .ok_or(BymlError::DataError("key is not in the hash key table"))?;
+                    Ok((Some(key), node_type(value), self.encode(value)?))
+                })
+                .collect::<Result<_>>()?,
+            _ => Vec::new(),
+        };
+        let at = self.buf.len();
+        match node {
+            Byml::Array(_) => return Ok(self.write_container(ARRAY, entries)),
+            Byml::Hash(_) => return Ok(self.write_container(HASH, entries)),
+            Byml::Binary(data) => {
+                self.buf.resize(at + align4(4 + data.len()), 0);
+                let mut out = self.out();
+                out.u32(at, data.len() as u32);
+                out.bytes(at + 4, data);
+            }
+            Byml::Int64(v) => self.append_u64(*v as u64),
+            Byml::UInt64(v) => self.append_u64(*v),
+            Byml::Double(v) => self.append_u64(v.to_bits()),
+            _ => unreachable!(),
+        }
+        Ok(at as u32)
+    }
+
+    fn append_u64(&mut self, value: u64) {
+        let at = self.buf.len();
+        self.buf.resize(at + 8, 0);
+        self.out().u64(at, value);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::BymlPatch;
+    use crate::{
+        byml::{Byml, BymlError, BymlIndex},
+        Endian,
+    };
+    use std::convert::TryInto;
+
+    fn doc() -> Byml {
+        Byml::from_text(
+            "Actors:\n\
+             - {name: Enemy_Bokoblin, life: 13, scale: 0.35}\n\
+             - {name: Enemy_Lizalfos, life: 24, scale: 1.0}\n\
+             Hashes: [31119, 1031290, 1035142]\n\
+             Big: !l 12345678901\n",
+        )
+        .unwrap()
+    }
+
+    #[test]
+    fn patch_in_place() {
+        let base = doc();
+        for endian in [Endian::Big, Endian::Little] {
+            let data = base.to_binary(endian);
+            let mut expected = base.clone();
+            let mut patch = BymlPatch::new(&data).unwrap();
+            assert!(patch.is_empty());
+            assert_eq!(patch.to_binary().unwrap(), data);
+
+            // Values that are already in the tables
+            let path = [
+                BymlIndex::HashIdx("Actors"),
+                BymlIndex::ArrayIdx(1),
+                BymlIndex::HashIdx("life"),
+            ];
+            patch.set(&path, Byml::Int(30)).unwrap();
+            expected["Actors"][1]["life"] = Byml::Int(30);
+            patch
+                .set(&[BymlIndex::HashIdx("Big")], Byml::Int64(-5))
+                .unwrap();
+            expected["Big"] = Byml::Int64(-5);
+            let patched = patch.to_binary().unwrap();
+            assert_eq!(Byml::from_binary(&patched).unwrap(), expected);
+            // Only the root, the actor array, one actor and the new value were
+            // written again, after padding the original data
+            assert!(patched.len() <= data.len() + 3 + 28 + 16 + 28 + 8);
+
+            // New keys and strings, and edits below inserted values
+            let path = [BymlIndex::HashIdx("Actors"), BymlIndex::ArrayIdx(2)];
+            patch.set(&path, Byml::Hash(Default::default())).unwrap();
+            patch
+                .set(
+                    &[
+                        BymlIndex::HashIdx("Actors"),
+                        BymlIndex::ArrayIdx(2),
+                        BymlIndex::HashIdx("name"),
+                    ],
+                    Byml::String("Enemy_Lynel_Dark".to_owned()),
+                )
+                .unwrap();
+            patch
+                .set(
+                    &[
+                        BymlIndex::HashIdx("Actors"),
+                        BymlIndex::ArrayIdx(0),
+                        BymlIndex::HashIdx("drops"),
+                    ],
+                    Byml::Array(vec![
+                        Byml::String("Item_Apple".to_owned()),
+                        Byml::Double(0.5),
+                    ]),
+                )
+                .unwrap();
+            patch.remove(&[BymlIndex::HashIdx("Hashes")]).unwrap();
+            let mut lynel = super::super::Hash::new();
+            lynel.insert("name".into(), Byml::String("Enemy_Lynel_Dark".to_owned()));
+            expected.as_mut_hash().unwrap().remove("Hashes");
+            if let Byml::Array(actors) = &mut expected["Actors"] {
+                actors.push(Byml::Hash(lynel));
+            }
+            expected["Actors"][0].as_mut_hash().unwrap().insert(
+                "drops".into(),
+                Byml::Array(vec![
+                    Byml::String("Item_Apple".to_owned()),
+                    Byml::Double(0.5),
+                ]),
+            );
+            let patched = patch.to_binary().unwrap();
+            assert_eq!(Byml::from_binary(&patched).unwrap(), expected);
+
+            assert!(patch
+                .set(
+                    &[BymlIndex::HashIdx("Hashes"), BymlIndex::ArrayIdx(0)],
+                    Byml::Null
+                )
+                .is_err());
+            let mut bad = BymlPatch::new(&data).unwrap();
+            bad.set(
+                &[BymlIndex::HashIdx("Missing"), BymlIndex::ArrayIdx(0)],
+                Byml::Null,
+            )
+            .unwrap();
+            assert!(bad.to_binary().is_err());
+        }
+    }
+
+    #[test]
+    fn bad_key_index() {
+        let mut data = doc().to_binary(Endian::Little);
+        // Point the first key of the root hash past the end of the key table
+        let root = u32::from_le_bytes(data[0xc..0x10].try_into().unwrap()) as usize;
+        data[root + 4..root + 7].copy_from_slice(&[0xff, 0xff, 0x00]);
+        let mut patch = BymlPatch::new(&data).unwrap();
+        patch
+            .set(&[BymlIndex::HashIdx("NewKey")], Byml::Int(1))
+            .unwrap();
+        assert!(patch.to_binary().is_err());
+    }
+
+    #[test]
+    fn unsorted_table() {
+        let mut data = Byml::from_text("{A: 1, B: 2}")
+            .unwrap()
+            .to_binary(Endian::Little);
+        // Swap the two keys so that the key table is out of order
+        let at = data.windows(4).position(|w| w == b"A\0B\0").unwrap();
+        data[at..at + 4].copy_from_slice(b"B\0A\0");
+        let mut patch = BymlPatch::new(&data).unwrap();
+        patch.set(&[BymlIndex::HashIdx("A")], Byml::Int(3)).unwrap();
+        assert!(matches!(
+            patch.to_binary(),
+            Err(BymlError::DataError("string table is not sorted"))
+        ));
+    }
+}
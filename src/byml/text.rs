@@ -0,0 +1,347 @@
+//! Native YAML text format.
+//!
+//! The format is the same as oead's: hashes and arrays with at most 10
+//! entries and no nested containers are written in flow style, unsigned and
+//! 64-bit values are tagged (`!u`, `!l`, `!ul`, `!f64`), and binary data is
+//! written as `!!binary` base64. Documents are written straight from the
+//! `Byml` tree into one buffer and parsed straight into a `Byml` tree, with
+//! no intermediate document in either direction.
+use super::{Byml, BymlBuilder, BymlError, Result};
+use crate::yaml::{self, Handler, Scalar};
+use std::{convert::TryFrom, fmt::Write};
+
+/// Containers with at most this many entries and no nested containers are
+/// written on a single line.
+const MAX_INLINE_LEN: usize = 10;
+
+fn is_container(node: &Byml) -> bool {
+    matches!(node, Byml::Array(_) | Byml::Hash(_))
+}
+
+fn is_inline(node: &Byml) -> bool {
+    match node {
+        Byml::Array(items) => items.len() <= MAX_INLINE_LEN && !items.iter().any(is_container),
+        Byml::Hash(hash) => hash.len() <= MAX_INLINE_LEN && !hash.values().any(is_container),
+        _ => true,
+    }
+}
+
+/// Estimate the size of the text form of a document so the output buffer
+/// rarely needs to grow.
+fn estimate_size(node: &Byml, depth: usize) -> usize {
+    match node {
+        Byml::Array(items) => items
+            .iter()
+            .map(|item| 2 * depth + 4 + estimate_size(item, depth + 1))
+            .sum(),
+        Byml::Hash(hash) => hash
+            .iter()
+            .map(|(key, value)| 2 * depth + key.len() + 3 + estimate_size(value, depth + 1))
+            .sum(),
+        Byml::String(s) => s.len(),
+        Byml::Binary(data) => data.len() / 3 * 4 + 13,
+        _ => 12,
+    }
+}
+
+struct Emitter {
+    out: String,
+}
+
+impl Emitter {
+    fn indent(&mut self, indent: usize) {
+        self.out.extend(std::iter::repeat(' ').take(indent));
+    }
+
+    fn scalar(&mut self, node: &Byml) {
+        match node {
+            Byml::Null => self.out.push_str("null"),
+            Byml::Bool(v) => self.out.push_str(if *v { "true" } else { "false" }),
+            Byml::Int(v) => write!(self.out, "{}", v).unwrap(),
+            Byml::UInt(v) => write!(self.out, "!u 0x{:08x}", v).unwrap(),
+            Byml::Int64(v) => write!(self.out, "!l {}", v).unwrap(),
+            Byml::UInt64(v) => write!(self.out, "!ul {}", v).unwrap(),
+            Byml::Float(v) => yaml::write_float(&mut self.out, *v),
+            Byml::Double(v) => {
+                self.out.push_str("!f64 ");
+                yaml::write_float(&mut self.out, *v);
+            }
+            Byml::String(v) => yaml::write_str(&mut self.out, v),
+            Byml::Binary(v) => {
+                self.out.push_str("!!binary ");
+                yaml::write_base64(&mut self.out, v);
+            }
+            Byml::Array(_) | Byml::Hash(_) => self.flow(node),
+        }
+    }
+
+    fn flow(&mut self, node: &Byml) {
+        match node {
+            Byml::Array(items) => {
+                self.out.push('[');
+                for (i, item) in items.iter().enumerate() {
+                    if i > 0 {
+                        self.out.push_str(", ");
+                    }
+                    self.scalar(item);
+                }
+                self.out.push(']');
+            }
+            Byml::Hash(hash) => {
+                self.out.push('{');
+                for (i, (key, value)) in hash.iter().enumerate() {
+                    if i > 0 {
+                        self.out.push_str(", ");
+                    }
+                    yaml::write_str(&mut self.out, key);
+                    self.out.push_str(": ");
+                    self.scalar(value);
+                }
+                self.out.push('}');
+            }
+            _ => self.scalar(node),
+        }
+    }
+
+    /// Write a node that starts on the current line, where `indent` is the
+    /// indent of the block it belongs to, and end the line.
+    fn node(&mut self, node: &Byml, indent: usize) {
+        if is_inline(node) {
+            self.scalar(node);
+            self.out.push('\n');
+        } else {
+            match node {
+                Byml::Array(items) => self.block_array(items, indent, true),
+                Byml::Hash(hash) => self.block_hash(hash, indent, true),
+                _ => unreachable!(),
+            }
+        }
+    }
+
+    /// Write a block sequence. If `continued`, the first entry goes on the
+    /// current line without indentation.
+    fn block_array(&mut self, items: &[Byml], indent: usize, continued: bool) {
+        for (i, item) in items.iter().enumerate() {
+            if i > 0 || !continued {
+                self.indent(indent);
+            }
+            self.out.push_str("- ");
+            self.node(item, indent + 2);
+        }
+    }
+
+    /// Write a block mapping. If `continued`, the first entry goes on the
+    /// current line without indentation.
+    fn block_hash(&mut self, hash: &super::Hash, indent: usize, continued: bool) {
+        for (i, (key, value)) in hash.iter().enumerate() {
+            if i > 0 || !continued {
+                self.indent(indent);
+            }
+            yaml::write_str(&mut self.out, key);
+            self.out.push(':');
+            match value {
+                // Sequences in mappings are not indented relative to their key.
+                Byml::Array(items) if !is_inline(value) => {
+                    self.out.push('\n');
+                    self.block_array(items, indent, false);
+                }
+                Byml::Hash(hash) if !is_inline(value) => {
+                    self.out.push('\n');
+                    self.block_hash(hash, indent + 2, false);
+                }
+                _ => {
+                    self.out.push(' ');
+                    self.node(value, indent);
+                }
+            }
+        }
+    }
+}
+
+/// Write a document to YAML.
+pub(super) fn to_text(root: &Byml) -> String {
+    let mut emitter = Emitter {
+        out: String::with_capacity(estimate_size(root, 0)),
+    };
+    match root {
+        Byml::Array(items) if !is_inline(root) => emitter.block_array(items, 0, false),
+        Byml::Hash(hash) if !is_inline(root) => emitter.block_hash(hash, 0, false),
+        _ => emitter.node(root, 0),
+    }
+    emitter.out
+}
+
+impl BymlBuilder {
+    fn push_plain(&mut self, value: &str) -> std::result::Result<(), String> {
+        if yaml::is_null(value) {
+            self.push_null();
+        } else if let Some(v) = yaml::parse_bool(value) {
+            self.push_bool(v);
+        } else if let Some(v) = yaml::parse_int(value) {
+            if let Ok(v) = i32::try_from(v) {
+                self.push_int(v);
+            } else if let Ok(v) = i64::try_from(v) {
+                self.push_int64(v);
+            } else {
+                self.push_uint64(u64::try_from(v).map_err(|_| "integer out of range")?);
+            }
+        } else if let Some(v) = yaml::parse_float(value) {
+            self.push_float(v as f32);
+        } else {
+            self.push_string(value);
+        }
+        Ok(())
+    }
+}
+
+fn int<T: TryFrom<i128>>(value: &str) -> std::result::Result<T, String> {
+    let v = yaml::parse_int(value).ok_or_else(|| format!("invalid integer: {}", value))?;
+    T::try_from(v).map_err(|_| format!("integer out of range: {}", value))
+}
+
+fn float(value: &str) -> std::result::Result<f64, String> {
+    yaml::parse_float(value)
+        .or_else(|| yaml::parse_int(value).map(|v| v as f64))
+        .ok_or_else(|| format!("invalid float: {}", value))
+}
+
+impl Handler for BymlBuilder {
+    fn scalar(&mut self, tag: Option<&str>, value: Scalar<'_>) -> std::result::Result<(), String> {
+        let text = &*value.value;
+        match tag {
+            None if value.plain => self.push_plain(text)?,
+            None | Some("!!str") => self.push_string(text),
+            Some("!u") => self.push_uint(int(text)?),
+            Some("!l") => self.push_int64(int(text)?),
+            Some("!ul") => self.push_uint64(int(text)?),
+            Some("!f64") => self.push_double(float(text)?),
+            Some("!!int") => self.push_int(int(text)?),
+            Some("!!float") => self.push_float(float(text)? as f32),
+            Some("!!bool") => {
+                self.push_bool(yaml::parse_bool(text).ok_or("invalid boolean")?);
+            }
+            Some("!!null") => self.push_null(),
+            Some("!!binary") => {
+                self.push_binary(&yaml::parse_base64(text).ok_or("invalid base64 data")?);
+            }
+            Some(tag) => return Err(format!("unknown tag: {}", tag)),
+        }
+        Ok(())
+    }
+
+    fn key(&mut self, key: Scalar<'_>) -> std::result::Result<(), String> {
+        self.push_key(&key.value);
+        Ok(())
+    }
+
+    fn begin_seq(&mut self, tag: Option<&str>) -> std::result::Result<(), String> {
+        match tag {
+            None | Some("!!seq") => {
+                self.begin_array(0);
+                Ok(())
+            }
+            Some(tag) => Err(format!("unknown tag: {}", tag)),
+        }
+    }
+
+    fn begin_map(&mut self, tag: Option<&str>) -> std::result::Result<(), String> {
+        match tag {
+            None | Some("!!map") => {
+                self.begin_hash(0);
+                Ok(())
+            }
+            Some(tag) => Err(format!("unknown tag: {}", tag)),
+        }
+    }
+
+    fn end(&mut self) -> std::result::Result<(), String> {
+        self.end_container();
+        Ok(())
+    }
+}
+
+/// Parse a YAML document.
+pub(super) fn from_text(text: &str) -> Result<Byml> {
+    let mut builder = BymlBuilder::default();
+    yaml::parse(text, &mut builder).map_err(|e| BymlError::TextError(e.to_string()))?;
+    Ok(builder.finish())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{from_text, to_text};
+    use crate::byml::Byml;
+
+    #[test]
+    fn text_roundtrip() {
+        let actor = |name: &str, i: i32| {
+            Byml::Hash(
+                vec![
+                    ("name".into(), Byml::String(name.to_owned())),
+                    ("life".into(), Byml::Int(i)),
+                    ("hash".into(), Byml::UInt(0xdead_beef)),
+                    ("scale".into(), Byml::Float(0.35)),
+                    (
+                        "tags".into(),
+                        Byml::Array(vec![Byml::String("0".to_owned()), Byml::Null]),
+                    ),
+                ]
+                .into_iter()
+                .collect(),
+            )
+        };
+        let byml = Byml::Hash(
+            vec![
+                (
+                    "Actors".into(),
+                    Byml::Array(vec![actor("Enemy_Bokoblin", 13), actor("it's: odd", -1)]),
+                ),
+                (
+                    "Misc".into(),
+                    Byml::Hash(
+                        vec![
+                            ("big".into(), Byml::Int64(-1 << 40)),
+                            ("huge".into(), Byml::UInt64(u64::MAX)),
+                            ("double".into(), Byml::Double(1e300)),
+                            ("data".into(), Byml::Binary(b"hello".to_vec())),
+                            ("empty".into(), Byml::Array(vec![])),
+                            ("nested".into(), Byml::Array(vec![Byml::Array(vec![])])),
+                            ("text".into(), Byml::String("line\nbreak".to_owned())),
+                        ]
+                        .into_iter()
+                        .collect(),
+                    ),
+                ),
+            ]
+            .into_iter()
+            .collect(),
+        );
+        let text = to_text(&byml);
+        assert!(text.starts_with("Actors:\n- hash: !u 0xdeadbeef\n  life: 13\n"));
+        assert!(text.contains("  tags: ['0', null]\n"));
+        assert!(text.contains("  data: !!binary aGVsbG8=\n"));
+        assert_eq!(from_text(&text).unwrap(), byml);
+
+        let root = Byml::Array(vec![byml.clone(), Byml::Array(vec![byml])]);
+        assert_eq!(from_text(&to_text(&root)).unwrap(), root);
+        assert_eq!(
+            from_text("{a: 1, b: [2.5, x, !l 3]}").unwrap(),
+            Byml::Hash(
+                vec![
+                    ("a".into(), Byml::Int(1)),
+                    (
+                        "b".into(),
+                        Byml::Array(vec![
+                            Byml::Float(2.5),
+                            Byml::String("x".to_owned()),
+                            Byml::Int64(3)
+                        ])
+                    ),
+                ]
+                .into_iter()
+                .collect()
+            )
+        );
+        assert!(from_text("a: !bogus 1").is_err());
+    }
+}
@@ -0,0 +1,570 @@
+//! Zero-copy, lazily decoded access to binary BYML documents.
+//!
+//! A `BymlView` borrows the original binary data and only decodes the nodes
+//! that are actually accessed. Hash keys are resolved through the document's
+//! hash key table, and containers are not descended into until requested.
+//! ```
+//! # use roead::{byml::{Byml, BymlView}, Endian};
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let text = "{Actors: [{name: Enemy_Lynel_Dark, instSize: 20480}]}";
+//! let buf: Vec<u8> = Byml::from_text(text)?.to_binary(Endian::Little);
+//! let actor_info = BymlView::new(&buf)?;
+//! let actors = actor_info.get("Actors")?.expect("No actor list");
+//! let name: &str = actors.at(0)?.get("name")?.unwrap().as_string()?;
+//! assert_eq!(name, "Enemy_Lynel_Dark");
+//! # Ok(())
+//! # }
+//! ```
+use super::{Byml, BymlError, Key, KeyPool, Result};
+use crate::{
+    stats::{self, Format, Phase},
+    Endian,
+};
+
+pub(crate) mod node_type {
+    pub const STRING: u8 = 0xA0;
+    pub const BINARY: u8 = 0xA1;
+    pub const ARRAY: u8 = 0xC0;
+    pub const HASH: u8 = 0xC1;
+    pub const STRING_TABLE: u8 = 0xC2;
+    pub const BOOL: u8 = 0xD0;
+    pub const INT: u8 = 0xD1;
+    pub const FLOAT: u8 = 0xD2;
+    pub const UINT: u8 = 0xD3;
+    pub const INT64: u8 = 0xD4;
+    pub const UINT64: u8 = 0xD5;
+    pub const DOUBLE: u8 = 0xD6;
+    pub const NULL: u8 = 0xFF;
+}
+
+use node_type::*;
+
+/// How deeply containers may nest. A malformed document can point a
+/// container back at itself or an ancestor, so anything that follows
+/// container offsets stops here rather than overflowing the stack.
+pub(crate) const MAX_DEPTH: usize = 256;
+
+/// Shared context for every node in a document: the raw data, its
+/// endianness and the locations of the two string tables.
+#[derive(Debug, Clone, Copy)]
+struct Document<'a> {
+    data: &'a [u8],
+    endian: Endian,
+    hash_key_table: usize,
+    string_table: usize,
+}
+
+impl<'a> Document<'a> {
+    #[inline]
+    fn bytes<const N: usize>(&self, offset: usize) -> Result<[u8; N]> {
+        let mut bytes = [0u8; N];
+        bytes.copy_from_slice(
+            self.data
+                .get(offset..offset + N)
+                .ok_or(BymlError::DataError("offset out of bounds"))?,
+        );
+        Ok(bytes)
+    }
+
+    #[inline]
+    fn u16(&self, offset: usize) -> Result<u16> {
+        let bytes = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u16::from_be_bytes(bytes),
+            Endian::Little => u16::from_le_bytes(bytes),
+        })
+    }
+
+    #[inline]
+    fn u24(&self, offset: usize) -> Result<u32> {
+        let [a, b, c]: [u8; 3] = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u32::from_be_bytes([0, a, b, c]),
+            Endian::Little => u32::from_le_bytes([a, b, c, 0]),
+        })
+    }
+
+    #[inline]
+    fn u32(&self, offset: usize) -> Result<u32> {
+        let bytes = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u32::from_be_bytes(bytes),
+            Endian::Little => u32::from_le_bytes(bytes),
+        })
+    }
+
+    #[inline]
+    fn u64(&self, offset: usize) -> Result<u64> {
+        let bytes = self.bytes(offset)?;
+        Ok(match self.endian {
+            Endian::Big => u64::from_be_bytes(bytes),
+            Endian::Little => u64::from_le_bytes(bytes),
+        })
+    }
+
+    #[inline]
+    fn u8(&self, offset: usize) -> Result<u8> {
+        self.data
+            .get(offset)
+            .copied()
+            .ok_or(BymlError::DataError("offset out of bounds"))
+    }
+
+    /// Number of entries in a string table, or 0 if the table is absent.
+    fn table_len(&self, table: usize) -> Result<u32> {
+        if table == 0 {
+            Ok(0)
+        } else {
+            self.u24(table + 1)
+        }
+    }
+
+    fn table_string(&self, table: usize, index: u32) -> Result<&'a str> {
+        if index >= self.table_len(table)? {
+            return Err(BymlError::DataError("string index out of bounds"));
+        }
+        let start = table + self.u32(table + 4 + 4 * index as usize)? as usize;
+        let bytes = self
+            .data
+            .get(start..)
+            .ok_or(BymlError::DataError("string offset out of bounds"))?;
+        let len = bytes
+            .iter()
+            .position(|b| *b == 0)
+            .ok_or(BymlError::DataError("unterminated string"))?;
+        std::str::from_utf8(&bytes[..len])
+            .map_err(|_| BymlError::DataError("string is not valid UTF-8"))
+    }
+
+    /// Binary search the (sorted) hash key table for a key.
+    fn key_index(&self, key: &str) -> Result<Option<u32>> {
+        let (mut lo, mut hi) = (0, self.table_len(self.hash_key_table)?);
+        while lo < hi {
+            let mid = lo + (hi - lo) / 2;
+            match self
+                .table_string(self.hash_key_table, mid)?
+                .as_bytes()
+                .cmp(key.as_bytes())
+            {
+                std::cmp::Ordering::Less => lo = mid + 1,
+                std::cmp::Ordering::Greater => hi = mid,
+                std::cmp::Ordering::Equal => return Ok(Some(mid)),
+            }
+        }
+        Ok(None)
+    }
+
+    fn container_len(&self, offset: usize, expected: u8) -> Result<usize> {
+        if self.u8(offset)? != expected {
+            return Err(BymlError::DataError("container node has wrong type"));
+        }
+        Ok(self.u24(offset + 1)? as usize)
+    }
+}
+
+/// The interned keys of a document, by index in its hash key table. Keys are
+/// created on first use.
+struct KeyTable<'a, 'p> {
+    doc: Document<'a>,
+    keys: Vec<Option<Key>>,
+    pool: Option<&'p mut KeyPool>,
+}
+
+impl<'a, 'p> KeyTable<'a, 'p> {
+    fn new(doc: Document<'a>, pool: Option<&'p mut KeyPool>) -> Result<Self> {
+        // The count comes straight from the header, so check that the table
+        // has room for its offsets before allocating a slot for each.
+        let len = doc.table_len(doc.hash_key_table)? as usize;
+        if doc.hash_key_table + 4 + 4 * len > doc.data.len() {
+            return Err(BymlError::DataError("hash key table out of bounds"));
+        }
+        Ok(KeyTable {
+            keys: vec![None; len],
+            doc,
+            pool,
+        })
+    }
+
+    fn get(&mut self, index: u32) -> Result<Key> {
+        if let Some(Some(key)) = self.keys.get(index as usize) {
+            return Ok(key.clone());
+        }
+        let text = self.doc.table_string(self.doc.hash_key_table, index)?;
+        let key = match &mut self.pool {
+            Some(pool) => pool.intern(text),
+            None => Key::from(text),
+        };
+        self.keys[index as usize] = Some(key.clone());
+        Ok(key)
+    }
+}
+
+/// A borrowed handle to a single node in a binary BYML document.
+///
+/// Views are cheap to copy. Accessors return a `BymlError::TypeError` if the
+/// node has a different type, or a `BymlError::DataError` if the underlying
+/// data turns out to be malformed.
+#[derive(Debug, Clone, Copy)]
+pub struct BymlView<'a> {
+    doc: Document<'a>,
+    node_type: u8,
+    value: u32,
+}
+
+impl<'a> BymlView<'a> {
+    /// Open a binary BYML document and return a view of its root node. Only
+    /// the header is validated; everything else is decoded on access.
+    pub fn new(data: &'a [u8]) -> Result<BymlView<'a>> {
+        if data.len() < 0x10 {
+            return Err(BymlError::DataError("not enough data for BYML header"));
+        }
+        let endian = match &data[0..2] {
+            b"BY" => Endian::Big,
+            b"YB" => Endian::Little,
+            _ => {
+                return Err(BymlError::MagicError(
+                    String::from_utf8_lossy(&data[0..2]).to_string(),
+                ))
+            }
+        };
+        let mut doc = Document {
+            data,
+            endian,
+            hash_key_table: 0,
+            string_table: 0,
+        };
+        if !(2..=4).contains(&doc.u16(2)?) {
+            return Err(BymlError::DataError("unsupported BYML version"));
+        }
+        doc.hash_key_table = doc.u32(4)? as usize;
+        doc.string_table = doc.u32(8)? as usize;
+        for table in [doc.hash_key_table, doc.string_table] {
+            if table != 0 && doc.u8(table)? != STRING_TABLE {
+                return Err(BymlError::DataError("invalid string table"));
+            }
+        }
+        let root = doc.u32(0xC)?;
+        if root == 0 {
+            return Ok(BymlView {
+                doc,
+                node_type: NULL,
+                value: 0,
+            });
+        }
+        match doc.u8(root as usize)? {
+            node_type @ (ARRAY | HASH) => Ok(BymlView {
+                doc,
+                node_type,
+                value: root,
+            }),
+            _ => Err(BymlError::DataError("root node must be an array or hash")),
+        }
+    }
+
+    /// Get the endianness of the underlying document.
+    pub fn endian(&self) -> Endian {
+        self.doc.endian
+    }
+
+    /// Get the raw BYML node type of the node.
+    pub(super) fn node_type(&self) -> u8 {
+        self.node_type
+    }
+
+    /// Check if the node is null.
+    pub fn is_null(&self) -> bool {
+        self.node_type == NULL
+    }
+
+    /// Check if the node is a hash.
+    pub fn is_hash(&self) -> bool {
+        self.node_type == HASH
+    }
+
+    /// Check if the node is an array.
+    pub fn is_array(&self) -> bool {
+        self.node_type == ARRAY
+    }
+
+    /// Get the number of entries in an array or hash node.
+    pub fn len(&self) -> Result<usize> {
+        match self.node_type {
+            ARRAY | HASH => self.doc.container_len(self.value as usize, self.node_type),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Check if an array or hash node has no entries.
+    pub fn is_empty(&self) -> Result<bool> {
+        self.len().map(|len| len == 0)
+    }
+
+    /// Look up a key in a hash node. Returns `Ok(None)` if the key is not present.
+    pub fn get(&self, key: &str) -> Result<Option<BymlView<'a>>> {
+        if self.node_type != HASH {
+            return Err(BymlError::TypeError);
+        }
+        let key_idx = match self.doc.key_index(key)? {
+            Some(idx) => idx,
+            None => return Ok(None),
+        };
+        let offset = self.value as usize;
+        let (mut lo, mut hi) = (0, self.doc.container_len(offset, HASH)?);
+        while lo < hi {
+            let mid = lo + (hi - lo) / 2;
+            let entry = offset + 4 + 8 * mid;
+            match self.doc.u24(entry)?.cmp(&key_idx) {
+                std::cmp::Ordering::Less => lo = mid + 1,
+                std::cmp::Ordering::Greater => hi = mid,
+                std::cmp::Ordering::Equal => return self.hash_entry(entry).map(|(_, v)| Some(v)),
+            }
+        }
+        Ok(None)
+    }
+
+    /// Get the node at an index in an array node.
+    pub fn at(&self, index: usize) -> Result<BymlView<'a>> {
+        let len = match self.node_type {
+            ARRAY => self.doc.container_len(self.value as usize, ARRAY)?,
+            _ => return Err(BymlError::TypeError),
+        };
+        if index >= len {
+            return Err(BymlError::DataError("array index out of bounds"));
+        }
+        self.array_entry(len, index)
+    }
+
+    /// Iterate over the entries of a hash node in key order.
+    pub fn hash_iter(&self) -> Result<impl Iterator<Item = Result<(&'a str, BymlView<'a>)>>> {
+        if self.node_type != HASH {
+            return Err(BymlError::TypeError);
+        }
+        let this = *self;
+        let offset = self.value as usize;
+        Ok((0..self.doc.container_len(offset, HASH)?)
+            .map(move |i| this.hash_entry(offset + 4 + 8 * i)))
+    }
+
+    /// Iterate over the items of an array node.
+    pub fn array_iter(&self) -> Result<impl Iterator<Item = Result<BymlView<'a>>>> {
+        if self.node_type != ARRAY {
+            return Err(BymlError::TypeError);
+        }
+        let this = *self;
+        let len = self.doc.container_len(self.value as usize, ARRAY)?;
+        Ok((0..len).map(move |i| this.array_entry(len, i)))
+    }
+
+    fn hash_entry(&self, entry: usize) -> Result<(&'a str, BymlView<'a>)> {
+        let key = self
+            .doc
+            .table_string(self.doc.hash_key_table, self.doc.u24(entry)?)?;
+        Ok((
+            key,
+            BymlView {
+                doc: self.doc,
+                node_type: self.doc.u8(entry + 3)?,
+                value: self.doc.u32(entry + 4)?,
+            },
+        ))
+    }
+
+    fn array_entry(&self, len: usize, index: usize) -> Result<BymlView<'a>> {
+        let offset = self.value as usize;
+        let values = offset + 4 + ((len + 3) & !3);
+        Ok(BymlView {
+            doc: self.doc,
+            node_type: self.doc.u8(offset + 4 + index)?,
+            value: self.doc.u32(values + 4 * index)?,
+        })
+    }
+
+    /// Returns a result with the boolean value or a type error
+    pub fn as_bool(&self) -> Result<bool> {
+        match self.node_type {
+            BOOL => Ok(self.value != 0),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the s32 value or a type error
+    pub fn as_int(&self) -> Result<i32> {
+        match self.node_type {
+            INT => Ok(self.value as i32),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u32 value or a type error
+    pub fn as_uint(&self) -> Result<u32> {
+        match self.node_type {
+            UINT => Ok(self.value),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f32 value or a type error
+    pub fn as_float(&self) -> Result<f32> {
+        match self.node_type {
+            FLOAT => Ok(f32::from_bits(self.value)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the i64 value or a type error
+    pub fn as_int64(&self) -> Result<i64> {
+        match self.node_type {
+            INT64 => Ok(self.doc.u64(self.value as usize)? as i64),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the u64 value or a type error
+    pub fn as_uint64(&self) -> Result<u64> {
+        match self.node_type {
+            UINT64 => self.doc.u64(self.value as usize),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with the f64 value or a type error
+    pub fn as_double(&self) -> Result<f64> {
+        match self.node_type {
+            DOUBLE => Ok(f64::from_bits(self.doc.u64(self.value as usize)?)),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with a string slice borrowed from the document or a type error
+    pub fn as_string(&self) -> Result<&'a str> {
+        match self.node_type {
+            STRING => self.doc.table_string(self.doc.string_table, self.value),
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Returns a result with a byte slice borrowed from the document or a type error
+    pub fn as_binary(&self) -> Result<&'a [u8]> {
+        match self.node_type {
+            BINARY => {
+                let start = self.value as usize + 4;
+                let len = self.doc.u32(self.value as usize)? as usize;
+                self.doc
+                    .data
+                    .get(start..start + len)
+                    .ok_or(BymlError::DataError("binary data out of bounds"))
+            }
+            _ => Err(BymlError::TypeError),
+        }
+    }
+
+    /// Decode this node and everything below it into an owned `Byml`. Each
+    /// distinct hash key is allocated once.
+    pub fn to_byml(&self) -> Result<Byml> {
+        let _span = stats::span(Format::Byml, Phase::Convert, self.doc.data.len());
+        self.decode(&mut KeyTable::new(self.doc, None)?, 0)
+    }
+
+    /// Decode this node and everything below it into an owned `Byml`, taking
+    /// hash keys from a pool shared with other documents.
+    pub fn to_byml_with_pool(&self, pool: &mut KeyPool) -> Result<Byml> {
+        let _span = stats::span(Format::Byml, Phase::Convert, self.doc.data.len());
+        self.decode(&mut KeyTable::new(self.doc, Some(pool))?, 0)
+    }
+
+    fn decode(&self, keys: &mut KeyTable, depth: usize) -> Result<Byml> {
+        if depth >= MAX_DEPTH && matches!(self.node_type, ARRAY | HASH) {
+            return Err(BymlError::DataError("containers are nested too deeply"));
+        }
+        Ok(match self.node_type {
+            NULL => Byml::Null,
+            BOOL => Byml::Bool(self.as_bool()?),
+            INT => Byml::Int(self.as_int()?),
+            UINT => Byml::UInt(self.as_uint()?),
+            FLOAT => Byml::Float(self.as_float()?),
+            INT64 => Byml::Int64(self.as_int64()?),
+            UINT64 => Byml::UInt64(self.as_uint64()?),
+            DOUBLE => Byml::Double(self.as_double()?),
+            STRING => Byml::String(self.as_string()?.to_owned()),
+            BINARY => Byml::Binary(self.as_binary()?.to_vec()),
+            ARRAY => Byml::Array(
+                self.array_iter()?
+                    .map(|node| node.and_then(|node| node.decode(keys, depth + 1)))
+                    .collect::<Result<_>>()?,
+            ),
+            HASH => {
+                let offset = self.value as usize;
+                Byml::Hash(
+                    (0..self.doc.container_len(offset, HASH)?)
+                        .map(|i| {
+                            let entry = offset + 4 + 8 * i;
+                            let key = keys.get(self.doc.u24(entry)?)?;
+                            let value = BymlView {
+                                doc: self.doc,
+                                node_type: self.doc.u8(entry + 3)?,
+                                value: self.doc.u32(entry + 4)?,
+                            };
+                            Ok((key, value.decode(keys, depth + 1)?))
+                        })
+                        .collect::<Result<_>>()?,
+                )
+            }
+            _ => return Err(BymlError::DataError("invalid node type")),
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::BymlView;
+    use crate::{byml::Byml, Endian};
+
+    #[test]
+    fn view_roundtrip() {
+        let text =
+            std::fs::read_to_string("include/oead/test/byml/files/ActorInfo.product.yml").unwrap();
+        let byml = Byml::from_text(&text).unwrap();
+        for endian in [Endian::Big, Endian::Little] {
+            let bytes = byml.to_binary(endian);
+            let view = BymlView::new(&bytes).unwrap();
+            assert_eq!(view.endian(), endian);
+            assert_eq!(view.to_byml().unwrap(), byml);
+        }
+    }
+
+    #[test]
+    fn view_lookup() {
+        let data = std::fs::read("include/oead/test/byml/files/ActorInfo.product.byml").unwrap();
+        let view = BymlView::new(&data).unwrap();
+        let actors = view.get("Actors").unwrap().unwrap();
+        assert_eq!(actors.len().unwrap(), 7934);
+        assert_eq!(
+            view.get("Hashes").unwrap().unwrap().at(0).unwrap().as_int().unwrap(),
+            31119
+        );
+        assert!(actors.at(0).unwrap().get("name").unwrap().is_some());
+        assert!(view.get("NotAKey").unwrap().is_none());
+        assert!(actors.at(7934).is_err());
+    }
+
+    #[test]
+    fn oversized_key_table() {
+        let byml = Byml::from_text("{A: 1, B: 2}").unwrap();
+        let mut bytes = byml.to_binary(Endian::Little);
+        let table = u32::from_le_bytes([bytes[4], bytes[5], bytes[6], bytes[7]]) as usize;
+        bytes[table + 1..table + 4].copy_from_slice(&[0xFF, 0xFF, 0xFF]);
+        assert!(BymlView::new(&bytes).unwrap().to_byml().is_err());
+    }
+
+    #[test]
+    fn cyclic_containers() {
+        let byml = Byml::from_text("{A: [1]}").unwrap();
+        let mut bytes = byml.to_binary(Endian::Little);
+        // Make the root's only entry a hash that is the root itself
+        let root = u32::from_le_bytes([bytes[12], bytes[13], bytes[14], bytes[15]]) as usize;
+        bytes[root + 7] = 0xC1;
+        bytes[root + 8..root + 12].copy_from_slice(&(root as u32).to_le_bytes());
+        let view = BymlView::new(&bytes).unwrap();
+        assert!(view.to_byml().is_err());
+    }
+}
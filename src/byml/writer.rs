@@ -0,0 +1,605 @@
+//! Binary BYML serialization straight from the Rust structures.
+//!
+//! Documents are laid out in the same order as oead lays them out, though
+//! not byte for byte: binary nodes are padded to a multiple of 4 bytes
+//! after their size and data. Hash keys and strings go into sorted tables,
+//! every container is followed by the non-inline nodes it refers to, and
+//! non-inline nodes that are equal to one written earlier point to that one
+//! instead of being written again.
+//!
+//! Serialization takes two passes. The first decides where every node goes,
+//! and the second writes the nodes at those offsets. The parallel writer
+//! gathers the tables and the node hashes used to find equal nodes on the
+//! rayon thread pool, and fills disjoint parts of the output buffer
+//! concurrently. Only the placement pass runs on a single thread, so the
+//! result does not depend on scheduling.
+use super::view::node_type::*;
+use super::Byml;
+use crate::Endian;
+use rayon::prelude::*;
+use std::collections::{HashMap, HashSet};
+use xxhash_rust::xxh3::xxh3_64;
+
+const HEADER_SIZE: usize = 0x10;
+
+/// Containers with at least this many children are processed on the thread
+/// pool by the parallel writer.
+const PARALLEL_THRESHOLD: usize = 64;
+
+/// Smallest amount of node data written by one job of the parallel writer.
+const MIN_WRITE_CHUNK: usize = 0x10000;
+
+#[inline]
+pub(super) fn align4(value: usize) -> usize {
+    (value + 3) & !3
+}
+
+pub(super) fn node_type(node: &Byml) -> u8 {
+    match node {
+        Byml::String(_) => STRING,
+        Byml::Binary(_) => BINARY,
+        Byml::Array(_) => ARRAY,
+        Byml::Hash(_) => HASH,
+        Byml::Bool(_) => BOOL,
+        Byml::Int(_) => INT,
+        Byml::Float(_) => FLOAT,
+        Byml::UInt(_) => UINT,
+        Byml::Int64(_) => INT64,
+        Byml::UInt64(_) => UINT64,
+        Byml::Double(_) => DOUBLE,
+        Byml::Null => NULL,
+    }
+}
+
+#[inline]
+fn is_container(node: &Byml) -> bool {
+    matches!(node, Byml::Array(_) | Byml::Hash(_))
+}
+
+/// Nodes that are stored outside of their parent container.
+#[inline]
+pub(super) fn is_non_inline(node: &Byml) -> bool {
+    matches!(
+        node,
+        Byml::Array(_)
+            | Byml::Hash(_)
+            | Byml::Binary(_)
+            | Byml::Int64(_)
+            | Byml::UInt64(_)
+            | Byml::Double(_)
+    )
+}
+
+fn children(node: &Byml) -> impl Iterator<Item = &Byml> {
+    let (items, values) = match node {
+        Byml::Array(items) => (Some(items.iter()), None),
+        Byml::Hash(hash) => (None, Some(hash.values())),
+        _ => (None, None),
+    };
+    items
+        .into_iter()
+        .flatten()
+        .chain(values.into_iter().flatten())
+}
+
+/// Size of the header, type list and entries of a container written at
+/// `offset`.
+fn container_end(node: &Byml, offset: usize) -> usize {
+    match node {
+        Byml::Array(items) => align4(offset + 4 + items.len()) + 4 * items.len(),
+        Byml::Hash(hash) => offset + 4 + 8 * hash.len(),
+        _ => unreachable!(),
+    }
+}
+
+/// Size of a non-inline value node. Binary data is padded so the next node
+/// stays aligned.
+fn value_size(node: &Byml) -> usize {
+    match node {
+        Byml::Binary(data) => align4(4 + data.len()),
+        Byml::Int64(_) | Byml::UInt64(_) | Byml::Double(_) => 8,
+        _ => unreachable!(),
+    }
+}
+
+pub(super) fn table_size(table: &[&str]) -> usize {
+    align4(4 + 4 * (table.len() + 1) + table.iter().map(|s| s.len() + 1).sum::<usize>())
+}
+
+#[inline]
+fn address(node: &Byml) -> usize {
+    node as *const Byml as usize
+}
+
+// Node hashes only serve to find candidates for sharing, which are then
+// compared in full, so a fast multiplicative mix is enough.
+const SEED: u64 = 0x517c_c1b7_2722_0a95;
+
+#[inline]
+fn mix(hash: u64, word: u64) -> u64 {
+    (hash.rotate_left(5) ^ word).wrapping_mul(SEED)
+}
+
+fn value_hash(node: &Byml) -> u64 {
+    let word = match node {
+        Byml::String(s) => xxh3_64(s.as_bytes()),
+        Byml::Binary(data) => xxh3_64(data),
+        Byml::Bool(v) => *v as u64,
+        Byml::Int(v) => *v as u32 as u64,
+        Byml::UInt(v) => *v as u64,
+        Byml::Float(v) => v.to_bits() as u64,
+        Byml::Int64(v) => *v as u64,
+        Byml::UInt64(v) => *v,
+        Byml::Double(v) => v.to_bits(),
+        _ => 0,
+    };
+    mix(mix(0, node_type(node) as u64), word)
+}
+
+/// Whether two nodes are written the same way. Unlike `==`, floats are
+/// compared by their bits, so -0.0 and 0.0 are kept apart and a NaN matches
+/// itself.
+fn same(a: &Byml, b: &Byml) -> bool {
+    match (a, b) {
+        (Byml::Array(a), Byml::Array(b)) => {
+            a.len() == b.len() && a.iter().zip(b).all(|(a, b)| same(a, b))
+        }
+        (Byml::Hash(a), Byml::Hash(b)) => {
+            a.len() == b.len()
+                && a.iter()
+                    .zip(b)
+                    .all(|((ka, a), (kb, b))| ka == kb && same(a, b))
+        }
+        (Byml::Float(a), Byml::Float(b)) => a.to_bits() == b.to_bits(),
+        (Byml::Double(a), Byml::Double(b)) => a.to_bits() == b.to_bits(),
+        _ => a == b,
+    }
+}
+
+/// Hash a container and record the hashes of all containers in its
+/// subtree in `out`.
+fn container_hash(node: &Byml, out: &mut Vec<(usize, u64)>, parallel: bool) -> u64 {
+    fn child_hash(node: &Byml, out: &mut Vec<(usize, u64)>, parallel: bool) -> u64 {
+        if is_container(node) {
+            container_hash(node, out, parallel)
+        } else {
+            value_hash(node)
+        }
+    }
+
+    let seed = mix(0, node_type(node) as u64);
+    let hash = match node {
+        Byml::Array(items) if parallel && items.len() >= PARALLEL_THRESHOLD => items
+            .par_iter()
+            .map(|item| {
+                let mut hashes = Vec::new();
+                (child_hash(item, &mut hashes, true), hashes)
+            })
+            .collect::<Vec<_>>()
+            .into_iter()
+            .fold(seed, |hash, (child, hashes)| {
+                out.extend(hashes);
+                mix(hash, child)
+            }),
+        Byml::Array(items) => items.iter().fold(seed, |hash, item| {
+            mix(hash, child_hash(item, out, parallel))
+        }),
+        Byml::Hash(hash) if parallel && hash.len() >= PARALLEL_THRESHOLD => hash
+            .iter()
+            .collect::<Vec<_>>()
+            .par_iter()
+            .map(|(key, value)| {
+                let mut hashes = Vec::new();
+                let child = child_hash(value, &mut hashes, true);
+                (xxh3_64(key.as_bytes()), child, hashes)
+            })
+            .collect::<Vec<_>>()
+            .into_iter()
+            .fold(seed, |hash, (key, child, hashes)| {
+                out.extend(hashes);
+                mix(mix(hash, key), child)
+            }),
+        Byml::Hash(hash) => hash.iter().fold(seed, |hash, (key, value)| {
+            mix(
+                mix(hash, xxh3_64(key.as_bytes())),
+                child_hash(value, out, parallel),
+            )
+        }),
+        _ => unreachable!(),
+    };
+    out.push((address(node), hash));
+    hash
+}
+
+/// Hash keys and strings used in a document, in no particular order.
+#[derive(Default)]
+struct Strings<'a> {
+    keys: Vec<&'a str>,
+    strings: Vec<&'a str>,
+    seen_keys: HashSet<usize>,
+}
+
+impl<'a> Strings<'a> {
+    fn collect(&mut self, node: &'a Byml, parallel: bool) {
+        match node {
+            Byml::String(s) => self.strings.push(s),
+            // Keys from one parse share their allocations, so most repeated
+            // keys can be skipped without comparing them
+            Byml::Hash(hash) => {
+                for key in hash.keys() {
+                    if self.seen_keys.insert(key.as_ptr() as usize) {
+                        self.keys.push(key);
+                    }
+                }
+            }
+            _ => (),
+        }
+        let count = match node {
+            Byml::Array(items) => items.len(),
+            Byml::Hash(hash) => hash.len(),
+            _ => return,
+        };
+        if parallel && count >= PARALLEL_THRESHOLD {
+            let parts: Vec<Strings> = children(node)
+                .collect::<Vec<_>>()
+                .par_iter()
+                .map(|child| {
+                    let mut part = Strings::default();
+                    part.collect(child, true);
+                    part
+                })
+                .collect();
+            for part in parts {
+                self.keys.extend(part.keys);
+                self.strings.extend(part.strings);
+            }
+        } else {
+            children(node).for_each(|child| self.collect(child, parallel));
+        }
+    }
+}
+
+/// Run two closures on the thread pool if `parallel` is set, or one after
+/// the other on the current thread otherwise.
+fn join<A, B, RA, RB>(parallel: bool, a: A, b: B) -> (RA, RB)
+where
+    A: FnOnce() -> RA + Send,
+    B: FnOnce() -> RB + Send,
+    RA: Send,
+    RB: Send,
+{
+    if parallel {
+        rayon::join(a, b)
+    } else {
+        (a(), b())
+    }
+}
+
+fn sort_table(mut table: Vec<&str>, parallel: bool) -> Vec<&str> {
+    if parallel {
+        table.par_sort_unstable();
+    } else {
+        table.sort_unstable();
+    }
+    table.dedup();
+    table
+}
+
+/// Where a node ends up in the output.
+struct Placed<'a> {
+    node: &'a Byml,
+    offset: usize,
+    /// For containers, the index in [`Layout::child_offsets`] of the offset
+    /// of the container's first non-inline child.
+    children: usize,
+}
+
+/// Decides the offset of every node, in the order oead writes them.
+struct Planner<'a> {
+    hashes: HashMap<usize, u64>,
+    written: HashMap<u64, Vec<(&'a Byml, u32)>>,
+    nodes: Vec<Placed<'a>>,
+    child_offsets: Vec<u32>,
+    size: usize,
+}
+
+impl<'a> Planner<'a> {
+    fn place_container(&mut self, node: &'a Byml) {
+        let start = self.child_offsets.len();
+        self.nodes.push(Placed {
+            node,
+            offset: self.size,
+            children: start,
+        });
+        self.size = container_end(node, self.size);
+        self.child_offsets
+            .extend(children(node).filter(|c| is_non_inline(c)).map(|_| 0));
+        for (i, child) in children(node).filter(|c| is_non_inline(c)).enumerate() {
+            let hash = if is_container(child) {
+                self.hashes[&address(child)]
+            } else {
+                value_hash(child)
+            };
+            let existing = self
+                .written
+                .get(&hash)
+                .and_then(|nodes| nodes.iter().find(|(node, _)| same(node, child)));
+            if let Some((_, offset)) = existing {
+                self.child_offsets[start + i] = *offset;
+                continue;
+            }
+            let offset = self.size as u32;
+            self.child_offsets[start + i] = offset;
+            self.written.entry(hash).or_default().push((child, offset));
+            if is_container(child) {
+                self.place_container(child);
+            } else {
+                self.nodes.push(Placed {
+                    node: child,
+                    offset: self.size,
+                    children: 0,
+                });
+                self.size += value_size(child);
+            }
+        }
+    }
+}
+
+/// A fully laid out document.
+pub(super) struct Layout<'a> {
+    endian: Endian,
+    version: u16,
+    keys: Vec<&'a str>,
+    strings: Vec<&'a str>,
+    key_table: usize,
+    string_table: usize,
+    root: usize,
+    nodes: Vec<Placed<'a>>,
+    child_offsets: Vec<u32>,
+    size: usize,
+    parallel: bool,
+}
+
+impl<'a> Layout<'a> {
+    pub(super) fn new(root: &'a Byml, endian: Endian, version: u16, parallel: bool) -> Layout<'a> {
+        let mut layout = Layout {
+            endian,
+            version,
+            keys: Vec::new(),
+            strings: Vec::new(),
+            key_table: 0,
+            string_table: 0,
+            root: 0,
+            nodes: Vec::new(),
+            child_offsets: Vec::new(),
+            size: HEADER_SIZE,
+            parallel,
+        };
+        if !is_container(root) {
+            return layout;
+        }
+
+        let (strings, hashes) = join(
+            parallel,
+            || {
+                let mut strings = Strings::default();
+                strings.collect(root, parallel);
+                strings
+            },
+            || {
+                let mut hashes = Vec::new();
+                container_hash(root, &mut hashes, parallel);
+                hashes
+            },
+        );
+        let Strings { keys, strings, .. } = strings;
+        let (keys, strings) = join(
+            parallel,
+            || sort_table(keys, parallel),
+            || sort_table(strings, parallel),
+        );
+        let mut offset = HEADER_SIZE;
+        if !keys.is_empty() {
+            layout.key_table = offset;
+            offset += table_size(&keys);
+        }
+        if !strings.is_empty() {
+            layout.string_table = offset;
+            offset += table_size(&strings);
+        }
+        layout.keys = keys;
+        layout.strings = strings;
+        layout.root = offset;
+
+        let mut planner = Planner {
+            hashes: hashes.into_iter().collect(),
+            written: HashMap::new(),
+            nodes: Vec::new(),
+            child_offsets: Vec::new(),
+            size: offset,
+        };
+        planner.place_container(root);
+        layout.nodes = planner.nodes;
+        layout.child_offsets = planner.child_offsets;
+        layout.size = align4(planner.size);
+        layout
+    }
+
+    pub(super) fn to_vec(&self) -> Vec<u8> {
+        let mut buf = vec![0u8; self.size];
+        let (head, body) = buf.split_at_mut(self.root.max(HEADER_SIZE));
+        let mut out = Out {
+            buf: head,
+            base: 0,
+            endian: self.endian,
+        };
+        out.u16(0, 0x4259);
+        out.u16(2, self.version);
+        out.u32(4, self.key_table as u32);
+        out.u32(8, self.string_table as u32);
+        if self.nodes.is_empty() {
+            return buf;
+        }
+        out.u32(12, self.root as u32);
+        if self.key_table != 0 {
+            out.table(self.key_table, &self.keys);
+        }
+        if self.string_table != 0 {
+            out.table(self.string_table, &self.strings);
+        }
+
+        if !self.parallel {
+            self.write_nodes(body, self.root, &self.nodes);
+            return buf;
+        }
+        let chunk =
+            ((self.size - self.root) / (rayon::current_num_threads() * 4)).max(MIN_WRITE_CHUNK);
+        let mut jobs = Vec::new();
+        let (mut rest, mut base, mut first) = (body, self.root, 0);
+        for i in 1..=self.nodes.len() {
+            let end = self.nodes.get(i).map_or(self.size, |node| node.offset);
+            if end - base >= chunk || i == self.nodes.len() {
+                let (part, tail) = std::mem::take(&mut rest).split_at_mut(end - base);
+                jobs.push((base, part, &self.nodes[first..i]));
+                rest = tail;
+                base = end;
+                first = i;
+            }
+        }
+        jobs.into_par_iter()
+            .for_each(|(base, part, nodes)| self.write_nodes(part, base, nodes));
+        buf
+    }
+
+    fn write_nodes(&self, buf: &mut [u8], base: usize, nodes: &[Placed]) {
+        let mut out = Out {
+            buf,
+            base,
+            endian: self.endian,
+        };
+        for placed in nodes {
+            let at = placed.offset;
+            match placed.node {
+                Byml::Array(items) => {
+                    out.u8(at, ARRAY);
+                    out.u24(at + 1, items.len() as u32);
+                    let entries = align4(at + 4 + items.len());
+                    let mut next = placed.children;
+                    for (i, item) in items.iter().enumerate() {
+                        out.u8(at + 4 + i, node_type(item));
+                        let value = self.entry_value(item, &mut next);
+                        out.u32(entries + 4 * i, value);
+                    }
+                }
+                Byml::Hash(hash) => {
+                    out.u8(at, HASH);
+                    out.u24(at + 1, hash.len() as u32);
+                    let mut next = placed.children;
+                    for (i, (key, value)) in hash.iter().enumerate() {
+                        let entry = at + 4 + 8 * i;
+                        let key = self.keys.binary_search(&key.as_str()).unwrap();
+                        out.u24(entry, key as u32);
+                        out.u8(entry + 3, node_type(value));
+                        let value = self.entry_value(value, &mut next);
+                        out.u32(entry + 4, value);
+                    }
+                }
+                Byml::Binary(data) => {
+                    out.u32(at, data.len() as u32);
+                    out.bytes(at + 4, data);
+                }
+                Byml::Int64(v) => out.u64(at, *v as u64),
+                Byml::UInt64(v) => out.u64(at, *v),
+                Byml::Double(v) => out.u64(at, v.to_bits()),
+                _ => unreachable!(),
+            }
+        }
+    }
+
+    /// The 32-bit value stored in a container entry: the value itself for
+    /// inline nodes, or the offset of the node otherwise.
+    fn entry_value(&self, node: &Byml, next_child: &mut usize) -> u32 {
+        if is_non_inline(node) {
+            *next_child += 1;
+            return self.child_offsets[*next_child - 1];
+        }
+        match node {
+            Byml::String(s) => self.strings.binary_search(&s.as_str()).unwrap() as u32,
+            Byml::Bool(v) => *v as u32,
+            Byml::Int(v) => *v as u32,
+            Byml::UInt(v) => *v,
+            Byml::Float(v) => v.to_bits(),
+            _ => 0,
+        }
+    }
+}
+
+/// Endian-aware writes into a part of the output buffer starting at `base`.
+pub(super) struct Out<'b> {
+    buf: &'b mut [u8],
+    base: usize,
+    endian: Endian,
+}
+
+impl<'b> Out<'b> {
+    pub(super) fn new(buf: &'b mut [u8], base: usize, endian: Endian) -> Self {
+        Out { buf, base, endian }
+    }
+
+    #[inline]
+    pub(super) fn bytes(&mut self, at: usize, bytes: &[u8]) {
+        let at = at - self.base;
+        self.buf[at..at + bytes.len()].copy_from_slice(bytes);
+    }
+
+    #[inline]
+    pub(super) fn u8(&mut self, at: usize, value: u8) {
+        self.buf[at - self.base] = value;
+    }
+
+    #[inline]
+    pub(super) fn u16(&mut self, at: usize, value: u16) {
+        match self.endian {
+            Endian::Big => self.bytes(at, &value.to_be_bytes()),
+            Endian::Little => self.bytes(at, &value.to_le_bytes()),
+        }
+    }
+
+    #[inline]
+    pub(super) fn u24(&mut self, at: usize, value: u32) {
+        match self.endian {
+            Endian::Big => self.bytes(at, &value.to_be_bytes()[1..]),
+            Endian::Little => self.bytes(at, &value.to_le_bytes()[..3]),
+        }
+    }
+
+    #[inline]
+    pub(super) fn u32(&mut self, at: usize, value: u32) {
+        match self.endian {
+            Endian::Big => self.bytes(at, &value.to_be_bytes()),
+            Endian::Little => self.bytes(at, &value.to_le_bytes()),
+        }
+    }
+
+    #[inline]
+    pub(super) fn u64(&mut self, at: usize, value: u64) {
+        match self.endian {
+            Endian::Big => self.bytes(at, &value.to_be_bytes()),
+            Endian::Little => self.bytes(at, &value.to_le_bytes()),
+        }
+    }
+
+    /// Write a string table: a header, the offsets of every string and of
+    /// the end of the last one relative to the table, then the strings.
+    pub(super) fn table(&mut self, at: usize, table: &[&str]) {
+        self.u8(at, STRING_TABLE);
+        self.u24(at + 1, table.len() as u32);
+        let mut offset = 4 + 4 * (table.len() + 1);
+        for (i, string) in table.iter().enumerate() {
+            self.u32(at + 4 + 4 * i, offset as u32);
+            self.bytes(at + offset, string.as_bytes());
+            offset += string.len() + 1;
+        }
+        self.u32(at + 4 + 4 * table.len(), offset as u32);
+    }
+}
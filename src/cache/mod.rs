@@ -0,0 +1,349 @@
+//! An opt-in cache of parsed documents, keyed by the contents of their
+//! binary data.
+//!
+//! Tools often parse the same files again and again: the same `ActorInfo`,
+//! the same AAMPs in every copy of an actor pack. A [`ParseCache`] hashes the
+//! input bytes with 128-bit xxh3 and hands out the document parsed from
+//! byte-identical input before, shared through an [`Arc`]. Entries are
+//! charged an estimate of their memory use against a budget, and the least
+//! recently used entries are evicted when it is exceeded.
+//!
+//! The process-wide cache returned by [`ParseCache::global`] starts with a
+//! budget of zero, which disables it, and is used by the `*_cached`
+//! constructors such as [`Byml::from_binary_cached`]:
+//! ```
+//! # use roead::{aamp::ParameterIO, cache::ParseCache};
+//! # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+//! ParseCache::global().set_budget(256 * 1024 * 1024);
+//! let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+//! let pio = ParameterIO::from_binary_cached(&data)?;
+//! let again = ParameterIO::from_binary_cached(&data)?;
+//! assert!(std::sync::Arc::ptr_eq(&pio, &again));
+//! # Ok(())
+//! # }
+//! ```
+use crate::{
+    aamp::{self, ParamList, Parameter, ParameterIO, ParameterList, ParameterObject},
+    byml::{self, Byml},
+    sarc::{Sarc, SarcError},
+};
+use once_cell::sync::Lazy;
+use std::{
+    any::{Any, TypeId},
+    collections::{BTreeMap, HashMap},
+    mem::size_of,
+    sync::{Arc, Mutex},
+};
+use xxhash_rust::xxh3::xxh3_128;
+
+/// A document type that can be stored in a [`ParseCache`].
+pub trait Cacheable: Any + Send + Sync + Sized {
+    type Error;
+
+    /// Parse the document from binary data.
+    fn parse(data: &[u8]) -> Result<Self, Self::Error>;
+
+    /// Estimate the memory used by the document, in bytes.
+    fn cost(&self) -> usize;
+}
+
+impl Cacheable for Byml {
+    type Error = byml::BymlError;
+
+    fn parse(data: &[u8]) -> byml::Result<Self> {
+        Byml::from_binary(data)
+    }
+
+    fn cost(&self) -> usize {
+        size_of::<Byml>() + byml_heap_size(self)
+    }
+}
+
+fn byml_heap_size(node: &Byml) -> usize {
+    match node {
+        Byml::String(v) => v.capacity(),
+        Byml::Binary(v) => v.capacity(),
+        Byml::Array(items) => {
+            items.capacity() * size_of::<Byml>() + items.iter().map(byml_heap_size).sum::<usize>()
+        }
+        // Each entry also pays for a share of its B-tree node's bookkeeping
+        Byml::Hash(hash) => hash
+            .iter()
+            .map(|(key, value)| {
+                size_of::<byml::Key>() + size_of::<Byml>() + 8 + key.len() + byml_heap_size(value)
+            })
+            .sum(),
+        _ => 0,
+    }
+}
+
+impl Cacheable for ParameterIO {
+    type Error = aamp::AampError;
+
+    fn parse(data: &[u8]) -> aamp::Result<Self> {
+        ParameterIO::from_binary(data)
+    }
+
+    fn cost(&self) -> usize {
+        size_of::<ParameterIO>() + self.doc_type.capacity() + list_heap_size(self)
+    }
+}
+
+fn list_heap_size<L: ParamList>(list: &L) -> usize {
+    // Index maps store each entry once plus one index slot in the hash table
+    let lists: usize = list
+        .lists()
+        .values()
+        .map(|list| size_of::<(u32, ParameterList)>() + 16 + list_heap_size(list))
+        .sum();
+    let objects: usize = list
+        .objects()
+        .values()
+        .map(|object| size_of::<(u32, ParameterObject)>() + 16 + object_heap_size(object))
+        .sum();
+    lists + objects
+}
+
+fn object_heap_size(object: &ParameterObject) -> usize {
+    object
+        .params()
+        .values()
+        .map(|param| {
+            size_of::<(u32, Parameter)>()
+                + 16
+                + match param {
+                    Parameter::String32(v)
+                    | Parameter::String64(v)
+                    | Parameter::String256(v)
+                    | Parameter::StringRef(v) => v.capacity(),
+                    Parameter::BufferInt(v) => 4 * v.capacity(),
+                    Parameter::BufferF32(v) => 4 * v.capacity(),
+                    Parameter::BufferU32(v) => 4 * v.capacity(),
+                    Parameter::BufferBinary(v) => v.capacity(),
+                    _ => 0,
+                }
+        })
+        .sum()
+}
+
+impl Cacheable for Sarc<'static> {
+    type Error = SarcError;
+
+    /// Parse the archive from a copy of the data, so the cached archive owns
+    /// it.
+    fn parse(data: &[u8]) -> Result<Self, SarcError> {
+        Sarc::read(data.to_vec())
+    }
+
+    fn cost(&self) -> usize {
+        size_of::<Sarc>() + self.data_size() + self.len() * 32
+    }
+}
+
+type CacheKey = (TypeId, u128);
+
+struct Entry {
+    value: Arc<dyn Any + Send + Sync>,
+    cost: usize,
+    last_use: u64,
+}
+
+#[derive(Default)]
+struct Inner {
+    budget: usize,
+    used: usize,
+    clock: u64,
+    entries: HashMap<CacheKey, Entry>,
+    /// Entries by the time they were last used, oldest first.
+    lru: BTreeMap<u64, CacheKey>,
+}
+
+impl Inner {
+    fn touch(&mut self, key: &CacheKey) -> Option<Arc<dyn Any + Send + Sync>> {
+        let entry = self.entries.get_mut(key)?;
+        self.clock += 1;
+        self.lru.remove(&entry.last_use);
+        entry.last_use = self.clock;
+        self.lru.insert(self.clock, *key);
+        Some(entry.value.clone())
+    }
+
+    fn evict_to(&mut self, budget: usize) {
+        while self.used > budget {
+            let key = match self.lru.values().next() {
+                Some(key) => *key,
+                None => break,
+            };
+            self.remove(&key);
+        }
+    }
+
+    fn remove(&mut self, key: &CacheKey) {
+        if let Some(entry) = self.entries.remove(key) {
+            self.lru.remove(&entry.last_use);
+            self.used -= entry.cost;
+        }
+    }
+}
+
+/// A thread-safe, content-addressed cache of parsed documents with a memory
+/// budget and least-recently-used eviction.
+pub struct ParseCache {
+    inner: Mutex<Inner>,
+}
+
+impl std::fmt::Debug for ParseCache {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let inner = self.inner.lock().unwrap();
+        f.debug_struct("ParseCache")
+            .field("budget", &inner.budget)
+            .field("used", &inner.used)
+            .field("len", &inner.entries.len())
+            .finish()
+    }
+}
+
+static GLOBAL: Lazy<ParseCache> = Lazy::new(|| ParseCache::new(0));
+
+impl ParseCache {
+    /// Create a cache that holds up to about `budget` bytes of documents.
+    pub fn new(budget: usize) -> Self {
+        ParseCache {
+            inner: Mutex::new(Inner {
+                budget,
+                ..Default::default()
+            }),
+        }
+    }
+
+    /// The process-wide cache used by the `*_cached` constructors. Its budget
+    /// is zero, so nothing is cached, until [`set_budget`](Self::set_budget)
+    /// is called.
+    pub fn global() -> &'static ParseCache {
+        &GLOBAL
+    }
+
+    /// Change the memory budget, evicting entries if the cache no longer
+    /// fits. A budget of zero disables the cache.
+    pub fn set_budget(&self, budget: usize) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.budget = budget;
+        inner.evict_to(budget);
+    }
+
+    /// The memory budget in bytes.
+    pub fn budget(&self) -> usize {
+        self.inner.lock().unwrap().budget
+    }
+
+    /// The estimated memory used by the cached documents, in bytes.
+    pub fn used(&self) -> usize {
+        self.inner.lock().unwrap().used
+    }
+
+    /// The number of cached documents.
+    pub fn len(&self) -> usize {
+        self.inner.lock().unwrap().entries.len()
+    }
+
+    /// Check if the cache holds no documents.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Remove every cached document.
+    pub fn clear(&self) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.entries.clear();
+        inner.lru.clear();
+        inner.used = 0;
+    }
+
+    /// Get the document parsed from byte-identical data before, or parse it
+    /// and cache the result. Documents larger than the whole budget are
+    /// returned without being cached.
+    ///
+    /// The cache is not locked while parsing, so threads that miss on the
+    /// same data at the same time may each parse it; all of them get the
+    /// document that was cached first.
+    pub fn get_or_parse<T: Cacheable>(&self, data: &[u8]) -> Result<Arc<T>, T::Error> {
+        if self.budget() == 0 {
+            return T::parse(data).map(Arc::new);
+        }
+        let key = (TypeId::of::<T>(), xxh3_128(data));
+        if let Some(value) = self.inner.lock().unwrap().touch(&key) {
+            return Ok(downcast(value));
+        }
+        let value = Arc::new(T::parse(data)?);
+        let cost = value.cost();
+        let mut inner = self.inner.lock().unwrap();
+        if let Some(cached) = inner.touch(&key) {
+            return Ok(downcast(cached));
+        }
+        if cost <= inner.budget {
+            let budget = inner.budget - cost;
+            inner.evict_to(budget);
+            inner.clock += 1;
+            let last_use = inner.clock;
+            inner.lru.insert(last_use, key);
+            inner.entries.insert(
+                key,
+                Entry {
+                    value: value.clone(),
+                    cost,
+                    last_use,
+                },
+            );
+            inner.used += cost;
+        }
+        Ok(value)
+    }
+}
+
+fn downcast<T: Cacheable>(value: Arc<dyn Any + Send + Sync>) -> Arc<T> {
+    // Entries are keyed by type, so this cannot fail
+    value.downcast().ok().unwrap()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::ParseCache;
+    use crate::{aamp::ParameterIO, byml::Byml, sarc::Sarc, Endian};
+    use std::sync::Arc;
+
+    fn doc(len: usize) -> Vec<u8> {
+        Byml::Array((0..len as i32).map(Byml::Int).collect()).to_binary(Endian::Little)
+    }
+
+    #[test]
+    fn cache_documents() {
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let cache = ParseCache::new(64 << 20);
+        let pio = cache.get_or_parse::<ParameterIO>(&data).unwrap();
+        assert!(Arc::ptr_eq(&pio, &cache.get_or_parse(&data).unwrap()));
+        assert_eq!(*pio, ParameterIO::from_binary(&data).unwrap());
+        assert!(cache.get_or_parse::<Byml>(&data).is_err());
+        assert_eq!(cache.len(), 1);
+
+        let (a, b, c) = (doc(100), doc(101), doc(102));
+        let cost = cache.get_or_parse::<Byml>(&a).unwrap();
+        let cost = super::Cacheable::cost(&*cost);
+        cache.set_budget(cost * 5 / 2);
+        assert_eq!(cache.len(), 1);
+        let first = cache.get_or_parse::<Byml>(&a).unwrap();
+        cache.get_or_parse::<Byml>(&b).unwrap();
+        // Using `a` again makes `b` the least recently used entry
+        cache.get_or_parse::<Byml>(&a).unwrap();
+        cache.get_or_parse::<Byml>(&c).unwrap();
+        assert_eq!(cache.len(), 2);
+        assert!(Arc::ptr_eq(&first, &cache.get_or_parse(&a).unwrap()));
+        assert!(cache.used() <= cache.budget());
+
+        let pack = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        cache.set_budget(0);
+        assert!(cache.is_empty());
+        let sarc = cache.get_or_parse::<Sarc>(&pack).unwrap();
+        assert_eq!(sarc.len(), 125);
+        assert!(cache.is_empty());
+    }
+}
@@ -0,0 +1,58 @@
+//! Content hashes and archive comparison.
+//!
+//! File contents are compared through 128-bit xxh3 hashes, which are
+//! computed on first use and cached by the archive or writer, so comparing
+//! the same archive against many others only hashes each file once. A
+//! matching hash is always confirmed by comparing the bytes, unless both
+//! sides are the same data.
+use std::collections::HashMap;
+use xxhash_rust::xxh3::xxh3_128;
+
+/// Hash the contents of a file.
+#[inline]
+pub(super) fn content_hash(data: &[u8]) -> u128 {
+    xxh3_128(data)
+}
+
+/// The differences between two archives, by file name.
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct SarcDiff<'a> {
+    /// Files that only exist in the other archive.
+    pub added: Vec<&'a str>,
+    /// Files that only exist in this archive.
+    pub removed: Vec<&'a str>,
+    /// Files that exist in both archives with different contents.
+    pub changed: Vec<&'a str>,
+}
+
+impl SarcDiff<'_> {
+    /// Check if the archives have exactly the same files.
+    pub fn is_empty(&self) -> bool {
+        self.added.is_empty() && self.removed.is_empty() && self.changed.is_empty()
+    }
+}
+
+/// Compare two sets of named files, using `same` to compare the contents of
+/// files present in both.
+pub(super) fn diff<'a, A, B>(
+    ours: impl Iterator<Item = (&'a str, A)>,
+    theirs: impl Iterator<Item = (&'a str, B)>,
+    same: impl Fn(&A, &B) -> bool,
+) -> SarcDiff<'a> {
+    let mut theirs: HashMap<&str, B> = theirs.collect();
+    let mut result = SarcDiff::default();
+    for (name, file) in ours {
+        match theirs.remove(name) {
+            None => result.removed.push(name),
+            Some(other) if !same(&file, &other) => result.changed.push(name),
+            Some(_) => (),
+        }
+    }
+    result
+        .added
+        .extend(theirs.into_iter().map(|(name, _)| name));
+    result.added.sort_unstable();
+    result.removed.sort_unstable();
+    result.changed.sort_unstable();
+    result
+}
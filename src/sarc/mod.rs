@@ -16,6 +16,18 @@
 //! # Ok(())
 //! # }
 //! ```
+//! Large archives can be memory-mapped instead of read into memory, and
+//! nested archives opened without copying them out of the parent:
+//! ```no_run
+//! # use roead::sarc::*;
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let pack = Sarc::open_mmap("content/Pack/TitleBG.pack")?;
+//! // Compressed archives are decompressed once, on first access
+//! let actor = pack.open_nested("Actor/Pack/Enemy_Lynel_Dark.sbactorpack")?;
+//! println!("{} files", actor.len());
+//! # Ok(())
+//! # }
+//! ```
 //! And writing a SARC:
 //! ```
 //! # use roead::sarc::*;
@@ -33,10 +45,27 @@
 //! # Ok(())
 //! # }
 //! ```
-use crate::{aamp, byml, ffi, yaz0, Endian};
-use std::{borrow::Cow, collections::HashMap, hash::Hash, io};
+//! Whole archives can be extracted and repacked on all cores with
+//! [`extract_all_parallel`] and [`SarcWriter::build_parallel`], and whole
+//! trees of nested archives walked on all cores with an [`ArchiveWalker`].
+use crate::{
+    aamp, byml,
+    stats::{self, Format, Phase},
+    yaz0, Endian,
+};
+use once_cell::sync::OnceCell;
+use std::{borrow::Cow, collections::HashMap, hash::Hash, io, ops::Deref, path::Path, sync::Arc};
 use thiserror::Error;
 
+mod diff;
+mod parallel;
+mod table;
+mod walk;
+mod writer;
+pub use diff::SarcDiff;
+pub use parallel::extract_all_parallel;
+pub use walk::{ArchiveWalker, NESTED_PATH_SEPARATOR};
+
 /// Error type for SARC parsing and writing.
 #[derive(Error, Debug)]
 pub enum SarcError {
@@ -46,12 +75,27 @@ pub enum SarcError {
     InsufficientDataError(usize),
     #[error("Compressed SARC could not be decompressed: {0}")]
     Yaz0Error(#[from] crate::yaz0::Yaz0Error),
+    #[error("File not found in SARC: {0}")]
+    MissingFileError(String),
+    #[error("Failed to open SARC: {0}")]
+    IoError(#[from] io::Error),
+    #[error("Invalid SARC data: {0}")]
+    DataError(&'static str),
     #[error("Failed to parse SARC: {0}")]
     OeadError(#[from] cxx::Exception),
 }
 
 type Result<T> = std::result::Result<T, SarcError>;
 
+fn gcd_usize(mut a: usize, mut b: usize) -> usize {
+    while b != 0 {
+        let t = a % b;
+        a = b;
+        b = t;
+    }
+    a
+}
+
 /// Provides readonly access to a file in a SARC
 #[derive(Debug, Clone, PartialEq, Eq, Hash)]
 pub struct File<'a> {
@@ -91,6 +135,12 @@ impl File<'_> {
         Sarc::read(self.data)
     }
 
+    /// Attempt to parse file as SARC through the process-wide parse cache.
+    /// See [`Sarc::read_cached`].
+    pub fn parse_as_sarc_cached(&self) -> Result<Arc<Sarc<'static>>> {
+        Sarc::read_cached(self.data)
+    }
+
     /// Check if the file is yaz0 compressed.
     #[inline]
     pub fn is_compressed(&self) -> bool {
@@ -108,6 +158,12 @@ impl File<'_> {
         aamp::ParameterIO::from_binary(self.data)
     }
 
+    /// Attempt to parse file as AAMP through the process-wide parse cache.
+    /// See [`ParameterIO::from_binary_cached`](aamp::ParameterIO::from_binary_cached).
+    pub fn parse_as_aamp_cached(&self) -> aamp::Result<Arc<aamp::ParameterIO>> {
+        aamp::ParameterIO::from_binary_cached(self.data)
+    }
+
     /// Check if the file is BYML.
     #[inline]
     pub fn is_byml(&self) -> bool {
@@ -121,12 +177,57 @@ impl File<'_> {
     pub fn parse_as_byml(&self) -> byml::Result<byml::Byml> {
         byml::Byml::from_binary(self.data)
     }
+
+    /// Attempt to parse file as BYML through the process-wide parse cache.
+    /// See [`Byml::from_binary_cached`](byml::Byml::from_binary_cached).
+    pub fn parse_as_byml_cached(&self) -> byml::Result<Arc<byml::Byml>> {
+        byml::Byml::from_binary_cached(self.data)
+    }
+}
+
+/// Backing storage for an archive.
+enum Data<'a> {
+    Borrowed(&'a [u8]),
+    Owned(Vec<u8>),
+    Mapped(Arc<memmap2::Mmap>),
+}
+
+impl Deref for Data<'_> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            Data::Borrowed(data) => data,
+            Data::Owned(data) => data,
+            Data::Mapped(map) => map,
+        }
+    }
+}
+
+impl AsRef<[u8]> for Data<'_> {
+    fn as_ref(&self) -> &[u8] {
+        self
+    }
+}
+
+impl<'a> From<Cow<'a, [u8]>> for Data<'a> {
+    fn from(data: Cow<'a, [u8]>) -> Self {
+        match data {
+            Cow::Borrowed(data) => Data::Borrowed(data),
+            Cow::Owned(data) => Data::Owned(data),
+        }
+    }
 }
 
 /// A simple SARC archive reader.
 pub struct Sarc<'a> {
-    inner: cxx::UniquePtr<ffi::Sarc>,
-    _data: Cow<'a, [u8]>,
+    table: table::FileTable,
+    index: OnceCell<table::NameIndex>,
+    /// Decompressed copies of yaz0 compressed files, filled on first access.
+    decompressed: OnceCell<Box<[OnceCell<Vec<u8>>]>>,
+    /// Content hashes of the files, filled on first access.
+    hashes: OnceCell<Box<[OnceCell<u128>]>>,
+    _data: Data<'a>,
 }
 
 impl std::fmt::Debug for Sarc<'_> {
@@ -140,12 +241,9 @@ impl std::fmt::Debug for Sarc<'_> {
     }
 }
 
-unsafe impl Send for Sarc<'_> {}
-unsafe impl Sync for Sarc<'_> {}
-
 impl Hash for Sarc<'_> {
     fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
-        self._data.hash(state)
+        self._data.as_ref().hash(state)
     }
 }
 
@@ -154,34 +252,38 @@ impl Eq for Sarc<'_> {}
 impl Clone for Sarc<'_> {
     fn clone(&self) -> Self {
         match &self._data {
-            Cow::Borrowed(data) => Self::read(*data).unwrap(),
-            Cow::Owned(data) => Self::read(data.clone()).unwrap(),
+            Data::Borrowed(data) => Self::read(*data).unwrap(),
+            Data::Owned(data) => Self::read(data.clone()).unwrap(),
+            Data::Mapped(map) => Self::from_data(Data::Mapped(map.clone())).unwrap(),
         }
     }
 }
 
 impl PartialEq for Sarc<'_> {
     fn eq(&self, other: &Sarc) -> bool {
-        self._data == other._data
+        self._data.as_ref() == other._data.as_ref()
     }
 }
 
 impl Sarc<'_> {
     /// Get the number of files that are stored in the archive.
     pub fn len(&self) -> usize {
-        self.inner.num_files() as usize
+        self.table.entries.len()
+    }
+
+    /// The size of the archive data in bytes.
+    pub(crate) fn data_size(&self) -> usize {
+        self._data.len()
     }
 
     /// Check if the SARC contains no files.
     pub fn is_empty(&self) -> bool {
-        self.inner.num_files() == 0
+        self.table.entries.is_empty()
     }
 
     /// Get an iterator over the contained files.
     pub fn files(&self) -> impl Iterator<Item = File> {
-        (0..self.len())
-            .into_iter()
-            .filter_map(move |i| self.get_file_by_index(i))
+        (0..self.len()).map(move |i| self.file_at(i))
     }
 
     /// Extracts owned filenames and data from the SARC.
@@ -203,56 +305,200 @@ impl Sarc<'_> {
     /// Get a vector of file names.
     pub fn list_filenames(&self) -> Vec<&str> {
         (0..self.len())
-            .into_iter()
-            .filter_map(|i| self.inner.idx_file_name(i as u16).ok())
+            .filter_map(|i| self.table.name(&self._data, i))
             .collect()
     }
 
     /// Get an option containing the data belonging to a file
     /// if it exists in the SARC, otherwise None.
     pub fn get_file_data(&self, name: &str) -> Option<&[u8]> {
-        self.inner.get_file_data(name).ok()
+        self.file_index(name)
+            .map(|i| self.table.data(&self._data, i))
+    }
+
+    /// Look up several files at once. The result has one entry for each
+    /// name, in the same order. This is faster than calling
+    /// [`get_file_data`](Sarc::get_file_data) for each name when no index
+    /// has been built.
+    pub fn get_files<S: AsRef<str>>(&self, names: &[S]) -> Vec<Option<File>> {
+        let found = match self.index.get() {
+            Some(index) => names
+                .iter()
+                .map(|name| {
+                    let name = name.as_ref();
+                    let hash = table::name_hash(name, self.table.multiplier);
+                    index.find(&self.table, &self._data, hash, name)
+                })
+                .collect(),
+            None => self.table.find_many(&self._data, names),
+        };
+        found
+            .into_iter()
+            .map(|idx| idx.map(|i| self.file_at(i)))
+            .collect()
+    }
+
+    /// Build a hash index of the file names, so that later lookups by name
+    /// take constant time instead of a binary search. This pays off for
+    /// archives that are queried many times. Building the index again has no
+    /// effect.
+    pub fn build_index(&self) {
+        self.index
+            .get_or_init(|| table::NameIndex::new(&self.table));
     }
 
     /// Get a file name and data by its index.
     pub fn get_file_by_index(&self, idx: usize) -> Option<File> {
         if idx >= self.len() {
-            return None;
-        }
-        let name = self.inner.idx_file_name(idx as u16);
-        let data = self.inner.idx_file_data(idx as u16);
-        if let Ok(data) = data {
-            Some(File {
-                name: name.ok(),
-                data,
-            })
-        } else {
             None
+        } else {
+            Some(self.file_at(idx))
+        }
+    }
+
+    #[inline]
+    fn file_at(&self, idx: usize) -> File {
+        File {
+            name: self.table.name(&self._data, idx),
+            data: self.table.data(&self._data, idx),
         }
     }
 
     /// Get the endianness of the SARC.
     pub fn endian(&self) -> Endian {
-        if self.inner.big_endian() {
-            Endian::Big
-        } else {
-            Endian::Little
-        }
+        self.table.endian
     }
 
     /// Get the offset to the beginning of file data.
     pub fn data_offset(&self) -> usize {
-        self.inner.get_offset() as usize
+        self.table.data_offset
     }
 
     /// Guess the minimum data alignment for files that are stored in the archive.
     pub fn guess_min_alignment(&self) -> usize {
-        self.inner.guess_align()
+        const MIN_ALIGNMENT: usize = 4;
+        let data_start = self._data.as_ptr() as usize;
+        let gcd = self.files().fold(MIN_ALIGNMENT, |gcd, file| {
+            gcd_usize(gcd, file.data.as_ptr() as usize - data_start)
+        });
+        if gcd.is_power_of_two() {
+            gcd
+        } else {
+            MIN_ALIGNMENT
+        }
     }
 
-    /// Compare the contents of two SARCs.
+    /// Compare the contents of two SARCs. Both must have the same files in
+    /// the same order. Files with different cached content hashes are told
+    /// apart without reading them again, and matching ones are confirmed by
+    /// comparing their bytes.
     pub fn has_equal_files(&self, other: &Sarc) -> bool {
-        self.inner.files_eq(&other.inner)
+        self.len() == other.len()
+            && (0..self.len()).all(|i| {
+                let (ours, theirs) = (self.file_at(i), other.file_at(i));
+                ours.name == theirs.name && self.same_file(i, other, i)
+            })
+    }
+
+    /// Check if a file of this SARC has the same contents as one of another.
+    fn same_file(&self, ours: usize, other: &Sarc, theirs: usize) -> bool {
+        let (data, other_data) = (
+            self.table.data(&self._data, ours),
+            other.table.data(&other._data, theirs),
+        );
+        data.len() == other_data.len()
+            && self.hash_at(ours) == other.hash_at(theirs)
+            && (data.as_ptr() == other_data.as_ptr() || data == other_data)
+    }
+
+    /// Get the 128-bit xxh3 hash of a file's contents. The hash is computed
+    /// on first access and cached for the lifetime of the SARC.
+    pub fn file_hash(&self, name: &str) -> Option<u128> {
+        self.file_index(name).map(|i| self.hash_at(i))
+    }
+
+    fn hash_at(&self, idx: usize) -> u128 {
+        *self
+            .cached_hash(idx)
+            .get_or_init(|| diff::content_hash(self.table.data(&self._data, idx)))
+    }
+
+    fn cached_hash(&self, idx: usize) -> &OnceCell<u128> {
+        let hashes = self.hashes.get_or_init(|| {
+            (0..self.len())
+                .map(|_| OnceCell::new())
+                .collect::<Vec<_>>()
+                .into_boxed_slice()
+        });
+        &hashes[idx]
+    }
+
+    /// Compare the files in this SARC with those in another one. Files that
+    /// have the same size in both are compared by their cached content
+    /// hashes first, so repeated comparisons against the same archive only
+    /// read the files that may match again, to confirm them byte by byte.
+    pub fn diff<'s>(&'s self, other: &'s Sarc) -> SarcDiff<'s> {
+        let files = |sarc: &'s Sarc| {
+            (0..sarc.len()).map(move |i| (sarc.table.name(&sarc._data, i).unwrap_or_default(), i))
+        };
+        diff::diff(files(self), files(other), |ours, theirs| {
+            self.same_file(*ours, other, *theirs)
+        })
+    }
+
+    /// Find the index of a file by its path.
+    fn file_index(&self, name: &str) -> Option<usize> {
+        let hash = table::name_hash(name, self.table.multiplier);
+        match self.index.get() {
+            Some(index) => index.find(&self.table, &self._data, hash, name),
+            None => self.table.find(&self._data, hash, name),
+        }
+    }
+
+    /// Get the data of a file, decompressed if it is yaz0 compressed. The
+    /// decompressed data is kept for the lifetime of the SARC, so each file
+    /// is only decompressed once no matter how often it is accessed.
+    pub fn get_file_data_decompressed(&self, name: &str) -> Option<yaz0::Result<&[u8]>> {
+        let idx = self.file_index(name)?;
+        self.file_data_decompressed_by_index(idx)
+    }
+
+    fn file_data_decompressed_by_index(&self, idx: usize) -> Option<yaz0::Result<&[u8]>> {
+        let data = self.get_file_by_index(idx)?.data;
+        if data.len() < 4 || &data[0..4] != b"Yaz0" {
+            return Some(Ok(data));
+        }
+        let cache = self.decompressed.get_or_init(|| {
+            (0..self.len())
+                .map(|_| OnceCell::new())
+                .collect::<Vec<_>>()
+                .into_boxed_slice()
+        });
+        Some(
+            cache[idx]
+                .get_or_try_init(|| yaz0::decompress(data))
+                .map(|data| data.as_slice()),
+        )
+    }
+
+    /// Open a SARC nested in this one. Uncompressed archives are read in
+    /// place without copying. Compressed archives are decompressed on first
+    /// access and the result is kept, so opening the same archive again is
+    /// cheap.
+    pub fn open_nested(&self, name: &str) -> Result<Sarc<'_>> {
+        let idx = self
+            .file_index(name)
+            .ok_or_else(|| SarcError::MissingFileError(name.to_owned()))?;
+        self.open_nested_by_index(idx)
+    }
+
+    /// Open a SARC nested in this one by its file index. See
+    /// [`open_nested`](Sarc::open_nested).
+    pub fn open_nested_by_index(&self, idx: usize) -> Result<Sarc<'_>> {
+        let data = self
+            .file_data_decompressed_by_index(idx)
+            .ok_or_else(|| SarcError::MissingFileError(format!("#{}", idx)))??;
+        Sarc::read(data)
     }
 
     /// Read a SARC from binary data. The data can be owned (so the SARC
@@ -261,33 +507,127 @@ impl Sarc<'_> {
     /// will own the decompressed data.
     pub fn read<'a, D: Into<Cow<'a, [u8]>>>(data: D) -> Result<Sarc<'a>> {
         let data = data.into();
-        if &data[0..4] == b"Yaz0" {
+        if data.len() >= 4 && &data[0..4] == b"Yaz0" {
             let data = crate::yaz0::decompress(data)?;
             Self::read(data)
-        } else if data.len() < 40 {
+        } else {
+            Sarc::from_data(data.into())
+        }
+    }
+
+    /// Read a SARC through the process-wide [`ParseCache`], so the file table
+    /// of byte-identical data is only parsed once while it stays cached. The
+    /// cached archive owns a copy of the data. See the [`cache`](crate::cache)
+    /// module.
+    ///
+    /// [`ParseCache`]: crate::cache::ParseCache
+    pub fn read_cached(data: &[u8]) -> Result<Arc<Sarc<'static>>> {
+        crate::cache::ParseCache::global().get_or_parse(data)
+    }
+
+    /// Open a SARC file by memory-mapping it, so only the parts of the
+    /// archive that are actually accessed are read from disk. The mapping is
+    /// kept alive for as long as the SARC (or any clone of it) exists. If the
+    /// file is yaz0 compressed it is decompressed into memory instead.
+    ///
+    /// The file must not be modified by other processes while it is mapped.
+    pub fn open_mmap<P: AsRef<Path>>(path: P) -> Result<Sarc<'static>> {
+        let file = std::fs::File::open(path)?;
+        let map = unsafe { memmap2::Mmap::map(&file)? };
+        if map.len() >= 4 && &map[0..4] == b"Yaz0" {
+            Self::read(yaz0::decompress(&map[..])?)
+        } else {
+            Sarc::from_data(Data::Mapped(Arc::new(map)))
+        }
+    }
+
+    fn from_data(data: Data) -> Result<Sarc> {
+        let _span = stats::span(Format::Sarc, Phase::Parse, data.len());
+        if data.len() < 40 {
             Err(SarcError::InsufficientDataError(data.len()))
         } else if &data[0..4] != b"SARC" {
             Err(SarcError::MagicError)
         } else {
             Ok(Sarc {
-                inner: ffi::sarc_from_binary(data.as_ref())?,
+                table: table::FileTable::parse(&data)?,
+                index: OnceCell::new(),
+                decompressed: OnceCell::new(),
+                hashes: OnceCell::new(),
                 _data: data,
             })
         }
     }
 }
 
+/// Where a [`SarcWriter`] keeps the data of a file.
+#[derive(Debug, Clone)]
+enum Storage<'a> {
+    Borrowed(&'a [u8]),
+    Owned(Vec<u8>),
+    Shared(Arc<[u8]>),
+}
+
+/// File data held by a [`SarcWriter`], with its content hash once it has
+/// been computed.
+#[derive(Debug, Clone)]
+struct FileData<'a> {
+    storage: Storage<'a>,
+    hash: OnceCell<u128>,
+}
+
+impl<'a> FileData<'a> {
+    fn new(storage: Storage<'a>) -> Self {
+        FileData {
+            storage,
+            hash: OnceCell::new(),
+        }
+    }
+
+    fn hash(&self) -> u128 {
+        *self.hash.get_or_init(|| diff::content_hash(self))
+    }
+
+    fn same_contents(&self, other: &FileData) -> bool {
+        self.len() == other.len()
+            && self.hash() == other.hash()
+            && (self.as_ptr() == other.as_ptr() || **self == **other)
+    }
+}
+
+impl Deref for FileData<'_> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match &self.storage {
+            Storage::Borrowed(data) => data,
+            Storage::Owned(data) => data,
+            Storage::Shared(data) => data,
+        }
+    }
+}
+
 /// A simple SARC archive writer.
 ///
+/// File data can be owned by the writer, borrowed, or shared through an
+/// [`Arc`], so rebuilding an archive only needs new storage for the files
+/// that actually change. A writer created from a [`Sarc`] borrows the data
+/// of every file from it.
+///
 /// *Note about the two modes:*
 /// Legacy mode is used for games with an old-style resource system that requires
 /// aligning nested SARCs and manual alignment of file data in archives.
 /// Legacy mode is not needed for games with a new-style resource system that
 /// automatically takes care of data alignment and does not require manual
 /// alignment nor nested SARC alignment.
-pub struct SarcWriter(cxx::UniquePtr<ffi::SarcWriter>);
+pub struct SarcWriter<'a> {
+    endian: Endian,
+    legacy: bool,
+    min_alignment: usize,
+    alignments: HashMap<String, usize>,
+    files: HashMap<String, FileData<'a>>,
+}
 
-impl std::fmt::Debug for SarcWriter {
+impl std::fmt::Debug for SarcWriter<'_> {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         f.debug_struct("SarcWriter")
             .field("len", &self.len())
@@ -295,110 +635,259 @@ impl std::fmt::Debug for SarcWriter {
     }
 }
 
-impl PartialEq for SarcWriter {
+impl PartialEq for SarcWriter<'_> {
     fn eq(&self, other: &Self) -> bool {
-        self.0.FilesEqual(&other.0)
+        self.files.len() == other.files.len()
+            && self.files.iter().all(|(name, data)| {
+                other
+                    .files
+                    .get(name)
+                    .map_or(false, |other| data.same_contents(other))
+            })
     }
 }
 
-impl Eq for SarcWriter {}
-unsafe impl Send for SarcWriter {}
-unsafe impl Sync for SarcWriter {}
+impl Eq for SarcWriter<'_> {}
 
-impl From<&Sarc<'_>> for SarcWriter {
-    fn from(sarc: &Sarc) -> Self {
-        SarcWriter(ffi::WriterFromSarc(&sarc.inner))
+impl<'a> From<&'a Sarc<'_>> for SarcWriter<'a> {
+    fn from(sarc: &'a Sarc) -> Self {
+        SarcWriter::from_sarc(sarc, &sarc._data, Storage::Borrowed)
     }
 }
 
-impl From<Sarc<'_>> for SarcWriter {
-    fn from(sarc: Sarc) -> Self {
-        SarcWriter(ffi::WriterFromSarc(&sarc.inner))
+impl<'a> From<Sarc<'a>> for SarcWriter<'a> {
+    fn from(sarc: Sarc<'a>) -> Self {
+        match sarc._data {
+            // The files can keep borrowing from wherever the SARC did
+            Data::Borrowed(data) => SarcWriter::from_sarc(&sarc, data, Storage::Borrowed),
+            _ => SarcWriter::from_sarc(&sarc, &sarc._data, |data| Storage::Owned(data.to_vec())),
+        }
     }
 }
 
-impl SarcWriter {
+impl<'a> SarcWriter<'a> {
     /// Construct a new SARC with the specified endianness.
-    pub fn new(endian: Endian) -> SarcWriter {
-        SarcWriter(ffi::NewSarcWriter(endian == Endian::Big, false))
+    pub fn new(endian: Endian) -> SarcWriter<'a> {
+        SarcWriter {
+            endian,
+            legacy: false,
+            min_alignment: 4,
+            alignments: writer::default_alignments(endian),
+            files: HashMap::new(),
+        }
     }
 
     /// Construct a new SARC with the specified endianness in legacy mode
     /// (for manual alignment).
-    pub fn new_legacy_mode(endian: Endian) -> SarcWriter {
-        SarcWriter(ffi::NewSarcWriter(endian == Endian::Big, true))
+    pub fn new_legacy_mode(endian: Endian) -> SarcWriter<'a> {
+        SarcWriter {
+            legacy: true,
+            ..SarcWriter::new(endian)
+        }
+    }
+
+    /// Start a writer with the settings of an existing SARC, storing the
+    /// data of each file as `store` decides. `data` must be the contents of
+    /// the SARC. Content hashes the SARC has already computed are kept.
+    fn from_sarc<'s>(
+        sarc: &Sarc,
+        data: &'s [u8],
+        store: impl Fn(&'s [u8]) -> Storage<'a>,
+    ) -> SarcWriter<'a> {
+        let mut writer = SarcWriter::new(sarc.endian());
+        writer.min_alignment = sarc.guess_min_alignment();
+        writer.files.reserve(sarc.len());
+        for i in 0..sarc.len() {
+            let name = sarc.table.name(data, i).unwrap_or_default();
+            let file = FileData {
+                storage: store(sarc.table.data(data, i)),
+                hash: sarc
+                    .hashes
+                    .get()
+                    .map_or_else(OnceCell::new, |hashes| hashes[i].clone()),
+            };
+            writer.files.insert(name.to_owned(), file);
+        }
+        writer
     }
 
-    /// Shortcut to construct a new SARC from existing data.
+    /// Shortcut to construct a new SARC from existing data. The files are
+    /// copied out of the data.
     pub fn from_binary<B: AsRef<[u8]>>(data: B) -> Result<Self> {
-        Sarc::read(data.as_ref()).map(Self::from)
+        let sarc = Sarc::read(data.as_ref())?;
+        Ok(SarcWriter::from_sarc(&sarc, &sarc._data, |data| {
+            Storage::Owned(data.to_vec())
+        }))
     }
 
     /// Get the number of files that are stored in the archive.
     pub fn len(&self) -> usize {
-        self.0.NumFiles()
+        self.files.len()
     }
 
     /// Checks if the SARC contains no files.
     pub fn is_empty(&self) -> bool {
-        self.0.NumFiles() == 0
+        self.files.is_empty()
+    }
+
+    /// Get the data of a file in the SARC, if present.
+    pub fn get_file_data(&self, name: &str) -> Option<&[u8]> {
+        self.files.get(name).map(|data| &**data)
     }
 
     /// Add a file to the SARC.
     pub fn add_file<B: Into<Vec<u8>>>(&mut self, name: &str, data: B) {
-        self.0.pin_mut().SetFile(name, data.into());
+        self.files
+            .insert(name.to_owned(), FileData::new(Storage::Owned(data.into())));
+    }
+
+    /// Add a file to the SARC without copying its data. The data has to
+    /// outlive the writer.
+    pub fn add_file_ref(&mut self, name: &str, data: &'a [u8]) {
+        self.files
+            .insert(name.to_owned(), FileData::new(Storage::Borrowed(data)));
+    }
+
+    /// Add a file to the SARC whose data is shared with other owners.
+    pub fn add_file_shared(&mut self, name: &str, data: Arc<[u8]>) {
+        self.files
+            .insert(name.to_owned(), FileData::new(Storage::Shared(data)));
     }
 
     /// Delete a file from the SARC.
     pub fn delete_file(&mut self, name: &str) -> bool {
-        self.0.pin_mut().DelFile(name)
+        self.files.remove(name).is_some()
+    }
+
+    /// Get the 128-bit xxh3 hash of a file's contents. The hash is computed
+    /// on first access and cached until the file is replaced.
+    pub fn file_hash(&self, name: &str) -> Option<u128> {
+        self.files.get(name).map(|data| data.hash())
+    }
+
+    /// Compare the files in this writer with those in another one. Files
+    /// that have the same size in both are compared by their cached content
+    /// hashes, and matching ones are confirmed byte by byte.
+    pub fn diff<'s>(&'s self, other: &'s SarcWriter) -> SarcDiff<'s> {
+        let files = |writer: &'s SarcWriter| {
+            writer
+                .files
+                .iter()
+                .map(|(name, data)| (name.as_str(), data))
+        };
+        diff::diff(files(self), files(other), |ours, theirs| {
+            ours.same_contents(theirs)
+        })
     }
 
     /// Set the minimum data alignment for files that are stored in the archive.
     pub fn set_alignment(&mut self, alignment: u8) {
-        self.0.pin_mut().SetMinAlignment(alignment as usize)
+        self.min_alignment = (alignment as usize).max(1)
     }
 
     /// Set the endianness of the SARC.
     pub fn set_endian(&mut self, endian: Endian) {
-        self.0.pin_mut().SetEndianness(endian == Endian::Big)
+        self.endian = endian
     }
 
     /// Set whether the SARC uses legacy alignment.
     pub fn set_legacy_mode(&mut self, legacy: bool) {
-        self.0.pin_mut().SetMode(legacy)
+        self.legacy = legacy
     }
 
     /// Write a SARC archive to an in-memory buffer.
     #[allow(clippy::clippy::wrong_self_convention)]
-    pub fn to_binary(&mut self) -> Vec<u8> {
-        self.0.pin_mut().Write().data
+    pub fn to_binary(&self) -> Vec<u8> {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self);
+        span.set_bytes(layout.size);
+        layout.to_vec()
     }
 
     /// Write a SARC archive to an in-memory buffer, returning a tuple containing
     /// both the file data and the final alignment.
     #[allow(clippy::clippy::wrong_self_convention)]
-    pub fn to_binary_and_check_alignment(&mut self) -> (Vec<u8>, usize) {
-        let result = self.0.pin_mut().Write();
-        (result.data, result.alignment)
+    pub fn to_binary_and_check_alignment(&self) -> (Vec<u8>, usize) {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self);
+        span.set_bytes(layout.size);
+        (layout.to_vec(), layout.alignment)
+    }
+
+    /// Write the SARC as a patched copy of `base`, which is usually the
+    /// archive this writer was created from. Files that still borrow their
+    /// data from `base` keep their place in its data section, which is copied
+    /// over as a single block, and only the file tables and new or changed
+    /// files are laid out again. Changed files are appended at the end.
+    ///
+    /// The result is a valid archive with the same files as
+    /// [`to_binary`](SarcWriter::to_binary) would produce, but its layout
+    /// differs and removed or replaced data is left in place, so it can be
+    /// larger. With no changes, the output matches `base` if its tables
+    /// were laid out the way this writer lays them out. If `base` has more
+    /// padding before its data than the files' alignment requires, that
+    /// padding is dropped, so the output is smaller but no longer identical.
+    pub fn to_binary_patched(&self, base: &Sarc) -> Vec<u8> {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout =
+            writer::Layout::patched(self, &base._data[base.data_offset()..], base.data_offset());
+        span.set_bytes(layout.size);
+        layout.to_vec()
+    }
+
+    /// Stream the SARC to any writer as a patched copy of `base`. See
+    /// [`to_binary_patched`](SarcWriter::to_binary_patched).
+    pub fn write_patched<W: io::Write>(&self, base: &Sarc, writer: &mut W) -> io::Result<()> {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout =
+            writer::Layout::patched(self, &base._data[base.data_offset()..], base.data_offset());
+        span.set_bytes(layout.size);
+        layout.write(writer)
+    }
+
+    /// Get the size of the archive this writer would produce, without
+    /// writing it.
+    pub fn binary_size(&self) -> usize {
+        writer::Layout::new(self).size
+    }
+
+    /// Write a SARC archive to any writer. The header and file tables are
+    /// laid out first and file data is then streamed to the writer directly,
+    /// so the archive is never assembled in memory.
+    pub fn write<W: io::Write>(&self, writer: &mut W) -> io::Result<()> {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self);
+        span.set_bytes(layout.size);
+        layout.write(writer)
     }
 
-    /// Write a SARC archive to any writer.
-    pub fn write<W: io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
-        writer.write_all(&self.to_binary())
+    /// Write a SARC archive with yaz0 compression to any writer. Like
+    /// [`write`](SarcWriter::write), this streams the archive, compressing it
+    /// as it is written.
+    pub fn write_compressed<W: io::Write>(&self, writer: &mut W) -> io::Result<()> {
+        self.write_compressed_with_level(writer, 7)
     }
 
-    /// Write a SARC archive with yaz0 compression to any writer.
-    pub fn write_compressed<W: io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
-        let bytes = crate::yaz0::compress(self.to_binary());
-        writer.write_all(&bytes)
+    /// Write a SARC archive with yaz0 compression to any writer, with the
+    /// specified compression level (6-9).
+    pub fn write_compressed_with_level<W: io::Write>(
+        &self,
+        writer: &mut W,
+        level: u8,
+    ) -> io::Result<()> {
+        let mut span = stats::span(Format::Sarc, Phase::Serialize, 0);
+        let layout = writer::Layout::new(self);
+        span.set_bytes(layout.size);
+        let mut writer = yaz0::Yaz0Writer::with_level(writer, layout.size, level)?;
+        layout.write(&mut writer)?;
+        writer.finish().map(|_| ())
     }
 }
 
 #[cfg(test)]
 mod tests {
     use crate::{
-        sarc::{self, SarcWriter},
+        sarc::{self, extract_all_parallel, SarcWriter},
         Endian,
     };
 
@@ -470,11 +959,304 @@ mod tests {
     fn sarc_to_writer() {
         let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
         let sarc = sarc::Sarc::read(&bytes).unwrap();
-        let mut writer = sarc::SarcWriter::from(&sarc);
+        let writer = sarc::SarcWriter::from(&sarc);
         assert_eq!(writer.len(), sarc.len());
         assert_eq!(writer.to_binary(), sarc._data.as_ref());
     }
 
+    #[test]
+    fn lookup_index() {
+        let data = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&data).unwrap();
+        let mut names: Vec<&str> = sarc.list_filenames();
+        names.insert(3, "Actor/Missing.bxml");
+        let check = |sarc: &sarc::Sarc| {
+            let batch = sarc.get_files(&names);
+            assert_eq!(batch.len(), names.len());
+            for (name, file) in names.iter().zip(batch) {
+                assert_eq!(file.as_ref().map(|f| f.data()), sarc.get_file_data(name));
+                assert_eq!(file.and_then(|f| f.name).unwrap_or(name), *name);
+            }
+            assert!(sarc.get_file_data("Actor/Missing.bxml").is_none());
+        };
+        check(&sarc);
+        sarc.build_index();
+        check(&sarc);
+        assert_eq!(
+            sarc.get_file_data("Actor/AS/Lynel_StunEnd.bas").unwrap(),
+            sarc.get_file_by_index(8).unwrap().data()
+        );
+    }
+
+    #[test]
+    fn lookup_colliding_names() {
+        let names = ["abc", "acb", "bac", "bca", "cab", "cba"];
+        let mut writer = SarcWriter::new(Endian::Little);
+        for name in names {
+            writer.add_file_ref(name, name.as_bytes());
+        }
+        // With a multiplier of 1, every permutation of a name has the same hash
+        let mut data = writer.to_binary();
+        data[0x1C..0x20].copy_from_slice(&1u32.to_le_bytes());
+        let hash: u32 = "abc".bytes().map(u32::from).sum();
+        for i in 0..names.len() {
+            let offset = 0x20 + 0x10 * i;
+            data[offset..offset + 4].copy_from_slice(&hash.to_le_bytes());
+        }
+        let sarc = sarc::Sarc::read(&data).unwrap();
+        let check = |sarc: &sarc::Sarc| {
+            for name in names {
+                assert_eq!(sarc.get_file_data(name).unwrap(), name.as_bytes());
+            }
+            for (name, file) in names.iter().zip(sarc.get_files(&names)) {
+                assert_eq!(file.unwrap().data(), name.as_bytes());
+            }
+            assert!(sarc.get_file_data("bbb").is_none());
+        };
+        check(&sarc);
+        sarc.build_index();
+        check(&sarc);
+    }
+
+    #[test]
+    fn open_mmap_nested() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let actor = crate::yaz0::decompress(&bytes).unwrap();
+        let mut writer = SarcWriter::new(Endian::Big);
+        writer.add_file("Actor/Pack/Compressed.sbactorpack", bytes.as_slice());
+        writer.add_file("Actor/Pack/Plain.bactorpack", actor.as_slice());
+        let path = std::env::temp_dir().join("roead_open_mmap_nested.pack");
+        std::fs::write(&path, writer.to_binary()).unwrap();
+
+        let pack = sarc::Sarc::open_mmap(&path).unwrap();
+        let plain = pack.open_nested("Actor/Pack/Plain.bactorpack").unwrap();
+        assert_eq!(plain._data.as_ref(), actor.as_slice());
+        assert_eq!(
+            plain._data.as_ptr(),
+            pack.get_file_data("Actor/Pack/Plain.bactorpack")
+                .unwrap()
+                .as_ptr()
+        );
+        let compressed = pack
+            .open_nested("Actor/Pack/Compressed.sbactorpack")
+            .unwrap();
+        assert_eq!(compressed, plain);
+        let again = pack
+            .open_nested("Actor/Pack/Compressed.sbactorpack")
+            .unwrap();
+        assert_eq!(compressed._data.as_ptr(), again._data.as_ptr());
+        assert!(pack.open_nested("Actor/Pack/Missing.sbactorpack").is_err());
+        drop(pack);
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn writer_borrowed_files() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&bytes).unwrap();
+        let extra = b"Borrowed data".to_vec();
+        let shared: std::sync::Arc<[u8]> = b"Shared data".to_vec().into();
+        let mut writer = SarcWriter::from(&sarc);
+        assert_eq!(
+            writer
+                .get_file_data("Actor/AS/Lynel_StunEnd.bas")
+                .unwrap()
+                .as_ptr(),
+            sarc.get_file_data("Actor/AS/Lynel_StunEnd.bas")
+                .unwrap()
+                .as_ptr()
+        );
+        writer.add_file_ref("Extra/Borrowed.txt", &extra);
+        writer.add_file_shared("Actor/AS/Lynel_StunEnd.bas", shared.clone());
+        let out = sarc::Sarc::read(writer.to_binary()).unwrap();
+        assert_eq!(out.len(), sarc.len() + 1);
+        assert_eq!(out.get_file_data("Extra/Borrowed.txt").unwrap(), &extra[..]);
+        assert_eq!(
+            out.get_file_data("Actor/AS/Lynel_StunEnd.bas").unwrap(),
+            &shared[..]
+        );
+        for file in sarc.files() {
+            let name = file.name_or_panic();
+            if name != "Actor/AS/Lynel_StunEnd.bas" {
+                assert_eq!(out.get_file_data(name).unwrap(), file.data());
+            }
+        }
+
+        let mut legacy = SarcWriter::new_legacy_mode(Endian::Big);
+        legacy.add_file("A.txt", b"Some text".to_vec());
+        legacy.add_file_ref("Nested.pack", &sarc._data);
+        let (data, alignment) = legacy.to_binary_and_check_alignment();
+        assert_eq!(alignment, 0x2000);
+        let out = sarc::Sarc::read(data).unwrap();
+        let nested = out.get_file_data("Nested.pack").unwrap();
+        assert_eq!(
+            (nested.as_ptr() as usize - out._data.as_ptr() as usize) % 0x2000,
+            0
+        );
+    }
+
+    #[test]
+    fn stream_sarc() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&bytes).unwrap();
+        let mut writer = SarcWriter::from(&sarc);
+        writer.set_legacy_mode(true);
+        writer.add_file("Nested.pack", sarc._data.as_ref());
+        let data = writer.to_binary();
+        assert_eq!(writer.binary_size(), data.len());
+        let mut streamed = vec![];
+        writer.write(&mut streamed).unwrap();
+        assert_eq!(streamed, data);
+        let mut compressed = vec![];
+        writer
+            .write_compressed_with_level(&mut compressed, 6)
+            .unwrap();
+        assert_eq!(crate::yaz0::decompress(&compressed).unwrap(), data);
+    }
+
+    #[test]
+    fn patch_sarc() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&bytes).unwrap();
+        let mut writer = SarcWriter::from(&sarc);
+        assert_eq!(writer.to_binary_patched(&sarc), sarc._data.as_ref());
+
+        let names = sarc.list_filenames();
+        writer.delete_file(names[0]);
+        writer.add_file(names[1], vec![0xAB; 0x1234]);
+        writer.add_file("Actor/New/File.txt", b"Brand new".to_vec());
+        let mut patched = vec![];
+        writer.write_patched(&sarc, &mut patched).unwrap();
+        assert_eq!(patched, writer.to_binary_patched(&sarc));
+
+        let out = sarc::Sarc::read(&patched).unwrap();
+        assert_eq!(out.len(), writer.len());
+        assert_eq!(out.get_file_data(names[0]), None);
+        assert_eq!(out.get_file_data(names[1]).unwrap(), &[0xAB; 0x1234][..]);
+        for name in &names[2..] {
+            let original = sarc.get_file_data(name).unwrap();
+            let file = out.get_file_data(name).unwrap();
+            assert_eq!(file, original);
+            assert_eq!(
+                file.as_ptr() as usize - out._data.as_ptr() as usize - out.data_offset(),
+                original.as_ptr() as usize - sarc._data.as_ptr() as usize - sarc.data_offset()
+            );
+        }
+        assert_eq!(
+            sarc::Sarc::read(writer.to_binary()).unwrap().to_file_map(),
+            out.to_file_map()
+        );
+    }
+
+    #[test]
+    fn sarc_diff() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&bytes).unwrap();
+        let copy = sarc::Sarc::read(sarc._data.to_vec()).unwrap();
+        assert!(sarc.has_equal_files(&copy));
+        assert!(sarc.diff(&copy).is_empty());
+
+        let names = sarc.list_filenames();
+        let mut writer = SarcWriter::from(&sarc);
+        writer.delete_file(names[0]);
+        let mut changed = sarc.get_file_data(names[1]).unwrap().to_vec();
+        changed[0] ^= 0xFF;
+        writer.add_file(names[1], changed);
+        writer.add_file("Actor/New/File.txt", b"Brand new".to_vec());
+        assert_eq!(writer.file_hash(names[2]), sarc.file_hash(names[2]));
+
+        let modified = sarc::Sarc::read(writer.to_binary()).unwrap();
+        assert!(!sarc.has_equal_files(&modified));
+        let diff = sarc.diff(&modified);
+        assert_eq!(diff.added, vec!["Actor/New/File.txt"]);
+        assert_eq!(diff.removed, vec![names[0]]);
+        assert_eq!(diff.changed, vec![names[1]]);
+        assert_eq!(SarcWriter::from(&sarc).diff(&writer), diff);
+    }
+
+    #[test]
+    fn parallel_sarc() {
+        let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let sarc = sarc::Sarc::read(&bytes).unwrap();
+        let mut writer = SarcWriter::from(&sarc);
+        let names = sarc.list_filenames();
+        let model = b"FRES".repeat(0x400);
+        writer.add_file("Model/Test.sbfres", model.as_slice());
+        let packed = writer.build_parallel(7).unwrap();
+        assert_eq!(packed, writer.build_parallel(7).unwrap());
+
+        let out = sarc::Sarc::read(&packed).unwrap();
+        let file = out.get_file_data("Model/Test.sbfres").unwrap();
+        assert_eq!(&file[0..4], b"Yaz0");
+        assert_eq!(crate::yaz0::decompress(file).unwrap(), model);
+        for name in &names {
+            assert_eq!(out.get_file_data(name), sarc.get_file_data(name));
+        }
+
+        let dir = std::env::temp_dir().join(format!("roead-sarc-{}", std::process::id()));
+        extract_all_parallel(&out, &dir, true).unwrap();
+        assert_eq!(std::fs::read(dir.join("Model/Test.sbfres")).unwrap(), model);
+        for name in &names {
+            assert_eq!(
+                std::fs::read(dir.join(name)).unwrap(),
+                sarc.get_file_data(name).unwrap()
+            );
+        }
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn walk_nested() {
+        use crate::sarc::{ArchiveWalker, SarcError};
+        use std::sync::Mutex;
+        let pack = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
+        let mut inner = SarcWriter::new(Endian::Little);
+        inner.add_file("Inner.txt", b"Inner".to_vec());
+        let mut outer = SarcWriter::new(Endian::Little);
+        outer.add_file("Actor/Pack/Enemy_Lynel_Dark.sbactorpack", pack.clone());
+        outer.add_file("Pack/Inner.sarc", inner.to_binary());
+        outer.add_file("Top.txt", b"Top".to_vec());
+        let data = outer.to_binary();
+
+        let walk = |walker: &ArchiveWalker| {
+            let found = Mutex::new(Vec::new());
+            walker
+                .walk_data("Outer.pack", &data, |path, data| {
+                    found.lock().unwrap().push((path.to_owned(), data.to_vec()));
+                    Ok::<(), SarcError>(())
+                })
+                .unwrap();
+            let mut found = found.into_inner().unwrap();
+            found.sort();
+            found
+        };
+        let mut walker = ArchiveWalker::new();
+        assert_eq!(walk(&walker).len(), 127);
+        walker.set_extensions(&["txt"]);
+        assert_eq!(
+            walk(&walker),
+            vec![
+                (
+                    "Outer.pack//Pack/Inner.sarc//Inner.txt".to_owned(),
+                    b"Inner".to_vec()
+                ),
+                ("Outer.pack//Top.txt".to_owned(), b"Top".to_vec()),
+            ]
+        );
+        walker.set_extensions::<&str>(&[]);
+        walker.set_magics(&[b"SARC"]);
+        walker.set_descend_filter(|path| !path.ends_with(".sbactorpack"));
+        let found = walk(&walker);
+        assert_eq!(found.len(), 1);
+        assert_eq!(
+            found[0].0,
+            "Outer.pack//Actor/Pack/Enemy_Lynel_Dark.sbactorpack"
+        );
+        assert_eq!(found[0].1, crate::yaz0::decompress(&pack).unwrap());
+        walker.set_include_archives(true);
+        assert_eq!(walk(&walker).len(), 3);
+    }
+
     #[test]
     fn destructure() {
         let bytes = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack").unwrap();
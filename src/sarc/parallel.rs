@@ -0,0 +1,97 @@
+//! Multithreaded extraction and repacking.
+//!
+//! Each file is handled as an independent job on the rayon thread pool, so
+//! archives with many compressed entries scale with the number of cores.
+//! The results are always assembled in the same order, so the output does
+//! not depend on how the work was scheduled.
+use super::{Result, Sarc, SarcError, SarcWriter};
+use crate::yaz0;
+use rayon::prelude::*;
+use std::{
+    collections::HashMap,
+    fs,
+    path::{Component, Path},
+};
+
+#[inline]
+fn is_compressed(data: &[u8]) -> bool {
+    data.len() >= 4 && &data[0..4] == b"Yaz0"
+}
+
+/// Write every file in a SARC to a directory, using the rayon thread pool.
+/// Each file is written to its path in the archive, relative to `dir`, and
+/// missing directories are created. If `decompress` is set, yaz0 compressed
+/// files are decompressed before they are written. Files without a name are
+/// written as their name hash in hex.
+///
+/// File paths that would leave `dir` are rejected.
+pub fn extract_all_parallel<P: AsRef<Path>>(sarc: &Sarc, dir: P, decompress: bool) -> Result<()> {
+    let dir = dir.as_ref();
+    (0..sarc.len()).into_par_iter().try_for_each(|i| {
+        let file = sarc.file_at(i);
+        let name = match file.name {
+            Some(name) => name.to_owned(),
+            None => format!("{:08x}", sarc.table.entries[i].hash),
+        };
+        if !Path::new(&name)
+            .components()
+            .all(|c| matches!(c, Component::Normal(_)))
+        {
+            return Err(SarcError::DataError(
+                "file path leaves the output directory",
+            ));
+        }
+        let path = dir.join(&name);
+        if let Some(parent) = path.parent() {
+            fs::create_dir_all(parent)?;
+        }
+        if decompress && is_compressed(file.data) {
+            fs::write(path, yaz0::decompress(file.data)?)?;
+        } else {
+            fs::write(path, file.data)?;
+        }
+        Ok(())
+    })
+}
+
+impl SarcWriter<'_> {
+    /// Write the SARC to an in-memory buffer, yaz0 compressing files on the
+    /// rayon thread pool with the specified compression level (6-9).
+    ///
+    /// Files are compressed if their name has a yaz0-associated extension
+    /// (starts with 's', but is not 'sarc') and they are not compressed
+    /// already. Large files are also split across threads, as with
+    /// [`yaz0::compress_parallel`]. Other files are stored as they are.
+    pub fn build_parallel(&self, level: u8) -> Result<Vec<u8>> {
+        if !(6..=9).contains(&level) {
+            return Err(yaz0::Yaz0Error::InvalidLevelError(level).into());
+        }
+        let files: Vec<(&str, &[u8])> = self
+            .files
+            .iter()
+            .map(|(name, data)| (name.as_str(), &**data))
+            .collect();
+        let compressed = files
+            .par_iter()
+            .map(|(name, data)| {
+                if !is_compressed(data) && yaz0::has_compressed_extension(name) {
+                    yaz0::compress_parallel(data, level).map(Some)
+                } else {
+                    Ok(None)
+                }
+            })
+            .collect::<yaz0::Result<Vec<Option<Vec<u8>>>>>()?;
+
+        let mut writer = SarcWriter {
+            endian: self.endian,
+            legacy: self.legacy,
+            min_alignment: self.min_alignment,
+            alignments: self.alignments.clone(),
+            files: HashMap::with_capacity(files.len()),
+        };
+        for ((name, data), packed) in files.iter().zip(&compressed) {
+            writer.add_file_ref(name, packed.as_deref().unwrap_or(data));
+        }
+        Ok(writer.to_binary())
+    }
+}
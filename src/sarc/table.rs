@@ -0,0 +1,243 @@
+//! Native parsing of the SARC file tables.
+//!
+//! The SFAT entries are read once when an archive is opened, so iterating
+//! files and looking up names never has to go through oead. Lookups
+//! binary-search the name hashes, which the format keeps sorted, or probe an
+//! optional open-addressed [`NameIndex`] for constant-time access.
+use super::{Result, SarcError};
+use crate::Endian;
+
+const HEADER_SIZE: usize = 0x14;
+const SFAT_HEADER_SIZE: usize = 0xC;
+const SFAT_ENTRY_SIZE: usize = 0x10;
+const SFNT_HEADER_SIZE: usize = 0x8;
+const HAS_NAME: u32 = 0x0100_0000;
+
+/// Hash a file name the same way SARC does.
+#[inline]
+pub(super) fn name_hash(name: &str, multiplier: u32) -> u32 {
+    name.bytes().fold(0u32, |hash, c| {
+        hash.wrapping_mul(multiplier)
+            .wrapping_add(c as i8 as i32 as u32)
+    })
+}
+
+/// A file entry, with all offsets absolute and validated.
+#[derive(Debug, Clone, Copy)]
+pub(super) struct Entry {
+    pub(super) hash: u32,
+    /// Offset and length of the file name, if it has one.
+    name: Option<(u32, u32)>,
+    begin: u32,
+    end: u32,
+}
+
+pub(super) struct FileTable {
+    pub(super) endian: Endian,
+    pub(super) data_offset: usize,
+    pub(super) multiplier: u32,
+    pub(super) entries: Box<[Entry]>,
+}
+
+impl FileTable {
+    pub(super) fn parse(data: &[u8]) -> Result<FileTable> {
+        let endian = match data.get(6..8) {
+            Some([0xFE, 0xFF]) => Endian::Big,
+            Some([0xFF, 0xFE]) => Endian::Little,
+            _ => return Err(SarcError::DataError("invalid byte order mark")),
+        };
+        let u16_at = |offset: usize| -> Result<u32> {
+            let bytes = data
+                .get(offset..offset + 2)
+                .ok_or(SarcError::DataError("offset out of bounds"))?;
+            let bytes = [bytes[0], bytes[1]];
+            Ok(match endian {
+                Endian::Big => u16::from_be_bytes(bytes),
+                Endian::Little => u16::from_le_bytes(bytes),
+            } as u32)
+        };
+        let u32_at = |offset: usize| -> Result<u32> {
+            let bytes = data
+                .get(offset..offset + 4)
+                .ok_or(SarcError::DataError("offset out of bounds"))?;
+            let bytes = [bytes[0], bytes[1], bytes[2], bytes[3]];
+            Ok(match endian {
+                Endian::Big => u32::from_be_bytes(bytes),
+                Endian::Little => u32::from_le_bytes(bytes),
+            })
+        };
+
+        let data_offset = u32_at(0xC)? as usize;
+        if data_offset > data.len() {
+            return Err(SarcError::DataError("data offset out of bounds"));
+        }
+        if data.get(HEADER_SIZE..HEADER_SIZE + 4) != Some(b"SFAT") {
+            return Err(SarcError::DataError("invalid SFAT magic"));
+        }
+        let num_files = u16_at(HEADER_SIZE + 6)? as usize;
+        let multiplier = u32_at(HEADER_SIZE + 8)?;
+        let entries_start = HEADER_SIZE + SFAT_HEADER_SIZE;
+        let sfnt = entries_start + SFAT_ENTRY_SIZE * num_files;
+        if data.get(sfnt..sfnt + 4) != Some(b"SFNT") {
+            return Err(SarcError::DataError("invalid SFNT magic"));
+        }
+        let names_start = sfnt + SFNT_HEADER_SIZE;
+        let names = data
+            .get(..data_offset)
+            .filter(|names| names.len() >= names_start)
+            .ok_or(SarcError::DataError("name table out of bounds"))?;
+
+        let entries = (0..num_files)
+            .map(|i| {
+                let offset = entries_start + SFAT_ENTRY_SIZE * i;
+                let attributes = u32_at(offset + 4)?;
+                let name = if attributes & HAS_NAME != 0 {
+                    let start = names_start + 4 * (attributes & 0xFFFF) as usize;
+                    let len = names
+                        .get(start..)
+                        .and_then(|name| name.iter().position(|c| *c == 0))
+                        .ok_or(SarcError::DataError("file name out of bounds"))?;
+                    Some((start as u32, len as u32))
+                } else {
+                    None
+                };
+                let begin = data_offset + u32_at(offset + 8)? as usize;
+                let end = data_offset + u32_at(offset + 12)? as usize;
+                if begin > end || end > data.len() {
+                    return Err(SarcError::DataError("file data out of bounds"));
+                }
+                Ok(Entry {
+                    hash: u32_at(offset)?,
+                    name,
+                    begin: begin as u32,
+                    end: end as u32,
+                })
+            })
+            .collect::<Result<Box<[Entry]>>>()?;
+        Ok(FileTable {
+            endian,
+            data_offset,
+            multiplier,
+            entries,
+        })
+    }
+
+    #[inline]
+    pub(super) fn name<'a>(&self, data: &'a [u8], idx: usize) -> Option<&'a str> {
+        let (start, len) = self.entries[idx].name?;
+        std::str::from_utf8(&data[start as usize..(start + len) as usize]).ok()
+    }
+
+    #[inline]
+    pub(super) fn data<'a>(&self, data: &'a [u8], idx: usize) -> &'a [u8] {
+        let entry = &self.entries[idx];
+        &data[entry.begin as usize..entry.end as usize]
+    }
+
+    /// Check that the entry at `idx` is the file called `name`. Entries
+    /// without a stored name can only be matched by their hash.
+    #[inline]
+    fn matches(&self, data: &[u8], idx: usize, hash: u32, name: &str) -> bool {
+        let entry = &self.entries[idx];
+        entry.hash == hash
+            && match entry.name {
+                Some((start, len)) => {
+                    &data[start as usize..(start + len) as usize] == name.as_bytes()
+                }
+                None => true,
+            }
+    }
+
+    /// Find a file by binary searching the sorted hashes.
+    pub(super) fn find(&self, data: &[u8], hash: u32, name: &str) -> Option<usize> {
+        let start = self.entries.partition_point(|entry| entry.hash < hash);
+        self.find_from(data, start, hash, name)
+    }
+
+    /// Check every entry with the hash from `start`, the first of them, since
+    /// several names can share a hash.
+    #[inline]
+    fn find_from(&self, data: &[u8], start: usize, hash: u32, name: &str) -> Option<usize> {
+        (start..self.entries.len())
+            .take_while(|idx| self.entries[*idx].hash == hash)
+            .find(|idx| self.matches(data, *idx, hash, name))
+    }
+
+    /// Find several files at once. The hashes are sorted and merged against
+    /// the file table in a single pass.
+    pub(super) fn find_many<S: AsRef<str>>(&self, data: &[u8], names: &[S]) -> Vec<Option<usize>> {
+        let mut wanted: Vec<(u32, usize)> = names
+            .iter()
+            .enumerate()
+            .map(|(i, name)| (name_hash(name.as_ref(), self.multiplier), i))
+            .collect();
+        wanted.sort_unstable();
+        let mut found = vec![None; names.len()];
+        let mut cursor = 0;
+        for (hash, i) in wanted {
+            while cursor < self.entries.len() && self.entries[cursor].hash < hash {
+                cursor += 1;
+            }
+            if cursor == self.entries.len() {
+                break;
+            }
+            found[i] = self.find_from(data, cursor, hash, names[i].as_ref());
+        }
+        found
+    }
+}
+
+/// Open-addressed table from name hash to file index.
+pub(super) struct NameIndex {
+    /// File indices, or `EMPTY` for unused slots.
+    slots: Box<[u16]>,
+    shift: u32,
+}
+
+impl NameIndex {
+    const EMPTY: u16 = u16::MAX;
+
+    /// Build the index with at most half of the slots used, so probe
+    /// sequences stay short.
+    pub(super) fn new(table: &FileTable) -> NameIndex {
+        let capacity = (table.entries.len() * 2).next_power_of_two().max(8);
+        let mut index = NameIndex {
+            slots: vec![Self::EMPTY; capacity].into_boxed_slice(),
+            shift: 32 - capacity.trailing_zeros(),
+        };
+        let mask = capacity - 1;
+        for (i, entry) in table.entries.iter().enumerate() {
+            let mut slot = index.slot(entry.hash);
+            while index.slots[slot] != Self::EMPTY {
+                slot = (slot + 1) & mask;
+            }
+            index.slots[slot] = i as u16;
+        }
+        index
+    }
+
+    /// The preferred slot for a hash. SARC hashes of similar names differ
+    /// mostly in their low bits, so they are scrambled first.
+    #[inline]
+    fn slot(&self, hash: u32) -> usize {
+        (hash.wrapping_mul(0x9E37_79B9) >> self.shift) as usize
+    }
+
+    pub(super) fn find(
+        &self,
+        table: &FileTable,
+        data: &[u8],
+        hash: u32,
+        name: &str,
+    ) -> Option<usize> {
+        let mask = self.slots.len() - 1;
+        let mut slot = self.slot(hash);
+        loop {
+            match self.slots[slot] {
+                Self::EMPTY => return None,
+                idx if table.matches(data, idx as usize, hash, name) => return Some(idx as usize),
+                _ => slot = (slot + 1) & mask,
+            }
+        }
+    }
+}
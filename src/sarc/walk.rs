@@ -0,0 +1,245 @@
+//! Parallel traversal of nested archives.
+//!
+//! An [`ArchiveWalker`] visits every file in an archive, in the archives
+//! nested in it, and so on, yaz0 decompressing files on the way. Every file
+//! and every nested archive is a job on the rayon thread pool, so deep and
+//! wide trees are spread across all cores by work stealing.
+use super::{Sarc, SarcError};
+use crate::yaz0;
+use rayon::prelude::*;
+use std::{
+    cell::Cell,
+    fs,
+    path::{Path, PathBuf},
+};
+
+/// The separator between the path of a nested archive and the path of a
+/// file in it, as in `Actor/Pack/Enemy_Lynel_Dark.sbactorpack//Actor/AS/Lynel_StunEnd.bas`.
+pub const NESTED_PATH_SEPARATOR: &str = "//";
+
+thread_local! {
+    /// Leaf files are decompressed into a buffer that each thread reuses.
+    static BUFFER: Cell<Vec<u8>> = Cell::new(Vec::new());
+}
+
+#[inline]
+fn is_compressed(data: &[u8]) -> bool {
+    data.len() >= 4 && &data[0..4] == b"Yaz0"
+}
+
+/// Check for SARC magic, also in yaz0 compressed data, where the magic is
+/// usually stored as a literal right after the header and the first flag byte.
+#[inline]
+fn is_sarc(data: &[u8]) -> bool {
+    (data.len() >= 4 && &data[0..4] == b"SARC")
+        || (is_compressed(data) && data.len() >= 0x15 && &data[0x11..0x15] == b"SARC")
+}
+
+fn extension(path: &str) -> &str {
+    let name = path.rsplit('/').next().unwrap_or(path);
+    name.rsplit_once('.').map_or("", |(_, ext)| ext)
+}
+
+/// Walks nested archives on the rayon thread pool and hands every file to a
+/// callback, with its nested path (see [`NESTED_PATH_SEPARATOR`]) and its
+/// decompressed data.
+///
+/// By default, every SARC is descended into (and not itself passed to the
+/// callback) and every other file is passed to the callback. Filters narrow
+/// this down; files that are filtered out by name are not decompressed at all.
+/// ```
+/// # use roead::sarc::{ArchiveWalker, Sarc, SarcError};
+/// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+/// let data = std::fs::read("test/Enemy_Lynel_Dark.sbactorpack")?;
+/// let mut walker = ArchiveWalker::new();
+/// walker.set_extensions(&["bxml"]);
+/// walker.walk_data("Enemy_Lynel_Dark.sbactorpack", &data, |path, data| {
+///     assert!(path.starts_with("Enemy_Lynel_Dark.sbactorpack//Actor/ActorLink/"));
+///     assert_eq!(&data[0..4], b"AAMP");
+///     Ok::<(), SarcError>(())
+/// })?;
+/// # Ok(())
+/// # }
+/// ```
+#[derive(Default)]
+pub struct ArchiveWalker {
+    extensions: Vec<String>,
+    magics: Vec<Vec<u8>>,
+    descend: Option<Box<dyn Fn(&str) -> bool + Send + Sync>>,
+    include_archives: bool,
+}
+
+impl std::fmt::Debug for ArchiveWalker {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ArchiveWalker")
+            .field("extensions", &self.extensions)
+            .field("magics", &self.magics)
+            .field("include_archives", &self.include_archives)
+            .finish()
+    }
+}
+
+impl ArchiveWalker {
+    /// Create a walker that descends into every SARC and yields every other
+    /// file.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Only yield files with one of these extensions, e.g. `"bxml"`. An empty
+    /// list yields files with any extension.
+    pub fn set_extensions<S: AsRef<str>>(&mut self, extensions: &[S]) {
+        self.extensions = extensions
+            .iter()
+            .map(|ext| ext.as_ref().trim_start_matches('.').to_owned())
+            .collect();
+    }
+
+    /// Only yield files whose decompressed data starts with one of these
+    /// magics, e.g. `b"AAMP"`. An empty list yields files with any contents.
+    pub fn set_magics<B: AsRef<[u8]>>(&mut self, magics: &[B]) {
+        self.magics = magics.iter().map(|m| m.as_ref().to_vec()).collect();
+    }
+
+    /// Only descend into the nested archives for whose nested path the
+    /// filter returns true. Archives that are not descended into are treated
+    /// like any other file.
+    pub fn set_descend_filter<F: Fn(&str) -> bool + Send + Sync + 'static>(&mut self, filter: F) {
+        self.descend = Some(Box::new(filter));
+    }
+
+    /// Also pass the archives that are descended into to the callback, if
+    /// they match the other filters.
+    pub fn set_include_archives(&mut self, include: bool) {
+        self.include_archives = include;
+    }
+
+    fn matches_name(&self, path: &str) -> bool {
+        self.extensions.is_empty() || self.extensions.iter().any(|ext| ext == extension(path))
+    }
+
+    fn matches_data(&self, data: &[u8]) -> bool {
+        self.magics.is_empty() || self.magics.iter().any(|magic| data.starts_with(magic))
+    }
+
+    /// Walk every file in an archive, with paths relative to it.
+    pub fn walk<F, E>(&self, sarc: &Sarc, f: F) -> Result<(), E>
+    where
+        F: Fn(&str, &[u8]) -> Result<(), E> + Sync,
+        E: From<SarcError> + Send,
+    {
+        self.walk_sarc(sarc, None, &f)
+    }
+
+    /// Walk a single file with the given path, which is descended into if it
+    /// is an archive.
+    pub fn walk_data<F, E>(&self, path: &str, data: &[u8], f: F) -> Result<(), E>
+    where
+        F: Fn(&str, &[u8]) -> Result<(), E> + Sync,
+        E: From<SarcError> + Send,
+    {
+        self.visit(path, data, &f)
+    }
+
+    /// Walk every file below a directory, e.g. a romfs dump, and every
+    /// archive in it. Paths are relative to the directory and always use `/`.
+    pub fn walk_dir<P, F, E>(&self, dir: P, f: F) -> Result<(), E>
+    where
+        P: AsRef<Path>,
+        F: Fn(&str, &[u8]) -> Result<(), E> + Sync,
+        E: From<SarcError> + Send,
+    {
+        let dir = dir.as_ref();
+        let mut files = Vec::new();
+        list_files(dir, &mut files).map_err(SarcError::from)?;
+        files.into_par_iter().try_for_each(|file| {
+            let path = file
+                .strip_prefix(dir)
+                .unwrap_or(&file)
+                .components()
+                .map(|c| c.as_os_str().to_string_lossy())
+                .collect::<Vec<_>>()
+                .join("/");
+            if !self.matches_name(&path) && !self.may_descend(&path) {
+                return Ok(());
+            }
+            let data = fs::read(&file).map_err(SarcError::from)?;
+            self.visit(&path, &data, &f)
+        })
+    }
+
+    fn may_descend(&self, path: &str) -> bool {
+        self.descend.as_ref().map_or(true, |descend| descend(path))
+    }
+
+    fn walk_sarc<F, E>(&self, sarc: &Sarc, prefix: Option<&str>, f: &F) -> Result<(), E>
+    where
+        F: Fn(&str, &[u8]) -> Result<(), E> + Sync,
+        E: From<SarcError> + Send,
+    {
+        (0..sarc.len()).into_par_iter().try_for_each(|i| {
+            let file = sarc.file_at(i);
+            let name = match file.name {
+                Some(name) => name.to_owned(),
+                None => format!("{:08x}", sarc.table.entries[i].hash),
+            };
+            let path = match prefix {
+                Some(prefix) => [prefix, &name].join(NESTED_PATH_SEPARATOR),
+                None => name,
+            };
+            self.visit(&path, file.data, f)
+        })
+    }
+
+    fn visit<F, E>(&self, path: &str, data: &[u8], f: &F) -> Result<(), E>
+    where
+        F: Fn(&str, &[u8]) -> Result<(), E> + Sync,
+        E: From<SarcError> + Send,
+    {
+        if is_sarc(data) && self.may_descend(path) {
+            // Nested archives keep their own decompressed copy, since their
+            // files are borrowed by jobs that can run on any thread.
+            let sarc = Sarc::read(data)?;
+            if self.include_archives && self.matches_name(path) && self.matches_data(&sarc._data) {
+                f(path, &sarc._data)?;
+            }
+            return self.walk_sarc(&sarc, Some(path), f);
+        }
+        if !self.matches_name(path) {
+            return Ok(());
+        }
+        if !is_compressed(data) {
+            return if self.matches_data(data) {
+                f(path, data)
+            } else {
+                Ok(())
+            };
+        }
+        // Taking the buffer out of the thread local keeps this sound even if
+        // the callback itself walks archives on the same thread.
+        let mut buf = BUFFER.with(Cell::take);
+        let result = yaz0::decompress_to_vec(data, &mut buf)
+            .map_err(|e| E::from(SarcError::from(e)))
+            .and_then(|_| {
+                if self.matches_data(&buf) {
+                    f(path, &buf)
+                } else {
+                    Ok(())
+                }
+            });
+        BUFFER.with(|cell| cell.set(buf));
+        result
+    }
+}
+
+fn list_files(dir: &Path, files: &mut Vec<PathBuf>) -> std::io::Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        if entry.file_type()?.is_dir() {
+            list_files(&entry.path(), files)?;
+        } else {
+            files.push(entry.path());
+        }
+    }
+    Ok(())
+}
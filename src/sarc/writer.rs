@@ -0,0 +1,382 @@
+//! Native SARC serialization.
+//!
+//! Files are sorted by name hash and their data is aligned using the same
+//! rules as oead, so archives come out byte for byte identical to what
+//! oead would write for the same files and settings.
+use super::{gcd_usize, table::name_hash, SarcWriter};
+use crate::Endian;
+use std::collections::HashMap;
+use std::io::{self, Write};
+
+const HEADER_SIZE: usize = 0x14;
+const SFAT_HEADER_SIZE: usize = 0xC;
+const SFAT_ENTRY_SIZE: usize = 0x10;
+const SFNT_HEADER_SIZE: usize = 0x8;
+const HAS_NAME: u32 = 0x0100_0000;
+const HASH_MULTIPLIER: u32 = 0x65;
+
+/// Extensions of the resource factories in BotW (1.5.0). In new mode the
+/// resource system aligns these itself, so their headers are not checked.
+const FACTORY_EXTENSIONS: &[&str] = &[
+    "sarc",
+    "bfres",
+    "bcamanim",
+    "batpl",
+    "bnfprl",
+    "bplacement",
+    "hks",
+    "lua",
+    "bactcapt",
+    "bitemico",
+    "jpg",
+    "bmaptex",
+    "bstftex",
+    "bgdata",
+    "bgsvdata",
+    "hknm2",
+    "bmscdef",
+    "bars",
+    "bxml",
+    "bgparamlist",
+    "bmodellist",
+    "baslist",
+    "baiprog",
+    "bphysics",
+    "bchemical",
+    "bas",
+    "batcllist",
+    "batcl",
+    "baischedule",
+    "bdmgparam",
+    "brgconfiglist",
+    "brgconfig",
+    "brgbw",
+    "bawareness",
+    "bdrop",
+    "bshop",
+    "brecipe",
+    "blod",
+    "bbonectrl",
+    "blifecondition",
+    "bumii",
+    "baniminfo",
+    "byaml",
+    "bassetting",
+    "hkrb",
+    "hkrg",
+    "bphyssb",
+    "hkcl",
+    "hksc",
+    "hktmrb",
+    "brgcon",
+    "esetlist",
+    "bdemo",
+    "bfevfl",
+    "bfevtm",
+];
+
+/// Alignment requirements for formats the resource system does not know
+/// about.
+pub(super) fn default_alignments(endian: Endian) -> HashMap<String, usize> {
+    let bffnt = match endian {
+        Endian::Big => 0x2000,
+        Endian::Little => 0x1000,
+    };
+    [
+        ("ksky", 8),
+        ("bksky", 8),
+        ("gtx", 0x2000),
+        ("sharcb", 0x1000),
+        ("sharc", 0x1000),
+        ("baglmf", 0x80),
+        ("bffnt", bffnt),
+    ]
+    .iter()
+    .map(|(ext, alignment)| (ext.to_string(), *alignment))
+    .collect()
+}
+
+#[inline]
+fn lcm(a: usize, b: usize) -> usize {
+    a / gcd_usize(a, b) * b
+}
+
+#[inline]
+fn align_up(value: usize, alignment: usize) -> usize {
+    (value + alignment - 1) / alignment * alignment
+}
+
+fn is_sarc(data: &[u8]) -> bool {
+    data.len() >= 0x20
+        && (&data[0..4] == b"SARC" || (&data[0..4] == b"Yaz0" && &data[0x11..0x15] == b"SARC"))
+}
+
+/// Alignment of files that start with an `nn::util::BinaryFileHeader`.
+fn new_binary_file_alignment(data: &[u8]) -> usize {
+    if data.len() <= 0x20 {
+        return 1;
+    }
+    let size = [data[0x1C], data[0x1D], data[0x1E], data[0x1F]];
+    let size = match [data[0xC], data[0xD]] {
+        [0xFE, 0xFF] => u32::from_be_bytes(size),
+        [0xFF, 0xFE] => u32::from_le_bytes(size),
+        _ => return 1,
+    };
+    if size as usize != data.len() {
+        return 1;
+    }
+    1usize.checked_shl(data[0xE] as u32).unwrap_or(1)
+}
+
+/// Alignment of Wii U bflim textures, which keep their header at the end.
+fn cafe_bflim_alignment(data: &[u8]) -> usize {
+    if data.len() <= 0x28 || &data[data.len() - 0x28..data.len() - 0x24] != b"FLIM" {
+        return 1;
+    }
+    let alignment = u16::from_be_bytes([data[data.len() - 8], data[data.len() - 7]]);
+    (alignment as usize).max(1)
+}
+
+impl SarcWriter<'_> {
+    pub(super) fn alignment_for_file(&self, name: &str, data: &[u8]) -> usize {
+        // Like oead, a name without a dot is its own extension.
+        let ext = &name[name.rfind('.').map(|i| i + 1).unwrap_or(0)..];
+        let mut alignment = self.min_alignment;
+        if let Some(required) = self.alignments.get(ext) {
+            alignment = lcm(alignment, *required);
+        }
+        if self.legacy && is_sarc(data) {
+            alignment = lcm(alignment, 0x2000);
+        }
+        if self.legacy || !FACTORY_EXTENSIONS.contains(&ext) {
+            alignment = lcm(alignment, new_binary_file_alignment(data));
+            if self.endian == Endian::Big {
+                alignment = lcm(alignment, cafe_bflim_alignment(data));
+            }
+        }
+        alignment
+    }
+}
+
+/// A file to be placed in an archive.
+struct Item<'w> {
+    hash: u32,
+    name: &'w str,
+    data: &'w [u8],
+    alignment: usize,
+}
+
+/// Collect the files of a writer in archive (name hash) order.
+fn sorted_items<'w>(writer: &'w SarcWriter) -> Vec<Item<'w>> {
+    let mut items: Vec<Item> = writer
+        .files
+        .iter()
+        .map(|(name, data)| {
+            let data: &[u8] = data;
+            Item {
+                hash: name_hash(name, HASH_MULTIPLIER),
+                name,
+                data,
+                alignment: writer.alignment_for_file(name, data),
+            }
+        })
+        .collect();
+    items.sort_unstable_by(|a, b| (a.hash, a.name).cmp(&(b.hash, b.name)));
+    items
+}
+
+/// Size of the header and tables, before any alignment of the data.
+fn tables_size(items: &[Item]) -> usize {
+    let names_size: usize = items.iter().map(|f| align_up(f.name.len() + 1, 4)).sum();
+    HEADER_SIZE + SFAT_HEADER_SIZE + SFAT_ENTRY_SIZE * items.len() + SFNT_HEADER_SIZE + names_size
+}
+
+/// A fully laid out archive: the header and tables, and where each chunk
+/// of file data goes.
+pub(super) struct Layout<'w> {
+    pub(super) tables: Vec<u8>,
+    /// Absolute offset and contents of each chunk of file data, in order.
+    pub(super) files: Vec<(usize, &'w [u8])>,
+    pub(super) size: usize,
+    pub(super) alignment: usize,
+}
+
+impl<'w> Layout<'w> {
+    pub(super) fn new(writer: &'w SarcWriter) -> Layout<'w> {
+        let items = sorted_items(writer);
+        let alignment = items.iter().fold(writer.min_alignment, |alignment, f| {
+            lcm(alignment, f.alignment)
+        });
+        let data_offset = align_up(tables_size(&items), alignment);
+        let mut ranges = Vec::with_capacity(items.len());
+        let mut chunks = Vec::with_capacity(items.len());
+        let mut data_end = 0;
+        for item in &items {
+            let begin = align_up(data_end, item.alignment);
+            data_end = begin + item.data.len();
+            ranges.push((begin, data_end));
+            chunks.push((data_offset + begin, item.data));
+        }
+        Layout::build(
+            writer.endian,
+            &items,
+            &ranges,
+            data_offset,
+            chunks,
+            alignment,
+        )
+    }
+
+    /// Lay out an archive as a patch of an existing one, whose data section
+    /// (everything from its data offset on) is `base` and starts at
+    /// `base_offset`. Files whose data lies in the base data section keep
+    /// their position relative to it whenever their alignment allows, and
+    /// that part of the section is copied as one block. Everything else is
+    /// appended after it.
+    pub(super) fn patched(
+        writer: &'w SarcWriter,
+        base: &'w [u8],
+        base_offset: usize,
+    ) -> Layout<'w> {
+        let items = sorted_items(writer);
+        let alignment = items.iter().fold(writer.min_alignment, |alignment, f| {
+            lcm(alignment, f.alignment)
+        });
+        // Keep the data offset congruent to the original so that the reused
+        // data stays aligned.
+        let tables_size = tables_size(&items);
+        let data_offset = if tables_size <= base_offset {
+            base_offset - (base_offset - tables_size) / alignment * alignment
+        } else {
+            base_offset + align_up(tables_size - base_offset, alignment)
+        };
+
+        let base_start = base.as_ptr() as usize;
+        let base_end = base_start + base.len();
+        let mut ranges = vec![(0, 0); items.len()];
+        let mut appended = Vec::new();
+        let mut reused_end = 0;
+        for (i, item) in items.iter().enumerate() {
+            let start = item.data.as_ptr() as usize;
+            let end = start + item.data.len();
+            if start >= base_start
+                && end <= base_end
+                && (data_offset + start - base_start) % item.alignment == 0
+            {
+                ranges[i] = (start - base_start, end - base_start);
+                reused_end = reused_end.max(end - base_start);
+            } else {
+                appended.push(i);
+            }
+        }
+
+        let mut chunks = Vec::with_capacity(appended.len() + 1);
+        if reused_end > 0 {
+            chunks.push((data_offset, &base[..reused_end]));
+        }
+        let mut data_end = reused_end;
+        for i in appended {
+            let item = &items[i];
+            let begin = align_up(data_offset + data_end, item.alignment) - data_offset;
+            data_end = begin + item.data.len();
+            ranges[i] = (begin, data_end);
+            chunks.push((data_offset + begin, item.data));
+        }
+        Layout::build(
+            writer.endian,
+            &items,
+            &ranges,
+            data_offset,
+            chunks,
+            alignment,
+        )
+    }
+
+    /// Write the header and tables for files placed at the given ranges
+    /// relative to the data offset.
+    fn build(
+        endian: Endian,
+        items: &[Item],
+        ranges: &[(usize, usize)],
+        data_offset: usize,
+        chunks: Vec<(usize, &'w [u8])>,
+        alignment: usize,
+    ) -> Layout<'w> {
+        let u16_bytes = |value: u16| match endian {
+            Endian::Big => value.to_be_bytes(),
+            Endian::Little => value.to_le_bytes(),
+        };
+        let u32_bytes = |value: u32| match endian {
+            Endian::Big => value.to_be_bytes(),
+            Endian::Little => value.to_le_bytes(),
+        };
+        let data_end = ranges.iter().map(|r| r.1).max().unwrap_or(0);
+        let size = data_offset + data_end;
+
+        let mut tables = Vec::with_capacity(data_offset);
+        tables.extend_from_slice(b"SARC");
+        tables.extend_from_slice(&u16_bytes(HEADER_SIZE as u16));
+        tables.extend_from_slice(&u16_bytes(0xFEFF));
+        tables.extend_from_slice(&u32_bytes(size as u32));
+        tables.extend_from_slice(&u32_bytes(data_offset as u32));
+        tables.extend_from_slice(&u16_bytes(0x0100));
+        tables.extend_from_slice(&[0; 2]);
+
+        tables.extend_from_slice(b"SFAT");
+        tables.extend_from_slice(&u16_bytes(SFAT_HEADER_SIZE as u16));
+        tables.extend_from_slice(&u16_bytes(items.len() as u16));
+        tables.extend_from_slice(&u32_bytes(HASH_MULTIPLIER));
+        let mut name_offset = 0;
+        for (item, (begin, end)) in items.iter().zip(ranges) {
+            tables.extend_from_slice(&u32_bytes(item.hash));
+            tables.extend_from_slice(&u32_bytes(HAS_NAME | (name_offset / 4) as u32));
+            tables.extend_from_slice(&u32_bytes(*begin as u32));
+            tables.extend_from_slice(&u32_bytes(*end as u32));
+            name_offset += align_up(item.name.len() + 1, 4);
+        }
+
+        tables.extend_from_slice(b"SFNT");
+        tables.extend_from_slice(&u16_bytes(SFNT_HEADER_SIZE as u16));
+        tables.extend_from_slice(&[0; 2]);
+        for item in items {
+            tables.extend_from_slice(item.name.as_bytes());
+            tables.resize(align_up(tables.len() + 1, 4), 0);
+        }
+        tables.resize(data_offset, 0);
+        Layout {
+            tables,
+            files: chunks,
+            size,
+            alignment,
+        }
+    }
+
+    /// Serialize the archive into a single buffer.
+    pub(super) fn to_vec(&self) -> Vec<u8> {
+        let mut out = Vec::with_capacity(self.size);
+        out.extend_from_slice(&self.tables);
+        for (offset, data) in &self.files {
+            out.resize(*offset, 0);
+            out.extend_from_slice(data);
+        }
+        out
+    }
+
+    /// Stream the archive to a writer. Only the tables are buffered; file
+    /// data is written straight from where the [`SarcWriter`] holds it.
+    pub(super) fn write<W: Write>(&self, writer: &mut W) -> io::Result<()> {
+        const ZEROS: [u8; 0x1000] = [0; 0x1000];
+        writer.write_all(&self.tables)?;
+        let mut pos = self.tables.len();
+        for (offset, data) in &self.files {
+            while pos < *offset {
+                let len = (*offset - pos).min(ZEROS.len());
+                writer.write_all(&ZEROS[..len])?;
+                pos += len;
+            }
+            writer.write_all(data)?;
+            pos += data.len();
+        }
+        Ok(())
+    }
+}
@@ -0,0 +1,408 @@
+//! Optional instrumentation of the parsing, conversion, serialization and
+//! compression paths, enabled by the `stats` feature.
+//!
+//! Every instrumented call adds its wall time, the size of the data it
+//! processed and the allocations it made to process-wide counters for its
+//! format and [`Phase`], which can be read at any time with [`snapshot`].
+//! Without the feature, the hooks compile to nothing.
+//!
+//! Phases nest: [`Byml::from_binary`](crate::byml::Byml::from_binary) is a
+//! parse that includes the conversion of the document into an owned tree, so
+//! the time and allocations of the conversion are counted under both phases.
+//!
+//! Allocations are only counted when the [`CountingAllocator`] is installed
+//! as the global allocator. Each thread counts its own allocations, so the
+//! counts stay exact when many documents are processed in parallel, but a
+//! call only counts the allocations of the thread it was made on. Work it
+//! hands to the rayon thread pool is missed, so
+//! [`Byml::to_binary_parallel`](crate::byml::Byml::to_binary_parallel),
+//! [`yaz0::compress_parallel`](crate::yaz0::compress_parallel) and
+//! [`SarcWriter::build_parallel`](crate::sarc::SarcWriter::build_parallel)
+//! under-report their allocations. [`Byml::to_binary`](crate::byml::Byml::to_binary)
+//! and the other calls do all their work on the calling thread.
+//!
+//! Compression is recorded once per call for its whole input, however the
+//! input is split into chunks internally. `build_parallel` records one
+//! compression per file it compresses, on the worker that compressed it, and
+//! then the serialization of the SARC. Those files are compressed at the same
+//! time, so their times add up to more than the wall time of the build. A
+//! [`Yaz0Writer`](crate::yaz0::Yaz0Writer) records one compression for each
+//! chunk of up to 256 KiB that it compresses.
+//! ```
+//! # #[cfg(feature = "stats")]
+//! # use roead::{aamp::ParameterIO, stats::{self, Format, Phase}};
+//! # #[cfg(feature = "stats")]
+//! #[global_allocator]
+//! static ALLOC: stats::CountingAllocator = stats::CountingAllocator::new();
+//!
+//! # #[cfg(feature = "stats")]
+//! # fn doctest() -> Result<(), Box<dyn std::error::Error>> {
+//! let data = std::fs::read("test/Chuchu_Middle.baiprog")?;
+//! let before = stats::snapshot();
+//! let pio = ParameterIO::from_binary(&data)?;
+//! let parse = stats::snapshot().since(&before).get(Format::Aamp, Phase::Parse);
+//! println!(
+//!     "{} µs, {} allocations",
+//!     parse.nanos / 1000,
+//!     parse.allocations
+//! );
+//! # Ok(())
+//! # }
+//! ```
+#[cfg(feature = "stats")]
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+    sync::atomic::{AtomicU64, Ordering},
+    time::Instant,
+};
+
+/// The format an instrumented call belongs to.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Format {
+    Byml,
+    Aamp,
+    Sarc,
+    Yaz0,
+}
+
+/// What an instrumented call does.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Phase {
+    /// Reading a document from binary data or text. Bytes are the input.
+    Parse,
+    /// Building an owned document from a view over binary data. Bytes are
+    /// the size of the binary document.
+    Convert,
+    /// Writing a document to binary data or text. Bytes are the output.
+    Serialize,
+    /// Yaz0 compression. Bytes are the uncompressed input.
+    Compress,
+    /// Yaz0 decompression. Bytes are the decompressed output.
+    Decompress,
+}
+
+#[cfg(feature = "stats")]
+const FORMATS: [Format; 4] = [Format::Byml, Format::Aamp, Format::Sarc, Format::Yaz0];
+#[cfg(feature = "stats")]
+const PHASES: [Phase; 5] = [
+    Phase::Parse,
+    Phase::Convert,
+    Phase::Serialize,
+    Phase::Compress,
+    Phase::Decompress,
+];
+
+/// Totals for one format and phase.
+#[cfg(feature = "stats")]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct PhaseStats {
+    /// Number of calls.
+    pub calls: u64,
+    /// Total wall time in nanoseconds.
+    pub nanos: u64,
+    /// Total size of the data processed, as described for each [`Phase`].
+    pub bytes: u64,
+    /// Number of allocations and reallocations.
+    pub allocations: u64,
+    /// Total size of those allocations.
+    pub allocated_bytes: u64,
+}
+
+#[cfg(feature = "stats")]
+impl PhaseStats {
+    fn since(&self, earlier: &PhaseStats) -> PhaseStats {
+        PhaseStats {
+            calls: self.calls.saturating_sub(earlier.calls),
+            nanos: self.nanos.saturating_sub(earlier.nanos),
+            bytes: self.bytes.saturating_sub(earlier.bytes),
+            allocations: self.allocations.saturating_sub(earlier.allocations),
+            allocated_bytes: self.allocated_bytes.saturating_sub(earlier.allocated_bytes),
+        }
+    }
+}
+
+/// A copy of every counter at one point in time.
+#[cfg(feature = "stats")]
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct Snapshot([[PhaseStats; 5]; 4]);
+
+#[cfg(feature = "stats")]
+impl Snapshot {
+    /// The totals for a format and phase.
+    pub fn get(&self, format: Format, phase: Phase) -> PhaseStats {
+        self.0[format as usize][phase as usize]
+    }
+
+    /// Iterate over the formats and phases with at least one call.
+    pub fn iter(&self) -> impl Iterator<Item = (Format, Phase, PhaseStats)> + '_ {
+        FORMATS.iter().flat_map(move |format| {
+            PHASES
+                .iter()
+                .map(move |phase| (*format, *phase, self.get(*format, *phase)))
+                .filter(|(_, _, stats)| stats.calls > 0)
+        })
+    }
+
+    /// The counts between an earlier snapshot and this one. If the counters
+    /// were [`reset`] in between, the result only covers the calls since the
+    /// reset, and counts that are lower than in `earlier` are zero.
+    pub fn since(&self, earlier: &Snapshot) -> Snapshot {
+        let mut diff = Snapshot::default();
+        for (i, formats) in self.0.iter().enumerate() {
+            for (j, stats) in formats.iter().enumerate() {
+                diff.0[i][j] = stats.since(&earlier.0[i][j]);
+            }
+        }
+        diff
+    }
+}
+
+#[cfg(feature = "stats")]
+struct Counters {
+    calls: AtomicU64,
+    nanos: AtomicU64,
+    bytes: AtomicU64,
+    allocations: AtomicU64,
+    allocated_bytes: AtomicU64,
+}
+
+#[cfg(feature = "stats")]
+impl Counters {
+    #[allow(clippy::declare_interior_mutable_const)]
+    const ZERO: Counters = Counters {
+        calls: AtomicU64::new(0),
+        nanos: AtomicU64::new(0),
+        bytes: AtomicU64::new(0),
+        allocations: AtomicU64::new(0),
+        allocated_bytes: AtomicU64::new(0),
+    };
+
+    fn fields(&self) -> [&AtomicU64; 5] {
+        [
+            &self.calls,
+            &self.nanos,
+            &self.bytes,
+            &self.allocations,
+            &self.allocated_bytes,
+        ]
+    }
+}
+
+#[cfg(feature = "stats")]
+#[allow(clippy::declare_interior_mutable_const)]
+const ROW: [Counters; 5] = [Counters::ZERO; 5];
+#[cfg(feature = "stats")]
+static COUNTERS: [[Counters; 5]; 4] = [ROW; 4];
+
+/// Read every counter. Counters are updated independently, so a snapshot
+/// taken while other threads are in instrumented calls may include some of
+/// the totals of a call but not others.
+#[cfg(feature = "stats")]
+pub fn snapshot() -> Snapshot {
+    let mut snapshot = Snapshot::default();
+    for (i, formats) in COUNTERS.iter().enumerate() {
+        for (j, counters) in formats.iter().enumerate() {
+            let load = |field: &AtomicU64| field.load(Ordering::Relaxed);
+            snapshot.0[i][j] = PhaseStats {
+                calls: load(&counters.calls),
+                nanos: load(&counters.nanos),
+                bytes: load(&counters.bytes),
+                allocations: load(&counters.allocations),
+                allocated_bytes: load(&counters.allocated_bytes),
+            };
+        }
+    }
+    snapshot
+}
+
+/// Set every counter back to zero. Snapshots taken before a reset stay
+/// valid, but [`Snapshot::since`] cannot tell how much was counted before
+/// the reset, so use a snapshot taken after it as the starting point.
+#[cfg(feature = "stats")]
+pub fn reset() {
+    for counters in COUNTERS.iter().flatten() {
+        for field in counters.fields().iter() {
+            field.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+#[cfg(feature = "stats")]
+thread_local! {
+    /// Allocations and allocated bytes of the current thread.
+    static ALLOCATIONS: Cell<(u64, u64)> = Cell::new((0, 0));
+}
+
+#[cfg(feature = "stats")]
+#[inline]
+fn thread_allocations() -> (u64, u64) {
+    ALLOCATIONS.try_with(Cell::get).unwrap_or((0, 0))
+}
+
+/// A global allocator that counts the allocations of each thread for the
+/// instrumentation, passing them on to another allocator, by default the
+/// system allocator.
+#[cfg(feature = "stats")]
+#[derive(Debug, Default)]
+pub struct CountingAllocator<A = System>(A);
+
+#[cfg(feature = "stats")]
+impl CountingAllocator {
+    /// Count allocations made through the system allocator.
+    pub const fn new() -> Self {
+        CountingAllocator(System)
+    }
+}
+
+#[cfg(feature = "stats")]
+impl<A> CountingAllocator<A> {
+    /// Count allocations made through another allocator.
+    pub const fn with_allocator(allocator: A) -> Self {
+        CountingAllocator(allocator)
+    }
+
+    #[inline]
+    fn count(size: usize) {
+        // Fails only while the thread is being torn down
+        let _ = ALLOCATIONS.try_with(|cell| {
+            let (count, bytes) = cell.get();
+            cell.set((count + 1, bytes + size as u64));
+        });
+    }
+}
+
+#[cfg(feature = "stats")]
+unsafe impl<A: GlobalAlloc> GlobalAlloc for CountingAllocator<A> {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        Self::count(layout.size());
+        self.0.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        Self::count(layout.size());
+        self.0.alloc_zeroed(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        self.0.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        Self::count(new_size);
+        self.0.realloc(ptr, layout, new_size)
+    }
+}
+
+/// Measures one instrumented call until it is dropped.
+#[cfg(feature = "stats")]
+pub(crate) struct Span {
+    counters: &'static Counters,
+    start: Instant,
+    bytes: usize,
+    allocations: (u64, u64),
+}
+
+#[cfg(feature = "stats")]
+impl Span {
+    /// Set the number of bytes processed, for calls that only know it at the
+    /// end.
+    #[inline]
+    pub(crate) fn set_bytes(&mut self, bytes: usize) {
+        self.bytes = bytes;
+    }
+}
+
+#[cfg(feature = "stats")]
+impl Drop for Span {
+    fn drop(&mut self) {
+        let nanos = self.start.elapsed().as_nanos() as u64;
+        let (count, bytes) = thread_allocations();
+        let counters = self.counters;
+        counters.calls.fetch_add(1, Ordering::Relaxed);
+        counters.nanos.fetch_add(nanos, Ordering::Relaxed);
+        counters
+            .bytes
+            .fetch_add(self.bytes as u64, Ordering::Relaxed);
+        counters
+            .allocations
+            .fetch_add(count - self.allocations.0, Ordering::Relaxed);
+        counters
+            .allocated_bytes
+            .fetch_add(bytes - self.allocations.1, Ordering::Relaxed);
+    }
+}
+
+/// Start measuring a call that processes `bytes` bytes.
+#[cfg(feature = "stats")]
+#[inline]
+pub(crate) fn span(format: Format, phase: Phase, bytes: usize) -> Span {
+    Span {
+        counters: &COUNTERS[format as usize][phase as usize],
+        start: Instant::now(),
+        bytes,
+        allocations: thread_allocations(),
+    }
+}
+
+#[cfg(not(feature = "stats"))]
+pub(crate) struct Span;
+
+#[cfg(not(feature = "stats"))]
+impl Span {
+    #[inline(always)]
+    pub(crate) fn set_bytes(&mut self, _bytes: usize) {}
+}
+
+#[cfg(not(feature = "stats"))]
+#[inline(always)]
+pub(crate) fn span(_format: Format, _phase: Phase, _bytes: usize) -> Span {
+    Span
+}
+
+#[cfg(all(test, feature = "stats"))]
+mod tests {
+    use super::{Format, Phase};
+    use crate::{aamp::ParameterIO, byml::Byml, yaz0, Endian};
+
+    #[test]
+    fn count_phases() {
+        let before = super::snapshot();
+        let data = std::fs::read("test/Chuchu_Middle.baiprog").unwrap();
+        let pio = ParameterIO::from_binary(&data).unwrap();
+        let doc = Byml::Array((0..100).map(Byml::Int).collect());
+        let binary = doc.to_binary(Endian::Little);
+        yaz0::decompress(yaz0::compress(&binary)).unwrap();
+        let stats = super::snapshot().since(&before);
+
+        // Other tests may run at the same time, so only lower bounds hold
+        let parse = stats.get(Format::Aamp, Phase::Parse);
+        assert!(parse.calls >= 1 && parse.bytes >= data.len() as u64);
+        assert!(stats.get(Format::Aamp, Phase::Convert).calls >= 1);
+        let serialize = stats.get(Format::Byml, Phase::Serialize);
+        assert!(serialize.calls >= 1 && serialize.bytes >= binary.len() as u64);
+        assert!(stats.get(Format::Yaz0, Phase::Compress).calls >= 1);
+        assert!(stats.get(Format::Yaz0, Phase::Decompress).bytes >= binary.len() as u64);
+        assert!(stats
+            .iter()
+            .any(|(format, phase, _)| format == Format::Aamp && phase == Phase::Parse));
+        drop(pio);
+    }
+
+    #[test]
+    fn since_reset() {
+        let mut later = super::Snapshot::default();
+        later.0[Format::Aamp as usize][Phase::Parse as usize].calls = 2;
+        let mut earlier = super::Snapshot::default();
+        earlier.0[Format::Aamp as usize][Phase::Parse as usize].calls = 5;
+        earlier.0[Format::Byml as usize][Phase::Parse as usize].nanos = 10;
+        assert_eq!(
+            later.since(&earlier).get(Format::Aamp, Phase::Parse).calls,
+            0
+        );
+        assert_eq!(
+            later.since(&earlier).get(Format::Byml, Phase::Parse).nanos,
+            0
+        );
+    }
+}
@@ -1,4 +1,4 @@
-#include "roead/include/sarc.h"
+#include "roead/include/types.h"
 #include "roead/src/lib.rs.h"
 #include "rust/cxx.h"
 #include <oead/types.h>
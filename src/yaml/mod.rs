@@ -0,0 +1,388 @@
+//! Shared YAML support for the BYML and AAMP text formats.
+//!
+//! Both formats use the same small subset of YAML: block and flow
+//! collections, plain and quoted scalars, and local tags. The parser in
+//! [`parser`] reports that subset as events so each format can build its
+//! own tree in a single pass, and the helpers here format and resolve
+//! scalars the way both formats expect.
+pub(crate) mod parser;
+
+pub(crate) use parser::{parse, Handler, Scalar};
+
+/// Append a float the way oead writes it, as `printf` would with `%.9g` for
+/// `f32` and `%.17g` for `f64`: the number of significant digits that always
+/// round-trips, with trailing zeroes removed. The output always contains a
+/// decimal point so that it is read back as a float.
+pub(crate) fn write_float<F: Float>(out: &mut String, value: F) {
+    if value.is_nan() {
+        out.push_str(".nan");
+    } else if value.is_infinite() {
+        out.push_str(if value.is_sign_negative() {
+            "-.inf"
+        } else {
+            ".inf"
+        });
+    } else {
+        let digits = F::DIGITS;
+        let scientific = format!("{:.*e}", digits - 1, value);
+        let (mantissa, exp) = scientific.split_once('e').unwrap();
+        let exp: i32 = exp.parse().unwrap();
+        let (repr, exp) = if exp < -4 || exp >= digits as i32 {
+            (trim_zeroes(mantissa).to_owned(), Some(exp))
+        } else {
+            let fixed = format!("{:.*}", (digits as i32 - 1 - exp) as usize, value);
+            (trim_zeroes(&fixed).to_owned(), None)
+        };
+        out.push_str(&repr);
+        if !repr.contains('.') {
+            out.push_str(".0");
+        }
+        if let Some(exp) = exp {
+            use std::fmt::Write;
+            let _ = write!(out, "e{}{:02}", if exp < 0 { '-' } else { '+' }, exp.abs());
+        }
+    }
+}
+
+fn trim_zeroes(repr: &str) -> &str {
+    if repr.contains('.') {
+        repr.trim_end_matches('0').trim_end_matches('.')
+    } else {
+        repr
+    }
+}
+
+/// The float types that can be written with [`write_float`].
+pub(crate) trait Float: Copy + std::fmt::Display + std::fmt::LowerExp {
+    /// The number of significant digits needed to round-trip any value.
+    const DIGITS: usize;
+    fn is_nan(self) -> bool;
+    fn is_infinite(self) -> bool;
+    fn is_sign_negative(self) -> bool;
+}
+
+impl Float for f32 {
+    const DIGITS: usize = 9;
+
+    fn is_nan(self) -> bool {
+        f32::is_nan(self)
+    }
+
+    fn is_infinite(self) -> bool {
+        f32::is_infinite(self)
+    }
+
+    fn is_sign_negative(self) -> bool {
+        f32::is_sign_negative(self)
+    }
+}
+
+impl Float for f64 {
+    const DIGITS: usize = 17;
+
+    fn is_nan(self) -> bool {
+        f64::is_nan(self)
+    }
+
+    fn is_infinite(self) -> bool {
+        f64::is_infinite(self)
+    }
+
+    fn is_sign_negative(self) -> bool {
+        f64::is_sign_negative(self)
+    }
+}
+
+/// Append a string as a scalar, quoting it if it would otherwise be read
+/// back as something else or is not valid as a plain scalar in either block
+/// or flow context.
+pub(crate) fn write_str(out: &mut String, value: &str) {
+    if is_plain_safe(value) && !resolves_to_non_string(value) {
+        out.push_str(value);
+    } else {
+        write_quoted(out, value);
+    }
+}
+
+/// Append a string that follows a tag such as `!str32`. The tag already makes
+/// it a string, so like oead this only quotes it if it is not valid as a
+/// plain scalar.
+pub(crate) fn write_tagged_str(out: &mut String, value: &str) {
+    if is_plain_safe(value) {
+        out.push_str(value);
+    } else {
+        write_quoted(out, value);
+    }
+}
+
+fn write_quoted(out: &mut String, value: &str) {
+    if value.chars().all(|c| !c.is_control()) {
+        out.push('\'');
+        for c in value.chars() {
+            if c == '\'' {
+                out.push('\'');
+            }
+            out.push(c);
+        }
+        out.push('\'');
+    } else {
+        out.push('"');
+        for c in value.chars() {
+            match c {
+                '"' => out.push_str("\\\""),
+                '\\' => out.push_str("\\\\"),
+                '\n' => out.push_str("\\n"),
+                '\t' => out.push_str("\\t"),
+                '\r' => out.push_str("\\r"),
+                '\0' => out.push_str("\\0"),
+                c if c.is_control() => {
+                    use std::fmt::Write;
+                    let _ = write!(out, "\\u{:04x}", c as u32);
+                }
+                c => out.push(c),
+            }
+        }
+        out.push('"');
+    }
+}
+
+fn is_plain_safe(value: &str) -> bool {
+    let bytes = value.as_bytes();
+    match (bytes.first(), bytes.last()) {
+        (Some(first), Some(last)) => {
+            !b"-?:,[]{}#&*!|>'\"%@` \t".contains(first)
+                && !matches!(last, b' ' | b'\t' | b':')
+                && !bytes.iter().any(|b| {
+                    matches!(b, b',' | b'[' | b']' | b'{' | b'}' | b'\n' | b'\r' | b'\t')
+                        || *b < 0x20
+                        || *b == 0x7f
+                })
+                && !value.contains(": ")
+                && !value.contains(" #")
+        }
+        _ => false,
+    }
+}
+
+/// Check if a plain scalar would be read as anything but a string, by this
+/// parser or by YAML 1.1 readers, which also accept words like “yes”.
+fn resolves_to_non_string(value: &str) -> bool {
+    is_null(value)
+        || parse_bool(value).is_some()
+        || parse_int(value).is_some()
+        || parse_float(value).is_some()
+        || matches!(
+            value,
+            "y" | "Y"
+                | "n"
+                | "N"
+                | "yes"
+                | "Yes"
+                | "YES"
+                | "no"
+                | "No"
+                | "NO"
+                | "on"
+                | "On"
+                | "ON"
+                | "off"
+                | "Off"
+                | "OFF"
+        )
+}
+
+/// Check if a plain scalar is null.
+pub(crate) fn is_null(value: &str) -> bool {
+    matches!(value, "" | "~" | "null" | "Null" | "NULL")
+}
+
+/// Resolve a plain scalar as a boolean.
+pub(crate) fn parse_bool(value: &str) -> Option<bool> {
+    match value {
+        "true" | "True" | "TRUE" => Some(true),
+        "false" | "False" | "FALSE" => Some(false),
+        _ => None,
+    }
+}
+
+/// Resolve a plain scalar as an integer. Decimal, hexadecimal (`0x`),
+/// octal (`0o`) and binary (`0b`) integers with an optional sign are
+/// accepted.
+pub(crate) fn parse_int(value: &str) -> Option<i128> {
+    let (negative, digits) = match value.as_bytes().first()? {
+        b'-' => (true, &value[1..]),
+        b'+' => (false, &value[1..]),
+        _ => (false, value),
+    };
+    let (radix, digits) = match digits.get(..2) {
+        Some("0x") | Some("0X") => (16, &digits[2..]),
+        Some("0o") => (8, &digits[2..]),
+        Some("0b") => (2, &digits[2..]),
+        _ => (10, digits),
+    };
+    if digits.is_empty() || !digits.bytes().all(|b| (b as char).is_digit(radix)) {
+        return None;
+    }
+    let value = i128::from_str_radix(digits, radix).ok()?;
+    Some(if negative { -value } else { value })
+}
+
+/// Resolve a plain scalar as a float. Only scalars with a decimal point or
+/// an exponent are floats; integers are left to [`parse_int`].
+pub(crate) fn parse_float(value: &str) -> Option<f64> {
+    let unsigned = value
+        .strip_prefix(|c| c == '-' || c == '+')
+        .unwrap_or(value);
+    match unsigned {
+        ".inf" | ".Inf" | ".INF" => {
+            return Some(if value.starts_with('-') {
+                f64::NEG_INFINITY
+            } else {
+                f64::INFINITY
+            })
+        }
+        ".nan" | ".NaN" | ".NAN" if unsigned.len() == value.len() => return Some(f64::NAN),
+        _ => {}
+    }
+    let bytes = unsigned.as_bytes();
+    let mantissa_end = bytes
+        .iter()
+        .position(|b| *b == b'e' || *b == b'E')
+        .unwrap_or(bytes.len());
+    let (mantissa, exp) = bytes.split_at(mantissa_end);
+    let digits = mantissa.iter().filter(|b| b.is_ascii_digit()).count();
+    let dots = mantissa.iter().filter(|b| **b == b'.').count();
+    if digits == 0 || dots > 1 || digits + dots != mantissa.len() {
+        return None;
+    }
+    if !exp.is_empty() {
+        let exp = &exp[1..];
+        let exp = exp
+            .strip_prefix(b"-")
+            .or_else(|| exp.strip_prefix(b"+"))
+            .unwrap_or(exp);
+        if exp.is_empty() || !exp.iter().all(|b| b.is_ascii_digit()) {
+            return None;
+        }
+    } else if dots == 0 {
+        return None;
+    }
+    value.parse().ok()
+}
+
+const BASE64: &[u8; 64] = b"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Append binary data in standard, padded base64.
+pub(crate) fn write_base64(out: &mut String, data: &[u8]) {
+    out.reserve((data.len() + 2) / 3 * 4);
+    for chunk in data.chunks(3) {
+        let bits = match *chunk {
+            [a, b, c] => (a as u32) << 16 | (b as u32) << 8 | c as u32,
+            [a, b] => (a as u32) << 16 | (b as u32) << 8,
+            [a] => (a as u32) << 16,
+            _ => unreachable!(),
+        };
+        for i in 0..4 {
+            if i <= chunk.len() {
+                out.push(BASE64[(bits >> (18 - 6 * i) & 0x3f) as usize] as char);
+            } else {
+                out.push('=');
+            }
+        }
+    }
+}
+
+/// Decode standard base64, ignoring whitespace.
+pub(crate) fn parse_base64(text: &str) -> Option<Vec<u8>> {
+    let mut out = Vec::with_capacity(text.len() / 4 * 3);
+    let (mut bits, mut count) = (0u32, 0);
+    let mut padding = 0;
+    for b in text.bytes().filter(|b| !b.is_ascii_whitespace()) {
+        let value = match b {
+            b'A'..=b'Z' => b - b'A',
+            b'a'..=b'z' => b - b'a' + 26,
+            b'0'..=b'9' => b - b'0' + 52,
+            b'+' => 62,
+            b'/' => 63,
+            b'=' => {
+                padding += 1;
+                0
+            }
+            _ => return None,
+        };
+        if padding > 0 && b != b'=' {
+            return None;
+        }
+        bits = bits << 6 | value as u32;
+        count += 1;
+        if count == 4 {
+            out.extend_from_slice(&[(bits >> 16) as u8, (bits >> 8) as u8, bits as u8]);
+            bits = 0;
+            count = 0;
+        }
+    }
+    if count != 0 || padding > 2 {
+        return None;
+    }
+    out.truncate(out.len() - padding);
+    Some(out)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn scalars() {
+        let mut out = String::new();
+        for value in [1.0f32, 0.35, -1.5e-7, 3.4e38, 100.0] {
+            out.clear();
+            write_float(&mut out, value);
+            assert_eq!(parse_float(&out).unwrap() as f32, value, "{}", out);
+        }
+        out.clear();
+        write_float(&mut out, 1e20f64);
+        assert_eq!(out, "1.0e+20");
+        for &value in &[
+            "0", "true", "null", "", "a: b", "[x]", "- x", "'q'", "1.5", "yes", "x\n",
+        ] {
+            out.clear();
+            write_str(&mut out, value);
+            assert_ne!(out, value);
+        }
+        for &value in &[
+            "Enemy_Bokoblin",
+            "Half-Lambert",
+            "オフ",
+            "a:b",
+            "0x",
+            "1.2.3",
+        ] {
+            out.clear();
+            write_str(&mut out, value);
+            assert_eq!(out, value);
+        }
+        for &(value, written) in &[
+            ("Null", "Null"),
+            ("0.3", "0.3"),
+            ("", "''"),
+            ("a: b", "'a: b'"),
+        ] {
+            out.clear();
+            write_tagged_str(&mut out, value);
+            assert_eq!(out, written);
+        }
+        assert_eq!(parse_int("0x1f"), Some(31));
+        assert_eq!(parse_int("-12"), Some(-12));
+        assert_eq!(parse_int("1.0"), None);
+        assert_eq!(parse_float("1"), None);
+        assert_eq!(parse_float("-.inf"), Some(f64::NEG_INFINITY));
+        assert_eq!(parse_float("inf"), None);
+        for data in [&b""[..], b"a", b"ab", b"abc", b"abcd"] {
+            out.clear();
+            write_base64(&mut out, data);
+            assert_eq!(parse_base64(&out).unwrap(), data);
+        }
+        assert_eq!(parse_base64("aGVsbG8=").unwrap(), b"hello");
+    }
+}
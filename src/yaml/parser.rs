@@ -0,0 +1,733 @@
+//! A single-pass parser for the subset of YAML used by the text formats.
+//!
+//! The parser walks the text once and reports each node to a [`Handler`] as
+//! it is read, so no intermediate document tree is built. Supported are
+//! block mappings and sequences (including sequences that are not indented
+//! relative to their parent key), flow mappings and sequences that may span
+//! several lines, plain, single-quoted and double-quoted scalars with line
+//! folding, local and secondary tags, comments and a leading document
+//! marker. Anchors, aliases, complex keys and block scalars are rejected.
+use std::{borrow::Cow, fmt};
+
+/// A scalar value. Plain (unquoted) scalars may resolve to other types;
+/// quoted ones are always strings.
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) struct Scalar<'a> {
+    pub(crate) value: Cow<'a, str>,
+    pub(crate) plain: bool,
+}
+
+/// Receives the nodes of a document in order. Every `begin_seq` and
+/// `begin_map` is matched by an `end`, and inside a mapping each value is
+/// preceded by a `key`.
+pub(crate) trait Handler {
+    fn scalar(&mut self, tag: Option<&str>, value: Scalar<'_>) -> Result<()>;
+    fn key(&mut self, key: Scalar<'_>) -> Result<()>;
+    fn begin_seq(&mut self, tag: Option<&str>) -> Result<()>;
+    fn begin_map(&mut self, tag: Option<&str>) -> Result<()>;
+    fn end(&mut self) -> Result<()>;
+}
+
+/// A parse error with the line on which it occurred.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub(crate) struct Error {
+    line: usize,
+    message: String,
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "line {}: {}", self.line, self.message)
+    }
+}
+
+type Result<T> = std::result::Result<T, String>;
+
+/// Parse a document, reporting its nodes to `handler`. An empty document
+/// reports nothing.
+pub(crate) fn parse<H: Handler>(text: &str, handler: &mut H) -> std::result::Result<(), Error> {
+    let mut parser = Parser {
+        text: text.strip_prefix('\u{feff}').unwrap_or(text),
+        pos: 0,
+        line_start: 0,
+    };
+    parser.document(handler).map_err(|message| Error {
+        line: parser.text[..parser.pos.min(parser.text.len())]
+            .bytes()
+            .filter(|b| *b == b'\n')
+            .count()
+            + 1,
+        message,
+    })
+}
+
+struct Parser<'a> {
+    text: &'a str,
+    pos: usize,
+    line_start: usize,
+}
+
+#[inline]
+fn is_blank(b: u8) -> bool {
+    b == b' ' || b == b'\t'
+}
+
+#[inline]
+fn is_break(b: u8) -> bool {
+    b == b'\n' || b == b'\r'
+}
+
+#[inline]
+fn is_flow_indicator(b: u8) -> bool {
+    matches!(b, b',' | b'[' | b']' | b'{' | b'}')
+}
+
+impl<'a> Parser<'a> {
+    #[inline]
+    fn peek(&self) -> Option<u8> {
+        self.text.as_bytes().get(self.pos).copied()
+    }
+
+    #[inline]
+    fn peek_at(&self, offset: usize) -> Option<u8> {
+        self.text.as_bytes().get(self.pos + offset).copied()
+    }
+
+    #[inline]
+    fn column(&self) -> usize {
+        self.pos - self.line_start
+    }
+
+    /// Whether the next character ends the current token: whitespace, a line
+    /// break or the end of the input.
+    #[inline]
+    fn is_separated_at(&self, offset: usize) -> bool {
+        self.peek_at(offset)
+            .map_or(true, |b| is_blank(b) || is_break(b))
+    }
+
+    fn skip_blanks(&mut self) {
+        while self.peek().map_or(false, is_blank) {
+            self.pos += 1;
+        }
+    }
+
+    /// Skip one line break, if there is one.
+    fn skip_break(&mut self) -> bool {
+        match self.peek() {
+            Some(b'\r') if self.peek_at(1) == Some(b'\n') => self.pos += 2,
+            Some(b'\r') | Some(b'\n') => self.pos += 1,
+            _ => return false,
+        }
+        self.line_start = self.pos;
+        true
+    }
+
+    fn skip_comment(&mut self) {
+        if self.peek() == Some(b'#') {
+            while self.peek().map_or(false, |b| !is_break(b)) {
+                self.pos += 1;
+            }
+        }
+    }
+
+    /// Finish the current line: only blanks and a comment may follow.
+    fn end_line(&mut self) -> Result<()> {
+        self.skip_blanks();
+        self.skip_comment();
+        if self.skip_break() || self.peek().is_none() {
+            Ok(())
+        } else {
+            Err("unexpected content after value".into())
+        }
+    }
+
+    /// Move to the first character of the next line with content, skipping
+    /// empty and comment-only lines, and return its indentation. Does
+    /// nothing if already positioned at content. Returns `None` at the end
+    /// of the input or of the document.
+    fn next_line(&mut self) -> Option<usize> {
+        loop {
+            self.skip_blanks();
+            self.skip_comment();
+            if !self.skip_break() {
+                break;
+            }
+        }
+        if self.peek().is_none() || self.at_document_marker() {
+            None
+        } else {
+            Some(self.column())
+        }
+    }
+
+    /// Whether the parser is at a `---` or `...` marker at the start of a line.
+    fn at_document_marker(&self) -> bool {
+        let rest = &self.text[self.pos..];
+        self.column() == 0
+            && (rest.starts_with("---") || rest.starts_with("..."))
+            && self.is_separated_at(3)
+    }
+
+    fn document<H: Handler>(&mut self, h: &mut H) -> Result<()> {
+        // Directives and the document start marker.
+        loop {
+            match self.next_line() {
+                Some(0) if self.peek() == Some(b'%') => {
+                    while self.peek().map_or(false, |b| !is_break(b)) {
+                        self.pos += 1;
+                    }
+                }
+                _ => break,
+            }
+        }
+        if self.at_document_marker() && self.text[self.pos..].starts_with("---") {
+            self.pos += 3;
+        } else if self.next_line().is_none() {
+            return Ok(());
+        }
+        self.block_node(-1, true, h)?;
+        match self.next_line() {
+            None => Ok(()),
+            Some(_) => Err("unexpected content after document".into()),
+        }
+    }
+
+    fn tag(&mut self) -> Result<Option<&'a str>> {
+        if self.peek() != Some(b'!') {
+            return Ok(None);
+        }
+        let start = self.pos;
+        while self.peek().map_or(false, |b| {
+            !is_blank(b) && !is_break(b) && !is_flow_indicator(b)
+        }) {
+            self.pos += 1;
+        }
+        let tag = &self.text[start..self.pos];
+        self.skip_blanks();
+        Ok(Some(tag))
+    }
+
+    fn check_unsupported(&self) -> Result<()> {
+        match self.peek() {
+            Some(b'&') | Some(b'*') => Err("anchors and aliases are not supported".into()),
+            Some(b'|') | Some(b'>') => Err("block scalars are not supported".into()),
+            Some(b'?') if self.is_separated_at(1) => Err("complex keys are not supported".into()),
+            _ => Ok(()),
+        }
+    }
+
+    /// Whether the parser is at a block sequence entry indicator.
+    #[inline]
+    fn at_seq_entry(&self) -> bool {
+        self.peek() == Some(b'-') && self.is_separated_at(1)
+    }
+
+    /// Whether the parser is at a mapping value indicator.
+    #[inline]
+    fn at_value_indicator(&self) -> bool {
+        self.peek() == Some(b':') && self.is_separated_at(1)
+    }
+
+    /// Parse a node in block context. The parser is positioned after the
+    /// indicator that introduced it (a key's `:`, a `- ` or the start of
+    /// the document), and the node belongs to a parent at `parent` indent.
+    /// Mapping values may be sequences at the same indent as their key,
+    /// which `compact_seq` allows.
+    fn block_node<H: Handler>(
+        &mut self,
+        parent: isize,
+        compact_seq: bool,
+        h: &mut H,
+    ) -> Result<()> {
+        self.skip_blanks();
+        let tag = self.tag()?;
+        self.check_unsupported()?;
+        match self.peek() {
+            None | Some(b'#') | Some(b'\n') | Some(b'\r') => {
+                self.end_line()?;
+                let line = self.pos;
+                let line_start = self.line_start;
+                match self.next_line() {
+                    Some(indent)
+                        if self.at_seq_entry()
+                            && (indent as isize > parent
+                                || (compact_seq && indent as isize == parent.max(0))) =>
+                    {
+                        self.block_seq(indent, tag, h)
+                    }
+                    Some(indent) if indent as isize > parent => match self.peek() {
+                        Some(b'[') | Some(b'{') => {
+                            self.flow_node(tag, h)?;
+                            self.end_line()
+                        }
+                        _ => self.block_scalar_or_map(parent, tag, h),
+                    },
+                    _ => {
+                        self.pos = line;
+                        self.line_start = line_start;
+                        h.scalar(
+                            tag,
+                            Scalar {
+                                value: Cow::Borrowed(""),
+                                plain: true,
+                            },
+                        )
+                    }
+                }
+            }
+            Some(b'[') | Some(b'{') => {
+                self.flow_node(tag, h)?;
+                self.end_line()
+            }
+            _ if self.at_seq_entry() => {
+                let indent = self.column();
+                self.block_seq(indent, tag, h)
+            }
+            _ => self.block_scalar_or_map(parent, tag, h),
+        }
+    }
+
+    /// Parse a scalar in block context. If it turns out to be a mapping key,
+    /// parse the block mapping it starts instead.
+    fn block_scalar_or_map<H: Handler>(
+        &mut self,
+        parent: isize,
+        tag: Option<&str>,
+        h: &mut H,
+    ) -> Result<()> {
+        self.check_unsupported()?;
+        let indent = self.column();
+        let scalar = match self.peek() {
+            Some(b'\'') | Some(b'"') => self.quoted()?,
+            _ => self.plain(false)?,
+        };
+        self.skip_blanks();
+        if self.at_value_indicator() {
+            if indent as isize <= parent {
+                return Err("bad indentation of a mapping entry".into());
+            }
+            return self.block_map(indent, tag, Some(scalar), h);
+        }
+        let scalar = if scalar.plain {
+            self.plain_continuation(scalar, parent)?
+        } else {
+            scalar
+        };
+        h.scalar(tag, scalar)?;
+        self.end_line()
+    }
+
+    /// Append any continuation lines of a multi-line plain scalar. They must
+    /// be indented more than the parent node.
+    fn plain_continuation(&mut self, first: Scalar<'a>, parent: isize) -> Result<Scalar<'a>> {
+        let mut value = first.value;
+        loop {
+            let (pos, line_start) = (self.pos, self.line_start);
+            self.skip_blanks();
+            if !self.skip_break() {
+                self.pos = pos;
+                break;
+            }
+            let mut breaks = 1;
+            loop {
+                self.skip_blanks();
+                if !self.skip_break() {
+                    break;
+                }
+                breaks += 1;
+            }
+            if self.peek().is_none()
+                || self.column() as isize <= parent
+                || self.peek() == Some(b'#')
+                || self.at_document_marker()
+            {
+                self.pos = pos;
+                self.line_start = line_start;
+                break;
+            }
+            let next = self.plain(false)?;
+            self.skip_blanks();
+            if self.at_value_indicator() {
+                return Err("mapping keys are not allowed here".into());
+            }
+            let value = value.to_mut();
+            if breaks == 1 {
+                value.push(' ');
+            } else {
+                (1..breaks).for_each(|_| value.push('\n'));
+            }
+            value.push_str(&next.value);
+        }
+        Ok(Scalar { value, plain: true })
+    }
+
+    fn block_seq<H: Handler>(&mut self, indent: usize, tag: Option<&str>, h: &mut H) -> Result<()> {
+        h.begin_seq(tag)?;
+        loop {
+            self.pos += 1;
+            self.block_node(indent as isize, false, h)?;
+            match self.next_line() {
+                Some(i) if i == indent && self.at_seq_entry() => continue,
+                Some(i) if i > indent => return Err("bad indentation of a sequence entry".into()),
+                _ => break,
+            }
+        }
+        h.end()
+    }
+
+    fn block_map<H: Handler>(
+        &mut self,
+        indent: usize,
+        tag: Option<&str>,
+        first: Option<Scalar<'_>>,
+        h: &mut H,
+    ) -> Result<()> {
+        h.begin_map(tag)?;
+        if let Some(key) = first {
+            h.key(key)?;
+            self.pos += 1;
+            self.block_node(indent as isize, true, h)?;
+        }
+        loop {
+            match self.next_line() {
+                Some(i) if i == indent && !self.at_seq_entry() => {}
+                Some(i) if i > indent => return Err("bad indentation of a mapping entry".into()),
+                _ => break,
+            }
+            self.check_unsupported()?;
+            let key = match self.peek() {
+                Some(b'\'') | Some(b'"') => self.quoted()?,
+                _ => self.plain(false)?,
+            };
+            self.skip_blanks();
+            if !self.at_value_indicator() {
+                return Err("expected ':' after mapping key".into());
+            }
+            h.key(key)?;
+            self.pos += 1;
+            self.block_node(indent as isize, true, h)?;
+        }
+        h.end()
+    }
+
+    /// Skip whitespace, line breaks and comments inside a flow collection.
+    fn skip_flow_space(&mut self) {
+        loop {
+            self.skip_blanks();
+            self.skip_comment();
+            if !self.skip_break() {
+                break;
+            }
+        }
+    }
+
+    fn flow_node<H: Handler>(&mut self, tag: Option<&str>, h: &mut H) -> Result<()> {
+        self.skip_flow_space();
+        let tag = match tag {
+            Some(tag) => Some(tag),
+            None => {
+                let tag = self.tag()?;
+                self.skip_flow_space();
+                tag
+            }
+        };
+        self.check_unsupported()?;
+        match self.peek() {
+            Some(b'[') => {
+                self.pos += 1;
+                h.begin_seq(tag)?;
+                self.flow_entries(b']', |p, h| p.flow_node(None, h), h)?;
+                h.end()
+            }
+            Some(b'{') => {
+                self.pos += 1;
+                h.begin_map(tag)?;
+                self.flow_entries(
+                    b'}',
+                    |p, h| {
+                        let key = p.flow_scalar()?;
+                        p.skip_flow_space();
+                        if p.peek() != Some(b':') {
+                            return Err("expected ':' after mapping key".into());
+                        }
+                        p.pos += 1;
+                        h.key(key)?;
+                        p.flow_node(None, h)
+                    },
+                    h,
+                )?;
+                h.end()
+            }
+            _ => {
+                let scalar = self.flow_scalar()?;
+                h.scalar(tag, scalar)
+            }
+        }
+    }
+
+    fn flow_entries<H: Handler>(
+        &mut self,
+        close: u8,
+        mut entry: impl FnMut(&mut Self, &mut H) -> Result<()>,
+        h: &mut H,
+    ) -> Result<()> {
+        loop {
+            self.skip_flow_space();
+            if self.peek() == Some(close) {
+                self.pos += 1;
+                return Ok(());
+            }
+            entry(self, h)?;
+            self.skip_flow_space();
+            match self.peek() {
+                Some(b',') => self.pos += 1,
+                Some(b) if b == close => {
+                    self.pos += 1;
+                    return Ok(());
+                }
+                _ => return Err("expected ',' or end of flow collection".into()),
+            }
+        }
+    }
+
+    fn flow_scalar(&mut self) -> Result<Scalar<'a>> {
+        match self.peek() {
+            Some(b'\'') | Some(b'"') => self.quoted(),
+            Some(b) if is_flow_indicator(b) => Ok(Scalar {
+                value: Cow::Borrowed(""),
+                plain: true,
+            }),
+            _ => self.plain(true),
+        }
+    }
+
+    /// Read a single-line plain scalar. Trailing blanks are not included.
+    fn plain(&mut self, flow: bool) -> Result<Scalar<'a>> {
+        let start = self.pos;
+        let mut end = start;
+        while let Some(b) = self.peek() {
+            if is_break(b)
+                || (b == b':'
+                    && (self.is_separated_at(1)
+                        || (flow && self.peek_at(1).map_or(false, is_flow_indicator))))
+                || (flow && is_flow_indicator(b))
+                || (b == b'#' && self.pos > start && self.text.as_bytes()[self.pos - 1] == b' ')
+            {
+                break;
+            }
+            self.pos += 1;
+            if !is_blank(b) {
+                end = self.pos;
+            }
+        }
+        self.pos = end;
+        Ok(Scalar {
+            value: Cow::Borrowed(&self.text[start..end]),
+            plain: true,
+        })
+    }
+
+    /// Read a single- or double-quoted scalar, which may span several lines.
+    fn quoted(&mut self) -> Result<Scalar<'a>> {
+        let quote = self.peek().unwrap();
+        self.pos += 1;
+        let start = self.pos;
+        // Fast path: no escapes or line breaks.
+        while let Some(b) = self.peek() {
+            if b == quote {
+                if quote == b'\'' && self.peek_at(1) == Some(b'\'') {
+                    break;
+                }
+                let value = &self.text[start..self.pos];
+                self.pos += 1;
+                return Ok(Scalar {
+                    value: Cow::Borrowed(value),
+                    plain: false,
+                });
+            }
+            if is_break(b) || (quote == b'"' && b == b'\\') {
+                break;
+            }
+            self.pos += 1;
+        }
+        let mut value = String::from(&self.text[start..self.pos]);
+        loop {
+            let b = match self.peek() {
+                Some(b) => b,
+                None => return Err("unterminated quoted scalar".into()),
+            };
+            match b {
+                b'\'' if quote == b'\'' => {
+                    if self.peek_at(1) == Some(b'\'') {
+                        value.push('\'');
+                        self.pos += 2;
+                    } else {
+                        self.pos += 1;
+                        break;
+                    }
+                }
+                b'"' if quote == b'"' => {
+                    self.pos += 1;
+                    break;
+                }
+                b'\\' if quote == b'"' => {
+                    self.pos += 1;
+                    if self.peek().map_or(false, is_break) {
+                        self.skip_break();
+                        self.skip_blanks();
+                    } else {
+                        self.escape(&mut value)?;
+                    }
+                }
+                b'\n' | b'\r' => {
+                    while value.ends_with(|c| c == ' ' || c == '\t') {
+                        value.pop();
+                    }
+                    let mut breaks = 0;
+                    loop {
+                        self.skip_blanks();
+                        if !self.skip_break() {
+                            break;
+                        }
+                        breaks += 1;
+                    }
+                    if breaks == 1 {
+                        value.push(' ');
+                    } else {
+                        (1..breaks).for_each(|_| value.push('\n'));
+                    }
+                }
+                _ => {
+                    let c = self.text[self.pos..].chars().next().unwrap();
+                    value.push(c);
+                    self.pos += c.len_utf8();
+                }
+            }
+        }
+        Ok(Scalar {
+            value: Cow::Owned(value),
+            plain: false,
+        })
+    }
+
+    fn escape(&mut self, value: &mut String) -> Result<()> {
+        let b = self.peek().ok_or("unterminated escape sequence")?;
+        self.pos += 1;
+        let c = match b {
+            b'0' => '\0',
+            b'a' => '\x07',
+            b'b' => '\x08',
+            b't' | b'\t' => '\t',
+            b'n' => '\n',
+            b'v' => '\x0b',
+            b'f' => '\x0c',
+            b'r' => '\r',
+            b'e' => '\x1b',
+            b' ' => ' ',
+            b'"' => '"',
+            b'/' => '/',
+            b'\\' => '\\',
+            b'N' => '\u{85}',
+            b'_' => '\u{a0}',
+            b'L' => '\u{2028}',
+            b'P' => '\u{2029}',
+            b'x' | b'u' | b'U' => {
+                let len = match b {
+                    b'x' => 2,
+                    b'u' => 4,
+                    _ => 8,
+                };
+                let digits = self
+                    .text
+                    .get(self.pos..self.pos + len)
+                    .ok_or("truncated escape sequence")?;
+                self.pos += len;
+                u32::from_str_radix(digits, 16)
+                    .ok()
+                    .and_then(char::from_u32)
+                    .ok_or("invalid escape sequence")?
+            }
+            _ => return Err("invalid escape sequence".into()),
+        };
+        value.push(c);
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{parse, Handler, Result, Scalar};
+
+    /// Records events as a compact string.
+    #[derive(Default)]
+    struct Events(String);
+
+    impl Handler for Events {
+        fn scalar(&mut self, tag: Option<&str>, value: Scalar<'_>) -> Result<()> {
+            if let Some(tag) = tag {
+                self.0 += tag;
+                self.0 += " ";
+            }
+            self.0 += if value.plain { "=" } else { "'" };
+            self.0 += &value.value;
+            self.0 += ";";
+            Ok(())
+        }
+
+        fn key(&mut self, key: Scalar<'_>) -> Result<()> {
+            self.0 += &key.value;
+            self.0 += ":";
+            Ok(())
+        }
+
+        fn begin_seq(&mut self, tag: Option<&str>) -> Result<()> {
+            self.0 += tag.unwrap_or("");
+            self.0 += "[";
+            Ok(())
+        }
+
+        fn begin_map(&mut self, tag: Option<&str>) -> Result<()> {
+            self.0 += tag.unwrap_or("");
+            self.0 += "{";
+            Ok(())
+        }
+
+        fn end(&mut self) -> Result<()> {
+            self.0 += "}";
+            Ok(())
+        }
+    }
+
+    fn events(text: &str) -> String {
+        let mut events = Events::default();
+        parse(text, &mut events).unwrap();
+        events.0
+    }
+
+    #[test]
+    fn parse_yaml() {
+        assert_eq!(
+            events("!io\nversion: 0\nobj: !obj\n  a: !vec2 [1.0,\n    2.0]\n  b: ''\n"),
+            "!io{version:=0;obj:!obj{a:!vec2[=1.0;=2.0;}b:';}}"
+        );
+        assert_eq!(
+            events("# comment\n---\nActors:\n- name: Bokoblin  # trailing\n  data: {x: 1, y: [a, b]}\n- - 1\n  - 2\nEmpty:\nLast: \"a\\tb\"\n"),
+            "{Actors:[{name:=Bokoblin;data:{x:=1;y:[=a;=b;}}}[=1;=2;}}Empty:=;Last:'a\tb;}"
+        );
+        assert_eq!(
+            events("- 'it''s\n  folded'\n- plain\n  continued\n- !u 0x10\n- []\n- {}\n"),
+            "['it's folded;=plain continued;!u =0x10;[}{}}"
+        );
+        assert_eq!(
+            events("'0': !list\n  objects: {}\n"),
+            "{0:!list{objects:{}}}"
+        );
+        assert_eq!(events(""), "");
+        let mut events = Events::default();
+        let err = parse("a: 1\n  b: 2\n", &mut events).unwrap_err();
+        assert_eq!(err.line, 2);
+        assert!(parse("a: &x 1\n", &mut Events::default()).is_err());
+        assert!(parse("a: [1, 2\n", &mut Events::default()).is_err());
+    }
+}
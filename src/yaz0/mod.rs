@@ -8,32 +8,98 @@
 //! At the default compression level, file sizes are typically within 1% of Nintendo’s.
 //!
 //! For detailed benchmarks, see the results files in the [test directory of the syaz0 project](https://github.com/zeldamods/syaz0/tree/master/test).
+//!
+//! Large inputs can be compressed on all cores with [`compress_parallel`], which
+//! splits the data into chunks and stitches the results into one stream.
+//! [`Yaz0Writer`] and [`Yaz0Reader`] compress and decompress incrementally
+//! through `io::Write` and `io::Read` without holding the whole data in memory.
 use std::{borrow::Cow, path::Path};
 
-use crate::ffi;
+use crate::{
+    ffi,
+    stats::{self, Format, Phase},
+};
 use thiserror::Error;
 use unicase::UniCase;
 
+mod parallel;
+mod stream;
+mod tokens;
+pub use parallel::{compress_parallel, compress_parallel_with_chunk_size, DEFAULT_CHUNK_SIZE};
+pub use stream::{Yaz0Reader, Yaz0Writer};
+
 #[derive(Error, Debug)]
 pub enum Yaz0Error {
     #[error("Invalid yaz0 magic, expected \"Yaz0\", found {0}")]
     MagicError(String),
     #[error("Invalid compression level, expected 6-9, found {0}")]
     InvalidLevelError(u8),
+    #[error("Output buffer too small, expected at least {expected} bytes, found {found}")]
+    BufferSizeError { expected: usize, found: usize },
     #[error("oead could not compress or decompress")]
     OeadError(#[from] cxx::Exception),
 }
 
 pub type Result<T> = std::result::Result<T, Yaz0Error>;
 
-/// Decompress yaz0 compressed data.
-pub fn decompress<B: AsRef<[u8]>>(data: B) -> Result<Vec<u8>> {
-    if &data.as_ref()[0..4] != b"Yaz0" {
+/// Compress data with oead, recording the call for the instrumentation.
+fn oead_compress(data: &[u8], level: u8) -> cxx::UniquePtr<cxx::CxxVector<u8>> {
+    let _span = stats::span(Format::Yaz0, Phase::Compress, data.len());
+    ffi::compress(data, level)
+}
+
+/// Decompress data with oead into a buffer of exactly the decompressed size,
+/// recording the call for the instrumentation.
+fn oead_decompress(data: &[u8], dst: &mut [u8]) -> Result<()> {
+    let _span = stats::span(Format::Yaz0, Phase::Decompress, dst.len());
+    Ok(ffi::decompress_into(data, dst)?)
+}
+
+/// Get the decompressed size of yaz0 compressed data from its header.
+pub fn decompressed_size<B: AsRef<[u8]>>(data: B) -> Result<usize> {
+    let data = data.as_ref();
+    if data.len() < 0x10 || &data[0..4] != b"Yaz0" {
         return Err(Yaz0Error::MagicError(
-            String::from_utf8_lossy(&data.as_ref()[0..4]).to_string(),
+            String::from_utf8_lossy(&data[0..data.len().min(4)]).to_string(),
         ));
     }
-    Ok(ffi::decompress(data.as_ref())?)
+    Ok(u32::from_be_bytes([data[4], data[5], data[6], data[7]]) as usize)
+}
+
+/// Decompress yaz0 compressed data.
+pub fn decompress<B: AsRef<[u8]>>(data: B) -> Result<Vec<u8>> {
+    let data = data.as_ref();
+    let mut buf = vec![0u8; decompressed_size(data)?];
+    oead_decompress(data, &mut buf)?;
+    Ok(buf)
+}
+
+/// Decompress yaz0 compressed data into a caller-provided buffer, which must
+/// be at least [`decompressed_size`] bytes long. Returns the number of bytes
+/// written to the start of the buffer.
+pub fn decompress_into<B: AsRef<[u8]>>(data: B, dst: &mut [u8]) -> Result<usize> {
+    let data = data.as_ref();
+    let size = decompressed_size(data)?;
+    if dst.len() < size {
+        return Err(Yaz0Error::BufferSizeError {
+            expected: size,
+            found: dst.len(),
+        });
+    }
+    oead_decompress(data, &mut dst[..size])?;
+    Ok(size)
+}
+
+/// Decompress yaz0 compressed data into a reusable buffer, replacing its
+/// contents. The existing allocation is kept if it is large enough, so
+/// decompressing many files through one buffer only allocates for the largest.
+pub fn decompress_to_vec<B: AsRef<[u8]>>(data: B, buf: &mut Vec<u8>) -> Result<()> {
+    let data = data.as_ref();
+    let size = decompressed_size(data)?;
+    buf.clear();
+    buf.resize(size, 0);
+    oead_decompress(data, buf)?;
+    Ok(())
 }
 
 /// Check if data is yaz0 compressed and decompress if needed.
@@ -49,7 +115,7 @@ pub fn decompress_if<'a, B: Into<Cow<'a, [u8]>>>(data: B) -> Result<Cow<'a, [u8]
 
 /// Compress data with default compression level (7).
 pub fn compress<B: AsRef<[u8]>>(data: B) -> Vec<u8> {
-    ffi::compress(data.as_ref(), 7)
+    oead_compress(data.as_ref(), 7).as_slice().to_vec()
 }
 
 /// Compress data with specified compression level. Available levels are 6-9, from
@@ -58,23 +124,29 @@ pub fn compress_with_level<B: AsRef<[u8]>>(data: B, level: u8) -> Result<Vec<u8>
     if !(6..=9).contains(&level) {
         return Err(Yaz0Error::InvalidLevelError(level));
     }
-    Ok(ffi::compress(data.as_ref(), level))
+    Ok(oead_compress(data.as_ref(), level).as_slice().to_vec())
 }
 
 /// Compress data conditionally, if an associated path has a yaz0-associated
 /// file extension (starts with 's', but does not equal 'sarc').
 #[inline]
 pub fn compress_if<'a, B: Into<Cow<'a, [u8]>>, P: AsRef<Path>>(data: B, path: P) -> Cow<'a, [u8]> {
-    if let Some(ext) = path.as_ref().extension() {
-        if let Some(ext) = ext.to_str() {
-            if ext.starts_with('s') && UniCase::new("sarc") != UniCase::new(ext) {
-                return compress(data.into()).into();
-            }
-        }
+    if has_compressed_extension(path) {
+        return compress(data.into()).into();
     }
     data.into()
 }
 
+/// Check if a path has a yaz0-associated file extension (starts with 's', but
+/// does not equal 'sarc').
+#[inline]
+pub(crate) fn has_compressed_extension<P: AsRef<Path>>(path: P) -> bool {
+    match path.as_ref().extension().and_then(|ext| ext.to_str()) {
+        Some(ext) => ext.starts_with('s') && UniCase::new("sarc") != UniCase::new(ext),
+        None => false,
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -87,6 +159,21 @@ mod tests {
         assert_eq!(&contents, &decomp);
     }
 
+    #[test]
+    fn decompress_into_test() {
+        let data = std::fs::read("test/Cargo.stoml").unwrap();
+        let decomp = std::fs::read("test/Cargo.toml").unwrap();
+        assert_eq!(decompressed_size(&data).unwrap(), decomp.len());
+        let mut buf = vec![0xFF; decomp.len() + 16];
+        assert_eq!(decompress_into(&data, &mut buf).unwrap(), decomp.len());
+        assert_eq!(&buf[..decomp.len()], &decomp[..]);
+        assert!(decompress_into(&data, &mut buf[..decomp.len() - 1]).is_err());
+        let mut buf = Vec::new();
+        decompress_to_vec(&data, &mut buf).unwrap();
+        decompress_to_vec(&data, &mut buf).unwrap();
+        assert_eq!(buf, decomp);
+    }
+
     #[test]
     fn compress_test() {
         let data = std::fs::read("test/Cargo.toml").unwrap();
@@ -95,6 +182,105 @@ mod tests {
         assert_eq!(comp.len(), meta.len() as usize);
     }
 
+    #[test]
+    fn compress_parallel_test() {
+        let data = std::fs::read("test/Cargo.toml").unwrap().repeat(64);
+        let comp = compress_parallel_with_chunk_size(&data, 7, 0x1000).unwrap();
+        assert_eq!(decompress(&comp).unwrap(), data);
+        assert!(comp.len() < data.len() / 8);
+        assert_eq!(
+            compress_parallel(&data, 7).unwrap(),
+            compress_with_level(&data, 7).unwrap()
+        );
+    }
+
+    #[test]
+    fn stream_test() {
+        use std::io::{Read, Write};
+        let data = std::fs::read("test/Cargo.toml").unwrap().repeat(2048);
+        let mut writer = Yaz0Writer::new(Vec::new(), data.len()).unwrap();
+        for piece in data.chunks(10_000) {
+            writer.write_all(piece).unwrap();
+        }
+        let comp = writer.finish().unwrap();
+        assert_eq!(decompress(&comp).unwrap(), data);
+        let mut reader = Yaz0Reader::new(&comp[..]).unwrap();
+        assert_eq!(reader.decompressed_size(), data.len());
+        let mut out = Vec::new();
+        let mut buf = [0u8; 777];
+        loop {
+            match reader.read(&mut buf).unwrap() {
+                0 => break,
+                n => out.extend_from_slice(&buf[..n]),
+            }
+        }
+        assert_eq!(out, data);
+    }
+
+    /// Yields one byte at a time and, after the header, fails with `error`
+    /// before every other byte.
+    struct FlakyReader<'a> {
+        data: &'a [u8],
+        offset: usize,
+        error: std::io::ErrorKind,
+        fail: bool,
+    }
+
+    impl std::io::Read for FlakyReader<'_> {
+        fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+            if self.offset >= tokens::HEADER_SIZE && self.offset < self.data.len() {
+                self.fail = !self.fail;
+                if self.fail {
+                    return Err(self.error.into());
+                }
+            }
+            let len = buf.len().min(self.data.len() - self.offset).min(1);
+            buf[..len].copy_from_slice(&self.data[self.offset..self.offset + len]);
+            self.offset += len;
+            Ok(len)
+        }
+    }
+
+    #[test]
+    fn stream_resume_test() {
+        use std::io::{ErrorKind, Read};
+        let data = std::fs::read("test/Cargo.toml").unwrap().repeat(8);
+        let comp = compress_with_level(&data, 7).unwrap();
+        let flaky = |error| FlakyReader {
+            data: &comp,
+            offset: 0,
+            error,
+            fail: false,
+        };
+
+        // Interrupted reads are retried
+        let mut out = Vec::new();
+        Yaz0Reader::new(flaky(ErrorKind::Interrupted))
+            .unwrap()
+            .read_to_end(&mut out)
+            .unwrap();
+        assert_eq!(out, data);
+
+        // Other errors are returned once no more output can be produced, and
+        // decoding resumes after them
+        let mut reader = Yaz0Reader::new(flaky(ErrorKind::WouldBlock)).unwrap();
+        let mut out = Vec::new();
+        let mut buf = [0u8; 100];
+        let mut errors = 0;
+        loop {
+            match reader.read(&mut buf) {
+                Ok(0) => break,
+                Ok(n) => out.extend_from_slice(&buf[..n]),
+                Err(e) => {
+                    assert_eq!(e.kind(), ErrorKind::WouldBlock);
+                    errors += 1;
+                }
+            }
+        }
+        assert!(errors > 0);
+        assert_eq!(out, data);
+    }
+
     #[test]
     fn condition_test() {
         let data = b"Some random data";
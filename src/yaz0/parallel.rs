@@ -0,0 +1,65 @@
+//! Multithreaded yaz0 compression.
+//!
+//! The input is split into chunks which oead compresses independently on the
+//! rayon thread pool. Each chunk is compressed together with the 4 KiB of
+//! input preceding it, so back-references can still reach across chunk
+//! boundaries. The resulting streams are split back into literal and match
+//! tokens and repacked into a single continuous yaz0 stream.
+use super::tokens::{self, GroupPacker, Tokens, HEADER_SIZE, WINDOW_SIZE};
+use super::{Result, Yaz0Error};
+use crate::{
+    ffi,
+    stats::{self, Format, Phase},
+};
+use rayon::prelude::*;
+
+/// Default amount of input compressed by each worker.
+pub const DEFAULT_CHUNK_SIZE: usize = 0x10_0000;
+
+/// Compress data across the rayon thread pool with the specified compression
+/// level (6-9), using the default chunk size of 1 MiB.
+///
+/// Inputs no larger than one chunk are compressed on the calling thread and
+/// produce exactly the same output as [`compress_with_level`](super::compress_with_level).
+pub fn compress_parallel<B: AsRef<[u8]>>(data: B, level: u8) -> Result<Vec<u8>> {
+    compress_parallel_with_chunk_size(data, level, DEFAULT_CHUNK_SIZE)
+}
+
+/// Compress data across the rayon thread pool with the specified compression
+/// level (6-9) and chunk size. Smaller chunks spread the work more evenly at a
+/// small cost in compression ratio. Chunks are at least 4 KiB.
+pub fn compress_parallel_with_chunk_size<B: AsRef<[u8]>>(
+    data: B,
+    level: u8,
+    chunk_size: usize,
+) -> Result<Vec<u8>> {
+    if !(6..=9).contains(&level) {
+        return Err(Yaz0Error::InvalidLevelError(level));
+    }
+    let data = data.as_ref();
+    // One call for the whole input, however many chunks it is split into
+    let _span = stats::span(Format::Yaz0, Phase::Compress, data.len());
+    let chunk_size = chunk_size.max(WINDOW_SIZE);
+    if data.len() <= chunk_size {
+        return Ok(ffi::compress(data, level).as_slice().to_vec());
+    }
+    let chunks: Vec<Tokens> = (0..(data.len() + chunk_size - 1) / chunk_size)
+        .into_par_iter()
+        .map(|i| {
+            let start = i * chunk_size;
+            tokens::compress_range(data, start, (start + chunk_size).min(data.len()), level)
+        })
+        .collect();
+
+    let size: usize = chunks
+        .iter()
+        .map(|c| c.bytes.len() + c.literals.len() / 8 + 1)
+        .sum();
+    let mut out = Vec::with_capacity(HEADER_SIZE + size);
+    out.extend_from_slice(&tokens::header(data.len()));
+    let mut packer = GroupPacker::new(out);
+    for chunk in &chunks {
+        packer.push(chunk);
+    }
+    Ok(packer.into_inner())
+}
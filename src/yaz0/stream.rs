@@ -0,0 +1,316 @@
+//! Incremental yaz0 compression and decompression over `io::Write` and
+//! `io::Read`, using bounded memory.
+use super::tokens::{self, GroupPacker, HEADER_SIZE, WINDOW_SIZE};
+use crate::stats::{self, Format, Phase};
+use std::io::{self, Read, Write};
+
+/// Amount of input the writer buffers before compressing it.
+const CHUNK_SIZE: usize = 0x4_0000;
+
+/// A yaz0 encoder that compresses data as it is written and passes the
+/// result on to an inner writer.
+///
+/// Because the yaz0 header stores the decompressed size, it has to be known
+/// when the writer is created. Input is compressed by oead in chunks of
+/// 256 KiB. Each chunk can still reference the 4 KiB before it, so the output
+/// is nearly as small as compressing everything in one go.
+/// ```
+/// # use roead::yaz0::Yaz0Writer;
+/// # use std::io::Write;
+/// # fn doctest() -> std::io::Result<()> {
+/// let data = std::fs::read("test/Cargo.toml")?;
+/// let file = std::fs::File::create("Cargo.stoml")?;
+/// let mut writer = Yaz0Writer::new(file, data.len())?;
+/// writer.write_all(&data)?;
+/// writer.finish()?;
+/// # Ok(())
+/// # }
+/// ```
+pub struct Yaz0Writer<W: Write> {
+    inner: Option<W>,
+    level: u8,
+    size: usize,
+    written: usize,
+    /// The tail of the previous chunk followed by the pending input.
+    input: Vec<u8>,
+    prefix: usize,
+    packer: GroupPacker,
+}
+
+impl<W: Write> Yaz0Writer<W> {
+    /// Create a writer for `size` bytes of input with the default
+    /// compression level (7). The header is written immediately.
+    pub fn new(writer: W, size: usize) -> io::Result<Yaz0Writer<W>> {
+        Self::with_level(writer, size, 7)
+    }
+
+    /// Create a writer for `size` bytes of input with the specified
+    /// compression level (6-9). The header is written immediately.
+    pub fn with_level(mut writer: W, size: usize, level: u8) -> io::Result<Yaz0Writer<W>> {
+        if !(6..=9).contains(&level) {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                super::Yaz0Error::InvalidLevelError(level),
+            ));
+        }
+        if size > u32::MAX as usize {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "yaz0 data cannot be larger than 4 GiB",
+            ));
+        }
+        writer.write_all(&tokens::header(size))?;
+        Ok(Yaz0Writer {
+            inner: Some(writer),
+            level,
+            size,
+            written: 0,
+            input: Vec::with_capacity(WINDOW_SIZE + CHUNK_SIZE.min(size)),
+            prefix: 0,
+            packer: GroupPacker::new(Vec::new()),
+        })
+    }
+
+    fn compress_pending(&mut self) -> io::Result<()> {
+        if self.input.len() == self.prefix {
+            return Ok(());
+        }
+        let _span = stats::span(
+            Format::Yaz0,
+            Phase::Compress,
+            self.input.len() - self.prefix,
+        );
+        let tokens = tokens::compress_range(&self.input, self.prefix, self.input.len(), self.level);
+        self.packer.push(&tokens);
+        self.packer.flush_complete(self.inner.as_mut().unwrap())?;
+        let keep = self.input.len().min(WINDOW_SIZE);
+        self.input.drain(..self.input.len() - keep);
+        self.prefix = keep;
+        Ok(())
+    }
+
+    /// Compress any remaining input and write the final group. Fails if the
+    /// amount of data written does not match the size given on creation.
+    pub fn finish(mut self) -> io::Result<W> {
+        let result = self.do_finish();
+        let inner = self.inner.take().unwrap();
+        result.map(|_| inner)
+    }
+
+    fn do_finish(&mut self) -> io::Result<()> {
+        if self.written != self.size {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!(
+                    "expected {} bytes of yaz0 input, got {}",
+                    self.size, self.written
+                ),
+            ));
+        }
+        self.compress_pending()?;
+        let writer = self.inner.as_mut().unwrap();
+        writer.write_all(
+            &std::mem::replace(&mut self.packer, GroupPacker::new(Vec::new())).into_inner(),
+        )?;
+        writer.flush()
+    }
+}
+
+impl<W: Write> Write for Yaz0Writer<W> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        let len = buf
+            .len()
+            .min(CHUNK_SIZE - (self.input.len() - self.prefix))
+            .min(self.size - self.written);
+        if len == 0 && !buf.is_empty() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "more data written than the declared yaz0 size",
+            ));
+        }
+        self.input.extend_from_slice(&buf[..len]);
+        self.written += len;
+        if self.input.len() - self.prefix == CHUNK_SIZE {
+            self.compress_pending()?;
+        }
+        Ok(len)
+    }
+
+    /// Flushes the inner writer. Pending input is only compressed once a full
+    /// chunk is available or the writer is finished.
+    fn flush(&mut self) -> io::Result<()> {
+        self.inner.as_mut().unwrap().flush()
+    }
+}
+
+impl<W: Write> Drop for Yaz0Writer<W> {
+    fn drop(&mut self) {
+        if self.inner.is_some() {
+            let _ = self.do_finish();
+        }
+    }
+}
+
+const RING_SIZE: usize = 0x1000;
+const INPUT_BUF_SIZE: usize = 0x2000;
+
+/// A yaz0 decoder that decompresses data from an inner reader as it is read.
+///
+/// Only the last 4 KiB of output are kept for back-references, along with a
+/// small input buffer, so memory use does not depend on the size of the data.
+/// ```
+/// # use roead::yaz0::Yaz0Reader;
+/// # use std::io::Read;
+/// # fn doctest() -> std::io::Result<()> {
+/// let file = std::fs::File::open("test/Cargo.stoml")?;
+/// let mut reader = Yaz0Reader::new(file)?;
+/// let mut text = String::with_capacity(reader.decompressed_size());
+/// reader.read_to_string(&mut text)?;
+/// # Ok(())
+/// # }
+/// ```
+pub struct Yaz0Reader<R: Read> {
+    inner: R,
+    input: Box<[u8; INPUT_BUF_SIZE]>,
+    input_pos: usize,
+    input_len: usize,
+    ring: Box<[u8; RING_SIZE]>,
+    size: usize,
+    produced: usize,
+    flags: u8,
+    bits: u8,
+    /// The bytes read so far of a back-reference whose input ran out. The
+    /// flag bit of a token is only consumed once the token is complete, so
+    /// decoding can resume after an error from the inner reader.
+    token: [u8; 3],
+    token_len: usize,
+    match_dist: usize,
+    match_left: usize,
+}
+
+impl<R: Read> Yaz0Reader<R> {
+    /// Read and validate the yaz0 header from `reader`.
+    pub fn new(mut reader: R) -> io::Result<Yaz0Reader<R>> {
+        let mut header = [0u8; HEADER_SIZE];
+        reader.read_exact(&mut header)?;
+        if &header[0..4] != b"Yaz0" {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                super::Yaz0Error::MagicError(String::from_utf8_lossy(&header[0..4]).to_string()),
+            ));
+        }
+        Ok(Yaz0Reader {
+            inner: reader,
+            input: Box::new([0; INPUT_BUF_SIZE]),
+            input_pos: 0,
+            input_len: 0,
+            ring: Box::new([0; RING_SIZE]),
+            size: u32::from_be_bytes([header[4], header[5], header[6], header[7]]) as usize,
+            produced: 0,
+            flags: 0,
+            bits: 0,
+            token: [0; 3],
+            token_len: 0,
+            match_dist: 0,
+            match_left: 0,
+        })
+    }
+
+    /// The decompressed size declared in the header.
+    pub fn decompressed_size(&self) -> usize {
+        self.size
+    }
+
+    /// Get back the inner reader.
+    pub fn into_inner(self) -> R {
+        self.inner
+    }
+
+    #[inline]
+    fn byte(&mut self) -> io::Result<u8> {
+        while self.input_pos == self.input_len {
+            self.input_len = match self.inner.read(&mut self.input[..]) {
+                Ok(0) => return Err(io::ErrorKind::UnexpectedEof.into()),
+                Ok(len) => len,
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                Err(e) => return Err(e),
+            };
+            self.input_pos = 0;
+        }
+        self.input_pos += 1;
+        Ok(self.input[self.input_pos - 1])
+    }
+
+    /// Decode the next token, returning its byte if it is a literal or
+    /// setting up the back-reference otherwise. Nothing is consumed from the
+    /// state unless the whole token could be read.
+    fn token(&mut self) -> io::Result<Option<u8>> {
+        if self.bits == 0 {
+            self.flags = self.byte()?;
+            self.bits = 8;
+        }
+        let literal = if self.flags & 0x80 != 0 {
+            Some(self.byte()?)
+        } else {
+            while self.token_len < 2 || (self.token_len == 2 && self.token[0] >> 4 == 0) {
+                self.token[self.token_len] = self.byte()?;
+                self.token_len += 1;
+            }
+            let [b1, b2, b3] = self.token;
+            let dist = (((b1 & 0xF) as usize) << 8 | b2 as usize) + 1;
+            if dist > self.produced {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "yaz0 back-reference before start of data",
+                ));
+            }
+            self.match_dist = dist;
+            self.match_left = match b1 >> 4 {
+                0 => b3 as usize + 0x12,
+                n => n as usize + 2,
+            };
+            self.token_len = 0;
+            None
+        };
+        self.flags <<= 1;
+        self.bits -= 1;
+        Ok(literal)
+    }
+}
+
+impl<R: Read> Read for Yaz0Reader<R> {
+    /// Decompress into `out`. If the inner reader fails after some output
+    /// was produced, that output is returned first and the error is left for
+    /// the next call; the decoder can resume where it stopped.
+    fn read(&mut self, out: &mut [u8]) -> io::Result<usize> {
+        let len = out.len().min(self.size - self.produced);
+        let mut n = 0;
+        while n < len {
+            if self.match_left > 0 {
+                let count = self.match_left.min(len - n);
+                for _ in 0..count {
+                    let pos = self.produced;
+                    let byte = self.ring[(pos - self.match_dist) % RING_SIZE];
+                    self.ring[pos % RING_SIZE] = byte;
+                    out[n] = byte;
+                    n += 1;
+                    self.produced += 1;
+                }
+                self.match_left -= count;
+                continue;
+            }
+            match self.token() {
+                Ok(Some(byte)) => {
+                    self.ring[self.produced % RING_SIZE] = byte;
+                    out[n] = byte;
+                    n += 1;
+                    self.produced += 1;
+                }
+                Ok(None) => (),
+                Err(_) if n > 0 => break,
+                Err(e) => return Err(e),
+            }
+        }
+        Ok(n)
+    }
+}
@@ -0,0 +1,158 @@
+//! Conversion between oead's compressed output and a stream of literal and
+//! match tokens, which lets separately compressed pieces of one input be
+//! packed into a single yaz0 stream.
+use std::io::{self, Write};
+
+/// Maximum back-reference distance.
+pub(super) const WINDOW_SIZE: usize = 0x1000;
+pub(super) const HEADER_SIZE: usize = 0x10;
+
+pub(super) fn header(size: usize) -> [u8; HEADER_SIZE] {
+    let mut header = [0; HEADER_SIZE];
+    header[0..4].copy_from_slice(b"Yaz0");
+    header[4..8].copy_from_slice(&(size as u32).to_be_bytes());
+    header
+}
+
+/// The tokens of one compressed chunk: their raw encodings back to back, and
+/// whether each one is a literal byte as opposed to a back-reference.
+pub(super) struct Tokens {
+    pub(super) bytes: Vec<u8>,
+    pub(super) literals: Vec<bool>,
+}
+
+/// Split a yaz0 stream compressed from `input` into tokens, dropping those
+/// that only produce the first `skip` bytes of output. A back-reference that
+/// straddles `skip` is shortened to the part after it.
+fn tokenize(stream: &[u8], input: &[u8], skip: usize) -> Tokens {
+    let mut tokens = Tokens {
+        bytes: Vec::with_capacity(stream.len()),
+        literals: Vec::with_capacity(input.len() - skip),
+    };
+    let (mut src, mut pos) = (HEADER_SIZE, 0);
+    while pos < input.len() {
+        let flags = stream[src];
+        src += 1;
+        for bit in 0..8 {
+            if pos >= input.len() {
+                break;
+            }
+            if flags & (0x80 >> bit) != 0 {
+                if pos >= skip {
+                    tokens.bytes.push(stream[src]);
+                    tokens.literals.push(true);
+                }
+                src += 1;
+                pos += 1;
+                continue;
+            }
+            let (b1, b2) = (stream[src], stream[src + 1]);
+            let dist = (((b1 & 0xF) as usize) << 8 | b2 as usize) + 1;
+            let (len, size) = match b1 >> 4 {
+                0 => (stream[src + 2] as usize + 0x12, 3),
+                n => (n as usize + 2, 2),
+            };
+            if pos >= skip {
+                tokens.bytes.extend_from_slice(&stream[src..src + size]);
+                tokens.literals.push(false);
+            } else if pos + len > skip {
+                let rest = pos + len - skip;
+                if rest >= 3 {
+                    push_match(&mut tokens, dist, rest);
+                } else {
+                    for byte in &input[skip..pos + len] {
+                        tokens.bytes.push(*byte);
+                        tokens.literals.push(true);
+                    }
+                }
+            }
+            src += size;
+            pos += len;
+        }
+    }
+    tokens
+}
+
+fn push_match(tokens: &mut Tokens, dist: usize, len: usize) {
+    let dist = dist - 1;
+    if len >= 0x12 {
+        tokens
+            .bytes
+            .extend_from_slice(&[(dist >> 8) as u8, dist as u8, (len - 0x12) as u8]);
+    } else {
+        tokens
+            .bytes
+            .extend_from_slice(&[((len - 2) << 4 | dist >> 8) as u8, dist as u8]);
+    }
+    tokens.literals.push(false);
+}
+
+/// Compress `data[start..end]` with oead and return its tokens. Up to 4 KiB
+/// of the preceding input is compressed along with it so that matches can
+/// reach back across `start`. This is not recorded by the instrumentation,
+/// so that the prefix is not counted twice; callers record their own input.
+pub(super) fn compress_range(data: &[u8], start: usize, end: usize, level: u8) -> Tokens {
+    let prefix = start - start.min(WINDOW_SIZE);
+    let input = &data[prefix..end];
+    tokenize(
+        crate::ffi::compress(input, level).as_slice(),
+        input,
+        start - prefix,
+    )
+}
+
+/// Packs tokens into groups of eight behind a flag byte.
+pub(super) struct GroupPacker {
+    buf: Vec<u8>,
+    flags: usize,
+    count: u8,
+}
+
+impl GroupPacker {
+    pub(super) fn new(buf: Vec<u8>) -> GroupPacker {
+        GroupPacker {
+            buf,
+            flags: 0,
+            count: 8,
+        }
+    }
+
+    pub(super) fn push(&mut self, tokens: &Tokens) {
+        let mut src = 0;
+        for literal in &tokens.literals {
+            if self.count == 8 {
+                self.flags = self.buf.len();
+                self.buf.push(0);
+                self.count = 0;
+            }
+            let size = if *literal {
+                self.buf[self.flags] |= 0x80 >> self.count;
+                1
+            } else if tokens.bytes[src] >> 4 == 0 {
+                3
+            } else {
+                2
+            };
+            self.buf.extend_from_slice(&tokens.bytes[src..src + size]);
+            src += size;
+            self.count += 1;
+        }
+    }
+
+    /// Write out every complete group, keeping the one still being filled.
+    pub(super) fn flush_complete<W: Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        let end = if self.count == 8 {
+            self.buf.len()
+        } else {
+            self.flags
+        };
+        writer.write_all(&self.buf[..end])?;
+        self.buf.drain(..end);
+        self.flags -= end.min(self.flags);
+        Ok(())
+    }
+
+    pub(super) fn into_inner(self) -> Vec<u8> {
+        self.buf
+    }
+}
@@ -9,16 +9,11 @@
 using oead::yaz0::Compress;
 using oead::yaz0::Decompress;
 
-rust::Vec<uint8_t> decompress(const rust::Slice<const uint8_t> data) {
-    auto dec = Decompress(tcb::span(data.data(), data.size()));
-    rust::Vec<uint8_t> vec;
-    std::move(dec.begin(), dec.end(), std::back_inserter(vec));
-    return vec;
+void decompress_into(const rust::Slice<const uint8_t> data, rust::Slice<uint8_t> dst) {
+    Decompress(tcb::span(data.data(), data.size()), tcb::span(dst.data(), dst.size()));
 }
 
-rust::Vec<uint8_t> compress(const rust::Slice<const uint8_t> data, uint8_t level) {
-    auto com = Compress(tcb::span(data.data(), data.size()), 0, level);
-    rust::Vec<uint8_t> vec;
-    std::move(com.begin(), com.end(), std::back_inserter(vec));
-    return vec;
+std::unique_ptr<std::vector<uint8_t>> compress(const rust::Slice<const uint8_t> data, uint8_t level) {
+    return std::make_unique<std::vector<uint8_t>>(
+        Compress(tcb::span(data.data(), data.size()), 0, level));
 }